@@ -44,6 +44,8 @@ int cmdClientIsConnected( void );
 
 error_code_t cmdClientSetValue( parameter_value_t val, uint32_t value, uint32_t timeout );
 error_code_t cmdClientSetValueWithoutResp( parameter_value_t val, uint32_t value );
+/* Non blocking, values set before task sends them are merged and only last one is sent */
+error_code_t cmdClientSetValueCoalesced( parameter_value_t val, uint32_t value );
 error_code_t cmdClientGetValue( parameter_value_t val, uint32_t* value, uint32_t timeout );
 error_code_t cmdClientGetString( parameter_string_t val, char* str, uint32_t str_len, uint32_t timeout );
 
@@ -25,6 +25,7 @@
 
 #define PAYLOAD_SIZE 256
 #define QUEUE_SIZE   16
+#define PENDING_WORDS ( ( PARAM_LAST_VALUE + 31 ) / 32 )
 
 typedef struct
 {
@@ -43,9 +44,19 @@ struct cmd_client_req_context
   uint32_t request_number;
   QueueHandle_t msg_queue;
   uint8_t buffer[PAYLOAD_SIZE];
+
+  /* Coalesced values, only last value of parameter is sent */
+  portMUX_TYPE pending_lock;
+  uint32_t pending_mask[PENDING_WORDS];
+  uint32_t pending_values[PARAM_LAST_VALUE];
+  bool flush_requested;
+};
+
+static struct cmd_client_req_context ctx = {
+  .pending_lock = portMUX_INITIALIZER_UNLOCKED,
 };
 
-static struct cmd_client_req_context ctx;
+static void _flush_pending( void );
 
 static error_code_t _receive_packet( TickType_t timeout, uint32_t* read_bytes )
 {
@@ -134,6 +145,13 @@ static void _requests_process( void* arg )
   {
     if ( xQueueReceive( ctx.msg_queue, &msg, portMAX_DELAY ) == pdTRUE )
     {
+      /* NULL message only wakes up task to send coalesced values */
+      if ( msg == NULL )
+      {
+        _flush_pending();
+        continue;
+      }
+
       uint32_t len = 0;
       msg->result = _request_msg_process( msg, &len );
       if ( msg->sem != NULL )
@@ -240,6 +258,78 @@ static request_command_data_t* _prepare_string_msg( parameter_string_t val, char
   return msg;
 }
 
+static void _flush_pending( void )
+{
+  uint32_t mask[PENDING_WORDS];
+  uint32_t values[PARAM_LAST_VALUE];
+
+  portENTER_CRITICAL( &ctx.pending_lock );
+  memcpy( mask, ctx.pending_mask, sizeof( mask ) );
+  memcpy( values, ctx.pending_values, sizeof( values ) );
+  memset( ctx.pending_mask, 0, sizeof( ctx.pending_mask ) );
+  ctx.flush_requested = false;
+  portEXIT_CRITICAL( &ctx.pending_lock );
+
+  for ( uint32_t val = 0; val < PARAM_LAST_VALUE; val++ )
+  {
+    if ( ( mask[val / 32] & ( 1UL << ( val % 32 ) ) ) == 0 )
+    {
+      continue;
+    }
+
+    request_command_data_t* msg = _prepare_u32_msg( val, values[val], PC_SET_UINT32, 0 );
+    uint32_t len = 0;
+    if ( _request_msg_process( msg, &len ) != ERROR_CODE_OK )
+    {
+      LOG( PRINT_ERROR, "%s: cannot send %d", __func__, val );
+    }
+    _cleanup_msg( msg );
+  }
+}
+
+error_code_t cmdClientSetValueCoalesced( parameter_value_t val, uint32_t value )
+{
+  LOG( PRINT_DEBUG, "%s: %d %d", __func__, val, value );
+  if ( val >= PARAM_LAST_VALUE )
+  {
+    LOG( PRINT_ERROR, "%s: Invalid argument", __func__ );
+    return ERROR_CODE_FAIL;
+  }
+
+  if ( parameters_setValue( val, value ) == false )
+  {
+    LOG( PRINT_ERROR, "%s: cannot set value", __func__ );
+    return ERROR_CODE_FAIL;
+  }
+
+  bool wake_up = false;
+  portENTER_CRITICAL( &ctx.pending_lock );
+  ctx.pending_values[val] = value;
+  ctx.pending_mask[val / 32] |= 1UL << ( val % 32 );
+  if ( !ctx.flush_requested )
+  {
+    ctx.flush_requested = true;
+    wake_up = true;
+  }
+  portEXIT_CRITICAL( &ctx.pending_lock );
+
+  if ( wake_up )
+  {
+    request_command_data_t* msg = NULL;
+    if ( xQueueSend( ctx.msg_queue, &msg, 0 ) != pdTRUE )
+    {
+      /* Value stays pending, it is sent with next wake up */
+      portENTER_CRITICAL( &ctx.pending_lock );
+      ctx.flush_requested = false;
+      portEXIT_CRITICAL( &ctx.pending_lock );
+      LOG( PRINT_ERROR, "%s: cannot add msg to queue", __func__ );
+      return ERROR_CODE_FAIL;
+    }
+  }
+
+  return ERROR_CODE_OK;
+}
+
 error_code_t cmdClientSetValueWithoutResp( parameter_value_t val, uint32_t value )
 {
   LOG( PRINT_DEBUG, "%s: %d %d", __func__, val, value );
@@ -8,6 +8,7 @@
 #include <sys/select.h>
 
 #include "app_config.h"
+#include "dev_config.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
@@ -21,7 +22,7 @@
 
 #if CONFIG_DEBUG_CMD_SERVER
 #define LOG( _lvl, ... ) \
-  debug_printf( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
+  DevConfig_Log( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
 #else
 #define LOG( PRINT_INFO, ... )
 #endif
@@ -39,6 +39,7 @@ static const char *parameter_string_names[] =
 
 static uint32_t parameters_value[PARAM_LAST_VALUE];
 static char parameters_string[PARAM_STR_LAST_VALUE][STR_SIZE];
+static param_change_cb change_cb;
 
 
 static bool _read_parameters( void )
@@ -219,11 +220,21 @@ bool parameters_setValue( parameter_value_t val, uint32_t value )
     return false;
   }
 
+  bool is_changed = parameters_value[val] != value;
   parameters_value[val] = value;
   //ToDo send to Drv
+  if ( is_changed && change_cb != NULL )
+  {
+    change_cb( val, value );
+  }
   return true;
 }
 
+void parameters_setChangeCb( param_change_cb cb )
+{
+  change_cb = cb;
+}
+
 bool parameters_setString( parameter_string_t val, const char* str )
 {
   if ( val >= PARAM_STR_LAST_VALUE || strlen( str ) >= PARSE_CMD_MAX_STRING_LEN )
@@ -61,6 +61,8 @@ typedef struct
   param_set_cb cb;
 } parameter_t;
 
+typedef void ( *param_change_cb )( parameter_value_t val, uint32_t value );
+
 /* Public functions ----------------------------------------------------------*/
 
 /**
@@ -114,6 +116,12 @@ uint32_t parameters_getDefaultValue( parameter_value_t val );
  */
 bool parameters_setValue( parameter_value_t val, uint32_t value );
 
+/**
+ * @brief   Register callback called when value is changed by @c parameters_setValue.
+ * @param   [in] cb - callback, called in context of setter
+ */
+void parameters_setChangeCb( param_change_cb cb );
+
 /**
  * @brief   Set string.
  * @param   [in] val - parameter which set value
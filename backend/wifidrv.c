@@ -1,6 +1,7 @@
 #include "wifidrv.h"
 
 #include "app_config.h"
+#include "dev_config.h"
 #include "driver/gpio.h"
 #include "esp_event.h"
 #include "esp_log.h"
@@ -8,6 +9,7 @@
 #include "esp_netif.h"
 #include "esp_sleep.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_wifi_types.h"
 #include "freertos/FreeRTOS.h"
@@ -24,7 +26,7 @@
 
 #if CONFIG_DEBUG_WIFI
 #define LOG( _lvl, ... ) \
-  debug_printf( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
+  DevConfig_Log( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
 #else
 #define LOG( PRINT_INFO, ... )
 #endif
@@ -35,6 +37,17 @@
 #define DEFAULT_SCAN_LIST_SIZE         32
 #define CONFIG_TCPIP_EVENT_THD_WA_SIZE 4096
 #define MAX_VAL( a, b )                a > b ? a : b
+#define WIFI_FAST_DATA_MAGIC           0x57464331
+#define WAIT_CONNECT_PERIOD_MS         250
+
+/* Reuse cached DHCP lease as static IP on fast reconnect, skips DHCP exchange */
+#ifndef CONFIG_WIFI_FAST_STATIC_IP
+#define CONFIG_WIFI_FAST_STATIC_IP 0
+#endif
+
+#ifndef CONFIG_WIFI_FAST_CONNECT_TIMEOUT_MS
+#define CONFIG_WIFI_FAST_CONNECT_TIMEOUT_MS 3000
+#endif
 
 typedef enum
 {
@@ -68,6 +81,17 @@ typedef struct
   size_t size;
 } callback_list_t;
 
+/* Last good association, target of fast reconnect */
+typedef struct
+{
+  uint32_t magic;
+  char ssid[33];
+  uint8_t bssid[6];
+  uint8_t channel;
+  esp_netif_ip_info_t ip_info;
+  esp_ip4_addr_t dns;
+} wifi_fast_data_t;
+
 typedef struct
 {
   wifi_app_status_t state;
@@ -88,6 +112,14 @@ typedef struct
   wifi_sta_list_t gl_sta_list;
   int rssi;
 
+  esp_netif_t* netif;
+  wifi_fast_data_t fast_data;
+  bool is_fast_data;
+  bool is_fast_attempt;
+  bool is_fast_failed;
+  int64_t connect_start_us;
+  wifi_connect_stats_t connect_stats;
+
   callback_list_t on_connect_cb;
   callback_list_t on_disconnect_cb;
 } wifidrv_ctx_t;
@@ -131,9 +163,9 @@ static void _wifi_read_info_cb( void* arg, wifi_vendor_ie_type_t type, const uin
 {
 }
 
-static int _wifi_data_save( wifiConData_t* data )
+static int _nvs_blob_save( const char* key, const void* data, size_t size )
 {
-  LOG( PRINT_INFO, "%s", __func__ );
+  LOG( PRINT_INFO, "%s %s", __func__, key );
   nvs_handle my_handle;
   esp_err_t err;
 
@@ -145,7 +177,7 @@ static int _wifi_data_save( wifiConData_t* data )
     return err;
   }
 
-  err = nvs_set_blob( my_handle, "wifi", data, sizeof( wifiConData_t ) );
+  err = nvs_set_blob( my_handle, key, data, size );
 
   if ( err != ESP_OK )
   {
@@ -166,7 +198,7 @@ static int _wifi_data_save( wifiConData_t* data )
   return ESP_OK;
 }
 
-static esp_err_t _wifi_data_read( wifiConData_t* data )
+static esp_err_t _nvs_blob_read( const char* key, void* data, size_t size )
 {
   nvs_handle my_handle;
   esp_err_t err;
@@ -181,7 +213,7 @@ static esp_err_t _wifi_data_read( wifiConData_t* data )
   // Read the size of memory space required for blob
   size_t required_size = 0;    // value will default to 0, if not set yet in NVS
 
-  err = nvs_get_blob( my_handle, "wifi", NULL, &required_size );
+  err = nvs_get_blob( my_handle, key, NULL, &required_size );
   if ( ( err != ESP_OK ) && ( err != ESP_ERR_NVS_NOT_FOUND ) )
   {
     nvs_close( my_handle );
@@ -189,9 +221,9 @@ static esp_err_t _wifi_data_read( wifiConData_t* data )
   }
 
   // Read previously saved blob if available
-  if ( required_size == sizeof( wifiConData_t ) )
+  if ( required_size == size )
   {
-    err = nvs_get_blob( my_handle, "wifi", data, &required_size );
+    err = nvs_get_blob( my_handle, key, data, &required_size );
     nvs_close( my_handle );
     return err;
   }
@@ -263,12 +295,63 @@ static void _wifi_scan_done_handler( void* arg, esp_event_base_t event_base, int
   }
 }
 
+static void _update_connect_stats( void )
+{
+  wifi_connect_stats_t* stats = &ctx.connect_stats;
+  uint32_t time_ms = (uint32_t) ( ( esp_timer_get_time() - ctx.connect_start_us ) / 1000 );
+
+  if ( ctx.is_fast_attempt )
+  {
+    stats->last_fast_ms = time_ms;
+    stats->fast_count++;
+  }
+  else
+  {
+    stats->last_full_ms = time_ms;
+    stats->full_count++;
+  }
+
+  LOG( PRINT_INFO, "Time to IP %u ms (%s)", time_ms, ctx.is_fast_attempt ? "fast" : "full" );
+}
+
+static void _update_fast_data( const ip_event_got_ip_t* event )
+{
+  wifi_ap_record_t ap_info = { 0 };
+  wifi_fast_data_t data = { 0 };
+
+  if ( esp_wifi_sta_get_ap_info( &ap_info ) != ESP_OK )
+  {
+    return;
+  }
+
+  data.magic = WIFI_FAST_DATA_MAGIC;
+  strncpy( data.ssid, (char*) ctx.wifi_config.sta.ssid, sizeof( data.ssid ) - 1 );
+  memcpy( data.bssid, ap_info.bssid, sizeof( data.bssid ) );
+  data.channel = ap_info.primary;
+  data.ip_info = event->ip_info;
+
+  esp_netif_dns_info_t dns = { 0 };
+  if ( esp_netif_get_dns_info( ctx.netif, ESP_NETIF_DNS_MAIN, &dns ) == ESP_OK )
+  {
+    data.dns = dns.ip.u_addr.ip4;
+  }
+
+  /* Flash is written only when AP or lease changed */
+  if ( !ctx.is_fast_data || memcmp( &data, &ctx.fast_data, sizeof( data ) ) != 0 )
+  {
+    ctx.fast_data = data;
+    ctx.is_fast_data = true;
+    _nvs_blob_save( "fast", &ctx.fast_data, sizeof( ctx.fast_data ) );
+  }
+}
+
 static void _got_ip_event_handler( void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data )
 {
   switch ( event_id )
   {
     case IP_EVENT_STA_GOT_IP:
       LOG( PRINT_INFO, "%s Have IP", __func__, event_base, event_id );
+      _update_connect_stats();
       if ( ( memcmp( ctx.wifi_con_data.ssid, ctx.wifi_config.sta.ssid,
                      MAX_VAL( strlen( (char*) ctx.wifi_config.sta.ssid ), strlen( (char*) ctx.wifi_con_data.ssid ) ) )
              != 0 )
@@ -279,9 +362,11 @@ static void _got_ip_event_handler( void* arg, esp_event_base_t event_base, int32
         strncpy( (char*) ctx.wifi_con_data.ssid, (char*) ctx.wifi_config.sta.ssid, sizeof( ctx.wifi_con_data.ssid ) );
         strncpy( (char*) ctx.wifi_con_data.password, (char*) ctx.wifi_config.sta.password,
                  sizeof( ctx.wifi_con_data.password ) );
-        _wifi_data_save( &ctx.wifi_con_data );
+        _nvs_blob_save( "wifi", &ctx.wifi_con_data, sizeof( ctx.wifi_con_data ) );
       }
 
+      _update_fast_data( (ip_event_got_ip_t*) event_data );
+      ctx.is_fast_failed = false;
       ctx.connected = true;
       break;
   }
@@ -346,11 +431,11 @@ static void _state_init( void )
   ESP_ERROR_CHECK( esp_event_loop_create_default() );
   if ( wifi_type == T_WIFI_TYPE_SERVER )
   {
-    esp_netif_create_default_wifi_ap();
+    ctx.netif = esp_netif_create_default_wifi_ap();
   }
   else
   {
-    esp_netif_create_default_wifi_sta();
+    ctx.netif = esp_netif_create_default_wifi_sta();
   }
 
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -363,7 +448,12 @@ static void _state_init( void )
   }
   else
   {
-    if ( _wifi_data_read( &ctx.wifi_con_data ) == ESP_OK )
+    if ( _nvs_blob_read( "fast", &ctx.fast_data, sizeof( ctx.fast_data ) ) == ESP_OK )
+    {
+      ctx.is_fast_data = ctx.fast_data.magic == WIFI_FAST_DATA_MAGIC;
+    }
+
+    if ( _nvs_blob_read( "wifi", &ctx.wifi_con_data, sizeof( ctx.wifi_con_data ) ) == ESP_OK )
     {
       strncpy( (char*) ctx.wifi_config.sta.ssid, (char*) ctx.wifi_con_data.ssid, sizeof( ctx.wifi_config.sta.ssid ) );
       strncpy( (char*) ctx.wifi_config.sta.password, (char*) ctx.wifi_con_data.password,
@@ -408,6 +498,51 @@ static void _state_idle( void )
   }
 }
 
+/* Target cached BSSID and channel directly, full scan is used when cache does not match or failed */
+static void _prepare_sta_config( void )
+{
+  wifi_sta_config_t* sta = &ctx.wifi_config.sta;
+
+  ctx.is_fast_attempt = ctx.is_fast_data && !ctx.is_fast_failed
+                        && strncmp( (char*) sta->ssid, ctx.fast_data.ssid, sizeof( sta->ssid ) ) == 0;
+  sta->bssid_set = ctx.is_fast_attempt;
+  if ( ctx.is_fast_attempt )
+  {
+    memcpy( sta->bssid, ctx.fast_data.bssid, sizeof( sta->bssid ) );
+    sta->channel = ctx.fast_data.channel;
+  }
+  else
+  {
+    sta->channel = 0;
+  }
+
+#if CONFIG_WIFI_FAST_STATIC_IP
+  if ( ctx.is_fast_attempt )
+  {
+    esp_netif_dns_info_t dns = { 0 };
+    dns.ip.type = ESP_IPADDR_TYPE_V4;
+    dns.ip.u_addr.ip4 = ctx.fast_data.dns;
+    esp_netif_dhcpc_stop( ctx.netif );
+    esp_netif_set_ip_info( ctx.netif, &ctx.fast_data.ip_info );
+    esp_netif_set_dns_info( ctx.netif, ESP_NETIF_DNS_MAIN, &dns );
+  }
+  else
+  {
+    esp_netif_dhcpc_start( ctx.netif );
+  }
+#endif
+}
+
+static void _fast_connect_failed( void )
+{
+  LOG( PRINT_INFO, "Fast connect failed reason %d, full scan", ctx.reason_disconnect );
+  ctx.connect_stats.fast_fail_count++;
+  ctx.is_fast_failed = true;
+  ctx.connect_attemps = 0;
+  esp_wifi_disconnect();
+  _change_state( WIFI_APP_CONNECT );
+}
+
 static void _state_connect( void )
 {
   int ret = 0;
@@ -418,6 +553,14 @@ static void _state_connect( void )
     _start_sta_mode();
   }
 
+  /* Time of fallback connect includes failed fast attempt */
+  if ( !ctx.is_fast_failed || !ctx.is_fast_attempt )
+  {
+    ctx.connect_start_us = esp_timer_get_time();
+  }
+
+  _prepare_sta_config();
+  ctx.reason_disconnect = 0;
   esp_wifi_set_config( ESP_IF_WIFI_STA, &ctx.wifi_config );
   ret = esp_wifi_connect();
   if ( ret == ESP_OK )
@@ -449,12 +592,18 @@ static void _state_wait_connecting( void )
     ctx.connect_attemps = 0;
     _change_state( WIFI_APP_START );
   }
+  else if ( ctx.is_fast_attempt
+            && ( ctx.reason_disconnect != 0 || ctx.connect_attemps * WAIT_CONNECT_PERIOD_MS >= CONFIG_WIFI_FAST_CONNECT_TIMEOUT_MS ) )
+  {
+    _fast_connect_failed();
+  }
   else
   {
     if ( ctx.connect_attemps > 30 )
     {
       LOG( PRINT_INFO, "Timeout connect" );
       ctx.connect_req = false;
+      ctx.is_fast_failed = false;
       ctx.connect_attemps = 0;
       _change_state( WIFI_APP_IDLE );
       ctx.is_started = false;
@@ -462,7 +611,7 @@ static void _state_wait_connecting( void )
       esp_wifi_stop();
     }
 
-    vTaskDelay( MS2ST( 250 ) );
+    vTaskDelay( MS2ST( WAIT_CONNECT_PERIOD_MS ) );
     ctx.connect_attemps++;
   }
 }
@@ -817,3 +966,8 @@ uint32_t wifiDrvGetClientCount( void )
 {
   return ctx.client_cnt;
 }
+
+void wifiDrvGetConnectStats( wifi_connect_stats_t* stats )
+{
+  *stats = ctx.connect_stats;
+}
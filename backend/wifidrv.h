@@ -38,6 +38,15 @@ typedef struct
   char password[64];
 } wifiConData_t;
 
+typedef struct
+{
+  uint32_t last_fast_ms;    // time to IP of last reconnect to cached BSSID
+  uint32_t last_full_ms;    // time to IP of last connect with scan, includes failed fast attempt
+  uint32_t fast_count;
+  uint32_t full_count;
+  uint32_t fast_fail_count;
+} wifi_connect_stats_t;
+
 typedef void ( *wifi_drv_callback )( void );
 
 /* Public functions ----------------------------------------------------------*/
@@ -177,4 +186,10 @@ void wifiDrvRegisterDisconnectCb( wifi_drv_callback cb );
  */
 uint32_t wifiDrvGetClientCount( void );
 
+/**
+ * @brief   Get time to IP statistics of fast and full connect
+ * @param   [out] stats - statistics
+ */
+void wifiDrvGetConnectStats( wifi_connect_stats_t* stats );
+
 #endif
\ No newline at end of file
@@ -3,12 +3,16 @@
 #include <string.h>
 
 #include "app_config.h"
+#include "battery.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
-#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_continuous.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "history.h"
 #include "power_on.h"
+#include "scheduler.h"
 
 #define MODULE_NAME "[Battery] "
 #define DEBUG_LVL   PRINT_INFO
@@ -21,9 +25,21 @@
 #endif
 
 #define DEFAULT_VREF       1100    // Use adc2_vref_to_gpio() to obtain a better estimate
-#define NO_OF_SAMPLES      64    // Multisampling
 #define CHARGER_STATUS_PIN 35
 
+/* One DMA frame per measure: 256 samples in ~13 ms, frame is read by next job run
+ * without waiting, so scheduler task is not blocked during conversion. Read job is
+ * delayed one tick more, start can be at end of tick, and is re-armed if frame is not ready */
+#define SAMPLE_FREQ_HZ     20000
+#define CONV_FRAME_SIZE    ( 256 * SOC_ADC_DIGI_RESULT_BYTES )
+#define CONV_TIME_MS       20
+#define CONV_READ_DELAY_MS ( CONV_TIME_MS + portTICK_PERIOD_MS )
+#define CONV_READ_RETRIES  3
+#define MEASURE_PERIOD_MS  1000
+
+/* History reader must not stall other scheduler jobs, sample is skipped instead */
+#define HISTORY_LOCK_TIMEOUT_MS 5
+
 static const adc_channel_t channel = ADC_CHANNEL_6;    // GPIO34 if ADC1, GPIO14 if ADC2
 static const adc_atten_t atten = ADC_ATTEN_DB_11;
 static const adc_unit_t unit = ADC_UNIT_1;
@@ -37,14 +53,117 @@ static const adc_bitwidth_t width = ADC_BITWIDTH_12;
 #define CRITICAL_VOLTAGE    3000
 #define MAX_VOL             4200
 
-#define ADC_BUFFOR_SIZE 32
+/* Power off after CRITICAL_DEBOUNCE_CNT measures in row below CRITICAL_VOLTAGE */
+#define CRITICAL_DEBOUNCE_CNT 5
+
+/* IIR: y += (x - y) / 2^IIR_SHIFT, time constant ~16 measures like previous 32 samples window */
+#define IIR_SHIFT     4
+#define IIR_FRAC_BITS 8
+
+/* Load compensation: terminal voltage drops by I * R under load, SoC is looked up from
+ * voltage + drop. Load is static estimate of controller plus hints of running consumers */
+#ifndef CONFIG_BATTERY_INTERNAL_RESISTANCE_MOHM
+#define CONFIG_BATTERY_INTERNAL_RESISTANCE_MOHM 150
+#endif
+
+#ifndef CONFIG_BATTERY_BASE_LOAD_MA
+#define CONFIG_BATTERY_BASE_LOAD_MA 80
+#endif
+
+#ifndef CONFIG_BATTERY_MOTOR_LOAD_MA
+#define CONFIG_BATTERY_MOTOR_LOAD_MA 500
+#endif
+
+#ifndef CONFIG_BATTERY_SERVO_LOAD_MA
+#define CONFIG_BATTERY_SERVO_LOAD_MA 300
+#endif
+
+typedef struct
+{
+  uint16_t voltage;
+  uint8_t soc;
+} soc_point_t;
+
+/* Li-ion open circuit voltage to state of charge, descending voltage */
+static const soc_point_t soc_table[] =
+  {
+    { .voltage = 4200, .soc = 100 },
+    { .voltage = 4100, .soc = 90 },
+    { .voltage = 4000, .soc = 80 },
+    { .voltage = 3920, .soc = 70 },
+    { .voltage = 3850, .soc = 60 },
+    { .voltage = 3800, .soc = 50 },
+    { .voltage = 3750, .soc = 40 },
+    { .voltage = 3710, .soc = 30 },
+    { .voltage = 3680, .soc = 20 },
+    { .voltage = 3600, .soc = 10 },
+    { .voltage = 3450, .soc = 5 },
+    { .voltage = 3000, .soc = 0 },
+};
+
 static uint32_t voltage;
-static uint32_t voltage_sum;
+static uint32_t voltage_filtered;
 static uint32_t voltage_average;
-static uint32_t voltage_table[ADC_BUFFOR_SIZE];
-static uint32_t voltage_measure_cnt;
-static uint32_t voltage_table_size;
+static uint32_t critical_cnt;
+static uint32_t load_mask;
+static uint8_t soc;
 static bool voltage_is_measured;
+static history_t history;
+static uint8_t history_buffer[HISTORY_DEFAULT_BUFFER_SIZE];
+static SemaphoreHandle_t history_mutex;
+static adc_continuous_handle_t adc_handle;
+static adc_cali_handle_t adc_cali_handle;
+static bool do_calibration;
+static scheduler_job_t adc_job_ctx;
+static scheduler_job_t adc_read_job_ctx;
+static uint8_t read_retry_cnt;
+
+static const uint32_t load_current_ma[BATTERY_LOAD_LAST] =
+  {
+    [BATTERY_LOAD_MOTOR] = CONFIG_BATTERY_MOTOR_LOAD_MA,
+    [BATTERY_LOAD_SERVO] = CONFIG_BATTERY_SERVO_LOAD_MA,
+};
+
+/* Voltage drop on internal resistance, charger rises terminal voltage so only on discharge */
+static uint32_t _load_drop_mv( void )
+{
+  if ( gpio_get_level( CHARGER_STATUS_PIN ) == 0 )
+  {
+    return 0;
+  }
+
+  uint32_t mask = __atomic_load_n( &load_mask, __ATOMIC_RELAXED );
+  uint32_t current_ma = CONFIG_BATTERY_BASE_LOAD_MA;
+  for ( int i = 0; i < BATTERY_LOAD_LAST; i++ )
+  {
+    if ( mask & ( 1 << i ) )
+    {
+      current_ma += load_current_ma[i];
+    }
+  }
+
+  return current_ma * CONFIG_BATTERY_INTERNAL_RESISTANCE_MOHM / 1000;
+}
+
+static uint8_t _voltage_to_soc( uint32_t ocv )
+{
+  if ( ocv >= soc_table[0].voltage )
+  {
+    return soc_table[0].soc;
+  }
+
+  for ( size_t i = 1; i < sizeof( soc_table ) / sizeof( soc_table[0] ); i++ )
+  {
+    if ( ocv >= soc_table[i].voltage )
+    {
+      const soc_point_t* hi = &soc_table[i - 1];
+      const soc_point_t* lo = &soc_table[i];
+      return lo->soc + ( ocv - lo->voltage ) * ( hi->soc - lo->soc ) / ( hi->voltage - lo->voltage );
+    }
+  }
+
+  return 0;
+}
 
 static bool _adc_calibration_init( adc_unit_t u, adc_channel_t ch, adc_atten_t at, adc_cali_handle_t* out_handle )
 {
@@ -84,83 +203,158 @@ static bool _adc_calibration_init( adc_unit_t u, adc_channel_t ch, adc_atten_t a
   return calibrated;
 }
 
-static void adc_task()
+/* Read frame of burst started CONV_TIME_MS ago. Return false if no new voltage was measured */
+static bool _sample_burst( adc_continuous_handle_t handle, adc_cali_handle_t cali_handle, bool do_calibration )
 {
-  //-------------ADC1 Init---------------//
-  adc_oneshot_unit_handle_t adc1_handle;
-  adc_oneshot_unit_init_cfg_t init_config1 = {
-    .unit_id = unit,
-  };
-  ESP_ERROR_CHECK( adc_oneshot_new_unit( &init_config1, &adc1_handle ) );
+  static uint8_t frame[CONV_FRAME_SIZE];
+  static uint8_t drop[CONV_FRAME_SIZE];
+  uint32_t frame_len = 0;
+  uint32_t drop_len = 0;
+  uint32_t raw_sum = 0;
+  uint32_t raw_cnt = 0;
 
-  //-------------ADC1 Config---------------//
-  adc_oneshot_chan_cfg_t config = {
-    .bitwidth = width,
-    .atten = atten,
-  };
-  ESP_ERROR_CHECK( adc_oneshot_config_channel( adc1_handle, channel, &config ) );
+  esp_err_t ret = adc_continuous_read( handle, frame, sizeof( frame ), &frame_len, 0 );
+  if ( ret == ESP_ERR_TIMEOUT && read_retry_cnt < CONV_READ_RETRIES )
+  {
+    /* Frame not complete yet, ADC keeps running until next try */
+    read_retry_cnt++;
+    Scheduler_Start( &adc_read_job_ctx, portTICK_PERIOD_MS, 0 );
+    return false;
+  }
+  read_retry_cnt = 0;
 
-  //-------------ADC1 Calibration Init---------------//
-  adc_cali_handle_t adc1_cali_chan0_handle = NULL;
-  bool do_calibration1_chan0 = _adc_calibration_init( unit, channel, atten, &adc1_cali_chan0_handle );
+  /* Drop frames converted after first one, next burst starts with fresh frame */
+  while ( adc_continuous_read( handle, drop, sizeof( drop ), &drop_len, 0 ) == ESP_OK )
+  {
+  }
+  adc_continuous_stop( handle );
 
-  gpio_config_t io_conf;
-  io_conf.intr_type = GPIO_INTR_DISABLE;
-  io_conf.pull_down_en = 0;
-  io_conf.pin_bit_mask = BIT64( CHARGER_STATUS_PIN );
-  io_conf.mode = GPIO_MODE_INPUT;
-  io_conf.pull_up_en = 0;
-  gpio_config( &io_conf );
+  if ( ret != ESP_OK )
+  {
+    LOG( PRINT_ERROR, "ADC read error %d", ret );
+    return false;
+  }
 
-  while ( 1 )
+  for ( uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= frame_len; i += SOC_ADC_DIGI_RESULT_BYTES )
   {
-    int adc_reading = 0;
-    int voltage_meas = 0;
-    // Multisampling
-    for ( int i = 0; i < NO_OF_SAMPLES; i++ )
+    adc_digi_output_data_t* data = (adc_digi_output_data_t*) &frame[i];
+    if ( data->type1.channel == channel )
     {
-      ESP_ERROR_CHECK( adc_oneshot_read( adc1_handle, channel, &adc_reading ) );
-      LOG( PRINT_DEBUG, "ADC%d Channel[%d] Raw Data: %d", unit + 1, channel, adc_reading );
-      if ( do_calibration1_chan0 )
-      {
-        ESP_ERROR_CHECK( adc_cali_raw_to_voltage( adc1_cali_chan0_handle, adc_reading, &voltage_meas ) );
-        LOG( PRINT_DEBUG, "ADC%d Channel[%d] Cali Voltage: %d mV", unit + 1, channel, voltage_meas );
-      }
+      raw_sum += data->type1.data;
+      raw_cnt++;
     }
+  }
+
+  if ( raw_cnt == 0 )
+  {
+    return false;
+  }
+
+  int adc_reading = raw_sum / raw_cnt;
+  int voltage_meas = adc_reading;
+  if ( do_calibration )
+  {
+    ESP_ERROR_CHECK( adc_cali_raw_to_voltage( cali_handle, adc_reading, &voltage_meas ) );
+  }
 
-    adc_reading /= NO_OF_SAMPLES;
-    // Convert adc_reading to voltage in mV
+  voltage = MAX_VOL * voltage_meas / MAX_ADC_FOR_MAX_VOL;
+  LOG( PRINT_DEBUG, "Raw: %d (%d samples) Voltage: %d mV", adc_reading, raw_cnt, voltage );
+
+  /* IIR low-pass, state keeps IIR_FRAC_BITS fraction bits */
+  if ( !voltage_is_measured )
+  {
+    voltage_filtered = voltage << IIR_FRAC_BITS;
+  }
+  else
+  {
+    voltage_filtered += ( (int32_t) ( voltage << IIR_FRAC_BITS ) - (int32_t) voltage_filtered ) >> IIR_SHIFT;
+  }
 
-    LOG( PRINT_DEBUG, "Raw: %d\tVoltage: %dmV\n", adc_reading, voltage );
+  voltage_average = voltage_filtered >> IIR_FRAC_BITS;
+  soc = _voltage_to_soc( voltage_average + _load_drop_mv() );
+  voltage_is_measured = true;
+  return true;
+}
 
-    voltage = MAX_VOL * voltage_meas / MAX_ADC_FOR_MAX_VOL;
+static void _check_critical( void )
+{
+  if ( voltage < CRITICAL_VOLTAGE )
+  {
+    critical_cnt++;
+  }
+  else
+  {
+    critical_cnt = 0;
+  }
 
-    voltage_table[voltage_measure_cnt % ADC_BUFFOR_SIZE] = voltage;
-    voltage_measure_cnt++;
-    if ( voltage_table_size < ADC_BUFFOR_SIZE )
+  if ( critical_cnt >= CRITICAL_DEBOUNCE_CNT )
+  {
+    LOG( PRINT_INFO, "Found critical battery voltage. Power off" );
+    power_on_disable_system();
+  }
+}
+
+static void adc_job( void* arg )
+{
+  ESP_ERROR_CHECK( adc_continuous_start( adc_handle ) );
+  Scheduler_Start( &adc_read_job_ctx, CONV_READ_DELAY_MS, 0 );
+}
+
+static void adc_read_job( void* arg )
+{
+  /* Failed burst keeps previous voltage, it must not be counted by debounce again */
+  if ( _sample_burst( adc_handle, adc_cali_handle, do_calibration ) )
+  {
+    if ( xSemaphoreTake( history_mutex, MS2ST( HISTORY_LOCK_TIMEOUT_MS ) ) == pdTRUE )
     {
-      voltage_table_size++;
+      History_Add( &history, (int32_t) voltage_average, ST2MS( xTaskGetTickCount() ) );
+      xSemaphoreGive( history_mutex );
     }
-
-    voltage_sum = 0;
-    for ( uint8_t i = 0; i < voltage_table_size; i++ )
+    else
     {
-      voltage_sum += voltage_table[i];
+      LOG( PRINT_ERROR, "history busy, sample skipped" );
     }
 
-    voltage_average = voltage_sum / voltage_table_size;
+    _check_critical();
+  }
 
-    voltage_is_measured = true;
+  LOG( PRINT_DEBUG, "Average: %d measured %d soc %d%%", voltage_average, voltage, soc );
+}
 
-    if ( voltage < CRITICAL_VOLTAGE )
-    {
-      LOG( PRINT_INFO, "Found critical battery voltage. Power off" );
-      power_on_disable_system();
-    }
+static void _adc_init( void )
+{
+  adc_continuous_handle_t handle = NULL;
+  adc_continuous_handle_cfg_t handle_config = {
+    .max_store_buf_size = CONV_FRAME_SIZE * 2,
+    .conv_frame_size = CONV_FRAME_SIZE,
+  };
+  ESP_ERROR_CHECK( adc_continuous_new_handle( &handle_config, &handle ) );
 
-    LOG( PRINT_DEBUG, "Average: %d measured %d", voltage_average, voltage );
-    vTaskDelay( MS2ST( 1000 ) );
-  }
+  adc_digi_pattern_config_t pattern = {
+    .atten = atten,
+    .channel = channel,
+    .unit = unit,
+    .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+  };
+  adc_continuous_config_t dig_config = {
+    .pattern_num = 1,
+    .adc_pattern = &pattern,
+    .sample_freq_hz = SAMPLE_FREQ_HZ,
+    .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+    .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+  };
+  ESP_ERROR_CHECK( adc_continuous_config( handle, &dig_config ) );
+  adc_handle = handle;
+
+  do_calibration = _adc_calibration_init( unit, channel, atten, &adc_cali_handle );
+
+  gpio_config_t io_conf;
+  io_conf.intr_type = GPIO_INTR_DISABLE;
+  io_conf.pull_down_en = 0;
+  io_conf.pin_bit_mask = BIT64( CHARGER_STATUS_PIN );
+  io_conf.mode = GPIO_MODE_INPUT;
+  io_conf.pull_up_en = 0;
+  gpio_config( &io_conf );
 }
 
 bool battery_is_measured( void )
@@ -173,12 +367,48 @@ float battery_get_voltage( void )
   return (float) voltage_average / 1000;
 }
 
+uint8_t battery_get_soc( void )
+{
+  return soc;
+}
+
+void battery_set_load( battery_load_t load, bool on )
+{
+  if ( load >= BATTERY_LOAD_LAST )
+  {
+    return;
+  }
+
+  if ( on )
+  {
+    __atomic_or_fetch( &load_mask, 1 << load, __ATOMIC_RELAXED );
+  }
+  else
+  {
+    __atomic_and_fetch( &load_mask, ~( 1 << load ), __ATOMIC_RELAXED );
+  }
+}
+
 bool battery_get_charging_status( void )
 {
   return gpio_get_level( CHARGER_STATUS_PIN ) == 0;
 }
 
+size_t battery_get_history( uint8_t level, history_sample_t* out, size_t count )
+{
+  xSemaphoreTake( history_mutex, portMAX_DELAY );
+  size_t result = History_GetWindow( &history, level, out, count );
+  xSemaphoreGive( history_mutex );
+  return result;
+}
+
 void battery_init( void )
 {
-  xTaskCreate( adc_task, "adc_task", 4096, NULL, 5, NULL );
+  const history_level_cfg_t history_cfg[] = HISTORY_DEFAULT_LEVELS;
+  History_Init( &history, history_buffer, sizeof( history_buffer ), history_cfg, HISTORY_DEFAULT_LEVELS_CNT );
+  history_mutex = xSemaphoreCreateMutex();
+  _adc_init();
+  Scheduler_AddJob( &adc_job_ctx, "battery", adc_job, NULL );
+  Scheduler_AddJob( &adc_read_job_ctx, "battery_read", adc_read_job, NULL );
+  Scheduler_Start( &adc_job_ctx, 0, MEASURE_PERIOD_MS );
 }
@@ -1,9 +1,21 @@
 #ifndef BATTERY_H
 #define BATTERY_H
 
+#include "history.h"
+
+typedef enum
+{
+  BATTERY_LOAD_MOTOR,
+  BATTERY_LOAD_SERVO,
+  BATTERY_LOAD_LAST
+} battery_load_t;
+
 void battery_init( void );
 float battery_get_voltage( void );
 bool battery_get_charging_status( void );
 bool battery_is_measured( void );
+uint8_t battery_get_soc( void );    // state of charge in percent
+void battery_set_load( battery_load_t load, bool on );    // running consumer, its current compensates SoC
+size_t battery_get_history( uint8_t level, history_sample_t* out, size_t count );    // voltage in mV
 
 #endif
\ No newline at end of file
@@ -0,0 +1,410 @@
+/**
+ *******************************************************************************
+ * @file    binlog.c
+ * @author  Dmytro Shevchenko
+ * @brief   Deferred formatting binary log source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "binlog.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#endif
+
+/* Private macros ------------------------------------------------------------*/
+
+#define INFO_COMMITTED 0x80000000
+#define INFO_PADDING   0x40000000
+#define INFO_LVL_SHIFT 24
+#define INFO_LVL_MASK  0x0F
+#define INFO_ARGS_SHIFT 16
+#define INFO_ARGS_MASK 0xFF
+#define INFO_LEN_MASK  0xFFFF
+
+#define ALIGN4( _x ) ( ( ( _x ) + 3 ) & ~3u )
+
+/* Reservation is the only critical part. Interrupts are masked on writer core and spinlock
+ * serializes writers of other core, ring may be chosen before task migrated to other core */
+#ifdef ESP_PLATFORM
+#define RESERVE_LOCK( _ring )                                 \
+  UBaseType_t _irq_state = portSET_INTERRUPT_MASK_FROM_ISR(); \
+  _spin_lock( _ring )
+#define RESERVE_UNLOCK( _ring ) \
+  _spin_unlock( _ring );        \
+  portCLEAR_INTERRUPT_MASK_FROM_ISR( _irq_state )
+#else
+#define RESERVE_LOCK( _ring )   _spin_lock( _ring )
+#define RESERVE_UNLOCK( _ring ) _spin_unlock( _ring )
+#endif
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  uint32_t info;
+  uint32_t time_us;
+  const char* fmt;
+} record_t;
+
+/* Private functions ---------------------------------------------------------*/
+
+static inline void _spin_lock( binlog_ring_t* ring )
+{
+  while ( __atomic_exchange_n( &ring->lock, 1, __ATOMIC_ACQUIRE ) != 0 )
+  {
+  }
+}
+
+static inline void _spin_unlock( binlog_ring_t* ring )
+{
+  __atomic_store_n( &ring->lock, 0, __ATOMIC_RELEASE );
+}
+
+static size_t _arg_size( uint8_t type, uint64_t value )
+{
+  switch ( type )
+  {
+    case BINLOG_ARG_INT:
+      return sizeof( uint32_t );
+
+    case BINLOG_ARG_STRING:
+    {
+      const char* str = (const char*) (uintptr_t) value;
+      return 1 + ( str != NULL ? strnlen( str, BINLOG_MAX_STRING ) : 0 );
+    }
+
+    default:
+      return sizeof( uint64_t );
+  }
+}
+
+static size_t _stored_size( uint8_t type, const uint8_t* data )
+{
+  return type == BINLOG_ARG_STRING ? (size_t) 1 + data[0] : _arg_size( type, 0 );
+}
+
+static size_t _put_arg( uint8_t* buf, uint8_t type, uint64_t value )
+{
+  switch ( type )
+  {
+    case BINLOG_ARG_INT:
+    {
+      uint32_t value32 = (uint32_t) value;
+      memcpy( buf, &value32, sizeof( value32 ) );
+      return sizeof( value32 );
+    }
+
+    case BINLOG_ARG_STRING:
+    {
+      const char* str = (const char*) (uintptr_t) value;
+      uint8_t len = str != NULL ? (uint8_t) strnlen( str, BINLOG_MAX_STRING ) : 0;
+      buf[0] = len;
+      memcpy( &buf[1], str, len );
+      return 1 + len;
+    }
+
+    default:
+      memcpy( buf, &value, sizeof( value ) );
+      return sizeof( value );
+  }
+}
+
+/* Oldest committed record, padding at the end of buffer is skipped */
+static record_t* _tail_record( binlog_ring_t* ring )
+{
+  while ( 1 )
+  {
+    uint32_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+    if ( ring->tail == head )
+    {
+      return NULL;
+    }
+
+    record_t* record = (record_t*) &ring->buffer[ring->tail & ( ring->size - 1 )];
+    uint32_t info = __atomic_load_n( &record->info, __ATOMIC_ACQUIRE );
+    if ( !( info & INFO_COMMITTED ) )
+    {
+      return NULL;
+    }
+
+    if ( !( info & INFO_PADDING ) )
+    {
+      return record;
+    }
+
+    __atomic_store_n( &ring->tail, ring->tail + ( info & INFO_LEN_MASK ), __ATOMIC_RELEASE );
+  }
+}
+
+/* One printf conversion, argument type is known from record so length modifiers are replaced */
+static int _format_arg( char* out, size_t out_size, const char* spec, size_t spec_len, char conv, uint8_t type, const uint8_t* data )
+{
+  char fmt[16];
+  size_t len = 0;
+
+  for ( size_t i = 0; i < spec_len && len < sizeof( fmt ) - 4; i++ )
+  {
+    if ( strchr( "hlzjtL", spec[i] ) == NULL )
+    {
+      fmt[len++] = spec[i];
+    }
+  }
+
+  uint32_t value32 = 0;
+  uint64_t value64 = 0;
+  if ( type == BINLOG_ARG_INT )
+  {
+    memcpy( &value32, data, sizeof( value32 ) );
+  }
+  else if ( type != BINLOG_ARG_STRING )
+  {
+    memcpy( &value64, data, sizeof( value64 ) );
+  }
+
+  switch ( conv )
+  {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+    case 'c':
+    {
+      bool is_signed = conv == 'd' || conv == 'i';
+      if ( type == BINLOG_ARG_INT )
+      {
+        value64 = is_signed ? (uint64_t) (int64_t) (int32_t) value32 : value32;
+      }
+      else if ( type == BINLOG_ARG_STRING || type == BINLOG_ARG_DOUBLE )
+      {
+        break;
+      }
+
+      if ( conv == 'c' )
+      {
+        fmt[len++] = 'c';
+        fmt[len] = 0;
+        return snprintf( out, out_size, fmt, (int) value64 );
+      }
+
+      fmt[len++] = 'l';
+      fmt[len++] = 'l';
+      fmt[len++] = conv;
+      fmt[len] = 0;
+      return is_signed ? snprintf( out, out_size, fmt, (long long) value64 ) : snprintf( out, out_size, fmt, (unsigned long long) value64 );
+    }
+
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      if ( type == BINLOG_ARG_DOUBLE )
+      {
+        double value;
+        memcpy( &value, &value64, sizeof( value ) );
+        fmt[len++] = conv;
+        fmt[len] = 0;
+        return snprintf( out, out_size, fmt, value );
+      }
+      break;
+
+    case 's':
+      if ( type == BINLOG_ARG_STRING )
+      {
+        char str[BINLOG_MAX_STRING + 1];
+        memcpy( str, &data[1], data[0] );
+        str[data[0]] = 0;
+        fmt[len++] = 's';
+        fmt[len] = 0;
+        return snprintf( out, out_size, fmt, str );
+      }
+      break;
+
+    case 'p':
+      if ( type != BINLOG_ARG_STRING && type != BINLOG_ARG_DOUBLE )
+      {
+        return snprintf( out, out_size, "%p", (void*) (uintptr_t) ( type == BINLOG_ARG_INT ? value32 : value64 ) );
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return snprintf( out, out_size, "<?>" );
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+void BinLog_Init( binlog_ring_t* ring, uint8_t* buffer, uint32_t size )
+{
+  assert( ring );
+  assert( buffer );
+  assert( size >= 64 && ( size & ( size - 1 ) ) == 0 );
+  assert( ( (uintptr_t) buffer & 3 ) == 0 );
+
+  memset( ring, 0, sizeof( binlog_ring_t ) );
+  ring->buffer = buffer;
+  ring->size = size;
+}
+
+bool BinLog_Write( binlog_ring_t* ring, uint32_t time_us, uint8_t lvl, const char* fmt, uint8_t nargs, const uint8_t* types, const uint64_t* values )
+{
+  /* Ring is not initialized yet */
+  if ( ring->size == 0 )
+  {
+    return false;
+  }
+
+  size_t len = sizeof( record_t ) + nargs;
+  for ( uint8_t i = 0; i < nargs; i++ )
+  {
+    len += _arg_size( types[i], values[i] );
+  }
+  len = ALIGN4( len );
+
+  record_t* record = NULL;
+  RESERVE_LOCK( ring );
+  uint32_t head = ring->head;
+  uint32_t pos = head & ( ring->size - 1 );
+  uint32_t pad = pos + len > ring->size ? ring->size - pos : 0;
+  if ( len <= INFO_LEN_MASK && pad + len <= ring->size - ( head - __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE ) ) )
+  {
+    if ( pad > 0 )
+    {
+      ( (record_t*) &ring->buffer[pos] )->info = INFO_COMMITTED | INFO_PADDING | pad;
+      pos = 0;
+    }
+    record = (record_t*) &ring->buffer[pos];
+    record->info = len;
+    __atomic_store_n( &ring->head, head + pad + len, __ATOMIC_RELEASE );
+    ring->written++;
+  }
+  else
+  {
+    ring->dropped++;
+  }
+  RESERVE_UNLOCK( ring );
+
+  if ( record == NULL )
+  {
+    return false;
+  }
+
+  record->time_us = time_us;
+  record->fmt = fmt;
+  uint8_t* data = (uint8_t*) ( record + 1 );
+  memcpy( data, types, nargs );
+  data += nargs;
+  for ( uint8_t i = 0; i < nargs; i++ )
+  {
+    data += _put_arg( data, types[i], values[i] );
+  }
+
+  __atomic_store_n( &record->info, INFO_COMMITTED | ( (uint32_t) ( lvl & INFO_LVL_MASK ) << INFO_LVL_SHIFT ) | ( (uint32_t) nargs << INFO_ARGS_SHIFT ) | len, __ATOMIC_RELEASE );
+  return true;
+}
+
+bool BinLog_Peek( binlog_ring_t* ring, uint32_t* time_us )
+{
+  assert( ring );
+  assert( time_us );
+
+  record_t* record = _tail_record( ring );
+  if ( record == NULL )
+  {
+    return false;
+  }
+
+  *time_us = record->time_us;
+  return true;
+}
+
+bool BinLog_Read( binlog_ring_t* ring, binlog_msg_t* msg, char* text, size_t text_size )
+{
+  assert( ring );
+  assert( msg );
+  assert( text && text_size > 0 );
+
+  record_t* record = _tail_record( ring );
+  if ( record == NULL )
+  {
+    return false;
+  }
+
+  uint32_t info = record->info;
+  uint8_t nargs = ( info >> INFO_ARGS_SHIFT ) & INFO_ARGS_MASK;
+  const uint8_t* types = (const uint8_t*) ( record + 1 );
+  const uint8_t* data = types + nargs;
+  const char* fmt = record->fmt;
+  size_t pos = 0;
+  uint8_t arg = 0;
+
+  msg->time_us = record->time_us;
+  msg->lvl = ( info >> INFO_LVL_SHIFT ) & INFO_LVL_MASK;
+  text[0] = 0;
+
+  while ( *fmt && pos + 1 < text_size )
+  {
+    if ( *fmt != '%' )
+    {
+      text[pos++] = *fmt++;
+      continue;
+    }
+
+    if ( fmt[1] == '%' )
+    {
+      text[pos++] = '%';
+      fmt += 2;
+      continue;
+    }
+
+    /* %[flags][width][.precision][length]conversion */
+    size_t spec_len = 1 + strspn( fmt + 1, "-+ #0123456789.hlzjtL" );
+    char conv = fmt[spec_len];
+    if ( conv == 0 )
+    {
+      break;
+    }
+
+    int written = 0;
+    if ( arg < nargs )
+    {
+      written = _format_arg( &text[pos], text_size - pos, fmt, spec_len, conv, types[arg], data );
+      data += _stored_size( types[arg], data );
+      arg++;
+    }
+    else
+    {
+      written = snprintf( &text[pos], text_size - pos, "<?>" );
+    }
+
+    pos += written > 0 ? (size_t) written : 0;
+    if ( pos >= text_size )
+    {
+      pos = text_size - 1;
+    }
+    fmt += spec_len + 1;
+  }
+  text[pos] = 0;
+
+  __atomic_store_n( &ring->tail, ring->tail + ( info & INFO_LEN_MASK ), __ATOMIC_RELEASE );
+  return true;
+}
+
+uint32_t BinLog_GetDropped( binlog_ring_t* ring )
+{
+  assert( ring );
+  return ring->dropped;
+}
@@ -0,0 +1,184 @@
+/**
+ *******************************************************************************
+ * @file    binlog.h
+ * @author  Dmytro Shevchenko
+ * @brief   Deferred formatting binary log header file. Platform independent.
+ *
+ *          Writer stores only format pointer, timestamp and raw arguments in
+ *          ring buffer. Message is formatted later by reader (low priority
+ *          task). Format string must be static (string literal), %s arguments
+ *          are copied (up to BINLOG_MAX_STRING chars), pointers other than
+ *          strings must be casted to void*. Space reservation is short spinlock
+ *          (interrupts of writer core are masked), so tasks of any core and
+ *          interrupts can write to one ring. One ring per core keeps cores from
+ *          spinning on each other.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _BINLOG_H_
+#define _BINLOG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Public macro --------------------------------------------------------------*/
+
+#define BINLOG_MAX_ARGS   12
+#define BINLOG_MAX_STRING 32
+
+#define BINLOG_ARG_TYPE( _x ) _Generic( ( _x ),                      \
+  char*: BINLOG_ARG_STRING,                                         \
+  const char*: BINLOG_ARG_STRING,                                   \
+  unsigned char*: BINLOG_ARG_STRING,                                \
+  const unsigned char*: BINLOG_ARG_STRING,                          \
+  float: BINLOG_ARG_DOUBLE,                                         \
+  double: BINLOG_ARG_DOUBLE,                                        \
+  long: BINLOG_ARG_INT64,                                           \
+  unsigned long: BINLOG_ARG_INT64,                                  \
+  long long: BINLOG_ARG_INT64,                                      \
+  unsigned long long: BINLOG_ARG_INT64,                             \
+  void*: BINLOG_ARG_POINTER,                                        \
+  const void*: BINLOG_ARG_POINTER,                                  \
+  default: BINLOG_ARG_INT )
+
+#define BINLOG_ARG_VALUE( _x ) _Generic( ( _x ),                     \
+  char*: _BinLog_Pointer,                                           \
+  const char*: _BinLog_Pointer,                                     \
+  unsigned char*: _BinLog_Pointer,                                  \
+  const unsigned char*: _BinLog_Pointer,                            \
+  float: _BinLog_Double,                                            \
+  double: _BinLog_Double,                                           \
+  void*: _BinLog_Pointer,                                           \
+  const void*: _BinLog_Pointer,                                     \
+  default: _BinLog_Int )( _x )
+
+#define _BINLOG_NTH( _0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _n, ... ) _n
+#define _BINLOG_NARGS( ... )                                         _BINLOG_NTH( _0, ##__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 )
+#define _BINLOG_CAT( _a, _b )                                        _BINLOG_CAT_( _a, _b )
+#define _BINLOG_CAT_( _a, _b )                                       _a##_b
+
+#define _BINLOG_MAP_0( _m )
+#define _BINLOG_MAP_1( _m, _a )       _m( _a ),
+#define _BINLOG_MAP_2( _m, _a, ... )  _m( _a ), _BINLOG_MAP_1( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_3( _m, _a, ... )  _m( _a ), _BINLOG_MAP_2( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_4( _m, _a, ... )  _m( _a ), _BINLOG_MAP_3( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_5( _m, _a, ... )  _m( _a ), _BINLOG_MAP_4( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_6( _m, _a, ... )  _m( _a ), _BINLOG_MAP_5( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_7( _m, _a, ... )  _m( _a ), _BINLOG_MAP_6( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_8( _m, _a, ... )  _m( _a ), _BINLOG_MAP_7( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_9( _m, _a, ... )  _m( _a ), _BINLOG_MAP_8( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_10( _m, _a, ... ) _m( _a ), _BINLOG_MAP_9( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_11( _m, _a, ... ) _m( _a ), _BINLOG_MAP_10( _m, __VA_ARGS__ )
+#define _BINLOG_MAP_12( _m, _a, ... ) _m( _a ), _BINLOG_MAP_11( _m, __VA_ARGS__ )
+#define _BINLOG_MAP( _m, ... )        _BINLOG_CAT( _BINLOG_MAP_, _BINLOG_NARGS( __VA_ARGS__ ) )( _m, ##__VA_ARGS__ )
+
+/**
+ * @brief   Write message to ring.
+ * @param   [in] _ring - ring pointer
+ * @param   [in] _time_us - timestamp
+ * @param   [in] _lvl - message level, 0..15
+ * @param   [in] _fmt - printf format, must be string literal
+ */
+#define BINLOG_WRITE( _ring, _time_us, _lvl, _fmt, ... )                                        \
+  BinLog_Write( _ring, _time_us, _lvl, _fmt, _BINLOG_NARGS( __VA_ARGS__ ),                       \
+                (const uint8_t[]) { _BINLOG_MAP( BINLOG_ARG_TYPE, ##__VA_ARGS__ ) 0 },          \
+                (const uint64_t[]) { _BINLOG_MAP( BINLOG_ARG_VALUE, ##__VA_ARGS__ ) 0 } )
+
+/* Public types --------------------------------------------------------------*/
+
+typedef enum
+{
+  BINLOG_ARG_INT,
+  BINLOG_ARG_INT64,
+  BINLOG_ARG_DOUBLE,
+  BINLOG_ARG_STRING,
+  BINLOG_ARG_POINTER,
+} binlog_arg_t;
+
+typedef struct
+{
+  uint8_t* buffer;
+  uint32_t size;    // power of 2
+  uint32_t head;
+  uint32_t tail;
+  uint32_t lock;    // reservation spinlock
+  uint32_t dropped;
+  uint32_t written;
+} binlog_ring_t;
+
+typedef struct
+{
+  uint32_t time_us;
+  uint8_t lvl;
+} binlog_msg_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+static inline uint64_t _BinLog_Int( uint64_t value )
+{
+  return value;
+}
+
+static inline uint64_t _BinLog_Double( double value )
+{
+  uint64_t bits;
+  memcpy( &bits, &value, sizeof( bits ) );
+  return bits;
+}
+
+static inline uint64_t _BinLog_Pointer( const void* value )
+{
+  return (uintptr_t) value;
+}
+
+/**
+ * @brief   Init ring.
+ * @param   [in] ring - ring pointer
+ * @param   [in] buffer - ring storage, 4 bytes aligned
+ * @param   [in] size - storage size, power of 2
+ */
+void BinLog_Init( binlog_ring_t* ring, uint8_t* buffer, uint32_t size );
+
+/**
+ * @brief   Write message, use BINLOG_WRITE macro. Message is dropped if ring is full.
+ * @param   [in] ring - ring pointer
+ * @param   [in] time_us - timestamp
+ * @param   [in] lvl - message level
+ * @param   [in] fmt - printf format
+ * @param   [in] nargs - count of arguments
+ * @param   [in] types - binlog_arg_t of arguments
+ * @param   [in] values - raw arguments
+ * @return  true if message is stored
+ */
+bool BinLog_Write( binlog_ring_t* ring, uint32_t time_us, uint8_t lvl, const char* fmt, uint8_t nargs, const uint8_t* types, const uint64_t* values );
+
+/**
+ * @brief   Get timestamp of oldest completed message without reading it.
+ * @param   [in] ring - ring pointer
+ * @param   [out] time_us - timestamp
+ * @return  true if message is available
+ */
+bool BinLog_Peek( binlog_ring_t* ring, uint32_t* time_us );
+
+/**
+ * @brief   Read and format oldest completed message.
+ * @param   [in] ring - ring pointer
+ * @param   [out] msg - message level and timestamp
+ * @param   [out] text - formatted message
+ * @param   [in] text_size - text buffer size
+ * @return  true if message is read
+ */
+bool BinLog_Read( binlog_ring_t* ring, binlog_msg_t* msg, char* text, size_t text_size );
+
+/**
+ * @brief   Get count of messages dropped because ring was full.
+ * @param   [in] ring - ring pointer
+ * @return  dropped messages
+ */
+uint32_t BinLog_GetDropped( binlog_ring_t* ring );
+
+#endif
@@ -6,6 +6,8 @@
  */
 #include "but.h"
 
+#include <assert.h>
+
 #include "app_config.h"
 #include "buzzer.h"
 #include "driver/gpio.h"
@@ -13,8 +15,10 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 #include "pcf8574.h"
 #include "stdint.h"
+#include "ui_trace.h"
 
 #define MODULE_NAME "[Button] "
 #define DEBUG_LVL   PRINT_INFO
@@ -142,72 +146,325 @@ void init_but_struct( void )
   button10.is_gpio = 1;
 }
 
-static uint32_t start_time;
+/* Gesture state machine -----------------------------------------------------*/
 
-static void process_button( void* arg )
+typedef enum
 {
-  uint8_t red_val = 0;
-  // ESP_ERROR_CHECK(esp_task_wdt_add(NULL));
+  BUT_FSM_IDLE,
+  BUT_FSM_PRESSED,
+  BUT_FSM_HOLD,
+  BUT_FSM_WAIT_SECOND,
+  BUT_FSM_SECOND_PRESSED,
+  BUT_FSM_LAST
+} but_fsm_state_t;
 
-  while ( 1 )
+typedef enum
+{
+  BUT_INPUT_PRESS,
+  BUT_INPUT_RELEASE,
+  BUT_INPUT_TIMEOUT,
+  BUT_INPUT_LAST
+} but_fsm_input_t;
+
+typedef enum
+{
+  BUT_MSG_EDGE,
+  BUT_MSG_TIMEOUT,
+} but_msg_type_t;
+
+typedef struct
+{
+  uint8_t button;
+  uint8_t type;
+  uint8_t timer_gen;
+} but_msg_t;
+
+typedef but_fsm_state_t ( *but_action_t )( uint8_t idx, but_fsm_state_t next );
+
+typedef struct
+{
+  but_fsm_state_t next;
+  but_action_t action;
+} but_transition_t;
+
+#define LONG_PRESS_MS      ( TIMER_CNT_TIMEOUT * BUT_TIMER_PERIOD_MS )
+#define LONG_LONG_PRESS_MS ( TIMER_LONG_CNT_TIMEOUT * BUT_TIMER_PERIOD_MS )
+#define MSG_QUEUE_SIZE     ( BUTTON_CNT * 2 )
+
+static QueueHandle_t msg_queue;
+static QueueHandle_t event_queue;
+
+static void _emit( uint8_t idx, but_event_type_t type )
+{
+  but_t* but = but_tab[idx];
+
+  UI_TRACE( UI_TRACE_BUTTON_CB, idx | ( type << 8 ) );
+  switch ( type )
   {
-    // esp_task_wdt_reset();
-    start_time = xTaskGetTickCount();
+    case BUT_EVENT_PRESS:
+      if ( but->fall_callback != 0 )
+      {
+        buzzer_click();
+        but->fall_callback( but->arg );
+      }
+      break;
 
-    for ( uint8_t i = 0; i < BUTTON_CNT; i++ )
-    {
-      red_val = read_button( but_tab[i] );
-      if ( red_val != but_tab[i]->value )
+    case BUT_EVENT_RELEASE:
+      if ( but->rise_callback != 0 )
+      {
+        but->rise_callback( but->arg );
+      }
+      break;
+
+    case BUT_EVENT_LONG_PRESS:
+      if ( but->timer_callback != 0 )
       {
-        but_tab[i]->value = red_val;
-        if ( red_val == 1 )
-        {
-          if ( but_tab[i]->rise_callback != 0 )
-          {
-            but_tab[i]->rise_callback( but_tab[i]->arg );
-          }
-        }
-        else if ( ( red_val == 0 ) && ( but_tab[i]->fall_callback != 0 ) )
-        {
-          buzzer_click();
-          but_tab[i]->fall_callback( but_tab[i]->arg );
-        }
+        but->timer_callback( but->arg );
       }
+      break;
 
-      // timer
-      if ( red_val == 0 )
+    case BUT_EVENT_LONG_LONG_PRESS:
+      if ( but->timer_long_callback != 0 )
       {
-        but_tab[i]->tim_cnt++;
-        if ( ( but_tab[i]->tim_cnt >= TIMER_CNT_TIMEOUT ) && ( but_tab[i]->state == 0 ) )
-        {
-          if ( but_tab[i]->timer_callback != 0 )
-          {
-            but_tab[i]->timer_callback( but_tab[i]->arg );
-          }
-
-          but_tab[i]->state = 1;
-        }
-
-        if ( ( but_tab[i]->tim_cnt >= TIMER_LONG_CNT_TIMEOUT ) && ( but_tab[i]->state == 1 ) )
-        {
-          if ( but_tab[i]->timer_long_callback != 0 )
-          {
-            but_tab[i]->timer_long_callback( but_tab[i]->arg );
-          }
-
-          but_tab[i]->tim_cnt = 0;
-          but_tab[i]->state = 2;
-        }
+        but->timer_long_callback( but->arg );
       }
-      else
+      break;
+
+    default:
+      break;
+  }
+
+  if ( event_queue != NULL )
+  {
+    but_event_t event = { .button = idx, .type = type, .time_ms = ST2MS( xTaskGetTickCount() ) };
+    if ( xQueueSend( event_queue, &event, 0 ) != pdTRUE )
+    {
+      LOG( PRINT_DEBUG, "Event queue full, drop %d", type );
+    }
+  }
+}
+
+/* Timer ID keeps button index and generation of arming, callback does not read but_t */
+static void _timer_start( uint8_t idx, uint32_t period_ms )
+{
+  but_t* but = but_tab[idx];
+  but->timer_gen++;
+  but->timer_period_ms = period_ms;
+  vTimerSetTimerID( but->gesture_timer, (void*) (uintptr_t) ( idx | ( but->timer_gen << 8 ) ) );
+  xTimerChangePeriod( but->gesture_timer, MS2ST( period_ms ), 0 );
+}
+
+static void _timer_stop( uint8_t idx )
+{
+  but_t* but = but_tab[idx];
+  but->timer_gen++;
+  xTimerStop( but->gesture_timer, 0 );
+}
+
+static but_fsm_state_t _act_none( uint8_t idx, but_fsm_state_t next )
+{
+  return next;
+}
+
+static but_fsm_state_t _act_press( uint8_t idx, but_fsm_state_t next )
+{
+  but_tab[idx]->tim_cnt = 0;
+  _timer_start( idx, LONG_PRESS_MS );
+  _emit( idx, BUT_EVENT_PRESS );
+  return next;
+}
+
+static but_fsm_state_t _act_release( uint8_t idx, but_fsm_state_t next )
+{
+  but_t* but = but_tab[idx];
+
+  _emit( idx, BUT_EVENT_RELEASE );
+  if ( but->double_click_ms == 0 )
+  {
+    _timer_stop( idx );
+    _emit( idx, BUT_EVENT_CLICK );
+    return BUT_FSM_IDLE;
+  }
+
+  _timer_start( idx, but->double_click_ms );
+  return next;
+}
+
+static but_fsm_state_t _act_release_hold( uint8_t idx, but_fsm_state_t next )
+{
+  _timer_stop( idx );
+  _emit( idx, BUT_EVENT_RELEASE );
+  return next;
+}
+
+static but_fsm_state_t _act_click( uint8_t idx, but_fsm_state_t next )
+{
+  _emit( idx, BUT_EVENT_CLICK );
+  return next;
+}
+
+static but_fsm_state_t _act_double_click( uint8_t idx, but_fsm_state_t next )
+{
+  _timer_stop( idx );
+  _emit( idx, BUT_EVENT_RELEASE );
+  _emit( idx, BUT_EVENT_DOUBLE_CLICK );
+  return next;
+}
+
+static void _hold_timer_start( uint8_t idx )
+{
+  but_t* but = but_tab[idx];
+
+  if ( but->repeat_ms != 0 )
+  {
+    _timer_start( idx, but->repeat_ms );
+  }
+  else if ( but->tim_cnt < LONG_LONG_PRESS_MS )
+  {
+    _timer_start( idx, LONG_LONG_PRESS_MS - but->tim_cnt );
+  }
+}
+
+static but_fsm_state_t _act_long_press( uint8_t idx, but_fsm_state_t next )
+{
+  but_tab[idx]->tim_cnt = LONG_PRESS_MS;
+  _emit( idx, BUT_EVENT_LONG_PRESS );
+  _hold_timer_start( idx );
+  return next;
+}
+
+static but_fsm_state_t _act_hold( uint8_t idx, but_fsm_state_t next )
+{
+  but_t* but = but_tab[idx];
+  uint32_t prev = but->tim_cnt;
+
+  but->tim_cnt += but->timer_period_ms;
+  if ( but->repeat_ms != 0 )
+  {
+    _emit( idx, BUT_EVENT_REPEAT );
+  }
+
+  if ( prev < LONG_LONG_PRESS_MS && but->tim_cnt >= LONG_LONG_PRESS_MS )
+  {
+    _emit( idx, BUT_EVENT_LONG_LONG_PRESS );
+  }
+
+  _hold_timer_start( idx );
+  return next;
+}
+
+static const but_transition_t fsm_table[BUT_FSM_LAST][BUT_INPUT_LAST] =
+  {
+    [BUT_FSM_IDLE] = {
+      [BUT_INPUT_PRESS] = { BUT_FSM_PRESSED, _act_press },
+      [BUT_INPUT_RELEASE] = { BUT_FSM_IDLE, _act_none },
+      [BUT_INPUT_TIMEOUT] = { BUT_FSM_IDLE, _act_none },
+    },
+    [BUT_FSM_PRESSED] = {
+      [BUT_INPUT_PRESS] = { BUT_FSM_PRESSED, _act_none },
+      [BUT_INPUT_RELEASE] = { BUT_FSM_WAIT_SECOND, _act_release },
+      [BUT_INPUT_TIMEOUT] = { BUT_FSM_HOLD, _act_long_press },
+    },
+    [BUT_FSM_HOLD] = {
+      [BUT_INPUT_PRESS] = { BUT_FSM_HOLD, _act_none },
+      [BUT_INPUT_RELEASE] = { BUT_FSM_IDLE, _act_release_hold },
+      [BUT_INPUT_TIMEOUT] = { BUT_FSM_HOLD, _act_hold },
+    },
+    [BUT_FSM_WAIT_SECOND] = {
+      [BUT_INPUT_PRESS] = { BUT_FSM_SECOND_PRESSED, _act_press },
+      [BUT_INPUT_RELEASE] = { BUT_FSM_WAIT_SECOND, _act_none },
+      [BUT_INPUT_TIMEOUT] = { BUT_FSM_IDLE, _act_click },
+    },
+    [BUT_FSM_SECOND_PRESSED] = {
+      [BUT_INPUT_PRESS] = { BUT_FSM_SECOND_PRESSED, _act_none },
+      [BUT_INPUT_RELEASE] = { BUT_FSM_IDLE, _act_double_click },
+      [BUT_INPUT_TIMEOUT] = { BUT_FSM_HOLD, _act_long_press },
+    },
+};
+
+static void _fsm_process( uint8_t idx, but_fsm_input_t input )
+{
+  but_t* but = but_tab[idx];
+  const but_transition_t* transition = &fsm_table[but->state][input];
+
+  but->state = transition->action( idx, transition->next );
+}
+
+/* Interrupt engine ----------------------------------------------------------*/
+
+static void IRAM_ATTR _gpio_isr_handler( void* arg )
+{
+  uint8_t idx = (uint8_t) (uintptr_t) arg;
+  but_t* but = but_tab[idx];
+  BaseType_t woken = pdFALSE;
+
+  /* First edge is reported at once, bounces are masked by debounce timer */
+  if ( but->debounce_lock )
+  {
+    return;
+  }
+
+  but->debounce_lock = 1;
+  UI_TRACE( UI_TRACE_BUTTON_EDGE, idx );
+  but_msg_t msg = { .button = idx, .type = BUT_MSG_EDGE };
+  xQueueSendFromISR( msg_queue, &msg, &woken );
+  if ( xTimerResetFromISR( but->debounce_timer, &woken ) != pdPASS )
+  {
+    /* Timer queue is full, without unlock the button would stay masked forever */
+    but->debounce_lock = 0;
+  }
+  portYIELD_FROM_ISR( woken );
+}
+
+static void _debounce_timer_cb( TimerHandle_t timer )
+{
+  uint8_t idx = (uint8_t) (uintptr_t) pvTimerGetTimerID( timer );
+
+  /* Level is read again, edge during debounce window is not lost */
+  but_tab[idx]->debounce_lock = 0;
+  but_msg_t msg = { .button = idx, .type = BUT_MSG_EDGE };
+  xQueueSend( msg_queue, &msg, 0 );
+}
+
+static void _gesture_timer_cb( TimerHandle_t timer )
+{
+  uintptr_t id = (uintptr_t) pvTimerGetTimerID( timer );
+  but_msg_t msg = { .button = (uint8_t) id, .type = BUT_MSG_TIMEOUT, .timer_gen = (uint8_t) ( id >> 8 ) };
+  xQueueSend( msg_queue, &msg, 0 );
+}
+
+static void process_button( void* arg )
+{
+  but_msg_t msg;
+
+  while ( 1 )
+  {
+    if ( xQueueReceive( msg_queue, &msg, portMAX_DELAY ) != pdTRUE )
+    {
+      continue;
+    }
+
+    but_t* but = but_tab[msg.button];
+    if ( msg.type == BUT_MSG_TIMEOUT )
+    {
+      /* Generation of arming differs when timer was restarted or stopped after it fired */
+      if ( msg.timer_gen == but->timer_gen )
       {
-        but_tab[i]->tim_cnt = 0;
-        but_tab[i]->state = 0;
+        _fsm_process( msg.button, BUT_INPUT_TIMEOUT );
       }
-    }    // end for
+      continue;
+    }
+
+    uint8_t red_val = read_button( but );
+    if ( red_val == but->value )
+    {
+      continue;
+    }
 
-    vTaskDelay( MS2ST( 30 ) );
-  }    // end while
+    but->value = red_val;
+    LOG( PRINT_DEBUG, "Button %d value %d", msg.button, red_val );
+    _fsm_process( msg.button, red_val == 0 ? BUT_INPUT_PRESS : BUT_INPUT_RELEASE );
+  }
 }
 
 static void set_bit_mask( uint64_t* mask )
@@ -221,17 +478,20 @@ static void set_bit_mask( uint64_t* mask )
   }
 }
 
+void but_set_event_queue( void* queue )
+{
+  event_queue = (QueueHandle_t) queue;
+}
+
 void init_buttons( void )
 {
   // pcf8574_init();
   gpio_config_t io_conf;
 
-  // disable interrupt
-  io_conf.intr_type = GPIO_INTR_DISABLE;
+  io_conf.intr_type = GPIO_INTR_ANYEDGE;
   // disable pull-down mode
   io_conf.pull_down_en = 0;
   init_but_struct();
-  // interrupt of rising edge
   io_conf.pin_bit_mask = 0;
   // bit mask of the pins, use GPIO4/5 here
   set_bit_mask( &io_conf.pin_bit_mask );
@@ -240,5 +500,28 @@ void init_buttons( void )
   // enable pull-up mode
   io_conf.pull_up_en = 1;
   gpio_config( &io_conf );
+
+  msg_queue = xQueueCreate( MSG_QUEUE_SIZE, sizeof( but_msg_t ) );
+  assert( msg_queue );
+
+  /* Service can be installed by other driver */
+  esp_err_t err = gpio_install_isr_service( 0 );
+  assert( err == ESP_OK || err == ESP_ERR_INVALID_STATE );
+
+  for ( uint8_t i = 0; i < BUTTON_CNT; i++ )
+  {
+    but_t* but = but_tab[i];
+    but->state = BUT_FSM_IDLE;
+    but->debounce_timer = (void*) xTimerCreate( "but_deb", MS2ST( CONFIG_BUTTON_DEBOUNCE_MS ), pdFALSE, (void*) (uintptr_t) i, _debounce_timer_cb );
+    but->gesture_timer = (void*) xTimerCreate( "but_gest", MS2ST( LONG_PRESS_MS ), pdFALSE, (void*) (uintptr_t) i, _gesture_timer_cb );
+    assert( but->debounce_timer && but->gesture_timer );
+
+    if ( but->is_gpio )
+    {
+      but->value = read_button( but );
+      gpio_isr_handler_add( but->gpio, _gpio_isr_handler, (void*) (uintptr_t) i );
+    }
+  }
+
   xTaskCreate( process_button, "gpio_task", 4096, NULL, 13, NULL );
 }
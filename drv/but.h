@@ -13,10 +13,13 @@
 #define BUTTON_CNT             10    //ilo�� przycisk�w
 #define TIMER_CNT_TIMEOUT      20
 #define TIMER_LONG_CNT_TIMEOUT 100
+#define BUT_TIMER_PERIOD_MS    30    // timeouts above are counted in this period
 
-#define CONFIG_BUTTON_I2C TRUE
+#ifndef CONFIG_BUTTON_DEBOUNCE_MS
+#define CONFIG_BUTTON_DEBOUNCE_MS 20
+#endif
 
-void init_buttons( void );
+#define CONFIG_BUTTON_I2C TRUE
 
 #define BUT1_GPIO  19
 #define BUT2_GPIO  18
@@ -29,10 +32,29 @@ void init_buttons( void );
 #define BUT9_GPIO  33
 #define BUT10_GPIO 32
 
+typedef enum
+{
+  BUT_EVENT_PRESS,
+  BUT_EVENT_RELEASE,
+  BUT_EVENT_CLICK,
+  BUT_EVENT_DOUBLE_CLICK,
+  BUT_EVENT_LONG_PRESS,
+  BUT_EVENT_REPEAT,
+  BUT_EVENT_LONG_LONG_PRESS,
+  BUT_EVENT_LAST
+} but_event_type_t;
+
 typedef struct
 {
-  uint32_t tim_cnt;
-  uint8_t state;
+  uint8_t button;    // index in but_tab
+  but_event_type_t type;
+  uint32_t time_ms;
+} but_event_t;
+
+typedef struct
+{
+  uint32_t tim_cnt;    // hold time in ms
+  uint8_t state;    // gesture state machine state
   uint8_t value;
   uint8_t gpio;
   uint8_t bit;
@@ -42,6 +64,17 @@ typedef struct
   void ( *fall_callback )( void* arg );
   void ( *timer_callback )( void* arg );
   void ( *timer_long_callback )( void* arg );
+
+  /* Gesture configuration, 0 disables */
+  uint16_t repeat_ms;    // BUT_EVENT_REPEAT period after long press
+  uint16_t double_click_ms;    // BUT_EVENT_CLICK is delayed by this window
+
+  /* Interrupt engine */
+  void* debounce_timer;
+  void* gesture_timer;
+  volatile uint8_t debounce_lock;
+  uint8_t timer_gen;
+  uint32_t timer_period_ms;
 } but_t;
 
 typedef enum
@@ -51,6 +84,16 @@ typedef enum
   BUT_LOCK,
 } but_state;
 
+void init_buttons( void );
+
+/**
+ * @brief   Set queue receiving but_event_t of all buttons. Events are dropped
+ *          when queue is full, callbacks of but_t are called regardless.
+ * @param   [in] queue - FreeRTOS queue of but_event_t, NULL to disable
+ */
+void but_set_event_queue( void* queue );
+
+extern but_t* but_tab[BUTTON_CNT];
 extern but_t button1, button2, button3, button4, button5, button6, button7, button8, button9, button10;
 
 #endif /* BUT_H_ */
\ No newline at end of file
@@ -1,67 +1,256 @@
+/**
+ *******************************************************************************
+ * @file    buzzer.c
+ * @author  Dmytro Shevchenko
+ * @brief   Buzzer driver source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
 #include "buzzer.h"
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include <assert.h>
 
 #include "app_config.h"
-#include "driver/gpio.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include "driver/ledc.h"
+#include "freertos/timers.h"
 #include "parameters.h"
 
-#define BUZZER_INIT()
+/* Private macros ------------------------------------------------------------*/
 
-static uint32_t buzzer_timer;
+#define ARRAY_SIZE( _array ) sizeof( _array ) / sizeof( _array[0] )
+#define BUZZER_SPEED_MODE    LEDC_LOW_SPEED_MODE
+#define BUZZER_DUTY_HALF     ( 1 << ( 10 - 1 ) )
+#define BUZZER_QUEUE_SIZE    8
 
-void buzzer_click( void )
+#ifndef CONFIG_BUZZER_LEDC_TIMER
+#define CONFIG_BUZZER_LEDC_TIMER LEDC_TIMER_1
+#endif
+
+#ifndef CONFIG_BUZZER_LEDC_CHANNEL
+#define CONFIG_BUZZER_LEDC_CHANNEL LEDC_CHANNEL_4
+#endif
+
+#ifndef CONFIG_BUZZER_FREQUENCY_HZ
+#define CONFIG_BUZZER_FREQUENCY_HZ 2700
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+
+static const buzzer_note_t click_notes[] = { { CONFIG_BUZZER_FREQUENCY_HZ, 100 } };
+static const buzzer_note_t error_notes[] = { { CONFIG_BUZZER_FREQUENCY_HZ, 20 } };
+static const buzzer_note_t start_notes[] = { { 2000, 80 }, { 0, 20 }, { 2400, 80 }, { 0, 20 }, { 2700, 120 } };
+static const buzzer_note_t alarm_notes[] = { { 2700, 200 }, { 2000, 200 }, { 2700, 200 }, { 2000, 200 }, { 0, 400 } };
+
+const buzzer_melody_t BUZZER_MELODY_CLICK = { .notes = click_notes, .count = ARRAY_SIZE( click_notes ) };
+const buzzer_melody_t BUZZER_MELODY_ERROR = { .notes = error_notes, .count = ARRAY_SIZE( error_notes ) };
+const buzzer_melody_t BUZZER_MELODY_START = { .notes = start_notes, .count = ARRAY_SIZE( start_notes ) };
+const buzzer_melody_t BUZZER_MELODY_ALARM = { .notes = alarm_notes, .count = ARRAY_SIZE( alarm_notes ) };
+
+static TimerHandle_t note_timer;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Shared with ISR, protected by lock */
+static const buzzer_melody_t* queue[BUZZER_QUEUE_SIZE];
+static uint8_t queue_head;
+static uint8_t queue_count;
+static bool is_playing;
+
+/* Used only in timer task */
+static const buzzer_melody_t* melody;
+static uint8_t note_idx;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void _silence( void )
+{
+  ledc_set_duty( BUZZER_SPEED_MODE, CONFIG_BUZZER_LEDC_CHANNEL, 0 );
+  ledc_update_duty( BUZZER_SPEED_MODE, CONFIG_BUZZER_LEDC_CHANNEL );
+}
+
+/* Called in critical section */
+static bool _push( const buzzer_melody_t* new_melody, bool* kick )
 {
-  buzzer_timer = xTaskGetTickCount() + MS2ST( 100 );
-  if ( parameters_getValue( PARAM_BUZZER ) )
+  if ( queue_count >= BUZZER_QUEUE_SIZE )
   {
-    BUZZER_ON();
+    return false;
   }
+
+  queue[( queue_head + queue_count ) % BUZZER_QUEUE_SIZE] = new_melody;
+  queue_count++;
+  *kick = !is_playing;
+  is_playing = true;
+  return true;
 }
 
-void buzzer_error( void )
+/* Called in critical section */
+static const buzzer_melody_t* _pop( void )
 {
-  buzzer_timer = xTaskGetTickCount() + MS2ST( 20 );
-  if ( parameters_getValue( PARAM_BUZZER ) )
+  if ( queue_count == 0 )
   {
-    BUZZER_ON();
+    is_playing = false;
+    return NULL;
   }
+
+  const buzzer_melody_t* next = queue[queue_head];
+  queue_head = ( queue_head + 1 ) % BUZZER_QUEUE_SIZE;
+  queue_count--;
+  return next;
 }
 
-static void buzzer_task( void* arg )
+/* Runs in timer task, so notes are sequenced without locking hardware */
+static void _play_next( void )
 {
-  while ( 1 )
+  while ( melody == NULL || note_idx >= melody->count )
   {
-    if ( ( buzzer_timer != 0 ) && ( buzzer_timer < xTaskGetTickCount() ) )
+    portENTER_CRITICAL( &lock );
+    melody = _pop();
+    portEXIT_CRITICAL( &lock );
+    note_idx = 0;
+
+    if ( melody == NULL )
     {
-      BUZZER_OFF();
-      buzzer_timer = 0;
+      _silence();
+      return;
     }
 
-    vTaskDelay( MS2ST( 20 ) );
+    if ( !parameters_getValue( PARAM_BUZZER ) )
+    {
+      note_idx = melody->count;
+    }
+  }
+
+  const buzzer_note_t* note = &melody->notes[note_idx++];
+  if ( note->freq_hz > 0 )
+  {
+    ledc_set_freq( BUZZER_SPEED_MODE, CONFIG_BUZZER_LEDC_TIMER, note->freq_hz );
+    ledc_set_duty( BUZZER_SPEED_MODE, CONFIG_BUZZER_LEDC_CHANNEL, BUZZER_DUTY_HALF );
+    ledc_update_duty( BUZZER_SPEED_MODE, CONFIG_BUZZER_LEDC_CHANNEL );
   }
+  else
+  {
+    _silence();
+  }
+
+  TickType_t ticks = MS2ST( note->duration_ms );
+  xTimerChangePeriod( note_timer, ticks > 0 ? ticks : 1, 0 );
+}
+
+static void _note_end_cb( TimerHandle_t timer )
+{
+  _play_next();
+}
+
+static void _kick( void* arg1, uint32_t arg2 )
+{
+  if ( melody == NULL )
+  {
+    _play_next();
+  }
+}
+
+static void _stop( void* arg1, uint32_t arg2 )
+{
+  xTimerStop( note_timer, 0 );
+  melody = NULL;
+  _play_next();
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+bool Buzzer_Play( const buzzer_melody_t* new_melody )
+{
+  assert( new_melody );
+  assert( new_melody->count > 0 );
+  if ( note_timer == NULL )
+  {
+    return false;
+  }
+
+  bool kick = false;
+  portENTER_CRITICAL( &lock );
+  bool ret = _push( new_melody, &kick );
+  portEXIT_CRITICAL( &lock );
+
+  if ( kick )
+  {
+    xTimerPendFunctionCall( _kick, NULL, 0, portMAX_DELAY );
+  }
+
+  return ret;
+}
+
+bool Buzzer_PlayFromISR( const buzzer_melody_t* new_melody, BaseType_t* woken )
+{
+  if ( note_timer == NULL )
+  {
+    return false;
+  }
+
+  bool kick = false;
+  portENTER_CRITICAL_ISR( &lock );
+  bool ret = _push( new_melody, &kick );
+  portEXIT_CRITICAL_ISR( &lock );
+
+  if ( kick && xTimerPendFunctionCallFromISR( _kick, NULL, 0, woken ) != pdPASS )
+  {
+    /* Timer queue is full, melody stays queued and next play kicks timer task again */
+    portENTER_CRITICAL_ISR( &lock );
+    is_playing = false;
+    portEXIT_CRITICAL_ISR( &lock );
+  }
+
+  return ret;
+}
+
+void Buzzer_Stop( void )
+{
+  if ( note_timer == NULL )
+  {
+    return;
+  }
+
+  portENTER_CRITICAL( &lock );
+  queue_count = 0;
+  portEXIT_CRITICAL( &lock );
+
+  /* Silence immediately, sequencer state is cleared in timer task */
+  _silence();
+  xTimerPendFunctionCall( _stop, NULL, 0, portMAX_DELAY );
+}
+
+void buzzer_click( void )
+{
+  Buzzer_Play( &BUZZER_MELODY_CLICK );
+}
+
+void buzzer_error( void )
+{
+  Buzzer_Play( &BUZZER_MELODY_ERROR );
 }
 
 void buzzer_init( void )
 {
-  BUZZER_INIT();
-  gpio_config_t io_conf;
-
-  //disable interrupt
-  io_conf.intr_type = GPIO_INTR_DISABLE;
-  //disable pull-down mode
-  io_conf.pull_down_en = 0;
-  //interrupt of rising edge
-  io_conf.pin_bit_mask = ( 1ULL << BUZZER_PIN );
-  //set as input mode
-  io_conf.mode = GPIO_MODE_OUTPUT;
-  //enable pull-up mode
-  io_conf.pull_up_en = 0;
-  gpio_config( &io_conf );
-  BUZZER_OFF();
-  xTaskCreate( buzzer_task, "buzzer_task", 1024, NULL, 13, NULL );
+  ledc_timer_config_t timer_config = {
+    .speed_mode = BUZZER_SPEED_MODE,
+    .duty_resolution = LEDC_TIMER_10_BIT,
+    .timer_num = CONFIG_BUZZER_LEDC_TIMER,
+    .freq_hz = CONFIG_BUZZER_FREQUENCY_HZ,
+    .clk_cfg = LEDC_AUTO_CLK,
+  };
+  ESP_ERROR_CHECK( ledc_timer_config( &timer_config ) );
+
+  ledc_channel_config_t channel_config = {
+    .gpio_num = BUZZER_PIN,
+    .speed_mode = BUZZER_SPEED_MODE,
+    .channel = CONFIG_BUZZER_LEDC_CHANNEL,
+    .timer_sel = CONFIG_BUZZER_LEDC_TIMER,
+    .duty = 0,
+    .hpoint = 0,
+  };
+  ESP_ERROR_CHECK( ledc_channel_config( &channel_config ) );
+
+  note_timer = xTimerCreate( "buzzer", 1, pdFALSE, NULL, _note_end_cb );
+  assert( note_timer );
 }
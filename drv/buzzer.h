@@ -1,12 +1,71 @@
+/**
+ *******************************************************************************
+ * @file    buzzer.h
+ * @author  Dmytro Shevchenko
+ * @brief   Buzzer driver header file. Tone sequencer on LEDC channel,
+ *          notes are timed by one-shot timer, nothing runs when silent.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
 #ifndef _BUZZER_H_
 #define _BUZZER_H_
 
-#define BUZZER_PIN   4
-#define BUZZER_ON()  gpio_set_level( BUZZER_PIN, 1 );
-#define BUZZER_OFF() gpio_set_level( BUZZER_PIN, 0 );
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+/* Public macro --------------------------------------------------------------*/
+
+#define BUZZER_PIN 4
+
+/* Public types --------------------------------------------------------------*/
+
+typedef struct
+{
+  uint16_t freq_hz;    // 0 - pause
+  uint16_t duration_ms;
+} buzzer_note_t;
+
+typedef struct
+{
+  const buzzer_note_t* notes;
+  uint8_t count;
+} buzzer_melody_t;
+
+/* Public variables ----------------------------------------------------------*/
+
+extern const buzzer_melody_t BUZZER_MELODY_CLICK;
+extern const buzzer_melody_t BUZZER_MELODY_ERROR;
+extern const buzzer_melody_t BUZZER_MELODY_START;
+extern const buzzer_melody_t BUZZER_MELODY_ALARM;
+
+/* Public functions ----------------------------------------------------------*/
 
 void buzzer_init( void );
 void buzzer_click( void );
 void buzzer_error( void );
 
-#endif
\ No newline at end of file
+/**
+ * @brief   Queue melody. Played after already queued melodies.
+ * @param   [in] melody - melody, must be valid while played
+ * @return  false if queue is full
+ */
+bool Buzzer_Play( const buzzer_melody_t* melody );
+
+/**
+ * @brief   Queue melody from interrupt.
+ * @param   [in] melody - melody, must be valid while played
+ * @param   [out] woken - set to pdTRUE if context switch is needed
+ * @return  false if queue is full
+ */
+bool Buzzer_PlayFromISR( const buzzer_melody_t* melody, BaseType_t* woken );
+
+/**
+ * @brief   Silence buzzer and drop queued melodies.
+ */
+void Buzzer_Stop( void );
+
+#endif
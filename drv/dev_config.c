@@ -9,12 +9,14 @@
 /* Includes ------------------------------------------------------------------*/
 #include "dev_config.h"
 
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "app_config.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
@@ -27,6 +29,15 @@
 #define PARTITION_NAME     "dev_config"
 #define STORAGE_NAMESPACE  "config"
 #define DEV_CONFIG_SN_SIZE 32
+#define LOG_LINE_SIZE      160
+
+#ifndef CONFIG_DEV_CONFIG_LOG_RING_SIZE
+#define CONFIG_DEV_CONFIG_LOG_RING_SIZE 4096
+#endif
+
+#ifndef CONFIG_DEV_CONFIG_LOG_DRAIN_MS
+#define CONFIG_DEV_CONFIG_LOG_DRAIN_MS 20
+#endif
 
 /* Private types -------------------------------------------------------------*/
 
@@ -46,6 +57,12 @@ static const char* error_lvl_str[] =
 
 static SemaphoreHandle_t mutexSemaphore;
 
+/* One ring per core, writers are serialized only for space reservation */
+static binlog_ring_t log_ring[portNUM_PROCESSORS];
+static uint8_t log_buffer[portNUM_PROCESSORS][CONFIG_DEV_CONFIG_LOG_RING_SIZE] __attribute__( ( aligned( 4 ) ) );
+
+/* Private functions ---------------------------------------------------------*/
+
 static bool _read_data( void )
 {
   nvs_handle_t nvs;
@@ -103,25 +120,101 @@ static bool _save_data( void )
   return true;
 }
 
+static binlog_ring_t* _oldest_ring( void )
+{
+  binlog_ring_t* oldest = NULL;
+  uint32_t oldest_time = 0;
+
+  for ( int i = 0; i < portNUM_PROCESSORS; i++ )
+  {
+    uint32_t time_us;
+    if ( BinLog_Peek( &log_ring[i], &time_us ) && ( oldest == NULL || (int32_t) ( time_us - oldest_time ) < 0 ) )
+    {
+      oldest = &log_ring[i];
+      oldest_time = time_us;
+    }
+  }
+
+  return oldest;
+}
+
+static void _log_task( void* arg )
+{
+  static char text[LOG_LINE_SIZE];
+  uint32_t reported_dropped = 0;
+
+  while ( 1 )
+  {
+    binlog_ring_t* ring = _oldest_ring();
+    if ( ring == NULL )
+    {
+      uint32_t dropped = DevConfig_GetLogDropped();
+      if ( dropped != reported_dropped )
+      {
+        printf( "%s[LOG] %" PRIu32 " messages dropped\n\r", error_lvl_str[PRINT_WARNING], dropped - reported_dropped );
+        reported_dropped = dropped;
+      }
+      vTaskDelay( MS2ST( CONFIG_DEV_CONFIG_LOG_DRAIN_MS ) );
+      continue;
+    }
+
+    binlog_msg_t msg;
+    if ( BinLog_Read( ring, &msg, text, sizeof( text ) ) )
+    {
+      uint8_t lvl = msg.lvl < PRINT_TOP ? msg.lvl : PRINT_ERROR;
+      printf( "[%" PRIu32 ".%03" PRIu32 "] %s%s\n\r", msg.time_us / 1000000, ( msg.time_us / 1000 ) % 1000, error_lvl_str[lvl], text );
+    }
+  }
+}
+
+/* Public functions ---------------------------------------------------------*/
+
 void DevConfig_Printf( enum config_print_lvl module_lvl, enum config_print_lvl msg_lvl, const char* format, ... )
 {
   if ( module_lvl <= msg_lvl )
   {
-    xSemaphoreTake( mutexSemaphore, 250 );
-    printf( error_lvl_str[msg_lvl] );
+    char line[LOG_LINE_SIZE];
     va_list args;
     va_start( args, format );
-    vprintf( format, args );
+    vsnprintf( line, sizeof( line ), format, args );
     va_end( args );
-    printf( "\n\r" );
+
+    xSemaphoreTake( mutexSemaphore, 250 );
+    printf( "%s%s\n\r", error_lvl_str[msg_lvl], line );
     xSemaphoreGive( mutexSemaphore );
   }
 }
 
+binlog_ring_t* DevConfig_GetLogRing( void )
+{
+  return &log_ring[xPortGetCoreID()];
+}
+
+uint32_t DevConfig_GetLogTime( void )
+{
+  return (uint32_t) esp_timer_get_time();
+}
+
+uint32_t DevConfig_GetLogDropped( void )
+{
+  uint32_t dropped = 0;
+  for ( int i = 0; i < portNUM_PROCESSORS; i++ )
+  {
+    dropped += BinLog_GetDropped( &log_ring[i] );
+  }
+
+  return dropped;
+}
+
 void DevConfig_Init( void )
 {
   mutexSemaphore = xSemaphoreCreateBinary();
   xSemaphoreGive( mutexSemaphore );
+  for ( int i = 0; i < portNUM_PROCESSORS; i++ )
+  {
+    BinLog_Init( &log_ring[i], log_buffer[i], sizeof( log_buffer[i] ) );
+  }
+  xTaskCreate( _log_task, "log_task", 3072, NULL, tskIDLE_PRIORITY + 1, NULL );
   nvs_flash_init_partition( PARTITION_NAME );
   if ( false == _read_data() )
   {
@@ -15,6 +15,24 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "binlog.h"
+
+/* Public macro --------------------------------------------------------------*/
+
+/**
+ * @brief   Deferred log. Only format pointer, timestamp and arguments are stored
+ *          on caller task, message is printed by low priority log task. Format
+ *          must be string literal, see binlog.h for argument rules.
+ */
+#define DevConfig_Log( _module_lvl, _msg_lvl, ... )                                          \
+  do                                                                                         \
+  {                                                                                          \
+    if ( ( _module_lvl ) <= ( _msg_lvl ) )                                                   \
+    {                                                                                        \
+      BINLOG_WRITE( DevConfig_GetLogRing(), DevConfig_GetLogTime(), _msg_lvl, __VA_ARGS__ ); \
+    }                                                                                        \
+  } while ( 0 )
+
 /* Public types ----------------------------------------------------------*/
 enum config_print_lvl
 {
@@ -42,6 +60,21 @@ const char* DevConfig_GetSerialNumber( void );
  */
 void DevConfig_Printf( enum config_print_lvl module_lvl, enum config_print_lvl msg_lvl, const char* format, ... );
 
+/**
+ * @brief   Get deferred log ring of actual core. Use DevConfig_Log macro.
+ */
+binlog_ring_t* DevConfig_GetLogRing( void );
+
+/**
+ * @brief   Get deferred log timestamp. Use DevConfig_Log macro.
+ */
+uint32_t DevConfig_GetLogTime( void );
+
+/**
+ * @brief   Get count of deferred log messages dropped because ring was full.
+ */
+uint32_t DevConfig_GetLogDropped( void );
+
 /**
  * @brief   Only for production app using
  */
@@ -1,157 +1,265 @@
 #include "fast_add.h"
 
+#include <assert.h>
+
 #include "app_config.h"
+#include "cmd_client.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
 
 #define FAST_ADD_LIST_SIZE          8
 #define CONFIG_FAST_ADD_THD_WA_SIZE 2048
 
-static fast_add_t list[FAST_ADD_LIST_SIZE];
-static uint8_t list_cnt;
-
-static SemaphoreHandle_t xSemaphore;
+/* Every entry has at most one step and one release message queued */
+#define MSG_QUEUE_SIZE ( FAST_ADD_LIST_SIZE * 2 )
 
-void fastProcessStart( uint32_t* value, uint32_t max, uint32_t min, fast_process_sign sign, void ( *func )( uint32_t ) )
-{
-  if ( list_cnt >= FAST_ADD_LIST_SIZE )
+/* Previous fixed curve: 15 steps every 70 ms, then every 35 ms */
+static const fast_add_stage_t default_stages[] =
   {
-    return;
-  }
+    { .hold_ms = 0, .period_ms = 70, .step = 1 },
+    { .hold_ms = 15 * 70, .period_ms = 35, .step = 1 },
+};
 
-  if ( xSemaphoreTake( xSemaphore, (TickType_t) 100 ) == pdTRUE )
+static const fast_add_profile_t default_profile =
   {
-    for ( uint8_t i = 0; i < list_cnt; i++ )
-    {
-      if ( value == list[i].value )
-      {
-        fastProcessStop( value );
-        xSemaphoreGive( xSemaphore );
-        return;
-      }
-    }
+    .stages = default_stages,
+    .stages_cnt = sizeof( default_stages ) / sizeof( default_stages[0] ),
+};
 
-    list[list_cnt].sign = sign;
-    list[list_cnt].max = max;
-    list[list_cnt].min = min;
-    list[list_cnt].value = value;
-    list[list_cnt].counter = 0;
-    list[list_cnt].delay = 0;
-    list[list_cnt].func = func;
-    list_cnt++;
-    xSemaphoreGive( xSemaphore );
-  }
-}
+typedef struct
+{
+  fast_add_t* entry;
+  bool release;
+} fast_add_msg_t;
 
-void fastProcessStop( uint32_t* value )
+static fast_add_t list[FAST_ADD_LIST_SIZE];
+static QueueHandle_t msg_queue;
+static const fast_add_profile_t* profile = &default_profile;
+static portMUX_TYPE list_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const fast_add_stage_t* _get_stage( uint32_t hold_ms )
 {
-  if ( xSemaphoreTake( xSemaphore, (TickType_t) 100 ) == pdTRUE )
+  const fast_add_profile_t* p = profile;
+  const fast_add_stage_t* stage = &p->stages[0];
+
+  for ( uint8_t i = 1; i < p->stages_cnt; i++ )
   {
-    for ( uint8_t i = 0; i < list_cnt; i++ )
+    if ( hold_ms < p->stages[i].hold_ms )
     {
-      if ( value == list[i].value )
-      {
-        memcpy( &list[i], &list[list_cnt - 1], sizeof( fast_add_t ) );
-        memset( &list[list_cnt - 1], 0, sizeof( fast_add_t ) );
-        list_cnt--;
-        break;
-      }
+      break;
     }
-
-    xSemaphoreGive( xSemaphore );
+    stage = &p->stages[i];
   }
-}
 
-void fastProcessDeInit( void )
-{
-  memset( list, 0, sizeof( list ) );
-  list_cnt = 0;
+  return stage;
 }
 
-static void _add_process( uint8_t i )
+static void _add_process( fast_add_t* entry, uint32_t step )
 {
-  switch ( list[i].sign )
+  uint32_t value = *entry->value;
+
+  switch ( entry->sign )
   {
+    case FP_PLUS_10:
+      step *= 10;
+      /* fall through */
     case FP_PLUS:
-      if ( ( *list[i].value ) < list[i].max )
+      if ( value < entry->max )
       {
-        ( *list[i].value )++;
+        value = ( entry->max - value > step ) ? value + step : entry->max;
       }
       break;
 
+    case FP_MINUS_10:
+      step *= 10;
+      /* fall through */
     case FP_MINUS:
-      if ( ( *list[i].value ) > list[i].min )
+      if ( value > entry->min )
       {
-        ( *list[i].value )--;
+        value = ( value - entry->min > step ) ? value - step : entry->min;
       }
       break;
+  }
 
-    case FP_PLUS_10:
-      if ( ( *list[i].value ) < list[i].max - 10 )
-      {
-        *list[i].value += 10;
-      }
-      else if ( ( *list[i].value ) < list[i].max )
-      {
-        *list[i].value = list[i].max;
-      }
-      break;
+  /* Notify only real changes, held button at limit does not generate events */
+  if ( value == *entry->value )
+  {
+    return;
+  }
 
-    case FP_MINUS_10:
-      if ( ( *list[i].value ) > list[i].min + 10 )
-      {
-        *list[i].value -= 10;
-      }
-      else if ( ( *list[i].value ) > list[i].min )
-      {
-        *list[i].value = list[i].min;
-      }
-      break;
+  *entry->value = value;
+  if ( entry->func != NULL )
+  {
+    entry->func( value );
   }
 
-  if ( list[i].func != NULL )
+  /* Steps queued before request task runs are merged, only last value is sent */
+  if ( entry->param < PARAM_LAST_VALUE )
   {
-    list[i].func( *list[i].value );
+    cmdClientSetValueCoalesced( entry->param, value );
+  }
+}
+
+/* Timer task also debounces buttons, so it only passes step to fast_add task */
+static void _timer_cb( TimerHandle_t timer )
+{
+  fast_add_msg_t msg = { .entry = (fast_add_t*) pvTimerGetTimerID( timer ), .release = false };
+  xQueueSend( msg_queue, &msg, 0 );
+}
+
+static void _release_entry( void* arg, uint32_t unused )
+{
+  /* Executed in timer task after timer stop, so release is queued after last step of entry */
+  fast_add_msg_t msg = { .entry = (fast_add_t*) arg, .release = true };
+  xQueueSend( msg_queue, &msg, portMAX_DELAY );
+}
+
+static void _step( fast_add_t* entry )
+{
+  /* Entry is changed only when its timer is stopped, no locking needed */
+  if ( !entry->active )
+  {
+    return;
+  }
+
+  const fast_add_stage_t* stage = _get_stage( entry->hold_ms );
+  _add_process( entry, stage->step );
+  entry->hold_ms += stage->period_ms;
+
+  if ( entry->active )
+  {
+    xTimerChangePeriod( entry->timer, MS2ST( _get_stage( entry->hold_ms )->period_ms ), 0 );
   }
 }
 
 static void fast_add( void* arg )
 {
+  fast_add_msg_t msg;
+
   while ( 1 )
   {
-    for ( uint8_t i = 0; i < list_cnt; i++ )
+    if ( xQueueReceive( msg_queue, &msg, portMAX_DELAY ) != pdTRUE )
     {
-      if ( xSemaphoreTake( xSemaphore, (TickType_t) 10 ) == pdTRUE )
-      {
-        if ( list[i].counter < 15 )
-        {
-          if ( list[i].delay < 1 )
-          {
-            list[i].delay++;
-          }
-          else
-          {
-            list[i].delay = 0;
-            list[i].counter++;
-            _add_process( i );
-          }
-        }
-        else
-        {
-          list[i].delay = 0;
-          list[i].counter++;
-          _add_process( i );
-        }
-
-        xSemaphoreGive( xSemaphore );
-      }
+      continue;
+    }
+
+    if ( msg.release )
+    {
+      msg.entry->in_use = false;
+    }
+    else
+    {
+      _step( msg.entry );
     }
+  }
+}
 
-    vTaskDelay( MS2ST( 35 ) );
+static fast_add_t* _find_active( uint32_t* value )
+{
+  for ( uint8_t i = 0; i < FAST_ADD_LIST_SIZE; i++ )
+  {
+    if ( list[i].active && list[i].value == value )
+    {
+      return &list[i];
+    }
   }
+
+  return NULL;
+}
+
+static void _start( parameter_value_t param, uint32_t* value, uint32_t max, uint32_t min, fast_process_sign sign, void ( *func )( uint32_t ) )
+{
+  fast_add_t* entry = NULL;
+  bool is_started = false;
+
+  portENTER_CRITICAL( &list_lock );
+  is_started = _find_active( value ) != NULL;
+  for ( uint8_t i = 0; i < FAST_ADD_LIST_SIZE && !is_started; i++ )
+  {
+    if ( !list[i].in_use && list[i].timer != NULL )
+    {
+      entry = &list[i];
+      entry->in_use = true;
+      break;
+    }
+  }
+  portEXIT_CRITICAL( &list_lock );
+
+  if ( is_started )
+  {
+    fastProcessStop( value );
+    return;
+  }
+
+  if ( entry == NULL )
+  {
+    return;
+  }
+
+  entry->sign = sign;
+  entry->max = max;
+  entry->min = min;
+  entry->value = value;
+  entry->func = func;
+  entry->param = param;
+  entry->hold_ms = 0;
+  entry->active = true;
+  xTimerChangePeriod( entry->timer, MS2ST( _get_stage( 0 )->period_ms ), 0 );
+}
+
+void fastProcessStart( uint32_t* value, uint32_t max, uint32_t min, fast_process_sign sign, void ( *func )( uint32_t ) )
+{
+  _start( PARAM_LAST_VALUE, value, max, min, sign, func );
+}
+
+void fastProcessStartParam( parameter_value_t param, uint32_t* value, uint32_t max, uint32_t min, fast_process_sign sign, void ( *func )( uint32_t ) )
+{
+  _start( param, value, max, min, sign, func );
+}
+
+void fastProcessStop( uint32_t* value )
+{
+  portENTER_CRITICAL( &list_lock );
+  fast_add_t* entry = _find_active( value );
+  if ( entry != NULL )
+  {
+    entry->active = false;
+  }
+  portEXIT_CRITICAL( &list_lock );
+
+  if ( entry != NULL )
+  {
+    xTimerStop( entry->timer, 0 );
+    xTimerPendFunctionCall( _release_entry, entry, 0, portMAX_DELAY );
+  }
+}
+
+void fastProcessDeInit( void )
+{
+  for ( uint8_t i = 0; i < FAST_ADD_LIST_SIZE; i++ )
+  {
+    if ( list[i].active )
+    {
+      fastProcessStop( list[i].value );
+    }
+  }
+}
+
+void fastProcessSetProfile( const fast_add_profile_t* new_profile )
+{
+  assert( new_profile == NULL || ( new_profile->stages_cnt > 0 && new_profile->stages[0].hold_ms == 0 ) );
+  profile = new_profile != NULL ? new_profile : &default_profile;
 }
 
 void fastProcessStartTask( void )
 {
-  xSemaphore = xSemaphoreCreateMutex();
-  xSemaphoreGive( xSemaphore );
+  /* Every entry is armed by its one-shot timer only while button is held */
+  msg_queue = xQueueCreate( MSG_QUEUE_SIZE, sizeof( fast_add_msg_t ) );
+  assert( msg_queue );
+  for ( uint8_t i = 0; i < FAST_ADD_LIST_SIZE; i++ )
+  {
+    list[i].timer = (void*) xTimerCreate( "fast_add", MS2ST( _get_stage( 0 )->period_ms ), pdFALSE, (void*) &list[i], _timer_cb );
+    assert( list[i].timer );
+  }
   xTaskCreate( fast_add, "fast_add", CONFIG_FAST_ADD_THD_WA_SIZE, NULL, NORMALPRIO, NULL );
 }
@@ -2,6 +2,7 @@
 #define _FAST_ADD_H
 
 #include "app_config.h"
+#include "parameters.h"
 
 typedef enum
 {
@@ -11,18 +12,39 @@ typedef enum
   FP_MINUS_10,
 } fast_process_sign;
 
+/* Acceleration stage: from hold_ms value is changed by step every period_ms.
+ * Step is multiplied by 10 for FP_PLUS_10 and FP_MINUS_10. */
 typedef struct
 {
-  uint32_t counter;
-  uint32_t delay;
+  uint32_t hold_ms;
+  uint32_t period_ms;
+  uint32_t step;
+} fast_add_stage_t;
+
+typedef struct
+{
+  const fast_add_stage_t* stages;    // sorted by hold_ms, first stage hold_ms is 0
+  uint8_t stages_cnt;
+} fast_add_profile_t;
+
+typedef struct
+{
+  uint32_t hold_ms;
   uint32_t* value;
   uint32_t max, min, sign;
-  void ( *func )( uint32_t );
+  void ( *func )( uint32_t );    // called from fast_add task
+  parameter_value_t param;       // sent to remote side coalesced, PARAM_LAST_VALUE if not used
+  void* timer;
+  volatile bool active;
+  volatile bool in_use;
 } fast_add_t;
 
 void fastProcessStart( uint32_t* value, uint32_t max, uint32_t min, fast_process_sign sign, void ( *func )( uint32_t ) );
+/* Changes of value are also sent by cmdClientSetValueCoalesced, burst of steps gives one remote update */
+void fastProcessStartParam( parameter_value_t param, uint32_t* value, uint32_t max, uint32_t min, fast_process_sign sign, void ( *func )( uint32_t ) );
 void fastProcessStop( uint32_t* value );
 void fastProcessDeInit( void );
 void fastProcessStartTask( void );
+void fastProcessSetProfile( const fast_add_profile_t* profile );
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,121 @@
+/**
+ *******************************************************************************
+ * @file    flow_rate.c
+ * @author  Dmytro Shevchenko
+ * @brief   Flow rate engine source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "flow_rate.h"
+
+#include <assert.h>
+#include <string.h>
+
+/* Private macros ------------------------------------------------------------*/
+
+#define CL_PER_LITER     100
+#define MS_PER_MINUTE    60000
+#define ALERT_DISABLED   UINT64_MAX
+
+/* Private functions ---------------------------------------------------------*/
+
+static void _update_total( flow_rate_t* ctx )
+{
+  ctx->total_cl = (uint32_t) ( ctx->total_pulses * CL_PER_LITER / ctx->pulses_per_liter );
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+void FlowRate_Init( flow_rate_t* ctx, uint32_t pulses_per_liter )
+{
+  assert( ctx );
+  assert( pulses_per_liter > 0 );
+  memset( ctx, 0, sizeof( flow_rate_t ) );
+  ctx->pulses_per_liter = pulses_per_liter;
+  ctx->alert_cl = ALERT_DISABLED;
+  ctx->alert_armed = true;
+}
+
+void FlowRate_Reset( flow_rate_t* ctx )
+{
+  assert( ctx );
+  ctx->total_pulses = 0;
+  ctx->total_cl = 0;
+  ctx->rate_cl_min = 0;
+  ctx->alert_armed = true;
+}
+
+void FlowRate_SetPulsesPerLiter( flow_rate_t* ctx, uint32_t pulses_per_liter )
+{
+  assert( ctx );
+  assert( pulses_per_liter > 0 );
+  ctx->pulses_per_liter = pulses_per_liter;
+  _update_total( ctx );
+}
+
+void FlowRate_SetAlert( flow_rate_t* ctx, uint32_t alert_value_l )
+{
+  assert( ctx );
+  ctx->alert_cl = ( alert_value_l == UINT32_MAX ) ? ALERT_DISABLED : (uint64_t) alert_value_l * CL_PER_LITER;
+  ctx->alert_armed = ctx->total_cl < ctx->alert_cl;
+}
+
+uint32_t FlowRate_Update( flow_rate_t* ctx, uint32_t pulses, uint32_t time_ms )
+{
+  assert( ctx );
+  if ( !ctx->is_started )
+  {
+    ctx->last_pulses = pulses;
+    ctx->last_time_ms = time_ms;
+    ctx->last_pulse_time_ms = time_ms;
+    ctx->is_started = true;
+    return 0;
+  }
+
+  uint32_t delta_pulses = pulses - ctx->last_pulses;
+  uint32_t delta_ms = time_ms - ctx->last_time_ms;
+
+  if ( delta_ms == 0 )
+  {
+    return 0;
+  }
+
+  ctx->last_pulses = pulses;
+  ctx->last_time_ms = time_ms;
+
+  if ( delta_pulses > 0 )
+  {
+    ctx->last_pulse_time_ms = time_ms;
+    ctx->total_pulses += delta_pulses;
+    _update_total( ctx );
+  }
+
+  ctx->rate_cl_min = (uint32_t) ( (uint64_t) delta_pulses * CL_PER_LITER * MS_PER_MINUTE / ( (uint64_t) ctx->pulses_per_liter * delta_ms ) );
+  return delta_pulses;
+}
+
+bool FlowRate_CheckAlert( flow_rate_t* ctx )
+{
+  assert( ctx );
+  if ( ctx->total_cl < ctx->alert_cl )
+  {
+    ctx->alert_armed = true;
+    return false;
+  }
+
+  if ( ctx->alert_armed )
+  {
+    ctx->alert_armed = false;
+    return true;
+  }
+
+  return false;
+}
+
+uint32_t FlowRate_GetIdleTime( flow_rate_t* ctx, uint32_t time_ms )
+{
+  assert( ctx );
+  return time_ms - ctx->last_pulse_time_ms;
+}
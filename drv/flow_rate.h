@@ -0,0 +1,88 @@
+/**
+ *******************************************************************************
+ * @file    flow_rate.h
+ * @author  Dmytro Shevchenko
+ * @brief   Flow rate engine header file. Platform independent, used by
+ *          water flow sensor driver and host simulator.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _FLOW_RATE_H_
+#define _FLOW_RATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Public types --------------------------------------------------------------*/
+
+typedef struct
+{
+  uint32_t pulses_per_liter;
+  uint32_t last_pulses;
+  uint32_t last_time_ms;
+  uint32_t last_pulse_time_ms;
+  uint64_t total_pulses;
+  uint32_t total_cl;    // centi litre: 1 l = 100 cl
+  uint32_t rate_cl_min;    // centi litre per minute
+  uint64_t alert_cl;
+  bool alert_armed;
+  bool is_started;
+} flow_rate_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Init flow rate engine.
+ * @param   [in] ctx - engine context
+ * @param   [in] pulses_per_liter - pulses per liter
+ */
+void FlowRate_Init( flow_rate_t* ctx, uint32_t pulses_per_liter );
+
+/**
+ * @brief   Reset total and rate. Alert is armed again.
+ * @param   [in] ctx - engine context
+ */
+void FlowRate_Reset( flow_rate_t* ctx );
+
+/**
+ * @brief   Set pulses per liter. Total is recalculated from counted pulses.
+ * @param   [in] ctx - engine context
+ * @param   [in] pulses_per_liter - pulses per liter
+ */
+void FlowRate_SetPulsesPerLiter( flow_rate_t* ctx, uint32_t pulses_per_liter );
+
+/**
+ * @brief   Set alert threshold. Alert is armed if total is below threshold.
+ * @param   [in] ctx - engine context
+ * @param   [in] alert_value_l - alert value in liters
+ */
+void FlowRate_SetAlert( flow_rate_t* ctx, uint32_t alert_value_l );
+
+/**
+ * @brief   Feed engine with free running pulse counter sample.
+ *          Counter may wrap around, only difference to previous sample is used.
+ * @param   [in] ctx - engine context
+ * @param   [in] pulses - pulse counter value
+ * @param   [in] time_ms - sample timestamp in milliseconds
+ * @return  number of new pulses since previous sample
+ */
+uint32_t FlowRate_Update( flow_rate_t* ctx, uint32_t pulses, uint32_t time_ms );
+
+/**
+ * @brief   Check if total crossed alert threshold. Returns true only once per crossing.
+ * @param   [in] ctx - engine context
+ * @return  true if alert should be reported
+ */
+bool FlowRate_CheckAlert( flow_rate_t* ctx );
+
+/**
+ * @brief   Get time since last pulse.
+ * @param   [in] ctx - engine context
+ * @param   [in] time_ms - actual timestamp in milliseconds
+ * @return  time in milliseconds
+ */
+uint32_t FlowRate_GetIdleTime( flow_rate_t* ctx, uint32_t time_ms );
+
+#endif
@@ -0,0 +1,388 @@
+/**
+ *******************************************************************************
+ * @file    history.c
+ * @author  Dmytro Shevchenko
+ * @brief   Multi-resolution time-series history source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "history.h"
+
+#include <assert.h>
+#include <string.h>
+
+/* Private macros ------------------------------------------------------------*/
+
+#define MAX_SAMPLE_SIZE   16    // 5 bytes avg delta + 1 byte spread + 2 * 5 bytes spread
+#define SPREAD_SMALL_MAX  8
+#define SPREAD_ESCAPE     ( SPREAD_SMALL_MAX * SPREAD_SMALL_MAX )
+#define GAP_MARK          ( SPREAD_ESCAPE + 1 )
+#define GAP_MAX_RUN       127    // run fits in one varint byte, gap record is 3 bytes
+#define GAP_RECORD_SIZE   3
+
+/* Private functions ---------------------------------------------------------*/
+
+static size_t _put_varint( uint8_t* buf, uint32_t value )
+{
+  size_t len = 0;
+  while ( value >= 0x80 )
+  {
+    buf[len++] = (uint8_t) ( value | 0x80 );
+    value >>= 7;
+  }
+  buf[len++] = (uint8_t) value;
+  return len;
+}
+
+static size_t _get_varint( const uint8_t* buf, uint32_t* value )
+{
+  size_t len = 0;
+  uint32_t shift = 0;
+  *value = 0;
+  do
+  {
+    *value |= (uint32_t) ( buf[len] & 0x7F ) << shift;
+    shift += 7;
+  } while ( buf[len++] & 0x80 );
+  return len;
+}
+
+static uint32_t _zigzag( int32_t value )
+{
+  return ( (uint32_t) value << 1 ) ^ (uint32_t) ( value >> 31 );
+}
+
+static int32_t _unzigzag( uint32_t value )
+{
+  return (int32_t) ( value >> 1 ) ^ -(int32_t) ( value & 1 );
+}
+
+/*
+ * Sample format: zigzag varint avg delta to previous sample in block,
+ * then spread byte (avg - min) | (max - avg) << 3 if both are small,
+ * otherwise SPREAD_ESCAPE followed by two varints.
+ * Run of empty buckets: zero delta, GAP_MARK and run length varint.
+ */
+static size_t _encode( uint8_t* buf, const history_sample_t* sample, int32_t prev_avg )
+{
+  uint32_t lo = (uint32_t) sample->avg - (uint32_t) sample->min;
+  uint32_t hi = (uint32_t) sample->max - (uint32_t) sample->avg;
+  size_t len = _put_varint( buf, _zigzag( (int32_t) ( (uint32_t) sample->avg - (uint32_t) prev_avg ) ) );
+
+  if ( lo < SPREAD_SMALL_MAX && hi < SPREAD_SMALL_MAX )
+  {
+    buf[len++] = (uint8_t) ( lo | ( hi << 3 ) );
+  }
+  else
+  {
+    buf[len++] = SPREAD_ESCAPE;
+    len += _put_varint( &buf[len], lo );
+    len += _put_varint( &buf[len], hi );
+  }
+
+  return len;
+}
+
+/* Returns record length, run is count of buckets in record */
+static size_t _decode( const uint8_t* buf, history_sample_t* sample, int32_t prev_avg, uint32_t* run )
+{
+  uint32_t value = 0;
+  uint32_t lo = 0;
+  uint32_t hi = 0;
+  size_t len = _get_varint( buf, &value );
+
+  *run = 1;
+  if ( buf[len] == GAP_MARK )
+  {
+    len++;
+    len += _get_varint( &buf[len], run );
+    *sample = ( history_sample_t ) { .is_empty = true };
+    return len;
+  }
+
+  sample->is_empty = false;
+  sample->avg = (int32_t) ( (uint32_t) prev_avg + (uint32_t) _unzigzag( value ) );
+  if ( buf[len] == SPREAD_ESCAPE )
+  {
+    len++;
+    len += _get_varint( &buf[len], &lo );
+    len += _get_varint( &buf[len], &hi );
+  }
+  else
+  {
+    lo = buf[len] & 0x07;
+    hi = buf[len] >> 3;
+    len++;
+  }
+
+  sample->min = (int32_t) ( (uint32_t) sample->avg - lo );
+  sample->max = (int32_t) ( (uint32_t) sample->avg + hi );
+  return len;
+}
+
+static void _next_block( history_level_t* level )
+{
+  level->head = ( level->head + 1 ) % level->block_count;
+  if ( level->used < level->block_count )
+  {
+    level->used++;
+  }
+  else
+  {
+    level->samples -= level->block_samples[level->head];
+  }
+
+  level->block_samples[level->head] = 0;
+  level->write_pos = 0;
+  level->prev_avg = 0;
+}
+
+static void _store( history_level_t* level, const history_sample_t* sample )
+{
+  uint8_t encoded[MAX_SAMPLE_SIZE];
+  size_t len = _encode( encoded, sample, level->prev_avg );
+
+  if ( level->write_pos + len > HISTORY_BLOCK_SIZE )
+  {
+    _next_block( level );
+    len = _encode( encoded, sample, level->prev_avg );
+  }
+
+  memcpy( &level->buffer[level->head * HISTORY_BLOCK_SIZE + level->write_pos], encoded, len );
+  level->write_pos += len;
+  level->prev_avg = sample->avg;
+  level->block_samples[level->head]++;
+  level->samples++;
+}
+
+static void _store_gap( history_level_t* level, uint32_t buckets )
+{
+  /* Longer gap would only push all values out of level */
+  uint32_t max_gap = (uint32_t) level->block_count * ( HISTORY_BLOCK_SIZE / GAP_RECORD_SIZE ) * GAP_MAX_RUN;
+  if ( buckets > max_gap )
+  {
+    buckets = max_gap;
+  }
+
+  while ( buckets > 0 )
+  {
+    uint32_t run = buckets > GAP_MAX_RUN ? GAP_MAX_RUN : buckets;
+    if ( level->write_pos + GAP_RECORD_SIZE > HISTORY_BLOCK_SIZE )
+    {
+      _next_block( level );
+    }
+
+    uint8_t* buf = &level->buffer[level->head * HISTORY_BLOCK_SIZE + level->write_pos];
+    buf[0] = 0;
+    buf[1] = GAP_MARK;
+    buf[2] = (uint8_t) run;
+    level->write_pos += GAP_RECORD_SIZE;
+    level->block_samples[level->head] += run;
+    level->samples += run;
+    buckets -= run;
+  }
+}
+
+static void _accumulate( history_level_t* level, const history_sample_t* sample )
+{
+  if ( level->acc_cnt == 0 )
+  {
+    level->acc_min = sample->min;
+    level->acc_max = sample->max;
+    level->acc_sum = 0;
+  }
+
+  if ( sample->min < level->acc_min )
+  {
+    level->acc_min = sample->min;
+  }
+
+  if ( sample->max > level->acc_max )
+  {
+    level->acc_max = sample->max;
+  }
+
+  level->acc_sum += sample->avg;
+  level->acc_cnt++;
+}
+
+/* Close buckets of level before time, buckets without values are stored empty */
+static void _advance( history_t* hist, uint8_t level_num, uint32_t time_ms )
+{
+  history_level_t* level = &hist->levels[level_num];
+  uint32_t bucket_id = time_ms / level->period_ms;
+
+  if ( bucket_id == level->bucket_id )
+  {
+    return;
+  }
+
+  if ( level->acc_cnt > 0 )
+  {
+    history_sample_t sample = {
+      .min = level->acc_min,
+      .max = level->acc_max,
+      .avg = (int32_t) ( level->acc_sum / (int64_t) level->acc_cnt ),
+    };
+    level->acc_cnt = 0;
+    _store( level, &sample );
+
+    /* Downsample to next level, closed bucket is part of its actual bucket */
+    if ( level_num + 1 < hist->level_count )
+    {
+      _accumulate( &hist->levels[level_num + 1], &sample );
+    }
+  }
+  else
+  {
+    _store_gap( level, 1 );
+  }
+
+  /* Time going back (timestamp wrap) starts new bucket without gap */
+  if ( bucket_id > level->bucket_id )
+  {
+    _store_gap( level, bucket_id - level->bucket_id - 1 );
+  }
+  level->bucket_id = bucket_id;
+
+  if ( level_num + 1 < hist->level_count )
+  {
+    _advance( hist, level_num + 1, time_ms );
+  }
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+void History_Init( history_t* hist, uint8_t* buffer, size_t buffer_size, const history_level_cfg_t* cfg, uint8_t level_count )
+{
+  assert( hist );
+  assert( buffer );
+  assert( cfg );
+  assert( level_count > 0 && level_count <= HISTORY_MAX_LEVELS );
+
+  memset( hist, 0, sizeof( history_t ) );
+  hist->level_count = level_count;
+
+  size_t offset = 0;
+  for ( uint8_t i = 0; i < level_count; i++ )
+  {
+    history_level_t* level = &hist->levels[i];
+    assert( cfg[i].blocks > 0 && cfg[i].blocks <= HISTORY_MAX_BLOCKS );
+    assert( cfg[i].period_ms > 0 );
+    level->period_ms = cfg[i].period_ms;
+    assert( i == 0 || cfg[i].period_ms % cfg[i - 1].period_ms == 0 );
+
+    level->buffer = &buffer[offset];
+    level->block_count = cfg[i].blocks;
+    level->used = 1;
+    offset += cfg[i].blocks * HISTORY_BLOCK_SIZE;
+  }
+
+  assert( offset <= buffer_size );
+}
+
+void History_Add( history_t* hist, int32_t value, uint32_t time_ms )
+{
+  assert( hist );
+  if ( !hist->is_started )
+  {
+    for ( uint8_t i = 0; i < hist->level_count; i++ )
+    {
+      hist->levels[i].bucket_id = time_ms / hist->levels[i].period_ms;
+    }
+    hist->is_started = true;
+  }
+
+  _advance( hist, 0, time_ms );
+
+  history_sample_t sample = { .min = value, .max = value, .avg = value };
+  _accumulate( &hist->levels[0], &sample );
+}
+
+size_t History_GetWindow( history_t* hist, uint8_t level_num, history_sample_t* out, size_t count )
+{
+  assert( hist );
+  assert( out );
+  if ( level_num >= hist->level_count )
+  {
+    return 0;
+  }
+
+  history_level_t* level = &hist->levels[level_num];
+  size_t skip = level->samples > count ? level->samples - count : 0;
+  size_t written = 0;
+  uint16_t block = ( level->head + level->block_count - ( level->used - 1 ) ) % level->block_count;
+
+  for ( uint16_t i = 0; i < level->used; i++ )
+  {
+    uint16_t samples = level->block_samples[block];
+    if ( skip >= samples )
+    {
+      skip -= samples;
+    }
+    else
+    {
+      const uint8_t* data = &level->buffer[block * HISTORY_BLOCK_SIZE];
+      int32_t prev_avg = 0;
+      uint16_t j = 0;
+      while ( j < samples )
+      {
+        history_sample_t sample;
+        uint32_t run = 0;
+        data += _decode( data, &sample, prev_avg, &run );
+        prev_avg = sample.is_empty ? prev_avg : sample.avg;
+        j += run;
+        for ( ; run > 0 && written < count; run-- )
+        {
+          if ( skip > 0 )
+          {
+            skip--;
+            continue;
+          }
+          out[written++] = sample;
+        }
+      }
+    }
+
+    block = ( block + 1 ) % level->block_count;
+  }
+
+  return written;
+}
+
+size_t History_GetCount( history_t* hist, uint8_t level_num )
+{
+  assert( hist );
+  if ( level_num >= hist->level_count )
+  {
+    return 0;
+  }
+
+  return hist->levels[level_num].samples;
+}
+
+uint32_t History_GetPeriod( history_t* hist, uint8_t level_num )
+{
+  assert( hist );
+  if ( level_num >= hist->level_count )
+  {
+    return 0;
+  }
+
+  return hist->levels[level_num].period_ms;
+}
+
+size_t History_GetUsedBytes( history_t* hist )
+{
+  assert( hist );
+  size_t used = 0;
+  for ( uint8_t i = 0; i < hist->level_count; i++ )
+  {
+    history_level_t* level = &hist->levels[i];
+    used += ( level->used - 1 ) * HISTORY_BLOCK_SIZE + level->write_pos;
+  }
+
+  return used;
+}
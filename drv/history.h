@@ -0,0 +1,135 @@
+/**
+ *******************************************************************************
+ * @file    history.h
+ * @author  Dmytro Shevchenko
+ * @brief   Multi-resolution time-series history header file.
+ *          Buckets (min/max/avg) are stored delta + varint compressed in
+ *          fixed size blocks. Oldest block is dropped when level is full.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Public macro --------------------------------------------------------------*/
+
+#define HISTORY_MAX_LEVELS 3
+#define HISTORY_BLOCK_SIZE 64
+#define HISTORY_MAX_BLOCKS 96
+
+/* Slowly changing signal takes ~3 bytes per bucket (noisy one more), run of empty buckets 3 bytes:
+ * 1 s buckets ~3 min, 1 min buckets ~25 h, 1 h buckets ~1 week */
+#define HISTORY_DEFAULT_LEVELS                   \
+  {                                              \
+    { .period_ms = 1000, .blocks = 8 },          \
+    { .period_ms = 60 * 1000, .blocks = 72 },    \
+    { .period_ms = 60 * 60 * 1000, .blocks = 8 } \
+  }
+#define HISTORY_DEFAULT_LEVELS_CNT  3
+#define HISTORY_DEFAULT_BUFFER_SIZE ( ( 8 + 72 + 8 ) * HISTORY_BLOCK_SIZE )
+
+/* Public types --------------------------------------------------------------*/
+
+typedef struct
+{
+  int32_t min;
+  int32_t max;
+  int32_t avg;
+  bool is_empty;    // nothing was measured in bucket period, values are 0
+} history_sample_t;
+
+typedef struct
+{
+  uint32_t period_ms;    // bucket period, must be multiple of previous level period
+  uint16_t blocks;    // count of HISTORY_BLOCK_SIZE blocks
+} history_level_cfg_t;
+
+typedef struct
+{
+  uint32_t period_ms;
+  uint32_t bucket_id;    // time_ms / period_ms of accumulated bucket
+  uint8_t* buffer;
+  uint16_t block_count;
+  uint16_t head;
+  uint16_t used;
+  uint16_t write_pos;
+  int32_t prev_avg;
+  uint16_t block_samples[HISTORY_MAX_BLOCKS];
+  uint32_t samples;
+
+  /* Actual bucket accumulator */
+  int32_t acc_min;
+  int32_t acc_max;
+  int64_t acc_sum;
+  uint32_t acc_cnt;
+} history_level_t;
+
+typedef struct
+{
+  history_level_t levels[HISTORY_MAX_LEVELS];
+  uint8_t level_count;
+  bool is_started;
+} history_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Init history.
+ * @param   [in] hist - history pointer
+ * @param   [in] buffer - storage for all levels
+ * @param   [in] buffer_size - storage size, sum of levels blocks * HISTORY_BLOCK_SIZE
+ * @param   [in] cfg - levels configuration, from highest to lowest resolution
+ * @param   [in] level_count - count of levels
+ */
+void History_Init( history_t* hist, uint8_t* buffer, size_t buffer_size, const history_level_cfg_t* cfg, uint8_t level_count );
+
+/**
+ * @brief   Add measured value. Buckets of all levels are downsampled incrementally.
+ *          Buckets are aligned to time, periods without values are stored as empty
+ *          buckets when next value is added.
+ * @param   [in] hist - history pointer
+ * @param   [in] value - measured value
+ * @param   [in] time_ms - measure timestamp in milliseconds
+ */
+void History_Add( history_t* hist, int32_t value, uint32_t time_ms );
+
+/**
+ * @brief   Get newest buckets of level, oldest first.
+ * @param   [in] hist - history pointer
+ * @param   [in] level - level number
+ * @param   [out] out - buffer for buckets
+ * @param   [in] count - max count of buckets
+ * @return  count of copied buckets
+ */
+size_t History_GetWindow( history_t* hist, uint8_t level, history_sample_t* out, size_t count );
+
+/**
+ * @brief   Get count of stored buckets of level.
+ * @param   [in] hist - history pointer
+ * @param   [in] level - level number
+ * @return  count of buckets
+ */
+size_t History_GetCount( history_t* hist, uint8_t level );
+
+/**
+ * @brief   Get bucket period of level.
+ * @param   [in] hist - history pointer
+ * @param   [in] level - level number
+ * @return  period in milliseconds
+ */
+uint32_t History_GetPeriod( history_t* hist, uint8_t level );
+
+/**
+ * @brief   Get count of bytes used by compressed buckets.
+ * @param   [in] hist - history pointer
+ * @return  used bytes
+ */
+size_t History_GetUsedBytes( history_t* hist );
+
+#endif
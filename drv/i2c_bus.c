@@ -0,0 +1,379 @@
+/**
+ *******************************************************************************
+ * @file    i2c_bus.c
+ * @author  Dmytro Shevchenko
+ * @brief   Shared I2C bus owner task source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "i2c_bus.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "app_config.h"
+#include "driver/i2c.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+/* Private macros ------------------------------------------------------------*/
+
+#define MODULE_NAME "[I2C bus] "
+#define DEBUG_LVL   PRINT_INFO
+
+#if CONFIG_DEBUG_I2C_BUS
+#define LOG( _lvl, ... ) \
+  debug_printf( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
+#else
+#define LOG( PRINT_INFO, ... )
+#endif
+
+#ifndef CONFIG_I2C_BUS_QUEUE_SIZE
+#define CONFIG_I2C_BUS_QUEUE_SIZE 8
+#endif
+
+#ifndef CONFIG_I2C_BUS_CHUNK_SIZE
+#define CONFIG_I2C_BUS_CHUNK_SIZE 128
+#endif
+
+#ifndef CONFIG_I2C_BUS_TIMEOUT_MS
+#define CONFIG_I2C_BUS_TIMEOUT_MS 100
+#endif
+
+#define BATCH_MAX     8
+#define ACK_CHECK_EN  0x1
+#define LAST_NACK_VAL 0x2
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  TaskHandle_t task;
+  QueueHandle_t queue[I2C_BUS_PRIO_LAST];
+} i2c_bus_t;
+
+typedef struct
+{
+  i2c_bus_device_t* dev;
+  const uint8_t* write_data;
+  size_t write_len;
+  uint8_t* read_data;
+  size_t read_len;
+  uint32_t flags;
+  i2c_bus_done_cb cb;
+  void* arg;
+  int64_t queued_us;
+} i2c_bus_transaction_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+static i2c_bus_t buses[I2C_NUM_MAX];
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Private functions ---------------------------------------------------------*/
+
+static error_code_t _esp_to_error_code( esp_err_t err )
+{
+  switch ( err )
+  {
+    case ESP_OK:
+      return ERROR_CODE_OK;
+    case ESP_ERR_TIMEOUT:
+      return ERROR_CODE_TIMEOUT;
+    default:
+      return ERROR_CODE_FAIL;
+  }
+}
+
+static void _add_stats( i2c_bus_device_t* dev, uint32_t transactions, uint32_t batched, size_t bytes, int64_t bus_time_us, int64_t wait_us, error_code_t result )
+{
+  portENTER_CRITICAL( &stats_lock );
+  dev->stats.transactions += transactions;
+  dev->stats.batched += batched;
+  dev->stats.chunks++;
+  dev->stats.bytes += bytes;
+  dev->stats.bus_time_us += bus_time_us;
+  if ( wait_us > dev->stats.wait_max_us )
+  {
+    dev->stats.wait_max_us = (uint32_t) wait_us;
+  }
+  if ( result != ERROR_CODE_OK )
+  {
+    dev->stats.errors++;
+  }
+  portEXIT_CRITICAL( &stats_lock );
+}
+
+static void _complete( i2c_bus_transaction_t* t, error_code_t result )
+{
+  if ( t->cb != NULL )
+  {
+    t->cb( t->arg, result );
+  }
+}
+
+static void _append_start( i2c_cmd_handle_t cmd, uint8_t addr, bool read )
+{
+  i2c_master_start( cmd );
+  i2c_master_write_byte( cmd, ( addr << 1 ) | ( read ? I2C_MASTER_READ : I2C_MASTER_WRITE ), ACK_CHECK_EN );
+}
+
+static error_code_t _execute( i2c_cmd_handle_t cmd, i2c_bus_device_t* dev, uint32_t transactions, size_t bytes, int64_t wait_us )
+{
+  i2c_master_stop( cmd );
+  int64_t start = esp_timer_get_time();
+  error_code_t result = _esp_to_error_code( i2c_master_cmd_begin( dev->port, cmd, MS2ST( dev->timeout_ms ) ) );
+  _add_stats( dev, transactions, transactions - 1, bytes, esp_timer_get_time() - start, wait_us, result );
+  i2c_cmd_link_delete( cmd );
+  return result;
+}
+
+static void _process( i2c_bus_transaction_t* t );
+
+/* Execute all waiting high priority transactions */
+static void _process_high_prio( i2c_bus_t* bus )
+{
+  i2c_bus_transaction_t t;
+  while ( xQueueReceive( bus->queue[I2C_BUS_PRIO_HIGH], &t, 0 ) == pdTRUE )
+  {
+    _process( &t );
+  }
+}
+
+static void _process_split( i2c_bus_transaction_t* t, i2c_bus_prio_t prio )
+{
+  const uint8_t* data = &t->write_data[1];
+  size_t left = t->write_len - 1;
+  error_code_t result = ERROR_CODE_OK;
+  int64_t wait_us = esp_timer_get_time() - t->queued_us;
+
+  do
+  {
+    size_t len = left > CONFIG_I2C_BUS_CHUNK_SIZE ? CONFIG_I2C_BUS_CHUNK_SIZE : left;
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    _append_start( cmd, t->dev->addr, false );
+    i2c_master_write_byte( cmd, t->write_data[0], ACK_CHECK_EN );
+    if ( len > 0 )
+    {
+      i2c_master_write( cmd, data, len, ACK_CHECK_EN );
+    }
+    result = _execute( cmd, t->dev, 1, len + 1, wait_us );
+    data += len;
+    left -= len;
+    wait_us = 0;
+
+    if ( prio != I2C_BUS_PRIO_HIGH && left > 0 )
+    {
+      _process_high_prio( &buses[t->dev->port] );
+    }
+  } while ( left > 0 && result == ERROR_CODE_OK );
+
+  _complete( t, result );
+}
+
+static bool _can_batch( i2c_bus_transaction_t* first, i2c_bus_transaction_t* next )
+{
+  return next->dev == first->dev && next->read_len == 0 && !( next->flags & I2C_BUS_FLAG_SPLIT );
+}
+
+/* Back to back writes to same device are sent in one command link with repeated start */
+static void _process_write_batch( i2c_bus_transaction_t* t, i2c_bus_prio_t prio )
+{
+  i2c_bus_transaction_t batch[BATCH_MAX];
+  uint32_t count = 1;
+  size_t bytes = 0;
+
+  i2c_bus_t* bus = &buses[t->dev->port];
+  batch[0] = *t;
+  while ( count < BATCH_MAX && xQueuePeek( bus->queue[prio], &batch[count], 0 ) == pdTRUE && _can_batch( t, &batch[count] ) )
+  {
+    xQueueReceive( bus->queue[prio], &batch[count], 0 );
+    count++;
+  }
+
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  for ( uint32_t i = 0; i < count; i++ )
+  {
+    _append_start( cmd, t->dev->addr, false );
+    i2c_master_write( cmd, batch[i].write_data, batch[i].write_len, ACK_CHECK_EN );
+    bytes += batch[i].write_len;
+  }
+
+  error_code_t result = _execute( cmd, t->dev, count, bytes, esp_timer_get_time() - t->queued_us );
+  for ( uint32_t i = 0; i < count; i++ )
+  {
+    _complete( &batch[i], result );
+  }
+}
+
+static void _process_read( i2c_bus_transaction_t* t )
+{
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  if ( t->write_len > 0 )
+  {
+    _append_start( cmd, t->dev->addr, false );
+    i2c_master_write( cmd, t->write_data, t->write_len, ACK_CHECK_EN );
+  }
+
+  _append_start( cmd, t->dev->addr, true );
+  i2c_master_read( cmd, t->read_data, t->read_len, LAST_NACK_VAL );
+  error_code_t result = _execute( cmd, t->dev, 1, t->write_len + t->read_len, esp_timer_get_time() - t->queued_us );
+  _complete( t, result );
+}
+
+static void _process( i2c_bus_transaction_t* t )
+{
+  if ( t->read_len > 0 )
+  {
+    _process_read( t );
+  }
+  else if ( ( t->flags & I2C_BUS_FLAG_SPLIT ) && t->write_len > 1 )
+  {
+    _process_split( t, t->dev->prio );
+  }
+  else
+  {
+    _process_write_batch( t, t->dev->prio );
+  }
+}
+
+static void _bus_task( void* arg )
+{
+  i2c_bus_t* bus = (i2c_bus_t*) arg;
+  i2c_bus_transaction_t t;
+
+  while ( 1 )
+  {
+    ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+
+    while ( xQueueReceive( bus->queue[I2C_BUS_PRIO_HIGH], &t, 0 ) == pdTRUE || xQueueReceive( bus->queue[I2C_BUS_PRIO_LOW], &t, 0 ) == pdTRUE )
+    {
+      _process( &t );
+    }
+  }
+}
+
+static error_code_t _submit( i2c_bus_transaction_t* t, TickType_t timeout )
+{
+  i2c_bus_t* bus = &buses[t->dev->port];
+  t->queued_us = esp_timer_get_time();
+  if ( xQueueSend( bus->queue[t->dev->prio], t, timeout ) != pdTRUE )
+  {
+    LOG( PRINT_ERROR, "%s queue full", t->dev->name );
+    return ERROR_CODE_QUEUE_IS_FULL;
+  }
+
+  xTaskNotifyGive( bus->task );
+  return ERROR_CODE_OK;
+}
+
+static void _sync_done( void* arg, error_code_t result )
+{
+  i2c_bus_device_t* dev = (i2c_bus_device_t*) arg;
+  dev->result = result;
+  xSemaphoreGive( dev->done );
+}
+
+static error_code_t _transfer_sync( i2c_bus_transaction_t* t )
+{
+  i2c_bus_device_t* dev = t->dev;
+
+  t->cb = _sync_done;
+  t->arg = dev;
+  xSemaphoreTake( dev->mutex, portMAX_DELAY );
+  error_code_t result = _submit( t, portMAX_DELAY );
+  if ( result == ERROR_CODE_OK )
+  {
+    xSemaphoreTake( dev->done, portMAX_DELAY );
+    result = dev->result;
+  }
+  xSemaphoreGive( dev->mutex );
+  return result;
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+void I2CBus_Init( int port )
+{
+  assert( port >= 0 && port < I2C_NUM_MAX );
+  i2c_bus_t* bus = &buses[port];
+  if ( bus->task != NULL )
+  {
+    return;
+  }
+
+  for ( int i = 0; i < I2C_BUS_PRIO_LAST; i++ )
+  {
+    bus->queue[i] = xQueueCreate( CONFIG_I2C_BUS_QUEUE_SIZE, sizeof( i2c_bus_transaction_t ) );
+    assert( bus->queue[i] );
+  }
+
+  xTaskCreate( _bus_task, "i2c_bus", 3072, bus, NORMALPRIO + 1, &bus->task );
+}
+
+bool I2CBus_IsStarted( int port )
+{
+  return port >= 0 && port < I2C_NUM_MAX && buses[port].task != NULL;
+}
+
+error_code_t I2CBus_AddDevice( i2c_bus_device_t* dev, int port, const char* name, uint8_t addr, i2c_bus_prio_t prio, uint32_t timeout_ms )
+{
+  assert( dev );
+  assert( prio < I2C_BUS_PRIO_LAST );
+  if ( port < 0 || port >= I2C_NUM_MAX )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  if ( !I2CBus_IsStarted( port ) )
+  {
+    I2CBus_Init( port );
+  }
+
+  memset( dev, 0, sizeof( i2c_bus_device_t ) );
+  dev->name = name;
+  dev->port = port;
+  dev->addr = addr;
+  dev->prio = prio;
+  dev->timeout_ms = timeout_ms > 0 ? timeout_ms : CONFIG_I2C_BUS_TIMEOUT_MS;
+  dev->mutex = xSemaphoreCreateMutex();
+  dev->done = xSemaphoreCreateBinary();
+  assert( dev->mutex && dev->done );
+  return ERROR_CODE_OK;
+}
+
+error_code_t I2CBus_Write( i2c_bus_device_t* dev, const uint8_t* data, size_t len, uint32_t flags )
+{
+  assert( dev );
+  i2c_bus_transaction_t t = { .dev = dev, .write_data = data, .write_len = len, .flags = flags };
+  return _transfer_sync( &t );
+}
+
+error_code_t I2CBus_Read( i2c_bus_device_t* dev, uint8_t* data, size_t len )
+{
+  assert( dev );
+  assert( len > 0 );
+  i2c_bus_transaction_t t = { .dev = dev, .read_data = data, .read_len = len };
+  return _transfer_sync( &t );
+}
+
+error_code_t I2CBus_WriteAsync( i2c_bus_device_t* dev, const uint8_t* data, size_t len, uint32_t flags, i2c_bus_done_cb cb, void* arg )
+{
+  assert( dev );
+  i2c_bus_transaction_t t = { .dev = dev, .write_data = data, .write_len = len, .flags = flags, .cb = cb, .arg = arg };
+  return _submit( &t, 0 );
+}
+
+void I2CBus_GetStats( i2c_bus_device_t* dev, i2c_bus_stats_t* stats )
+{
+  assert( dev );
+  assert( stats );
+  portENTER_CRITICAL( &stats_lock );
+  *stats = dev->stats;
+  portEXIT_CRITICAL( &stats_lock );
+}
@@ -0,0 +1,129 @@
+/**
+ *******************************************************************************
+ * @file    i2c_bus.h
+ * @author  Dmytro Shevchenko
+ * @brief   Shared I2C bus owner task header file. Transactions of all devices
+ *          on one port are executed by one task of that port from priority queues.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _I2C_BUS_H_
+#define _I2C_BUS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error_code.h"
+
+/* Public macro --------------------------------------------------------------*/
+
+/* Write is sent in chunks, first byte (control byte) is repeated at start of
+ * every chunk. High priority transactions are executed between chunks. */
+#define I2C_BUS_FLAG_SPLIT 0x01
+
+/* Public types --------------------------------------------------------------*/
+
+typedef enum
+{
+  I2C_BUS_PRIO_LOW,
+  I2C_BUS_PRIO_HIGH,
+  I2C_BUS_PRIO_LAST
+} i2c_bus_prio_t;
+
+typedef void ( *i2c_bus_done_cb )( void* arg, error_code_t result );
+
+typedef struct
+{
+  uint32_t transactions;
+  uint32_t batched;    // transactions sent in one command link with previous one
+  uint32_t chunks;
+  uint32_t errors;
+  uint32_t wait_max_us;    // max time in queue
+  uint64_t bytes;
+  uint64_t bus_time_us;
+} i2c_bus_stats_t;
+
+typedef struct
+{
+  const char* name;
+  int port;
+  uint8_t addr;    // 7-bit address
+  i2c_bus_prio_t prio;
+  uint32_t timeout_ms;
+  i2c_bus_stats_t stats;
+  void* mutex;
+  void* done;
+  error_code_t result;
+} i2c_bus_device_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Start owner task of bus on port. I2C driver of port must be installed
+ *          before first transaction. Called by I2CBus_AddDevice if bus of port
+ *          is not started yet.
+ * @param   [in] port - I2C port number
+ */
+void I2CBus_Init( int port );
+
+/**
+ * @brief   Check if owner task of bus on port is started.
+ * @param   [in] port - I2C port number
+ * @return  true if started
+ */
+bool I2CBus_IsStarted( int port );
+
+/**
+ * @brief   Register device on bus of port, bus owner task is started if needed.
+ * @param   [in] dev - device context
+ * @param   [in] port - I2C port number
+ * @param   [in] name - name for statistics
+ * @param   [in] addr - 7-bit address
+ * @param   [in] prio - priority of device transactions
+ * @param   [in] timeout_ms - transaction timeout, 0 for CONFIG_I2C_BUS_TIMEOUT_MS
+ * @return  ERROR_CODE_OK, ERROR_CODE_FAIL if port is invalid
+ */
+error_code_t I2CBus_AddDevice( i2c_bus_device_t* dev, int port, const char* name, uint8_t addr, i2c_bus_prio_t prio, uint32_t timeout_ms );
+
+/**
+ * @brief   Write data and wait for result.
+ * @param   [in] dev - device context
+ * @param   [in] data - data to write
+ * @param   [in] len - data length
+ * @param   [in] flags - I2C_BUS_FLAG_x
+ * @return  transaction result
+ */
+error_code_t I2CBus_Write( i2c_bus_device_t* dev, const uint8_t* data, size_t len, uint32_t flags );
+
+/**
+ * @brief   Read data and wait for result.
+ * @param   [in] dev - device context
+ * @param   [out] data - read data
+ * @param   [in] len - data length
+ * @return  transaction result
+ */
+error_code_t I2CBus_Read( i2c_bus_device_t* dev, uint8_t* data, size_t len );
+
+/**
+ * @brief   Queue write without waiting. Data must be valid until cb is called.
+ * @param   [in] dev - device context
+ * @param   [in] data - data to write
+ * @param   [in] len - data length
+ * @param   [in] flags - I2C_BUS_FLAG_x
+ * @param   [in] cb - completion callback called from bus task, can be NULL
+ * @param   [in] arg - callback argument
+ * @return  ERROR_CODE_OK if queued
+ */
+error_code_t I2CBus_WriteAsync( i2c_bus_device_t* dev, const uint8_t* data, size_t len, uint32_t flags, i2c_bus_done_cb cb, void* arg );
+
+/**
+ * @brief   Get copy of device statistics.
+ * @param   [in] dev - device context
+ * @param   [out] stats - statistics
+ */
+void I2CBus_GetStats( i2c_bus_device_t* dev, i2c_bus_stats_t* stats );
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "app_config.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "parse_cmd.h"
 
 #define MODULE_NAME "[Keep] "
@@ -16,6 +17,7 @@
 
 static keepAlive_t* keepAliveTab[8];
 static uint8_t tabSize;
+static TaskHandle_t task_handle;
 
 static uint8_t keep_alive_frame[PACKET_SIZE] = { PACKET_SIZE, 0xFF, 0xFF, 0xFF, 0xFF, CMD_REQUEST, PC_KEEP_ALIVE };
 
@@ -60,53 +62,73 @@ int keepAliveCheckError( keepAlive_t* keep )
   return keep->keepAliveErrorFlag;
 }
 
-static void keepAliveProcess( void* pv )
+/* Return time to nearest deadline, UINT32_MAX if no entry is active */
+static uint32_t _check_entries( void )
 {
-  //LOG(PRINT_INFO, "KeepAliveTask\n");
   keepAlive_t* keep;
+  uint32_t now = ST2MS( xTaskGetTickCount() );
+  uint32_t next_ms = UINT32_MAX;
 
-  while ( 1 )
+  for ( uint8_t i = 0; i < tabSize; i++ )
   {
-    for ( uint8_t i = 0; i < tabSize; i++ )
-    {
-      keep = keepAliveTab[i];
+    keep = keepAliveTab[i];
 
-      if ( keep == NULL )
-      {
-        continue;
-      }
+    if ( keep == NULL )
+    {
+      continue;
+    }
 
-      if ( keep->keepAliveErrorFlag || ( keep->keepAliveActiveFlag == 0 ) )
-      {
-        continue;
-      }
+    if ( keep->keepAliveErrorFlag || ( keep->keepAliveActiveFlag == 0 ) )
+    {
+      continue;
+    }
 
-      LOG( PRINT_DEBUG, "keepALive time %d < %d\n", keep->keepAlive, ST2MS( xTaskGetTickCount() ) );
-      if ( keep->keepAlive < ST2MS( xTaskGetTickCount() ) )
+    LOG( PRINT_DEBUG, "keepALive time %d < %d\n", keep->keepAlive, now );
+    if ( keep->keepAlive < now )
+    {
+      if ( keep->keepAliveTry < KEEP_ALIVE_TRY )
       {
-        if ( keep->keepAliveTry < KEEP_ALIVE_TRY )
+        if ( keep->keepAliveSend != NULL )
         {
-          if ( keep->keepAliveSend != NULL )
-          {
-            LOG( PRINT_DEBUG, "keepAliveSend" );
-            keep->keepAliveSend( keep_alive_frame, sizeof( keep_alive_frame ) );
-          }
-
-          keep->keepAliveTry++;
-          keep->keepAlive = ST2MS( xTaskGetTickCount() ) + keep->timeout;
+          LOG( PRINT_DEBUG, "keepAliveSend" );
+          keep->keepAliveSend( keep_alive_frame, sizeof( keep_alive_frame ) );
         }
-        else
+
+        keep->keepAliveTry++;
+        keep->keepAlive = ST2MS( xTaskGetTickCount() ) + keep->timeout;
+      }
+      else
+      {
+        keep->keepAliveErrorFlag = 1;
+        if ( keep->keepAliveErrorCb != NULL )
         {
-          keep->keepAliveErrorFlag = 1;
-          if ( keep->keepAliveErrorCb != NULL )
-          {
-            keep->keepAliveErrorCb();
-          }
+          keep->keepAliveErrorCb();
         }
+        continue;
       }
     }
 
-    vTaskDelay( MS2ST( 25 ) );
+    /* keepAliveAccept only moves deadline later, task checks again at old one */
+    uint32_t time_to_next = keep->keepAlive > now ? keep->keepAlive - now + 1 : 1;
+    if ( time_to_next < next_ms )
+    {
+      next_ms = time_to_next;
+    }
+  }
+
+  return next_ms;
+}
+
+/* Send blocks on socket, so task does not share scheduler with other drivers */
+static void keepAliveProcess( void* pv )
+{
+  //LOG(PRINT_INFO, "KeepAliveTask\n");
+  while ( 1 )
+  {
+    uint32_t next_ms = _check_entries();
+
+    /* Woken up by keepAliveStart */
+    ulTaskNotifyTake( pdTRUE, next_ms == UINT32_MAX ? portMAX_DELAY : MS2ST( next_ms ) );
   }
 }
 
@@ -131,7 +153,7 @@ void sendKeepAliveFrame( void )
 
 void keepAliveStartTask( void )
 {
-  xTaskCreate( keepAliveProcess, "keepAliveProcess", 2048, NULL, NORMALPRIO, NULL );
+  xTaskCreate( keepAliveProcess, "keepAliveProcess", 2048, NULL, NORMALPRIO, &task_handle );
 }
 
 void keepAliveStart( keepAlive_t* keep )
@@ -144,6 +166,11 @@ void keepAliveStart( keepAlive_t* keep )
   keep->keepAliveActiveFlag = 1;
   keep->keepAliveErrorFlag = 0;
   keepAliveAccept( keep );
+  if ( task_handle != NULL )
+  {
+    /* Task computes nearest deadline of all entries */
+    xTaskNotifyGive( task_handle );
+  }
 }
 
 void keepAliveStop( keepAlive_t* keep )
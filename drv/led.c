@@ -1,70 +1,274 @@
-/*
- * but.c
- *
- *  Author: Demetriusz
+/**
+ *******************************************************************************
+ * @file    led.c
+ * @author  Dmytro Shevchenko
+ * @brief   LED driver source file
+ *******************************************************************************
  */
+
+/* Includes ------------------------------------------------------------------*/
+
 #include "led.h"
 
-#include <stdbool.h>
-#include <stdint.h>
+#include <assert.h>
+#include <math.h>
 
 #include "app_config.h"
-#include "driver/gpio.h"
-#include "esp_task_wdt.h"
+#include "battery.h"
+#include "driver/ledc.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
-#include "freertos/task.h"
 #include "parameters.h"
-#include "pwm_drv.h"
+#include "scheduler.h"
+
+/* Private macros ------------------------------------------------------------*/
 
 #define MODULE_NAME "[LED] "
 #define DEBUG_LVL   PRINT_INFO
 
-#if CONFIG_DEBUG_BUTTON
+#if CONFIG_DEBUG_LED
 #define LOG( _lvl, ... ) \
   debug_printf( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
 #else
 #define LOG( PRINT_INFO, ... )
 #endif
 
-#define PWM_UNIT MCPWM_UNIT_0
-#define PWM_DUTY _get_brightness()
+#define ARRAY_SIZE( _array ) sizeof( _array ) / sizeof( _array[0] )
+#define LED_SPEED_MODE       LEDC_LOW_SPEED_MODE
+#define LED_DUTY_RESOLUTION  LEDC_TIMER_13_BIT
+#define LED_DUTY_MAX         ( ( 1 << 13 ) - 1 )
+#define LED_GAMMA            2.2f
+
+/* Hardware fade is linear in duty, gamma curve is approximated by this count of linear segments */
+#define LED_FADE_SEGMENTS 4
+
+#ifndef CONFIG_LED_LEDC_TIMER
+#define CONFIG_LED_LEDC_TIMER LEDC_TIMER_0
+#endif
+
+#ifndef CONFIG_LED_LEDC_CHANNEL_BASE
+#define CONFIG_LED_LEDC_CHANNEL_BASE LEDC_CHANNEL_0
+#endif
+
+#ifndef CONFIG_LED_FREQUENCY_HZ
+#define CONFIG_LED_FREQUENCY_HZ 1000
+#endif
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  scheduler_job_t job;
+  uint8_t pin;
+
+  /* Request from API, taken by job */
+  const led_pattern_t* request;
+  led_step_t request_step;
+  led_pattern_t request_pattern;
+  bool is_request;
+
+  /* Played pattern, used only by job */
+  const led_pattern_t* pattern;
+  led_step_t single_step;
+  led_pattern_t single_pattern;
+  uint8_t step;
+  uint8_t loop;
+  uint8_t segment;
+  uint8_t level;
+  uint8_t from_level;
+  bool is_holding;
+} led_ctx_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+static const led_step_t blink_slow_steps[] = { { 100, 0, 500 }, { 0, 0, 500 } };
+static const led_step_t blink_fast_steps[] = { { 100, 0, 100 }, { 0, 0, 100 } };
+static const led_step_t breathe_steps[] = { { 100, 1000, 200 }, { 0, 1000, 300 } };
+static const led_step_t emergency_steps[] = { { 100, 0, 60 }, { 0, 0, 60 }, { 100, 0, 60 }, { 0, 0, 500 } };
+
+const led_pattern_t LED_PATTERN_BLINK_SLOW = { .steps = blink_slow_steps, .count = ARRAY_SIZE( blink_slow_steps ) };
+const led_pattern_t LED_PATTERN_BLINK_FAST = { .steps = blink_fast_steps, .count = ARRAY_SIZE( blink_fast_steps ) };
+const led_pattern_t LED_PATTERN_BREATHE = { .steps = breathe_steps, .count = ARRAY_SIZE( breathe_steps ) };
+const led_pattern_t LED_PATTERN_EMERGENCY = { .steps = emergency_steps, .count = ARRAY_SIZE( emergency_steps ) };
+
+static led_ctx_t leds[LED_AMOUNT];
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t gamma_table[LED_LEVEL_MAX + 1];
+static uint32_t gamma_brightness;
+static bool is_initialized;
 
-static pwm_drv_t pwm_drv[LED_AMOUNT];
+/* Private functions ---------------------------------------------------------*/
 
-static float _get_brightness( void )
+static uint32_t _get_brightness( void )
 {
   uint32_t value = parameters_getValue( PARAM_BRIGHTNESS );
   if ( value < 1 || value >= 10 )
   {
-    return 100.0;
+    return 100;
   }
-  else
+
+  return value * 10;
+}
+
+/* Table is rebuilt only when brightness parameter is changed */
+static void _update_gamma_table( void )
+{
+  uint32_t brightness = _get_brightness();
+  if ( brightness == gamma_brightness )
+  {
+    return;
+  }
+
+  for ( uint32_t i = 0; i <= LED_LEVEL_MAX; i++ )
   {
-    return (float) value * 10.0;
+    float value = powf( (float) i / LED_LEVEL_MAX, LED_GAMMA ) * brightness / 100.0f;
+    gamma_table[i] = (uint16_t) ( value * LED_DUTY_MAX + 0.5f );
   }
+  gamma_brightness = brightness;
 }
 
-static void _set_led( LEDs_t led, bool on_off )
+static ledc_channel_t _channel( led_ctx_t* led )
+{
+  return (ledc_channel_t) ( CONFIG_LED_LEDC_CHANNEL_BASE + ( led - leds ) );
+}
+
+static void _take_request( led_ctx_t* led )
 {
-  if ( on_off )
+  bool is_request = false;
+
+  portENTER_CRITICAL( &lock );
+  if ( led->is_request )
   {
-    PWMDrv_SetDuty( &pwm_drv[led], PWM_DUTY );
+    led->single_step = led->request_step;
+    led->single_pattern = led->request_pattern;
+    led->single_pattern.steps = &led->single_step;
+    led->pattern = led->request == &led->request_pattern ? &led->single_pattern : led->request;
+    led->is_request = false;
+    is_request = true;
   }
-  else
+  portEXIT_CRITICAL( &lock );
+
+  if ( is_request )
   {
-    PWMDrv_Stop( &pwm_drv[led], false );
+    ledc_fade_stop( LED_SPEED_MODE, _channel( led ) );
+    _update_gamma_table();
+    led->step = 0;
+    led->loop = 0;
+    led->segment = 0;
+    led->from_level = led->level;
+    led->is_holding = false;
   }
 }
 
+/*
+ * Runs in scheduler task. Fade segments are done by LEDC hardware,
+ * job is woken only on segment end and on step hold end.
+ */
+static void _led_job( void* arg )
+{
+  led_ctx_t* led = (led_ctx_t*) arg;
+  ledc_channel_t channel = _channel( led );
+  uint32_t idle_steps = 0;
+
+  _take_request( led );
+  while ( led->pattern != NULL )
+  {
+    const led_step_t* step = &led->pattern->steps[led->step];
+
+    if ( !led->is_holding && step->fade_ms > 0 && step->level != led->from_level && led->segment < LED_FADE_SEGMENTS )
+    {
+      led->segment++;
+      int32_t diff = (int32_t) step->level - led->from_level;
+      uint8_t level = (uint8_t) ( led->from_level + diff * led->segment / LED_FADE_SEGMENTS );
+      uint32_t time_ms = step->fade_ms / LED_FADE_SEGMENTS;
+      ledc_set_fade_with_time( LED_SPEED_MODE, channel, gamma_table[level], time_ms );
+      ledc_fade_start( LED_SPEED_MODE, channel, LEDC_FADE_NO_WAIT );
+      led->level = level;
+      Scheduler_Start( &led->job, time_ms, 0 );
+      return;
+    }
+
+    if ( !led->is_holding )
+    {
+      if ( step->fade_ms == 0 || step->level == led->from_level )
+      {
+        ledc_set_duty( LED_SPEED_MODE, channel, gamma_table[step->level] );
+        ledc_update_duty( LED_SPEED_MODE, channel );
+      }
+      led->level = step->level;
+      led->is_holding = true;
+      if ( step->hold_ms > 0 )
+      {
+        Scheduler_Start( &led->job, step->hold_ms, 0 );
+        return;
+      }
+    }
+
+    led->is_holding = false;
+    led->segment = 0;
+    led->from_level = led->level;
+    led->step++;
+    if ( led->step >= led->pattern->count )
+    {
+      led->step = 0;
+      led->loop++;
+      if ( led->pattern->repeat != 0 && led->loop >= led->pattern->repeat )
+      {
+        led->pattern = NULL;
+      }
+    }
+
+    /* Lap without fade or hold would loop forever in scheduler task, pattern keeps last level */
+    if ( led->pattern != NULL && led->pattern->repeat == 0 && ++idle_steps > led->pattern->count )
+    {
+      LOG( PRINT_ERROR, "pattern without fade or hold stopped" );
+      led->pattern = NULL;
+    }
+  }
+}
+
+static void _request( LEDs_t led_id, const led_pattern_t* pattern, uint8_t level, uint16_t fade_ms )
+{
+  if ( !is_initialized || led_id >= LED_AMOUNT )
+  {
+    return;
+  }
+
+  led_ctx_t* led = &leds[led_id];
+  portENTER_CRITICAL( &lock );
+  if ( pattern == NULL )
+  {
+    led->request_step.level = level > LED_LEVEL_MAX ? LED_LEVEL_MAX : level;
+    led->request_step.fade_ms = fade_ms;
+    led->request_step.hold_ms = 0;
+    led->request_pattern.count = 1;
+    led->request_pattern.repeat = 1;
+    pattern = &led->request_pattern;
+  }
+  led->request = pattern;
+  led->is_request = true;
+  portEXIT_CRITICAL( &lock );
+
+  Scheduler_Start( &led->job, 0, 0 );
+}
+
+static void _set_led( LEDs_t led, bool on_off )
+{
+  LED_Set( led, on_off ? LED_LEVEL_MAX : 0 );
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+/* Green LED shows running consumer, its load is also used by battery SoC */
 void set_motor_green_led( bool on_off )
 {
   _set_led( LED_UPPER_GREEN, on_off );
+  battery_set_load( BATTERY_LOAD_MOTOR, on_off );
 }
 
 void set_servo_green_led( bool on_off )
 {
   _set_led( LED_BOTTOM_GREEN, on_off );
+  battery_set_load( BATTERY_LOAD_SERVO, on_off );
 }
 
 void set_motor_red_led( bool on_off )
@@ -77,10 +281,64 @@ void set_servo_red_led( bool on_off )
   _set_led( LED_BOTTOM_RED, on_off );
 }
 
+void LED_Set( LEDs_t led, uint8_t level )
+{
+  _request( led, NULL, level, 0 );
+}
+
+void LED_Fade( LEDs_t led, uint8_t level, uint16_t fade_ms )
+{
+  _request( led, NULL, level, fade_ms );
+}
+
+void LED_Play( LEDs_t led, const led_pattern_t* pattern )
+{
+  assert( pattern );
+  assert( pattern->count > 0 );
+  _request( led, pattern, 0, 0 );
+}
+
+bool LED_IsBusy( LEDs_t led )
+{
+  if ( !is_initialized || led >= LED_AMOUNT )
+  {
+    return false;
+  }
+
+  return leds[led].is_request || leds[led].pattern != NULL;
+}
+
 void init_leds( void )
 {
-  PWMDrv_Init( &pwm_drv[LED_UPPER_RED], "up_red", PWM_DRV_DUTY_MODE_HIGH, 100, 0, MOTOR_LED_RED );
-  PWMDrv_Init( &pwm_drv[LED_BOTTOM_RED], "down_red", PWM_DRV_DUTY_MODE_HIGH, 100, 0, SERVO_VIBRO_LED_RED );
-  PWMDrv_Init( &pwm_drv[LED_UPPER_GREEN], "up_green", PWM_DRV_DUTY_MODE_HIGH, 100, 0, MOTOR_LED_GREEN );
-  PWMDrv_Init( &pwm_drv[LED_BOTTOM_GREEN], "down_green", PWM_DRV_DUTY_MODE_HIGH, 100, 1, SERVO_VIBRO_LED_GREEN );
+  leds[LED_UPPER_RED].pin = MOTOR_LED_RED;
+  leds[LED_BOTTOM_RED].pin = SERVO_VIBRO_LED_RED;
+  leds[LED_UPPER_GREEN].pin = MOTOR_LED_GREEN;
+  leds[LED_BOTTOM_GREEN].pin = SERVO_VIBRO_LED_GREEN;
+
+  ledc_timer_config_t timer_config = {
+    .speed_mode = LED_SPEED_MODE,
+    .duty_resolution = LED_DUTY_RESOLUTION,
+    .timer_num = CONFIG_LED_LEDC_TIMER,
+    .freq_hz = CONFIG_LED_FREQUENCY_HZ,
+    .clk_cfg = LEDC_AUTO_CLK,
+  };
+  ESP_ERROR_CHECK( ledc_timer_config( &timer_config ) );
+  ESP_ERROR_CHECK( ledc_fade_func_install( 0 ) );
+
+  for ( int i = 0; i < LED_AMOUNT; i++ )
+  {
+    ledc_channel_config_t channel_config = {
+      .gpio_num = leds[i].pin,
+      .speed_mode = LED_SPEED_MODE,
+      .channel = _channel( &leds[i] ),
+      .timer_sel = CONFIG_LED_LEDC_TIMER,
+      .duty = 0,
+      .hpoint = 0,
+    };
+    ESP_ERROR_CHECK( ledc_channel_config( &channel_config ) );
+    Scheduler_AddJob( &leds[i].job, "led", _led_job, &leds[i] );
+  }
+
+  _update_gamma_table();
+  is_initialized = true;
 }
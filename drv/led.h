@@ -1,7 +1,25 @@
+/**
+ *******************************************************************************
+ * @file    led.h
+ * @author  Dmytro Shevchenko
+ * @brief   LED driver header file. Gamma corrected brightness, hardware
+ *          (LEDC) fades. Pattern steps and blinks are timed by scheduler job.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
 #ifndef _LED_H_
 #define _LED_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+
+/* Public macro --------------------------------------------------------------*/
+
+#define LED_LEVEL_MAX 100
+
+/* Public types --------------------------------------------------------------*/
 
 typedef enum
 {
@@ -12,6 +30,29 @@ typedef enum
   LED_AMOUNT
 } LEDs_t;
 
+typedef struct
+{
+  uint8_t level;    // perceived brightness 0..LED_LEVEL_MAX
+  uint16_t fade_ms;    // hardware fade time from previous level
+  uint16_t hold_ms;    // time on level before next step
+} led_step_t;
+
+typedef struct
+{
+  const led_step_t* steps;
+  uint8_t count;
+  uint8_t repeat;    // 0 - forever
+} led_pattern_t;
+
+/* Public variables ----------------------------------------------------------*/
+
+extern const led_pattern_t LED_PATTERN_BLINK_SLOW;
+extern const led_pattern_t LED_PATTERN_BLINK_FAST;
+extern const led_pattern_t LED_PATTERN_BREATHE;
+extern const led_pattern_t LED_PATTERN_EMERGENCY;
+
+/* Public functions ----------------------------------------------------------*/
+
 void set_motor_green_led( bool on_off );
 void set_servo_green_led( bool on_off );
 void set_motor_red_led( bool on_off );
@@ -19,4 +60,35 @@ void set_servo_red_led( bool on_off );
 
 void init_leds( void );
 
-#endif
\ No newline at end of file
+/**
+ * @brief   Set LED brightness, stops pattern.
+ * @param   [in] led - LED
+ * @param   [in] level - perceived brightness 0..LED_LEVEL_MAX
+ */
+void LED_Set( LEDs_t led, uint8_t level );
+
+/**
+ * @brief   Fade LED to brightness, stops pattern.
+ * @param   [in] led - LED
+ * @param   [in] level - perceived brightness 0..LED_LEVEL_MAX
+ * @param   [in] fade_ms - fade time
+ */
+void LED_Fade( LEDs_t led, uint8_t level, uint16_t fade_ms );
+
+/**
+ * @brief   Play pattern. LED keeps level of last step when pattern ends.
+ *          Pattern repeated forever must contain step with fade or hold time,
+ *          pattern with lap without any fade or hold is stopped.
+ * @param   [in] led - LED
+ * @param   [in] pattern - pattern, must be valid while played
+ */
+void LED_Play( LEDs_t led, const led_pattern_t* pattern );
+
+/**
+ * @brief   Check if pattern or fade is running.
+ * @param   [in] led - LED
+ * @return  true if running
+ */
+bool LED_IsBusy( LEDs_t led );
+
+#endif
@@ -17,17 +17,24 @@
 
 #include "app_config.h"
 #include "dev_config.h"
+#include "esp_app_format.h"
 #include "esp_crt_bundle.h"
 #include "esp_efuse.h"
 #include "esp_event.h"
 #include "esp_http_client.h"
 #include "esp_https_ota.h"
+#include "esp_image_format.h"
 #include "esp_ota_ops.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_tls.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "miniz.h"
+#include "nvs.h"
 #include "ota.h"
+#include "ota_stream.h"
+#include "spi_flash_mmap.h"
 
 /* Private macros ------------------------------------------------------------*/
 #define MODULE_NAME "[OTA] "
@@ -40,6 +47,28 @@
 #define LOG( PRINT_INFO, ... )
 #endif
 
+#define PROGRESS_NVS_NAMESPACE "ota"
+#define PROGRESS_NVS_KEY       "progress"
+#define SAVE_EVERY_BLOCKS      16    // 64 kB of image with 4 kB blocks
+#define HTTP_READ_SIZE         1024
+
+#ifndef CONFIG_OTA_MAX_RETRIES
+#define CONFIG_OTA_MAX_RETRIES 20
+#endif
+
+#ifndef CONFIG_OTA_RETRY_DELAY_MS
+#define CONFIG_OTA_RETRY_DELAY_MS 2000
+#endif
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  const esp_partition_t* partition;
+  const esp_partition_t* running;
+  tinfl_decompressor* inflator;
+} ota_flash_t;
+
 /* Extern variables ----------------------------------------------------------*/
 extern const uint8_t server_cert_pem_start[] asm( "_binary_ca_cert_pem_start" );
 extern const uint8_t server_cert_pem_end[] asm( "_binary_ca_cert_pem_end" );
@@ -48,6 +77,7 @@ extern const uint8_t server_cert_pem_end[] asm( "_binary_ca_cert_pem_end" );
 static char localResponseBuffer[2048];
 static size_t percentage_download;
 static ota_driver_state_t state;
+static uint32_t throughput;
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -294,6 +324,294 @@ ota_end:
   return false;
 }
 
+static bool _progress_load( ota_stream_progress_t* progress )
+{
+  nvs_handle_t nvs;
+  size_t required_size = sizeof( ota_stream_progress_t );
+
+  if ( nvs_open( PROGRESS_NVS_NAMESPACE, NVS_READONLY, &nvs ) != ESP_OK )
+  {
+    return false;
+  }
+
+  esp_err_t err = nvs_get_blob( nvs, PROGRESS_NVS_KEY, progress, &required_size );
+  nvs_close( nvs );
+  return err == ESP_OK && required_size == sizeof( ota_stream_progress_t );
+}
+
+static void _progress_save( void* ctx, const ota_stream_progress_t* progress )
+{
+  nvs_handle_t nvs;
+
+  if ( nvs_open( PROGRESS_NVS_NAMESPACE, NVS_READWRITE, &nvs ) != ESP_OK )
+  {
+    return;
+  }
+
+  if ( nvs_set_blob( nvs, PROGRESS_NVS_KEY, progress, sizeof( ota_stream_progress_t ) ) == ESP_OK )
+  {
+    nvs_commit( nvs );
+  }
+  nvs_close( nvs );
+  LOG( PRINT_DEBUG, "Progress saved: block %" PRIu32 " offset %" PRIu32, progress->block_index, progress->input_offset );
+}
+
+static void _progress_clear( void )
+{
+  nvs_handle_t nvs;
+
+  if ( nvs_open( PROGRESS_NVS_NAMESPACE, NVS_READWRITE, &nvs ) != ESP_OK )
+  {
+    return;
+  }
+
+  nvs_erase_key( nvs, PROGRESS_NVS_KEY );
+  nvs_commit( nvs );
+  nvs_close( nvs );
+}
+
+static int _decompress( void* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t out_size, size_t* out_len )
+{
+  ota_flash_t* flash = (ota_flash_t*) ctx;
+  size_t in_bytes = in_len;
+
+  *out_len = out_size;
+  tinfl_init( flash->inflator );
+  tinfl_status status = tinfl_decompress( flash->inflator, in, &in_bytes, out, out, out_len, TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF );
+  return status == TINFL_STATUS_DONE ? 0 : -1;
+}
+
+static int _flash_write( void* ctx, uint32_t offset, const uint8_t* data, size_t len )
+{
+  ota_flash_t* flash = (ota_flash_t*) ctx;
+
+  if ( offset + len > flash->partition->size )
+  {
+    return -1;
+  }
+
+  if ( offset == 0 )
+  {
+    const size_t desc_offset = sizeof( esp_image_header_t ) + sizeof( esp_image_segment_header_t );
+    esp_app_desc_t app_desc;
+    if ( len < desc_offset + sizeof( esp_app_desc_t ) || data[0] != ESP_IMAGE_HEADER_MAGIC )
+    {
+      return -1;
+    }
+
+    memcpy( &app_desc, &data[desc_offset], sizeof( app_desc ) );
+    if ( app_desc.magic_word != ESP_APP_DESC_MAGIC_WORD || _validate_image_header( &app_desc ) != ESP_OK )
+    {
+      return -1;
+    }
+  }
+
+  /* Blocks continue from resume point and esp_ota_write_with_offset does not erase,
+   * so partition is written directly and image is verified when stream is done.
+   * Blocks are written in order, sector is erased when first block enters it, so
+   * block smaller than sector does not erase data of previous block */
+  uint32_t erase_start = ( offset + SPI_FLASH_SEC_SIZE - 1 ) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+  uint32_t erase_end = ( offset + len + SPI_FLASH_SEC_SIZE - 1 ) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+  if ( erase_end > erase_start && esp_partition_erase_range( flash->partition, erase_start, erase_end - erase_start ) != ESP_OK )
+  {
+    return -1;
+  }
+
+  return esp_partition_write( flash->partition, offset, data, len ) == ESP_OK ? 0 : -1;
+}
+
+/* Image can be written in several downloads, also last download can write nothing after resume */
+static esp_err_t _flash_finish( ota_flash_t* flash )
+{
+  const esp_partition_pos_t pos = {
+    .offset = flash->partition->address,
+    .size = flash->partition->size,
+  };
+  esp_image_metadata_t metadata;
+
+  esp_err_t err = esp_image_verify( ESP_IMAGE_VERIFY, &pos, &metadata );
+  if ( err != ESP_OK )
+  {
+    LOG( PRINT_ERROR, "Image verify error %d", err );
+    return err;
+  }
+
+  return esp_ota_set_boot_partition( flash->partition );
+}
+
+static int _read_source( void* ctx, uint32_t offset, uint8_t* data, size_t len )
+{
+  ota_flash_t* flash = (ota_flash_t*) ctx;
+  return esp_partition_read( flash->running, offset, data, len ) == ESP_OK ? 0 : -1;
+}
+
+/* Returns ESP_OK if connection was finished by stream result, error on connection problem */
+static esp_err_t _http_fetch( const char* url, ota_stream_t* stream, ota_stream_result_t* result, uint32_t* wire_bytes )
+{
+  esp_http_client_config_t config = {
+    .url = url,
+    .timeout_ms = 3000,
+    .keep_alive_enable = true,
+    .crt_bundle_attach = ota_bundle_attach,
+  };
+  uint8_t buffer[HTTP_READ_SIZE];
+  char range[32];
+  esp_err_t err = ESP_FAIL;
+
+  esp_http_client_handle_t client = esp_http_client_init( &config );
+  if ( client == NULL )
+  {
+    return ESP_FAIL;
+  }
+
+  uint32_t offset = OtaStream_GetInputOffset( stream );
+  snprintf( range, sizeof( range ), "bytes=%" PRIu32 "-", offset );
+  esp_http_client_set_header( client, "Range", range );
+  if ( esp_http_client_open( client, 0 ) != ESP_OK || esp_http_client_fetch_headers( client ) < 0 )
+  {
+    goto fetch_end;
+  }
+
+  /* Server without Range support sends whole file, skip already received part */
+  uint32_t skip = 0;
+  int status = esp_http_client_get_status_code( client );
+  if ( status == 200 )
+  {
+    skip = offset;
+  }
+  else if ( status != 206 )
+  {
+    LOG( PRINT_ERROR, "HTTP status %d", status );
+    goto fetch_end;
+  }
+
+  *result = OTA_STREAM_RESULT_OK;
+  while ( *result == OTA_STREAM_RESULT_OK )
+  {
+    int len = esp_http_client_read( client, (char*) buffer, sizeof( buffer ) );
+    if ( len <= 0 )
+    {
+      goto fetch_end;
+    }
+
+    *wire_bytes += len;
+    uint32_t drop = MIN( skip, (uint32_t) len );
+    skip -= drop;
+    *result = OtaStream_Feed( stream, &buffer[drop], len - drop );
+
+    uint32_t image_size = OtaStream_GetImageSize( stream );
+    if ( image_size > 0 )
+    {
+      percentage_download = (size_t) ( (uint64_t) OtaStream_GetOutputOffset( stream ) * 100 / image_size );
+    }
+  }
+  err = ESP_OK;
+
+fetch_end:
+  esp_http_client_close( client );
+  esp_http_client_cleanup( client );
+  return err;
+}
+
+/*
+ * Download of compressed or delta container. Progress is stored in NVS, download is continued
+ * with HTTP Range after connection lost or reset. Delta is applied against running partition
+ * directly into update partition block by block. Returns false if url is not a container.
+ */
+static bool _download_stream( const char* url, bool* is_container )
+{
+  ota_stream_progress_t progress;
+  ota_flash_t flash = { 0 };
+  ota_stream_io_t io = {
+    .decompress = _decompress,
+    .write = _flash_write,
+    .read_source = _read_source,
+    .save_progress = _progress_save,
+    .ctx = &flash,
+    .save_every = SAVE_EVERY_BLOCKS,
+  };
+  ota_stream_result_t result = OTA_STREAM_RESULT_OK;
+  uint32_t wire_bytes = 0;
+  uint32_t retries = 0;
+  bool ret = false;
+
+  *is_container = true;
+  flash.partition = esp_ota_get_next_update_partition( NULL );
+  flash.running = esp_ota_get_running_partition();
+  ota_stream_t* stream = malloc( sizeof( ota_stream_t ) );
+  flash.inflator = malloc( sizeof( tinfl_decompressor ) );
+  if ( flash.partition == NULL || stream == NULL || flash.inflator == NULL )
+  {
+    goto stream_end;
+  }
+
+  state = OTA_DRIVER_STATE_DOWNLOAD;
+  OtaStream_Init( stream, &io, _progress_load( &progress ) ? &progress : NULL );
+  int64_t start_us = esp_timer_get_time();
+  uint32_t start_offset = 0;
+  while ( retries < CONFIG_OTA_MAX_RETRIES )
+  {
+    uint32_t output_offset = OtaStream_GetOutputOffset( stream );
+    result = OTA_STREAM_RESULT_OK;
+    esp_err_t err = _http_fetch( url, stream, &result, &wire_bytes );
+    if ( result == OTA_STREAM_RESULT_SEEK )
+    {
+      LOG( PRINT_INFO, "Resume from %" PRIu32 " of %" PRIu32, OtaStream_GetOutputOffset( stream ), OtaStream_GetImageSize( stream ) );
+      start_offset = OtaStream_GetOutputOffset( stream );
+      continue;
+    }
+
+    if ( err == ESP_OK )
+    {
+      break;
+    }
+
+    /* Weak link: keep retrying as long as download moves forward */
+    retries = OtaStream_GetOutputOffset( stream ) > output_offset ? 0 : retries + 1;
+    OtaStream_SaveProgress( stream );
+    uint32_t offset = OtaStream_Rewind( stream );
+    LOG( PRINT_WARNING, "Connection lost at %" PRIu32 ", retry %" PRIu32, offset, retries );
+    vTaskDelay( MS2ST( CONFIG_OTA_RETRY_DELAY_MS ) );
+  }
+
+  if ( result == OTA_STREAM_RESULT_ERROR_FORMAT && OtaStream_GetImageSize( stream ) == 0 )
+  {
+    *is_container = false;
+    goto stream_end;
+  }
+
+  uint32_t elapsed_ms = (uint32_t) ( ( esp_timer_get_time() - start_us ) / 1000 ) + 1;
+  throughput = (uint32_t) ( (uint64_t) ( OtaStream_GetOutputOffset( stream ) - start_offset ) * 1000 / elapsed_ms );
+  LOG( PRINT_INFO, "Received %" PRIu32 " B in %" PRIu32 " ms, wire %" PRIu32 " B/s, effective %" PRIu32 " B/s",
+       wire_bytes, elapsed_ms, (uint32_t) ( (uint64_t) wire_bytes * 1000 / elapsed_ms ), throughput );
+
+  if ( result == OTA_STREAM_RESULT_DONE )
+  {
+    _progress_clear();
+    if ( _flash_finish( &flash ) == ESP_OK )
+    {
+      LOG( PRINT_INFO, "OTA stream upgrade successful. Wait rebooting ..." );
+      state = OTA_DRIVER_STATE_DONWLOAD_FINISHED;
+      ret = true;
+    }
+  }
+  else if ( result != OTA_STREAM_RESULT_OK )
+  {
+    /* Broken image, do not resume it */
+    LOG( PRINT_ERROR, "OTA stream error %d", result );
+    _progress_clear();
+  }
+
+stream_end:
+  if ( !ret && *is_container )
+  {
+    state = OTA_DRIVER_STATE_ERROR;
+  }
+  free( flash.inflator );
+  free( stream );
+  return ret;
+}
+
 static void _init( void )
 {
   state = OTA_DRIVER_STATE_IDLE;
@@ -319,7 +637,11 @@ static void _init( void )
 static void _task( void* pvParameters )
 {
   const char* url = (const char*) pvParameters;
-  _download_and_update_firmware( url );
+  bool is_container = false;
+  if ( !_download_stream( url, &is_container ) && !is_container )
+  {
+    _download_and_update_firmware( url );
+  }
   vTaskDelete( NULL );
 }
 
@@ -345,3 +667,8 @@ size_t OTA_GetDownloadPercentage( void )
 {
   return percentage_download;
 }
+
+uint32_t OTA_GetThroughput( void )
+{
+  return throughput;
+}
@@ -13,6 +13,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* Public types -------------------------------------------------------------*/
 
@@ -33,7 +34,9 @@ typedef enum
 void OTA_Init( void );
 
 /**
- * @brief   Download image.
+ * @brief   Download image. Compressed or delta container (see ota_stream.h)
+ *          is resumed with HTTP Range after connection lost or reset, plain
+ *          image is downloaded by esp_https_ota.
  */
 bool OTA_Download( const char* url );
 
@@ -47,4 +50,10 @@ ota_driver_state_t OTA_GetState( void );
  */
 size_t OTA_GetDownloadPercentage( void );
 
+/**
+ * @brief   Get effective throughput of last container download.
+ * @return  decompressed image bytes per second
+ */
+uint32_t OTA_GetThroughput( void );
+
 #endif
\ No newline at end of file
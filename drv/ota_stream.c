@@ -0,0 +1,423 @@
+/**
+ *******************************************************************************
+ * @file    ota_stream.c
+ * @author  Dmytro Shevchenko
+ * @brief   Resumable OTA image stream source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "ota_stream.h"
+
+#include <assert.h>
+#include <string.h>
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint32_t _get_u32( const uint8_t* buf )
+{
+  return (uint32_t) buf[0] | ( (uint32_t) buf[1] << 8 ) | ( (uint32_t) buf[2] << 16 ) | ( (uint32_t) buf[3] << 24 );
+}
+
+static size_t _get_varint( const uint8_t* buf, size_t len, uint32_t* value )
+{
+  size_t pos = 0;
+  uint32_t shift = 0;
+  *value = 0;
+  do
+  {
+    if ( pos >= len || shift > 28 )
+    {
+      return 0;
+    }
+    *value |= (uint32_t) ( buf[pos] & 0x7F ) << shift;
+    shift += 7;
+  } while ( buf[pos++] & 0x80 );
+  return pos;
+}
+
+static uint32_t _header_size( ota_stream_t* stream )
+{
+  if ( stream->fill >= OTA_STREAM_HEADER_SIZE && stream->in_buf[5] == OTA_STREAM_COMPRESSION_DELTA )
+  {
+    return OTA_STREAM_HEADER_SIZE + OTA_STREAM_DELTA_EXT_SIZE;
+  }
+
+  return OTA_STREAM_HEADER_SIZE;
+}
+
+static bool _check_source( ota_stream_t* stream )
+{
+  ota_stream_header_t* header = &stream->header;
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  sha256_ctx_t sha;
+
+  if ( stream->io.read_source == NULL )
+  {
+    return false;
+  }
+
+  Sha256_Init( &sha );
+  for ( uint32_t offset = 0; offset < header->source_size; offset += sizeof( stream->out_buf ) )
+  {
+    uint32_t len = header->source_size - offset;
+    if ( len > sizeof( stream->out_buf ) )
+    {
+      len = sizeof( stream->out_buf );
+    }
+
+    if ( stream->io.read_source( stream->io.ctx, offset, stream->out_buf, len ) != 0 )
+    {
+      return false;
+    }
+    Sha256_Update( &sha, stream->out_buf, len );
+  }
+  Sha256_Final( &sha, digest );
+
+  return memcmp( digest, header->source_sha256, SHA256_DIGEST_SIZE ) == 0;
+}
+
+static bool _apply_delta( ota_stream_t* stream, size_t delta_len, size_t expected )
+{
+  const uint8_t* delta = stream->delta_buf;
+  size_t pos = 0;
+  size_t out_len = 0;
+
+  while ( pos < delta_len )
+  {
+    uint8_t op = delta[pos++];
+    uint32_t offset = 0;
+    uint32_t len = 0;
+    size_t n = 0;
+
+    if ( op != OTA_STREAM_DELTA_LITERAL )
+    {
+      n = _get_varint( &delta[pos], delta_len - pos, &offset );
+      if ( n == 0 )
+      {
+        return false;
+      }
+      pos += n;
+    }
+
+    n = _get_varint( &delta[pos], delta_len - pos, &len );
+    if ( n == 0 || len > expected - out_len )
+    {
+      return false;
+    }
+    pos += n;
+
+    switch ( op )
+    {
+      case OTA_STREAM_DELTA_COPY:
+      case OTA_STREAM_DELTA_ADD:
+        if ( offset > stream->header.source_size || len > stream->header.source_size - offset || ( op == OTA_STREAM_DELTA_ADD && len > delta_len - pos ) )
+        {
+          return false;
+        }
+
+        if ( stream->io.read_source( stream->io.ctx, offset, &stream->out_buf[out_len], len ) != 0 )
+        {
+          return false;
+        }
+
+        if ( op == OTA_STREAM_DELTA_ADD )
+        {
+          for ( uint32_t i = 0; i < len; i++ )
+          {
+            stream->out_buf[out_len + i] += delta[pos + i];
+          }
+          pos += len;
+        }
+        break;
+
+      case OTA_STREAM_DELTA_LITERAL:
+        if ( len > delta_len - pos )
+        {
+          return false;
+        }
+        memcpy( &stream->out_buf[out_len], &delta[pos], len );
+        pos += len;
+        break;
+
+      default:
+        return false;
+    }
+
+    out_len += len;
+  }
+
+  return out_len == expected;
+}
+
+static ota_stream_result_t _parse_header( ota_stream_t* stream )
+{
+  ota_stream_header_t* header = &stream->header;
+  const uint8_t* buf = stream->in_buf;
+
+  header->magic = _get_u32( &buf[0] );
+  header->version = buf[4];
+  header->compression = buf[5];
+  header->block_size = _get_u32( &buf[8] );
+  header->image_size = _get_u32( &buf[12] );
+  header->block_count = _get_u32( &buf[16] );
+  memcpy( header->sha256, &buf[20], SHA256_DIGEST_SIZE );
+
+  if ( header->magic != OTA_STREAM_MAGIC || header->version != OTA_STREAM_VERSION || header->compression > OTA_STREAM_COMPRESSION_DELTA || header->block_size == 0 || header->block_size > OTA_STREAM_MAX_BLOCK_SIZE || header->block_count != ( header->image_size + header->block_size - 1 ) / header->block_size )
+  {
+    return OTA_STREAM_RESULT_ERROR_FORMAT;
+  }
+
+  if ( header->compression == OTA_STREAM_COMPRESSION_DELTA )
+  {
+    if ( stream->fill < _header_size( stream ) )
+    {
+      return OTA_STREAM_RESULT_OK;
+    }
+
+    header->source_size = _get_u32( &buf[OTA_STREAM_HEADER_SIZE] );
+    memcpy( header->source_sha256, &buf[OTA_STREAM_HEADER_SIZE + 4], SHA256_DIGEST_SIZE );
+    if ( !_check_source( stream ) )
+    {
+      return OTA_STREAM_RESULT_ERROR_SOURCE;
+    }
+  }
+
+  stream->has_header = true;
+  stream->state = OTA_STREAM_STATE_BLOCK_LEN;
+  stream->fill = 0;
+
+  memset( &stream->progress, 0, sizeof( stream->progress ) );
+  stream->progress.magic = OTA_STREAM_PROGRESS_MAGIC;
+  memcpy( stream->progress.image_sha256, header->sha256, SHA256_DIGEST_SIZE );
+  stream->progress.input_offset = stream->input_offset;
+  Sha256_Init( &stream->progress.sha );
+
+  if ( stream->has_resume && memcmp( stream->resume.image_sha256, header->sha256, SHA256_DIGEST_SIZE ) == 0 && stream->resume.block_index < header->block_count && stream->resume.input_offset >= stream->input_offset && stream->resume.output_offset == stream->resume.block_index * header->block_size )
+  {
+    stream->progress = stream->resume;
+  }
+
+  stream->has_resume = false;
+  if ( stream->progress.input_offset != stream->input_offset )
+  {
+    stream->input_offset = stream->progress.input_offset;
+    return OTA_STREAM_RESULT_SEEK;
+  }
+
+  return OTA_STREAM_RESULT_OK;
+}
+
+static ota_stream_result_t _finish_block( ota_stream_t* stream )
+{
+  ota_stream_header_t* header = &stream->header;
+  ota_stream_progress_t* progress = &stream->progress;
+  uint32_t expected = header->image_size - progress->output_offset;
+  size_t out_len = 0;
+  const uint8_t* out = stream->in_buf;
+
+  if ( expected > header->block_size )
+  {
+    expected = header->block_size;
+  }
+
+  if ( stream->block_len & OTA_STREAM_BLOCK_STORED )
+  {
+    out_len = stream->fill;
+  }
+  else if ( header->compression == OTA_STREAM_COMPRESSION_DELTA )
+  {
+    size_t delta_len = 0;
+    if ( stream->io.decompress( stream->io.ctx, stream->in_buf, stream->fill, stream->delta_buf, sizeof( stream->delta_buf ), &delta_len ) != 0 || !_apply_delta( stream, delta_len, expected ) )
+    {
+      return OTA_STREAM_RESULT_ERROR_DECOMPRESS;
+    }
+    out = stream->out_buf;
+    out_len = expected;
+  }
+  else if ( stream->io.decompress( stream->io.ctx, stream->in_buf, stream->fill, stream->out_buf, header->block_size, &out_len ) == 0 )
+  {
+    out = stream->out_buf;
+  }
+  else
+  {
+    return OTA_STREAM_RESULT_ERROR_DECOMPRESS;
+  }
+
+  if ( out_len != expected )
+  {
+    return OTA_STREAM_RESULT_ERROR_DECOMPRESS;
+  }
+
+  if ( stream->io.write( stream->io.ctx, progress->output_offset, out, out_len ) != 0 )
+  {
+    return OTA_STREAM_RESULT_ERROR_WRITE;
+  }
+
+  Sha256_Update( &progress->sha, out, out_len );
+  progress->output_offset += out_len;
+  progress->input_offset = stream->input_offset;
+  progress->block_index++;
+  stream->state = OTA_STREAM_STATE_BLOCK_LEN;
+  stream->fill = 0;
+
+  if ( progress->block_index == header->block_count )
+  {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_ctx_t sha = progress->sha;
+    Sha256_Final( &sha, digest );
+    stream->state = OTA_STREAM_STATE_DONE;
+    return memcmp( digest, header->sha256, SHA256_DIGEST_SIZE ) == 0 ? OTA_STREAM_RESULT_DONE : OTA_STREAM_RESULT_ERROR_HASH;
+  }
+
+  if ( stream->io.save_every > 0 && progress->block_index % stream->io.save_every == 0 )
+  {
+    OtaStream_SaveProgress( stream );
+  }
+
+  return OTA_STREAM_RESULT_OK;
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+void OtaStream_Init( ota_stream_t* stream, const ota_stream_io_t* io, const ota_stream_progress_t* resume )
+{
+  assert( stream );
+  assert( io );
+  assert( io->write );
+
+  memset( stream, 0, offsetof( ota_stream_t, in_buf ) );
+  stream->io = *io;
+  stream->state = OTA_STREAM_STATE_HEADER;
+  if ( resume != NULL && resume->magic == OTA_STREAM_PROGRESS_MAGIC )
+  {
+    stream->resume = *resume;
+    stream->has_resume = true;
+  }
+}
+
+ota_stream_result_t OtaStream_Feed( ota_stream_t* stream, const uint8_t* data, size_t len )
+{
+  assert( stream );
+  assert( data || len == 0 );
+
+  stream->received_bytes += len;
+  while ( len > 0 )
+  {
+    uint32_t need = 0;
+    switch ( stream->state )
+    {
+      case OTA_STREAM_STATE_HEADER:
+        need = _header_size( stream );
+        break;
+
+      case OTA_STREAM_STATE_BLOCK_LEN:
+        need = sizeof( uint32_t );
+        break;
+
+      case OTA_STREAM_STATE_BLOCK_DATA:
+        need = stream->block_len & ~OTA_STREAM_BLOCK_STORED;
+        break;
+
+      default:
+        return OTA_STREAM_RESULT_DONE;
+    }
+
+    uint32_t copy = need - stream->fill;
+    if ( copy > len )
+    {
+      copy = len;
+    }
+
+    memcpy( &stream->in_buf[stream->fill], data, copy );
+    stream->fill += copy;
+    stream->input_offset += copy;
+    data += copy;
+    len -= copy;
+    if ( stream->fill < need )
+    {
+      break;
+    }
+
+    ota_stream_result_t result = OTA_STREAM_RESULT_OK;
+    switch ( stream->state )
+    {
+      case OTA_STREAM_STATE_HEADER:
+        result = _parse_header( stream );
+        break;
+
+      case OTA_STREAM_STATE_BLOCK_LEN:
+        stream->block_len = _get_u32( stream->in_buf );
+        stream->fill = 0;
+        need = stream->block_len & ~OTA_STREAM_BLOCK_STORED;
+        if ( need == 0 || need > stream->header.block_size || ( stream->header.compression == OTA_STREAM_COMPRESSION_NONE && !( stream->block_len & OTA_STREAM_BLOCK_STORED ) ) )
+        {
+          return OTA_STREAM_RESULT_ERROR_FORMAT;
+        }
+        stream->state = OTA_STREAM_STATE_BLOCK_DATA;
+        break;
+
+      case OTA_STREAM_STATE_BLOCK_DATA:
+        result = _finish_block( stream );
+        break;
+
+      default:
+        break;
+    }
+
+    if ( result != OTA_STREAM_RESULT_OK )
+    {
+      return result;
+    }
+  }
+
+  return OTA_STREAM_RESULT_OK;
+}
+
+uint32_t OtaStream_Rewind( ota_stream_t* stream )
+{
+  assert( stream );
+
+  stream->fill = 0;
+  if ( !stream->has_header )
+  {
+    stream->state = OTA_STREAM_STATE_HEADER;
+    stream->input_offset = 0;
+  }
+  else if ( stream->state != OTA_STREAM_STATE_DONE )
+  {
+    stream->state = OTA_STREAM_STATE_BLOCK_LEN;
+    stream->input_offset = stream->progress.input_offset;
+  }
+
+  return stream->input_offset;
+}
+
+void OtaStream_SaveProgress( ota_stream_t* stream )
+{
+  assert( stream );
+
+  if ( stream->has_header && stream->state != OTA_STREAM_STATE_DONE && stream->io.save_progress != NULL )
+  {
+    stream->io.save_progress( stream->io.ctx, &stream->progress );
+  }
+}
+
+uint32_t OtaStream_GetInputOffset( ota_stream_t* stream )
+{
+  assert( stream );
+  return stream->input_offset;
+}
+
+uint32_t OtaStream_GetOutputOffset( ota_stream_t* stream )
+{
+  assert( stream );
+  return stream->progress.output_offset;
+}
+
+uint32_t OtaStream_GetImageSize( ota_stream_t* stream )
+{
+  assert( stream );
+  return stream->has_header ? stream->header.image_size : 0;
+}
@@ -0,0 +1,197 @@
+/**
+ *******************************************************************************
+ * @file    ota_stream.h
+ * @author  Dmytro Shevchenko
+ * @brief   Resumable OTA image stream header file. Platform independent.
+ *
+ *          Image container:
+ *          header (OTA_STREAM_HEADER_SIZE bytes, little endian):
+ *            magic "HQOZ", version, compression, reserved[2], block_size,
+ *            image_size, block_count, sha256 of uncompressed image
+ *          delta extension (OTA_STREAM_COMPRESSION_DELTA only):
+ *            source_size, sha256 of source image
+ *          block_count blocks:
+ *            length (u32, OTA_STREAM_BLOCK_STORED bit if not compressed), data
+ *
+ *          Every block is compressed independently, so download can be
+ *          resumed from any block boundary with HTTP Range request without
+ *          storing decompressor window.
+ *
+ *          Delta block is deflated list of operations building block from
+ *          source image (running partition):
+ *            OTA_STREAM_DELTA_COPY, varint source offset, varint length
+ *            OTA_STREAM_DELTA_ADD, varint source offset, varint length, length diff bytes
+ *            OTA_STREAM_DELTA_LITERAL, varint length, length bytes
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _OTA_STREAM_H_
+#define _OTA_STREAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sha256.h"
+
+/* Public macro --------------------------------------------------------------*/
+
+#define OTA_STREAM_MAGIC          0x5A4F5148    // "HQOZ"
+#define OTA_STREAM_VERSION        1
+#define OTA_STREAM_HEADER_SIZE    52
+#define OTA_STREAM_DELTA_EXT_SIZE 36
+#define OTA_STREAM_MAX_BLOCK_SIZE 4096
+#define OTA_STREAM_MAX_DELTA_SIZE ( 2 * OTA_STREAM_MAX_BLOCK_SIZE )    // add operation carry diff of whole data
+#define OTA_STREAM_BLOCK_STORED   0x80000000
+#define OTA_STREAM_PROGRESS_MAGIC 0x4F50524F
+
+/* Public types --------------------------------------------------------------*/
+
+typedef enum
+{
+  OTA_STREAM_COMPRESSION_NONE,
+  OTA_STREAM_COMPRESSION_DEFLATE,    // raw deflate, no zlib header
+  OTA_STREAM_COMPRESSION_DELTA,    // raw deflate of delta operations
+} ota_stream_compression_t;
+
+typedef enum
+{
+  OTA_STREAM_DELTA_COPY,
+  OTA_STREAM_DELTA_ADD,
+  OTA_STREAM_DELTA_LITERAL,
+} ota_stream_delta_op_t;
+
+typedef enum
+{
+  OTA_STREAM_RESULT_OK,    // data consumed, need more
+  OTA_STREAM_RESULT_SEEK,    // continue download from OtaStream_GetInputOffset
+  OTA_STREAM_RESULT_DONE,    // image completed and hash is valid
+  OTA_STREAM_RESULT_ERROR_FORMAT,
+  OTA_STREAM_RESULT_ERROR_DECOMPRESS,
+  OTA_STREAM_RESULT_ERROR_WRITE,
+  OTA_STREAM_RESULT_ERROR_HASH,
+  OTA_STREAM_RESULT_ERROR_SOURCE,    // delta source is not the image patch was made for
+} ota_stream_result_t;
+
+typedef enum
+{
+  OTA_STREAM_STATE_HEADER,
+  OTA_STREAM_STATE_BLOCK_LEN,
+  OTA_STREAM_STATE_BLOCK_DATA,
+  OTA_STREAM_STATE_DONE,
+} ota_stream_state_t;
+
+typedef struct
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t compression;
+  uint32_t block_size;
+  uint32_t image_size;
+  uint32_t block_count;
+  uint8_t sha256[SHA256_DIGEST_SIZE];
+  uint32_t source_size;
+  uint8_t source_sha256[SHA256_DIGEST_SIZE];
+} ota_stream_header_t;
+
+/* State on block boundary, stored by user to resume after reset */
+typedef struct
+{
+  uint32_t magic;
+  uint8_t image_sha256[SHA256_DIGEST_SIZE];
+  uint32_t input_offset;
+  uint32_t output_offset;
+  uint32_t block_index;
+  sha256_ctx_t sha;
+} ota_stream_progress_t;
+
+typedef struct
+{
+  /* Decompress one block, return 0 on success */
+  int ( *decompress )( void* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t out_size, size_t* out_len );
+  /* Write decompressed block at image offset, return 0 on success */
+  int ( *write )( void* ctx, uint32_t offset, const uint8_t* data, size_t len );
+  /* Read source image for delta, return 0 on success. Can be NULL if delta is not used */
+  int ( *read_source )( void* ctx, uint32_t offset, uint8_t* data, size_t len );
+  /* Store progress, can be NULL */
+  void ( *save_progress )( void* ctx, const ota_stream_progress_t* progress );
+  void* ctx;
+  uint32_t save_every;    // blocks between save_progress calls
+} ota_stream_io_t;
+
+typedef struct
+{
+  ota_stream_io_t io;
+  ota_stream_state_t state;
+  ota_stream_header_t header;
+  ota_stream_progress_t progress;
+  ota_stream_progress_t resume;
+  bool has_header;
+  bool has_resume;
+  uint32_t input_offset;
+  uint32_t block_len;
+  uint32_t fill;
+  uint32_t received_bytes;
+  uint8_t in_buf[OTA_STREAM_MAX_BLOCK_SIZE];
+  uint8_t out_buf[OTA_STREAM_MAX_BLOCK_SIZE];
+  uint8_t delta_buf[OTA_STREAM_MAX_DELTA_SIZE];
+} ota_stream_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Init stream.
+ * @param   [in] stream - stream context
+ * @param   [in] io - user callbacks
+ * @param   [in] resume - progress stored before reset or NULL. Used only if
+ *                        image hash in header is the same.
+ */
+void OtaStream_Init( ota_stream_t* stream, const ota_stream_io_t* io, const ota_stream_progress_t* resume );
+
+/**
+ * @brief   Feed stream with downloaded data. Data must start at OtaStream_GetInputOffset.
+ * @param   [in] stream - stream context
+ * @param   [in] data - received data
+ * @param   [in] len - data length
+ * @return  OTA_STREAM_RESULT_OK if more data is needed,
+ *          OTA_STREAM_RESULT_SEEK if rest of data must be dropped and download restarted from new offset
+ */
+ota_stream_result_t OtaStream_Feed( ota_stream_t* stream, const uint8_t* data, size_t len );
+
+/**
+ * @brief   Drop partially received block after connection lost.
+ * @param   [in] stream - stream context
+ * @return  offset to continue download
+ */
+uint32_t OtaStream_Rewind( ota_stream_t* stream );
+
+/**
+ * @brief   Store progress of last completed block by save_progress callback.
+ * @param   [in] stream - stream context
+ */
+void OtaStream_SaveProgress( ota_stream_t* stream );
+
+/**
+ * @brief   Get offset in container of next expected byte.
+ * @param   [in] stream - stream context
+ * @return  offset
+ */
+uint32_t OtaStream_GetInputOffset( ota_stream_t* stream );
+
+/**
+ * @brief   Get count of decompressed bytes written to image.
+ * @param   [in] stream - stream context
+ * @return  written bytes
+ */
+uint32_t OtaStream_GetOutputOffset( ota_stream_t* stream );
+
+/**
+ * @brief   Get size of decompressed image.
+ * @param   [in] stream - stream context
+ * @return  size or 0 if header is not received yet
+ */
+uint32_t OtaStream_GetImageSize( ota_stream_t* stream );
+
+#endif
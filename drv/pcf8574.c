@@ -11,6 +11,11 @@ Please refer to LICENSE file for licensing information.
 
 #include "app_config.h"
 #include "driver/i2c.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "i2c_bus.h"
 
 #undef LOG
 #define LOG( ... )    // LOG( __VA_ARGS__)
@@ -21,8 +26,247 @@ Please refer to LICENSE file for licensing information.
 #define ACK_CHECK_EN  0x1 /*!< I2C master will check ack from slave*/
 #define LAST_NACK_VAL 0x2 /*!< I2C last_nack value */
 
+#ifndef CONFIG_PCF8574_TIMEOUT_MS
+#define CONFIG_PCF8574_TIMEOUT_MS 1000
+#endif
+
+#ifndef CONFIG_PCF8574_FLUSH_DELAY_MS
+#define CONFIG_PCF8574_FLUSH_DELAY_MS 1    // changes in this window are sent in one write
+#endif
+
+#define REQUEST_QUEUE_SIZE 8
+
+typedef enum
+{
+  PCF8574_REQ_FLUSH_DEFERRED,
+  PCF8574_REQ_FLUSH,
+  PCF8574_REQ_READ,
+} pcf8574_req_type_t;
+
+typedef struct
+{
+  pcf8574_req_type_t type;
+  uint8_t deviceid;
+  pcf8574_done_cb cb;
+  void* arg;
+} pcf8574_req_t;
+
 uint8_t pcf8574_pinstatus[PCF8574_MAXDEVICES];
 
+static uint8_t dirty_mask;
+static uint8_t flush_scheduled_mask;
+static uint8_t input_cache[PCF8574_MAXDEVICES];
+static TickType_t input_cache_time[PCF8574_MAXDEVICES];
+static uint8_t input_cache_valid_mask;
+static portMUX_TYPE shadow_lock = portMUX_INITIALIZER_UNLOCKED;
+static QueueHandle_t request_queue;
+static SemaphoreHandle_t flush_mutex;
+static SemaphoreHandle_t bus_dev_mutex;
+static i2c_bus_device_t bus_dev[PCF8574_MAXDEVICES];
+static uint8_t bus_dev_mask;
+
+/*
+ * shared bus device of deviceid, registered on first access so only used devices get bus contexts.
+ * Input reads have priority over display transfers on the same port
+ */
+static i2c_bus_device_t* _bus_device( uint8_t deviceid )
+{
+  if ( __atomic_load_n( &bus_dev_mask, __ATOMIC_ACQUIRE ) & ( 1 << deviceid ) )
+  {
+    return &bus_dev[deviceid];
+  }
+
+  if ( bus_dev_mutex == NULL )
+  {
+    return NULL;
+  }
+
+  xSemaphoreTake( bus_dev_mutex, portMAX_DELAY );
+  if ( !( bus_dev_mask & ( 1 << deviceid ) )
+       && I2CBus_AddDevice( &bus_dev[deviceid], PCF8574_I2C_PORT, "pcf8574", ( PCF8574_ADDRBASE >> 1 ) + deviceid, I2C_BUS_PRIO_HIGH, CONFIG_PCF8574_TIMEOUT_MS ) == ERROR_CODE_OK )
+  {
+    __atomic_or_fetch( &bus_dev_mask, 1 << deviceid, __ATOMIC_RELEASE );
+  }
+  xSemaphoreGive( bus_dev_mutex );
+
+  return ( bus_dev_mask & ( 1 << deviceid ) ) ? &bus_dev[deviceid] : NULL;
+}
+
+/*
+ * bus access
+ */
+static int _write( uint8_t deviceid, uint8_t data )
+{
+  i2c_bus_device_t* dev = _bus_device( deviceid );
+  if ( dev != NULL )
+  {
+    return I2CBus_Write( dev, &data, 1, 0 ) == ERROR_CODE_OK ? ESP_OK : ESP_FAIL;
+  }
+
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  i2c_master_start( cmd );
+  i2c_master_write_byte( cmd, ( PCF8574_ADDRBASE + ( deviceid << 1 ) ) | I2C_MASTER_WRITE, ACK_CHECK_EN );
+  i2c_master_write_byte( cmd, data, ACK_CHECK_EN );
+  i2c_master_stop( cmd );
+  int ret = i2c_master_cmd_begin( PCF8574_I2C_PORT, cmd, MS2ST( CONFIG_PCF8574_TIMEOUT_MS ) );
+  i2c_cmd_link_delete( cmd );
+  return ret;
+}
+
+static int _read( uint8_t deviceid, uint8_t* data )
+{
+  int ret = ESP_OK;
+  i2c_bus_device_t* dev = _bus_device( deviceid );
+  if ( dev != NULL )
+  {
+    ret = I2CBus_Read( dev, data, 1 ) == ERROR_CODE_OK ? ESP_OK : ESP_FAIL;
+  }
+  else
+  {
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_master_start( cmd );
+    i2c_master_write_byte( cmd, ( PCF8574_ADDRBASE + ( deviceid << 1 ) ) | I2C_MASTER_READ, ACK_CHECK_EN );
+    i2c_master_read( cmd, data, 1, LAST_NACK_VAL );
+    i2c_master_stop( cmd );
+    ret = i2c_master_cmd_begin( PCF8574_I2C_PORT, cmd, MS2ST( CONFIG_PCF8574_TIMEOUT_MS ) );
+    i2c_cmd_link_delete( cmd );
+  }
+
+  if ( ret == ESP_OK )
+  {
+    portENTER_CRITICAL( &shadow_lock );
+    input_cache[deviceid] = *data;
+    input_cache_time[deviceid] = xTaskGetTickCount();
+    input_cache_valid_mask |= 1 << deviceid;
+    portEXIT_CRITICAL( &shadow_lock );
+  }
+
+  return ret;
+}
+
+/*
+ * write shadow register of device if changed, all pin changes since last flush are sent at once.
+ * Snapshot and write are done under one mutex, so blocking flush and flush of task are not reordered
+ */
+static int _flush( uint8_t deviceid )
+{
+  xSemaphoreTake( flush_mutex, portMAX_DELAY );
+  portENTER_CRITICAL( &shadow_lock );
+  bool dirty = dirty_mask & ( 1 << deviceid );
+  uint8_t data = pcf8574_pinstatus[deviceid];
+  dirty_mask &= ~( 1 << deviceid );
+  portEXIT_CRITICAL( &shadow_lock );
+
+  int ret = dirty ? _write( deviceid, data ) : ESP_OK;
+  if ( ret != ESP_OK )
+  {
+    /* Try again with next flush */
+    portENTER_CRITICAL( &shadow_lock );
+    dirty_mask |= 1 << deviceid;
+    portEXIT_CRITICAL( &shadow_lock );
+  }
+  xSemaphoreGive( flush_mutex );
+
+  return ret;
+}
+
+static void _pcf8574_task( void* arg )
+{
+  pcf8574_req_t req;
+
+  while ( 1 )
+  {
+    if ( xQueueReceive( request_queue, &req, portMAX_DELAY ) != pdTRUE )
+    {
+      continue;
+    }
+
+    int ret = ESP_OK;
+    uint8_t data = 0;
+    switch ( req.type )
+    {
+      case PCF8574_REQ_FLUSH_DEFERRED:
+        /* Collect next changes of this tick */
+        vTaskDelay( MS2ST( CONFIG_PCF8574_FLUSH_DELAY_MS ) );
+        portENTER_CRITICAL( &shadow_lock );
+        flush_scheduled_mask &= ~( 1 << req.deviceid );
+        portEXIT_CRITICAL( &shadow_lock );
+        ret = _flush( req.deviceid );
+        break;
+
+      case PCF8574_REQ_FLUSH:
+        ret = _flush( req.deviceid );
+        data = pcf8574_pinstatus[req.deviceid];
+        break;
+
+      case PCF8574_REQ_READ:
+        ret = _read( req.deviceid, &data );
+        break;
+    }
+
+    LOG( "pcf8574 req %d dev %d status %d\n", req.type, req.deviceid, ret );
+    if ( req.cb != NULL )
+    {
+      req.cb( req.deviceid, ret, data, req.arg );
+    }
+  }
+}
+
+static int _send_request( pcf8574_req_type_t type, uint8_t deviceid, pcf8574_done_cb cb, void* arg )
+{
+  if ( request_queue == NULL )
+  {
+    return -1;
+  }
+
+  pcf8574_req_t req = { .type = type, .deviceid = deviceid, .cb = cb, .arg = arg };
+  return xQueueSend( request_queue, &req, 0 ) == pdTRUE ? ESP_OK : -1;
+}
+
+/*
+ * update shadow register, write is deferred
+ */
+static void _shadow_update( uint8_t deviceid, uint8_t mask, uint8_t data )
+{
+  bool schedule = false;
+
+  portENTER_CRITICAL( &shadow_lock );
+  uint8_t b = ( pcf8574_pinstatus[deviceid] & ~mask ) | ( data & mask );
+  if ( b != pcf8574_pinstatus[deviceid] )
+  {
+    pcf8574_pinstatus[deviceid] = b;
+    dirty_mask |= 1 << deviceid;
+    if ( !( flush_scheduled_mask & ( 1 << deviceid ) ) )
+    {
+      flush_scheduled_mask |= 1 << deviceid;
+      schedule = true;
+    }
+  }
+  portEXIT_CRITICAL( &shadow_lock );
+
+  if ( schedule && _send_request( PCF8574_REQ_FLUSH_DEFERRED, deviceid, NULL, NULL ) != ESP_OK )
+  {
+    /* Stays dirty, sent with next flush */
+    portENTER_CRITICAL( &shadow_lock );
+    flush_scheduled_mask &= ~( 1 << deviceid );
+    portEXIT_CRITICAL( &shadow_lock );
+  }
+}
+
+/*
+ * pins mask of pinstart, pinlength range
+ */
+static bool _pins_mask( uint8_t pinstart, uint8_t pinlength, uint8_t* mask )
+{
+  if ( pinstart >= PCF8574_MAXPINS || pinlength == 0 || pinlength > pinstart + 1 )
+  {
+    return false;
+  }
+
+  *mask = ( ( 1 << pinlength ) - 1 ) << ( pinstart - pinlength + 1 );
+  return true;
+}
+
 /*
  * initialize
  */
@@ -32,6 +276,29 @@ void pcf8574_init()
   uint8_t i = 0;
   for ( i = 0; i < PCF8574_MAXDEVICES; i++ )
     pcf8574_pinstatus[i] = 0;
+
+  dirty_mask = 0;
+  input_cache_valid_mask = 0;
+
+  if ( flush_mutex == NULL )
+  {
+    flush_mutex = xSemaphoreCreateMutex();
+    assert( flush_mutex );
+  }
+
+  // devices are registered on shared bus of PCF8574_I2C_PORT on first access
+  if ( bus_dev_mutex == NULL )
+  {
+    bus_dev_mutex = xSemaphoreCreateMutex();
+    assert( bus_dev_mutex );
+  }
+
+  if ( request_queue == NULL )
+  {
+    request_queue = xQueueCreate( REQUEST_QUEUE_SIZE, sizeof( pcf8574_req_t ) );
+    assert( request_queue );
+    xTaskCreate( _pcf8574_task, "pcf8574", 2048, NULL, NORMALPRIO, NULL );
+  }
 }
 
 /*
@@ -68,16 +335,11 @@ uint8_t pcf8574_setoutput( uint8_t deviceid, uint8_t data )
 {
   if ( ( deviceid < PCF8574_MAXDEVICES ) )
   {
+    portENTER_CRITICAL( &shadow_lock );
     pcf8574_pinstatus[deviceid] = data;
-    int ret;
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start( cmd );
-    i2c_master_write_byte( cmd, PCF8574_ADDRBASE | I2C_MASTER_WRITE, ACK_CHECK_EN );
-    i2c_master_write_byte( cmd, data, ACK_CHECK_EN );
-    i2c_master_stop( cmd );
-    ret = i2c_master_cmd_begin( PCF8574_I2C_PORT, cmd, MS2ST( 1000 ) );
-    i2c_cmd_link_delete( cmd );
-    return ret;
+    dirty_mask |= 1 << deviceid;
+    portEXIT_CRITICAL( &shadow_lock );
+    return _flush( deviceid );
   }
   return -1;
 }
@@ -93,26 +355,15 @@ uint8_t pcf8574_setoutputpins( uint8_t deviceid, uint8_t pinstart, uint8_t pinle
   // pinstart                    4
   // data                        101   (pinlength 3)
   // result                 0b01110110
-  if ( ( deviceid < PCF8574_MAXDEVICES ) && ( pinstart - pinlength + 1 >= 0 && pinstart - pinlength + 1 >= 0 && pinstart < PCF8574_MAXPINS && pinstart > 0 && pinlength > 0 ) )
-  {
-    uint8_t b = 0;
-    b = pcf8574_pinstatus[deviceid];
-    uint8_t mask = ( ( 1 << pinlength ) - 1 ) << ( pinstart - pinlength + 1 );
-    data <<= ( pinstart - pinlength + 1 );
-    data &= mask;
-    b &= ~( mask );
-    b |= data;
-    pcf8574_pinstatus[deviceid] = b;
+  uint8_t mask = 0;
+  if ( ( deviceid < PCF8574_MAXDEVICES ) && _pins_mask( pinstart, pinlength, &mask ) )
+  {
+    portENTER_CRITICAL( &shadow_lock );
+    pcf8574_pinstatus[deviceid] = ( pcf8574_pinstatus[deviceid] & ~mask ) | ( ( data << ( pinstart - pinlength + 1 ) ) & mask );
+    dirty_mask |= 1 << deviceid;
+    portEXIT_CRITICAL( &shadow_lock );
     // update device
-    int ret;
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start( cmd );
-    i2c_master_write_byte( cmd, PCF8574_ADDRBASE | I2C_MASTER_WRITE, ACK_CHECK_EN );
-    i2c_master_write_byte( cmd, b, ACK_CHECK_EN );
-    i2c_master_stop( cmd );
-    ret = i2c_master_cmd_begin( PCF8574_I2C_PORT, cmd, MS2ST( 1000 ) );
-    i2c_cmd_link_delete( cmd );
-    return ret;
+    return _flush( deviceid );
   }
   return -1;
 }
@@ -124,20 +375,13 @@ uint8_t pcf8574_setoutputpin( uint8_t deviceid, uint8_t pin, uint8_t data )
 {
   if ( ( deviceid < PCF8574_MAXDEVICES ) && ( pin < PCF8574_MAXPINS ) )
   {
-    uint8_t b = 0;
-    b = pcf8574_pinstatus[deviceid];
-    b = ( data != 0 ) ? ( b | ( 1 << pin ) ) : ( b & ~( 1 << pin ) );
-    pcf8574_pinstatus[deviceid] = b;
+    portENTER_CRITICAL( &shadow_lock );
+    uint8_t b = pcf8574_pinstatus[deviceid];
+    pcf8574_pinstatus[deviceid] = ( data != 0 ) ? ( b | ( 1 << pin ) ) : ( b & ~( 1 << pin ) );
+    dirty_mask |= 1 << deviceid;
+    portEXIT_CRITICAL( &shadow_lock );
     // update device
-    int ret;
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start( cmd );
-    i2c_master_write_byte( cmd, PCF8574_ADDRBASE | I2C_MASTER_WRITE, ACK_CHECK_EN );
-    i2c_master_write_byte( cmd, b, ACK_CHECK_EN );
-    i2c_master_stop( cmd );
-    ret = i2c_master_cmd_begin( PCF8574_I2C_PORT, cmd, MS2ST( 1000 ) );
-    i2c_cmd_link_delete( cmd );
-    return ret;
+    return _flush( deviceid );
   }
   return -1;
 }
@@ -163,17 +407,10 @@ uint8_t pcf8574_setoutputpinlow( uint8_t deviceid, uint8_t pin )
  */
 int pcf8574_getinput( uint8_t deviceid )
 {
-  int data = 0;
+  uint8_t data = 0;
   if ( ( deviceid < PCF8574_MAXDEVICES ) )
   {
-    int ret;
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start( cmd );
-    i2c_master_write_byte( cmd, PCF8574_ADDRBASE | I2C_MASTER_READ, ACK_CHECK_EN );
-    i2c_master_read( cmd, (uint8_t*) &data, 1, LAST_NACK_VAL );
-    i2c_master_stop( cmd );
-    ret = i2c_master_cmd_begin( PCF8574_I2C_PORT, cmd, MS2ST( 1000 ) );
-    i2c_cmd_link_delete( cmd );
+    int ret = _read( deviceid, &data );
     if ( ret != ESP_OK )
     {
       // LOG("i2c status %d\n", ret);
@@ -184,14 +421,14 @@ int pcf8574_getinput( uint8_t deviceid )
 }
 
 /*
- * get input pin (up or low)
+ * get input pin (up or low), reading pins one by one reuses input read in last CONFIG_PCF8574_READ_STALE_MS
  */
 uint8_t pcf8574_getinputpin( uint8_t deviceid, uint8_t pin )
 {
   uint8_t data = -1;
   if ( ( deviceid < PCF8574_MAXDEVICES ) && ( pin < PCF8574_MAXPINS ) )
   {
-    data = pcf8574_getinput( deviceid );
+    data = pcf8574_getinput_cached( deviceid, CONFIG_PCF8574_READ_STALE_MS );
     if ( data != 255 )
     {
       data = ( data >> pin ) & 0b00000001;
@@ -199,3 +436,91 @@ uint8_t pcf8574_getinputpin( uint8_t deviceid, uint8_t pin )
   }
   return data;
 }
+
+/*
+ * shadow register: set output, write is deferred
+ */
+void pcf8574_shadow_setoutput( uint8_t deviceid, uint8_t data )
+{
+  if ( deviceid < PCF8574_MAXDEVICES )
+  {
+    _shadow_update( deviceid, 0xFF, data );
+  }
+}
+
+/*
+ * shadow register: set output pins, write is deferred
+ */
+void pcf8574_shadow_setoutputpins( uint8_t deviceid, uint8_t pinstart, uint8_t pinlength, uint8_t data )
+{
+  uint8_t mask = 0;
+  if ( ( deviceid < PCF8574_MAXDEVICES ) && _pins_mask( pinstart, pinlength, &mask ) )
+  {
+    _shadow_update( deviceid, mask, data << ( pinstart - pinlength + 1 ) );
+  }
+}
+
+/*
+ * shadow register: set output pin, write is deferred
+ */
+void pcf8574_shadow_setoutputpin( uint8_t deviceid, uint8_t pin, uint8_t data )
+{
+  if ( ( deviceid < PCF8574_MAXDEVICES ) && ( pin < PCF8574_MAXPINS ) )
+  {
+    _shadow_update( deviceid, 1 << pin, data ? 0xFF : 0 );
+  }
+}
+
+/*
+ * shadow register: write pending changes now, blocking if cb is NULL
+ */
+int pcf8574_flush( uint8_t deviceid, pcf8574_done_cb cb, void* arg )
+{
+  if ( deviceid >= PCF8574_MAXDEVICES )
+  {
+    return -1;
+  }
+
+  if ( cb == NULL )
+  {
+    return _flush( deviceid );
+  }
+
+  return _send_request( PCF8574_REQ_FLUSH, deviceid, cb, arg );
+}
+
+/*
+ * get input data, bus is read only if cached value is older than max_age_ms
+ */
+int pcf8574_getinput_cached( uint8_t deviceid, uint32_t max_age_ms )
+{
+  if ( deviceid >= PCF8574_MAXDEVICES )
+  {
+    return -1;
+  }
+
+  portENTER_CRITICAL( &shadow_lock );
+  bool valid = ( input_cache_valid_mask & ( 1 << deviceid ) ) && ( xTaskGetTickCount() - input_cache_time[deviceid] <= MS2ST( max_age_ms ) );
+  uint8_t data = input_cache[deviceid];
+  portEXIT_CRITICAL( &shadow_lock );
+
+  if ( valid )
+  {
+    return data;
+  }
+
+  return pcf8574_getinput( deviceid );
+}
+
+/*
+ * get input data without blocking, cb is called from pcf8574 task
+ */
+int pcf8574_getinput_async( uint8_t deviceid, pcf8574_done_cb cb, void* arg )
+{
+  if ( deviceid >= PCF8574_MAXDEVICES || cb == NULL )
+  {
+    return -1;
+  }
+
+  return _send_request( PCF8574_REQ_READ, deviceid, cb, arg );
+}
@@ -17,6 +17,13 @@ Please refer to LICENSE file for licensing information.
 #define PCF8574_MAXDEVICES 8    //max devices, depends on address (3 bit)
 #define PCF8574_MAXPINS    8    //max pin per device
 
+#ifndef CONFIG_PCF8574_READ_STALE_MS
+#define CONFIG_PCF8574_READ_STALE_MS 20    //default max age of cached input
+#endif
+
+//async completion, called from pcf8574 task; data is input for read, output for flush
+typedef void ( *pcf8574_done_cb )( uint8_t deviceid, int result, uint8_t data, void* arg );
+
 //pin status
 extern uint8_t pcf8574_pinstatus[PCF8574_MAXDEVICES];
 
@@ -31,4 +38,12 @@ extern uint8_t pcf8574_setoutputpinhigh( uint8_t deviceid, uint8_t pin );
 extern uint8_t pcf8574_setoutputpinlow( uint8_t deviceid, uint8_t pin );
 extern int pcf8574_getinput( uint8_t deviceid );
 extern uint8_t pcf8574_getinputpin( uint8_t deviceid, uint8_t pin );
+
+//shadow register functions, changes are combined and written by pcf8574 task
+extern void pcf8574_shadow_setoutput( uint8_t deviceid, uint8_t data );
+extern void pcf8574_shadow_setoutputpins( uint8_t deviceid, uint8_t pinstart, uint8_t pinlength, uint8_t data );
+extern void pcf8574_shadow_setoutputpin( uint8_t deviceid, uint8_t pin, uint8_t data );
+extern int pcf8574_flush( uint8_t deviceid, pcf8574_done_cb cb, void* arg );
+extern int pcf8574_getinput_cached( uint8_t deviceid, uint32_t max_age_ms );
+extern int pcf8574_getinput_async( uint8_t deviceid, pcf8574_done_cb cb, void* arg );
 #endif
@@ -0,0 +1,257 @@
+/**
+ *******************************************************************************
+ * @file    scheduler.c
+ * @author  Dmytro Shevchenko
+ * @brief   Shared periodic and one-shot job scheduler source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "scheduler.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "app_config.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* Private macros ------------------------------------------------------------*/
+
+#define MODULE_NAME "[Sched] "
+#define DEBUG_LVL   PRINT_INFO
+
+#if CONFIG_DEBUG_SCHEDULER
+#define LOG( _lvl, ... ) \
+  debug_printf( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
+#else
+#define LOG( PRINT_INFO, ... )
+#endif
+
+#ifndef CONFIG_SCHEDULER_STACK_SIZE
+#define CONFIG_SCHEDULER_STACK_SIZE 4096
+#endif
+
+#ifndef CONFIG_SCHEDULER_PRIORITY
+#define CONFIG_SCHEDULER_PRIORITY 13
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+
+static TaskHandle_t task_handle;
+static bool is_task_created;
+static scheduler_job_t* deadline_list;
+static scheduler_job_t* registered_list;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Private functions ---------------------------------------------------------*/
+
+static bool _is_before( uint32_t a, uint32_t b )
+{
+  return (int32_t) ( a - b ) < 0;
+}
+
+/* Called in critical section */
+static void _remove( scheduler_job_t* job )
+{
+  scheduler_job_t** it = &deadline_list;
+  while ( *it != NULL )
+  {
+    if ( *it == job )
+    {
+      *it = job->next;
+      break;
+    }
+    it = &( *it )->next;
+  }
+
+  job->next = NULL;
+  job->active = false;
+}
+
+/* Called in critical section, return true if job is new head */
+static bool _insert( scheduler_job_t* job )
+{
+  scheduler_job_t** it = &deadline_list;
+  while ( *it != NULL && !_is_before( job->deadline, ( *it )->deadline ) )
+  {
+    it = &( *it )->next;
+  }
+
+  job->next = *it;
+  *it = job;
+  job->active = true;
+  return deadline_list == job;
+}
+
+static void _run( scheduler_job_t* job, uint32_t deadline )
+{
+  uint32_t jitter_ms = ST2MS( xTaskGetTickCount() - deadline );
+  int64_t start = esp_timer_get_time();
+
+  job->cb( job->arg );
+
+  uint32_t run_time_us = (uint32_t) ( esp_timer_get_time() - start );
+
+  portENTER_CRITICAL( &lock );
+  job->stats.runs++;
+  job->stats.jitter_sum_ms += jitter_ms;
+  job->stats.run_time_sum_us += run_time_us;
+  if ( jitter_ms > job->stats.jitter_max_ms )
+  {
+    job->stats.jitter_max_ms = jitter_ms;
+  }
+  if ( run_time_us > job->stats.run_time_max_us )
+  {
+    job->stats.run_time_max_us = run_time_us;
+  }
+  portEXIT_CRITICAL( &lock );
+}
+
+static void _scheduler_task( void* arg )
+{
+  while ( 1 )
+  {
+    TickType_t sleep = portMAX_DELAY;
+    scheduler_job_t* job = NULL;
+    uint32_t deadline = 0;
+
+    portENTER_CRITICAL( &lock );
+    uint32_t now = xTaskGetTickCount();
+    if ( deadline_list != NULL )
+    {
+      if ( _is_before( now, deadline_list->deadline ) )
+      {
+        sleep = deadline_list->deadline - now;
+      }
+      else
+      {
+        job = deadline_list;
+        deadline = job->deadline;
+        _remove( job );
+        if ( job->period_ms != 0 )
+        {
+          /* Keep period without drift, skip runs missed by long delay */
+          job->deadline += MS2ST( job->period_ms );
+          if ( !_is_before( now, job->deadline ) )
+          {
+            job->deadline = now + MS2ST( job->period_ms );
+          }
+          _insert( job );
+        }
+      }
+    }
+    portEXIT_CRITICAL( &lock );
+
+    if ( job != NULL )
+    {
+      _run( job, deadline );
+      continue;
+    }
+
+    /* Woken up by notification when new job becomes first */
+    ulTaskNotifyTake( pdTRUE, sleep );
+  }
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+void Scheduler_AddJob( scheduler_job_t* job, const char* name, scheduler_job_cb cb, void* arg )
+{
+  assert( job );
+  assert( cb );
+
+  bool create_task = false;
+  memset( job, 0, sizeof( scheduler_job_t ) );
+  job->name = name;
+  job->cb = cb;
+  job->arg = arg;
+
+  portENTER_CRITICAL( &lock );
+  job->next_registered = registered_list;
+  registered_list = job;
+  if ( !is_task_created )
+  {
+    is_task_created = true;
+    create_task = true;
+  }
+  portEXIT_CRITICAL( &lock );
+
+  if ( create_task )
+  {
+    xTaskCreate( _scheduler_task, "scheduler", CONFIG_SCHEDULER_STACK_SIZE, NULL, CONFIG_SCHEDULER_PRIORITY, &task_handle );
+    assert( task_handle );
+  }
+}
+
+void Scheduler_Start( scheduler_job_t* job, uint32_t delay_ms, uint32_t period_ms )
+{
+  assert( job );
+  assert( job->cb );
+
+  portENTER_CRITICAL( &lock );
+  if ( job->active )
+  {
+    _remove( job );
+  }
+  job->period_ms = period_ms;
+  job->deadline = xTaskGetTickCount() + MS2ST( delay_ms );
+  bool is_first = _insert( job );
+  TaskHandle_t handle = task_handle;
+  portEXIT_CRITICAL( &lock );
+
+  /* Task not created yet checks list on start */
+  if ( is_first && handle != NULL && handle != xTaskGetCurrentTaskHandle() )
+  {
+    xTaskNotifyGive( handle );
+  }
+}
+
+void Scheduler_Stop( scheduler_job_t* job )
+{
+  assert( job );
+
+  /* Task wakes up at old deadline of first job, finds nothing and sleeps again */
+  portENTER_CRITICAL( &lock );
+  if ( job->active )
+  {
+    _remove( job );
+  }
+  portEXIT_CRITICAL( &lock );
+}
+
+bool Scheduler_IsActive( scheduler_job_t* job )
+{
+  assert( job );
+  return job->active;
+}
+
+void Scheduler_GetStats( scheduler_job_t* job, scheduler_job_stats_t* stats )
+{
+  assert( job );
+  assert( stats );
+  portENTER_CRITICAL( &lock );
+  *stats = job->stats;
+  portEXIT_CRITICAL( &lock );
+}
+
+void Scheduler_LogStats( void )
+{
+  /* Stack is shared by all jobs, only task minimum is meaningful */
+  if ( task_handle != NULL )
+  {
+    printf( MODULE_NAME "stack free min %u\n\r", (unsigned) uxTaskGetStackHighWaterMark( task_handle ) );
+  }
+  for ( scheduler_job_t* job = registered_list; job != NULL; job = job->next_registered )
+  {
+    scheduler_job_stats_t stats;
+    Scheduler_GetStats( job, &stats );
+    uint32_t runs = stats.runs ? stats.runs : 1;
+    printf( MODULE_NAME "%-12s runs %u jitter avg %u max %u ms, time avg %u max %u us\n\r",
+            job->name, (unsigned) stats.runs, (unsigned) ( stats.jitter_sum_ms / runs ), (unsigned) stats.jitter_max_ms,
+            (unsigned) ( stats.run_time_sum_us / runs ), (unsigned) stats.run_time_max_us );
+  }
+}
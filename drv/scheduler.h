@@ -0,0 +1,89 @@
+/**
+ *******************************************************************************
+ * @file    scheduler.h
+ * @author  Dmytro Shevchenko
+ * @brief   Shared periodic and one-shot job scheduler header file.
+ *          Jobs are run by one task from deadline ordered list, task sleeps
+ *          until nearest deadline.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Public types --------------------------------------------------------------*/
+
+typedef void ( *scheduler_job_cb )( void* arg );
+
+typedef struct
+{
+  uint32_t runs;
+  uint32_t jitter_max_ms;    // delay of start after deadline
+  uint64_t jitter_sum_ms;
+  uint32_t run_time_max_us;
+  uint64_t run_time_sum_us;
+} scheduler_job_stats_t;
+
+typedef struct scheduler_job
+{
+  const char* name;
+  scheduler_job_cb cb;
+  void* arg;
+  uint32_t period_ms;    // 0 for one-shot job
+  uint32_t deadline;    // ticks
+  bool active;
+  scheduler_job_stats_t stats;
+  struct scheduler_job* next;    // deadline list
+  struct scheduler_job* next_registered;
+} scheduler_job_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Register job. Scheduler task is started with first job.
+ * @param   [in] job - job context, must be valid all the time
+ * @param   [in] name - name for statistics
+ * @param   [in] cb - job function, must return quickly, blocking delays other jobs
+ * @param   [in] arg - job function argument
+ */
+void Scheduler_AddJob( scheduler_job_t* job, const char* name, scheduler_job_cb cb, void* arg );
+
+/**
+ * @brief   Start or restart job.
+ * @param   [in] job - job context
+ * @param   [in] delay_ms - time to first run
+ * @param   [in] period_ms - period of next runs, 0 for one-shot
+ */
+void Scheduler_Start( scheduler_job_t* job, uint32_t delay_ms, uint32_t period_ms );
+
+/**
+ * @brief   Stop job.
+ * @param   [in] job - job context
+ */
+void Scheduler_Stop( scheduler_job_t* job );
+
+/**
+ * @brief   Check if job waits for run.
+ * @param   [in] job - job context
+ * @return  true if active
+ */
+bool Scheduler_IsActive( scheduler_job_t* job );
+
+/**
+ * @brief   Get copy of job statistics.
+ * @param   [in] job - job context
+ * @param   [out] stats - statistics
+ */
+void Scheduler_GetStats( scheduler_job_t* job, scheduler_job_stats_t* stats );
+
+/**
+ * @brief   Print statistics of all jobs to console, also without CONFIG_DEBUG_SCHEDULER.
+ */
+void Scheduler_LogStats( void );
+
+#endif
@@ -0,0 +1,55 @@
+/**
+ *******************************************************************************
+ * @file    sha256.h
+ * @author  Dmytro Shevchenko
+ * @brief   SHA-256 header file. Platform independent, context is plain data
+ *          so it can be stored and hashing resumed later.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Public macro --------------------------------------------------------------*/
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE  64
+
+/* Public types --------------------------------------------------------------*/
+
+typedef struct
+{
+  uint32_t state[8];
+  uint64_t length;
+  uint8_t buffer[SHA256_BLOCK_SIZE];
+} sha256_ctx_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Init hash context.
+ * @param   [in] ctx - hash context
+ */
+void Sha256_Init( sha256_ctx_t* ctx );
+
+/**
+ * @brief   Add data to hash.
+ * @param   [in] ctx - hash context
+ * @param   [in] data - data
+ * @param   [in] len - data length
+ */
+void Sha256_Update( sha256_ctx_t* ctx, const uint8_t* data, size_t len );
+
+/**
+ * @brief   Finish hash.
+ * @param   [in] ctx - hash context
+ * @param   [out] digest - SHA256_DIGEST_SIZE bytes
+ */
+void Sha256_Final( sha256_ctx_t* ctx, uint8_t* digest );
+
+#endif
@@ -11,7 +11,7 @@
 #include "esp_wifi.h"
 #include "freertos/semphr.h"
 #include "keepalive.h"
-#include "oled.h"
+#include "oled_cmd.h"
 #include "wifidrv.h"
 
 #define MODULE_NAME "[SLEEP] "
@@ -25,6 +25,7 @@
 #endif
 
 #define WAKE_UP_PIN 12
+#define OLED_CLEAR_WAIT_MS 200
 
 typedef enum
 {
@@ -56,6 +57,8 @@ void go_to_wake_up( void )
 
 static void sleep_task( void* arg )
 {
+  uint32_t oled_ticket = 0;
+
   while ( 1 )
   {
     switch ( sleep_state )
@@ -87,9 +90,15 @@ static void sleep_task( void* arg )
         esp_sleep_enable_gpio_wakeup();
         gpio_wakeup_enable( WAKE_UP_PIN, GPIO_INTR_LOW_LEVEL );
         esp_wifi_stop();
-        oled_clearScreen();
-        oled_update();
-        BUZZER_OFF();
+        /* Display is owned by menu task, screen must be dark before sleep */
+        if ( OledCmd_Clear() == ERROR_CODE_OK && OledCmd_Update( &oled_ticket ) == ERROR_CODE_OK )
+        {
+          for ( int i = 0; i < OLED_CLEAR_WAIT_MS / 10 && !OledCmd_IsDone( oled_ticket ); i++ )
+          {
+            vTaskDelay( MS2ST( 10 ) );
+          }
+        }
+        Buzzer_Stop();
         esp_light_sleep_start();
         vTaskDelay( MS2ST( 3000 ) );
         if ( sleep_signal == 0 )
@@ -121,9 +130,7 @@ static void sleep_task( void* arg )
           LOG( PRINT_INFO, "cmdClientConnect or wifiDrvConnected error" );
         }
 
-        BUZZER_ON();
-        vTaskDelay( MS2ST( 100 ) );
-        BUZZER_OFF();
+        buzzer_click();
 
         if ( sleep_signal == 0 )
         {
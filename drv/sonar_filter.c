@@ -0,0 +1,138 @@
+/**
+ *******************************************************************************
+ * @file    sonar_filter.c
+ * @author  Dmytro Shevchenko
+ * @brief   Ultrasonic sensor frame parser and distance filters source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "sonar_filter.h"
+
+#include <assert.h>
+#include <string.h>
+
+/* Private functions ---------------------------------------------------------*/
+
+static bool _finish_frame( sonar_parser_t* parser, uint16_t* value )
+{
+  uint16_t data = ( parser->data_h << 8 ) | parser->data_l;
+
+  parser->state = SONAR_PARSER_STATE_HEADER;
+  if ( data > parser->max_value )
+  {
+    parser->errors++;
+    return false;
+  }
+
+  parser->frames++;
+  *value = data;
+  return true;
+}
+
+static uint16_t _median( const uint16_t* tab, uint32_t len )
+{
+  uint16_t sorted[SONAR_MEDIAN_SIZE];
+
+  memcpy( sorted, tab, len * sizeof( uint16_t ) );
+  for ( uint32_t i = 1; i < len; i++ )
+  {
+    uint16_t key = sorted[i];
+    int32_t j = i - 1;
+    while ( j >= 0 && sorted[j] > key )
+    {
+      sorted[j + 1] = sorted[j];
+      j--;
+    }
+    sorted[j + 1] = key;
+  }
+
+  return sorted[len / 2];
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+void SonarParser_Init( sonar_parser_t* parser, bool use_checksum, uint16_t max_value )
+{
+  assert( parser );
+  memset( parser, 0, sizeof( sonar_parser_t ) );
+  parser->state = SONAR_PARSER_STATE_HEADER;
+  parser->use_checksum = use_checksum;
+  parser->max_value = max_value;
+}
+
+bool SonarParser_Feed( sonar_parser_t* parser, uint8_t byte, uint16_t* value )
+{
+  assert( parser );
+  assert( value );
+
+  switch ( parser->state )
+  {
+    case SONAR_PARSER_STATE_HEADER:
+      if ( byte == SONAR_FRAME_HEADER )
+      {
+        parser->state = SONAR_PARSER_STATE_DATA_H;
+      }
+      break;
+
+    case SONAR_PARSER_STATE_DATA_H:
+      parser->data_h = byte;
+      parser->state = SONAR_PARSER_STATE_DATA_L;
+      break;
+
+    case SONAR_PARSER_STATE_DATA_L:
+      parser->data_l = byte;
+      if ( !parser->use_checksum )
+      {
+        return _finish_frame( parser, value );
+      }
+      parser->state = SONAR_PARSER_STATE_CHECKSUM;
+      break;
+
+    case SONAR_PARSER_STATE_CHECKSUM:
+      if ( (uint8_t) ( SONAR_FRAME_HEADER + parser->data_h + parser->data_l ) == byte )
+      {
+        return _finish_frame( parser, value );
+      }
+
+      parser->errors++;
+      /* Resynchronize, wrong byte can be header of next frame */
+      parser->state = ( byte == SONAR_FRAME_HEADER ) ? SONAR_PARSER_STATE_DATA_H : SONAR_PARSER_STATE_HEADER;
+      break;
+
+    default:
+      parser->state = SONAR_PARSER_STATE_HEADER;
+      break;
+  }
+
+  return false;
+}
+
+void SonarFilter_Init( sonar_filter_t* filter )
+{
+  assert( filter );
+  memset( filter, 0, sizeof( sonar_filter_t ) );
+}
+
+uint32_t SonarFilter_Add( sonar_filter_t* filter, uint16_t sample )
+{
+  assert( filter );
+
+  filter->median_tab[filter->median_cnt % SONAR_MEDIAN_SIZE] = sample;
+  filter->median_cnt++;
+  uint32_t median_len = filter->median_cnt < SONAR_MEDIAN_SIZE ? filter->median_cnt : SONAR_MEDIAN_SIZE;
+  uint16_t median = _median( filter->median_tab, median_len );
+
+  uint32_t pos = filter->average_cnt % SONAR_AVERAGE_SIZE;
+  if ( filter->average_cnt >= SONAR_AVERAGE_SIZE )
+  {
+    filter->average_sum -= filter->average_tab[pos];
+  }
+  filter->average_tab[pos] = median;
+  filter->average_sum += median;
+  filter->average_cnt++;
+
+  uint32_t average_len = filter->average_cnt < SONAR_AVERAGE_SIZE ? filter->average_cnt : SONAR_AVERAGE_SIZE;
+  return filter->average_sum / average_len;
+}
@@ -0,0 +1,89 @@
+/**
+ *******************************************************************************
+ * @file    sonar_filter.h
+ * @author  Dmytro Shevchenko
+ * @brief   Ultrasonic sensor frame parser and distance filters header file.
+ *          Platform independent.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _SONAR_FILTER_H_
+#define _SONAR_FILTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Public macro --------------------------------------------------------------*/
+
+#define SONAR_FRAME_HEADER   0xFF
+#define SONAR_MEDIAN_SIZE    5
+#define SONAR_AVERAGE_SIZE   32
+
+/* Public types --------------------------------------------------------------*/
+
+typedef enum
+{
+  SONAR_PARSER_STATE_HEADER,
+  SONAR_PARSER_STATE_DATA_H,
+  SONAR_PARSER_STATE_DATA_L,
+  SONAR_PARSER_STATE_CHECKSUM,
+} sonar_parser_state_t;
+
+typedef struct
+{
+  sonar_parser_state_t state;
+  uint8_t data_h;
+  uint8_t data_l;
+  bool use_checksum;
+  uint16_t max_value;
+  uint32_t frames;
+  uint32_t errors;
+} sonar_parser_t;
+
+typedef struct
+{
+  uint16_t median_tab[SONAR_MEDIAN_SIZE];
+  uint16_t average_tab[SONAR_AVERAGE_SIZE];
+  uint32_t median_cnt;
+  uint32_t average_cnt;
+  uint32_t average_sum;
+} sonar_filter_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Init frame parser. Frame: 0xFF, data H, data L [, checksum].
+ * @param   [in] parser - parser context
+ * @param   [in] use_checksum - frame contain checksum byte
+ * @param   [in] max_value - values above are dropped
+ */
+void SonarParser_Init( sonar_parser_t* parser, bool use_checksum, uint16_t max_value );
+
+/**
+ * @brief   Feed parser with received byte. State is kept between calls,
+ *          so frame can be split between UART reads.
+ * @param   [in] parser - parser context
+ * @param   [in] byte - received byte
+ * @param   [out] value - parsed value
+ * @return  true if frame completed and value is valid
+ */
+bool SonarParser_Feed( sonar_parser_t* parser, uint8_t byte, uint16_t* value );
+
+/**
+ * @brief   Init distance filter.
+ * @param   [in] filter - filter context
+ */
+void SonarFilter_Init( sonar_filter_t* filter );
+
+/**
+ * @brief   Add sample. Median of last SONAR_MEDIAN_SIZE samples rejects outliers,
+ *          result is averaged by running sum of SONAR_AVERAGE_SIZE medians.
+ * @param   [in] filter - filter context
+ * @param   [in] sample - measured distance
+ * @return  filtered distance
+ */
+uint32_t SonarFilter_Add( sonar_filter_t* filter, uint16_t sample );
+
+#endif
@@ -0,0 +1,184 @@
+/**
+ *******************************************************************************
+ * @file    ui_trace.c
+ * @author  Dmytro Shevchenko
+ * @brief   Input to display latency trace source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "ui_trace.h"
+
+#include <stdio.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <time.h>
+#define IRAM_ATTR
+#endif
+
+/* Private macros ------------------------------------------------------------*/
+
+#define TRACE_MASK      ( CONFIG_UI_TRACE_SIZE - 1 )
+#define DUMP_CHUNK_SIZE 32
+#define DUMP_STACK_SIZE 3072
+
+#if ( CONFIG_UI_TRACE_SIZE & TRACE_MASK ) != 0
+#error "CONFIG_UI_TRACE_SIZE must be power of 2"
+#endif
+
+/* Private types -------------------------------------------------------------*/
+
+/* seq is position + 1 of written record, 0 while record is written */
+typedef struct
+{
+  uint32_t seq;
+  ui_trace_record_t record;
+} trace_slot_t;
+
+typedef struct
+{
+  trace_slot_t slots[CONFIG_UI_TRACE_SIZE];
+  uint32_t head;
+  uint32_t tail;
+  uint32_t lost;
+  uint32_t stalled;    ///< tail + 1 of slot which was not finished on last read
+} ui_trace_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+static ui_trace_t trace;
+static uint32_t dumped_lost;
+
+/* Private functions ---------------------------------------------------------*/
+
+static inline uint32_t IRAM_ATTR _time_us( void )
+{
+#ifdef ESP_PLATFORM
+  return (uint32_t) esp_timer_get_time();
+#else
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint32_t) ( ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000 );
+#endif
+}
+
+#ifdef ESP_PLATFORM
+static void _dump_task( void* arg )
+{
+  while ( 1 )
+  {
+    vTaskDelay( pdMS_TO_TICKS( CONFIG_UI_TRACE_DUMP_MS ) );
+    UiTrace_Dump();
+  }
+}
+#endif
+
+/* Public functions ---------------------------------------------------------*/
+
+/* Writers of interrupt, tasks and other core only take own position, nobody waits */
+void IRAM_ATTR UiTrace_Point( uint16_t id, uint16_t arg )
+{
+  uint32_t pos = __atomic_fetch_add( &trace.head, 1, __ATOMIC_RELAXED );
+  trace_slot_t* slot = &trace.slots[pos & TRACE_MASK];
+
+  __atomic_store_n( &slot->seq, 0, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+  slot->record.time_us = _time_us();
+  slot->record.id = id;
+  slot->record.arg = arg;
+  __atomic_store_n( &slot->seq, pos + 1, __ATOMIC_RELEASE );
+}
+
+uint32_t UiTrace_Read( ui_trace_record_t* records, uint32_t max )
+{
+  uint32_t head = __atomic_load_n( &trace.head, __ATOMIC_ACQUIRE );
+  uint32_t count = 0;
+
+  if ( head - trace.tail > CONFIG_UI_TRACE_SIZE )
+  {
+    trace.lost += head - trace.tail - CONFIG_UI_TRACE_SIZE;
+    trace.tail = head - CONFIG_UI_TRACE_SIZE;
+  }
+
+  while ( trace.tail != head && count < max )
+  {
+    trace_slot_t* slot = &trace.slots[trace.tail & TRACE_MASK];
+    uint32_t seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+
+    /* Writer of this position is not finished yet (preempted), rest is read next time.
+     * Slot still not finished on next read was left by writer overtaken by one from next lap */
+    if ( seq == 0 || (int32_t) ( seq - ( trace.tail + 1 ) ) < 0 )
+    {
+      if ( trace.stalled != trace.tail + 1 )
+      {
+        trace.stalled = trace.tail + 1;
+        break;
+      }
+
+      trace.lost++;
+      trace.tail++;
+      continue;
+    }
+
+    ui_trace_record_t record = slot->record;
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    if ( seq != trace.tail + 1 || __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) != seq )
+    {
+      trace.lost++;
+    }
+    else
+    {
+      records[count++] = record;
+    }
+    trace.tail++;
+  }
+
+  return count;
+}
+
+uint32_t UiTrace_GetLost( void )
+{
+  return trace.lost;
+}
+
+void UiTrace_Dump( void )
+{
+  ui_trace_record_t records[DUMP_CHUNK_SIZE];
+  uint32_t count;
+  uint32_t total = 0;
+
+  while ( ( count = UiTrace_Read( records, DUMP_CHUNK_SIZE ) ) > 0 )
+  {
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+      printf( UI_TRACE_DUMP_TAG " %u %u %u\n", (unsigned) records[i].time_us, records[i].id, records[i].arg );
+    }
+    total += count;
+  }
+
+  /* Analyzer sums lost lines of all dumps */
+  uint32_t lost = UiTrace_GetLost();
+  if ( total > 0 || lost != dumped_lost )
+  {
+    printf( UI_TRACE_DUMP_TAG " lost %u\n", (unsigned) ( lost - dumped_lost ) );
+    dumped_lost = lost;
+  }
+}
+
+void UiTrace_StartDump( void )
+{
+#ifdef ESP_PLATFORM
+  static TaskHandle_t dump_task;
+
+  if ( dump_task == NULL )
+  {
+    xTaskCreate( _dump_task, "ui_trace", DUMP_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1, &dump_task );
+  }
+#endif
+}
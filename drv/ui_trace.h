@@ -0,0 +1,109 @@
+/**
+ *******************************************************************************
+ * @file    ui_trace.h
+ * @author  Dmytro Shevchenko
+ * @brief   Input to display latency trace header file.
+ *
+ *          Trace point stores only timestamp, id and one argument in ring
+ *          buffer, oldest records are overwritten. Points are in button
+ *          interrupt and callback dispatch (but.c), menu state change and
+ *          render (menu_drv.c) and display flush (oled.c). UiTrace_Dump prints
+ *          records as "UITRACE <time_us> <id> <arg>" lines, tools/ui_latency.c
+ *          reads them from monitor log and computes latency of interactions.
+ *          Points are compiled only with CONFIG_UI_TRACE.
+ *
+ *          Capture: build with CONFIG_UI_TRACE 1, menu driver starts dump task
+ *          which prints new records every CONFIG_UI_TRACE_DUMP_MS. Save
+ *          console, e.g. "idf.py monitor | tee monitor.log", use buttons and
+ *          run "tools/ui_latency monitor.log".
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _UI_TRACE_H_
+#define _UI_TRACE_H_
+
+#include <stdint.h>
+
+/* Public macro --------------------------------------------------------------*/
+
+#ifndef CONFIG_UI_TRACE
+#define CONFIG_UI_TRACE 0
+#endif
+
+/* Count of records, must be power of 2 */
+#ifndef CONFIG_UI_TRACE_SIZE
+#define CONFIG_UI_TRACE_SIZE 512
+#endif
+
+#ifndef CONFIG_UI_TRACE_DUMP_MS
+#define CONFIG_UI_TRACE_DUMP_MS 1000
+#endif
+
+#define UI_TRACE_DUMP_TAG "UITRACE"
+
+#if CONFIG_UI_TRACE
+#define UI_TRACE( _id, _arg ) UiTrace_Point( _id, _arg )
+#else
+#define UI_TRACE( _id, _arg )
+#endif
+
+/* Public types --------------------------------------------------------------*/
+
+/* Ids are part of dump format, add new ids at the end */
+typedef enum
+{
+  UI_TRACE_BUTTON_EDGE = 1,    ///< arg: button index
+  UI_TRACE_BUTTON_CB,    ///< arg: button index | but_event_type_t << 8
+  UI_TRACE_MENU_STATE,    ///< arg: new menu state
+  UI_TRACE_RENDER_START,
+  UI_TRACE_RENDER_END,
+  UI_TRACE_FLUSH_START,
+  UI_TRACE_FLUSH_END,    ///< arg: sent bytes, 0 if frame was not changed
+  UI_TRACE_ID_LAST,
+} ui_trace_id_t;
+
+typedef struct
+{
+  uint32_t time_us;
+  uint16_t id;
+  uint16_t arg;
+} ui_trace_record_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Store trace point, can be called from interrupt. Use UI_TRACE macro.
+ * @param   [in] id - ui_trace_id_t
+ * @param   [in] arg - point argument
+ */
+void UiTrace_Point( uint16_t id, uint16_t arg );
+
+/**
+ * @brief   Read records written since last read, oldest first.
+ * @param   [out] records - records buffer
+ * @param   [in] max - records buffer size
+ * @return  count of read records
+ */
+uint32_t UiTrace_Read( ui_trace_record_t* records, uint32_t max );
+
+/**
+ * @brief   Get count of records overwritten before they were read.
+ * @return  lost records
+ */
+uint32_t UiTrace_GetLost( void );
+
+/**
+ * @brief   Print records written since last read to stdout, for tools/ui_latency.c.
+ *          Lost count is printed as difference to previous dump, only if something changed.
+ */
+void UiTrace_Dump( void );
+
+/**
+ * @brief   Start low priority task calling UiTrace_Dump every CONFIG_UI_TRACE_DUMP_MS.
+ *          Only on ESP platform, console output may block, so it is not done in caller task.
+ */
+void UiTrace_StartDump( void );
+
+#endif
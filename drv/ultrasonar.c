@@ -4,21 +4,47 @@
 #include "driver/gpio.h"
 #include "driver/uart.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "history.h"
+#include "sonar_filter.h"
+
+#define MODULE_NAME "[SONAR] "
+#define DEBUG_LVL   PRINT_INFO
+
+#if CONFIG_DEBUG_ULTRASONAR
+#define LOG( _lvl, ... ) \
+  debug_printf( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
+#else
+#define LOG( PRINT_INFO, ... )
+#endif
+
+/* 3 byte frames without checksum by default, boards with checksum sensor set it to 1 */
+#ifndef CONFIG_ULTRASONAR_CHECKSUM
+#define CONFIG_ULTRASONAR_CHECKSUM 0
+#endif
 
 #define ECHO_UART_PORT_NUM UART_NUM_1
 #define RX_PIN             16
 #define TX_PIN             17
 
-#define FILTERED_TABLE_SIZE 32
+#define UART_RX_BUFFER_SIZE    ( 1024 * 2 )
+#define UART_EVENT_QUEUE_SIZE  8
+#define UART_RX_TIMEOUT_SYMB   3    // data event after 3 bytes of silence, frame end
+#define MAX_DISTANCE           3100
+#define DISCONNECT_TIMEOUT_MS  750
 
-static uint8_t read_buff[1024];
-static uint16_t read_data;
+static uint8_t read_buff[128];
 static uint32_t distance;
-static uint16_t filtered_tab[FILTERED_TABLE_SIZE];
-static uint32_t tab_iterator;
 static bool silos_is_connected;
-static uint8_t bad_read_data_count;
+static TickType_t last_frame_time;
+static QueueHandle_t uart_queue;
+static sonar_parser_t parser;
+static sonar_filter_t filter;
+static history_t history;
+static uint8_t history_buffer[HISTORY_DEFAULT_BUFFER_SIZE];
+static SemaphoreHandle_t history_mutex;
 
 static void uart_init( void )
 {
@@ -37,56 +63,78 @@ static void uart_init( void )
   intr_alloc_flags = ESP_INTR_FLAG_IRAM;
 #endif
 
-  ESP_ERROR_CHECK( uart_driver_install( ECHO_UART_PORT_NUM, 1024 * 2, 0, 0, NULL, intr_alloc_flags ) );
+  ESP_ERROR_CHECK( uart_driver_install( ECHO_UART_PORT_NUM, UART_RX_BUFFER_SIZE, 0, UART_EVENT_QUEUE_SIZE, &uart_queue, intr_alloc_flags ) );
   ESP_ERROR_CHECK( uart_param_config( ECHO_UART_PORT_NUM, &uart_config ) );
   ESP_ERROR_CHECK( uart_set_pin( ECHO_UART_PORT_NUM, TX_PIN, RX_PIN, -1, -1 ) );
+  ESP_ERROR_CHECK( uart_set_rx_timeout( ECHO_UART_PORT_NUM, UART_RX_TIMEOUT_SYMB ) );
 }
 
-static void sonar_task( void* arg )
+static void _new_sample( uint16_t sample )
 {
-  while ( 1 )
+  distance = SonarFilter_Add( &filter, sample );
+  last_frame_time = xTaskGetTickCount();
+  silos_is_connected = true;
+  LOG( PRINT_DEBUG, "Read data %d distance %d", sample, distance );
+
+  xSemaphoreTake( history_mutex, portMAX_DELAY );
+  History_Add( &history, (int32_t) distance, ST2MS( last_frame_time ) );
+  xSemaphoreGive( history_mutex );
+}
+
+static void _read_data( size_t size )
+{
+  while ( size > 0 )
   {
-    bool is_correct_readed = false;
-    // Read data from the UART
-    int len = uart_read_bytes( ECHO_UART_PORT_NUM, read_buff, sizeof( read_buff ), MS2ST( 20 ) );
+    int len = uart_read_bytes( ECHO_UART_PORT_NUM, read_buff, size < sizeof( read_buff ) ? size : sizeof( read_buff ), 0 );
+    if ( len <= 0 )
+    {
+      return;
+    }
 
     for ( int i = 0; i < len; i++ )
     {
-      if ( ( read_buff[i] == 0xFF ) && ( i + 2 < len ) )
+      uint16_t sample = 0;
+      if ( SonarParser_Feed( &parser, read_buff[i], &sample ) )
       {
-        read_data = ( read_buff[i + 1] << 8 ) | ( read_buff[i + 2] );
-
-        if ( read_data > 3100 )
-        {
-          continue;
-        }
-
-        i += 2;
-        filtered_tab[tab_iterator++ % FILTERED_TABLE_SIZE] = read_data;
-        for ( uint32_t j = 0; j < FILTERED_TABLE_SIZE; j++ )
-        {
-          distance += filtered_tab[j];
-        }
-
-        distance = distance / FILTERED_TABLE_SIZE;
-        printf( "[SONAR] Read data %d\n\r", read_data );
-        is_correct_readed = true;
+        _new_sample( sample );
       }
     }
-    if ( is_correct_readed )
-    {
-      silos_is_connected = is_correct_readed;
-      bad_read_data_count = 0;
-    }
-    else
+
+    size -= len;
+  }
+}
+
+static void sonar_task( void* arg )
+{
+  uart_event_t event;
+
+  while ( 1 )
+  {
+    if ( xQueueReceive( uart_queue, &event, MS2ST( DISCONNECT_TIMEOUT_MS ) ) == pdTRUE )
     {
-      if ( bad_read_data_count++ > 5 )
+      switch ( event.type )
       {
-        silos_is_connected = is_correct_readed;
+        case UART_DATA:
+          _read_data( event.size );
+          break;
+
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+          LOG( PRINT_WARNING, "UART overflow %d", event.type );
+          uart_flush_input( ECHO_UART_PORT_NUM );
+          xQueueReset( uart_queue );
+          SonarParser_Init( &parser, CONFIG_ULTRASONAR_CHECKSUM, MAX_DISTANCE );
+          break;
+
+        default:
+          break;
       }
     }
 
-    osDelay( 100 );
+    if ( xTaskGetTickCount() - last_frame_time > MS2ST( DISCONNECT_TIMEOUT_MS ) )
+    {
+      silos_is_connected = false;
+    }
   }
 }
 
@@ -100,8 +148,21 @@ uint32_t ultrasonar_get_distance( void )
   return distance;
 }
 
+size_t ultrasonar_get_history( uint8_t level, history_sample_t* out, size_t count )
+{
+  xSemaphoreTake( history_mutex, portMAX_DELAY );
+  size_t result = History_GetWindow( &history, level, out, count );
+  xSemaphoreGive( history_mutex );
+  return result;
+}
+
 void ultrasonar_start( void )
 {
+  const history_level_cfg_t history_cfg[] = HISTORY_DEFAULT_LEVELS;
+  History_Init( &history, history_buffer, sizeof( history_buffer ), history_cfg, HISTORY_DEFAULT_LEVELS_CNT );
+  history_mutex = xSemaphoreCreateMutex();
+  SonarParser_Init( &parser, CONFIG_ULTRASONAR_CHECKSUM, MAX_DISTANCE );
+  SonarFilter_Init( &filter );
   uart_init();
   xTaskCreate( sonar_task, "sonar_task", 4096, NULL, 10, NULL );
 }
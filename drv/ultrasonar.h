@@ -1,9 +1,11 @@
 #ifndef _ULTRASONAR_H_
 #define _ULTRASONAR_H_
 #include "app_config.h"
+#include "history.h"
 
 void ultrasonar_start( void );
 uint32_t ultrasonar_get_distance( void );
 bool ultrasonar_is_connected( void );
+size_t ultrasonar_get_history( uint8_t level, history_sample_t* out, size_t count );
 
 #endif
\ No newline at end of file
@@ -12,6 +12,8 @@
 
 #include "app_config.h"
 #include "driver/gpio.h"
+#include "driver/pulse_cnt.h"
+#include "freertos/semphr.h"
 #include "freertos/timers.h"
 
 /* Private macros ------------------------------------------------------------*/
@@ -25,9 +27,28 @@
 #define LOG( PRINT_INFO, ... )
 #endif
 
+/* Backend used by WaterFlowSensor_Init, selected in Kconfig */
+#ifdef CONFIG_WATER_FLOW_SENSOR_BACKEND_PCNT
+#define DEFAULT_BACKEND WATER_FLOW_SENSOR_BACKEND_PCNT
+#else
+#define DEFAULT_BACKEND WATER_FLOW_SENSOR_BACKEND_GPIO_ISR
+#endif
+
+#ifndef CONFIG_WATER_FLOW_SENSOR_SAMPLE_MS
+#define CONFIG_WATER_FLOW_SENSOR_SAMPLE_MS 1000
+#endif
+
+/* PCNT has no interrupt per pulse, idle sensor is only checked less often */
+#ifndef CONFIG_WATER_FLOW_SENSOR_IDLE_SAMPLE_MS
+#define CONFIG_WATER_FLOW_SENSOR_IDLE_SAMPLE_MS 10000
+#endif
+
 #define ARRAY_SIZE( _array ) sizeof( _array ) / sizeof( _array[0] )
 #define SHORT_PERIOD_MS      10000
 #define LONG_PERIOD_MS       60000
+#define PCNT_HIGH_LIMIT      32767
+#define PCNT_LOW_LIMIT       -1
+#define PCNT_GLITCH_NS       1000
 
 /* Private functions declaration ---------------------------------------------*/
 
@@ -49,25 +70,13 @@ static void IRAM_ATTR gpio_isr_handler( void* arg )
 {
   water_flow_sensor_t* dev = (water_flow_sensor_t*) arg;
   dev->counter++;
-  dev->value_cl = WATER_FLOW_CONVERT_L_TO_CL( dev->counter ) / dev->pulses_per_liter;
-  if ( dev->state != WATER_FLOW_SENSOR_STATE_IDLE )
-  {
-    portBASE_TYPE HPTaskAwoken = pdFALSE;
-    if ( dev->state == WATER_FLOW_SENSOR_STATE_NO_WATER_LONG_PERIOD || dev->state == WATER_FLOW_SENSOR_STATE_NO_WATER_SHORT_PERIOD )
-    {
-      dev->state = WATER_FLOW_SENSOR_STATE_START_MEASURE;
-      dev->event_cb( WATER_FLOW_SENSOR_EVENT_WATER_FLOW_BACK, 0 );
-      xTimerChangePeriodFromISR( dev->timer, MS2ST( SHORT_PERIOD_MS ), &HPTaskAwoken );
-      xTimerStartFromISR( dev->timer, &HPTaskAwoken );
-    }
-    else
-    {
-      xTimerResetFromISR( dev->timer, &HPTaskAwoken );
-    }
-  }
-  if ( dev->value_cl >= WATER_FLOW_CONVERT_L_TO_CL( dev->alert_value_l ) )
+
+  /* First pulse of idle sensor starts sampling again */
+  if ( !dev->is_sampling )
   {
-    dev->event_cb( WATER_FLOW_SENSOR_EVENT_ALERT_VALUE, dev->value_cl );
+    BaseType_t woken = pdFALSE;
+    dev->is_sampling = xTimerStartFromISR( (TimerHandle_t) dev->timer, &woken ) == pdPASS;
+    portYIELD_FROM_ISR( woken );
   }
 }
 
@@ -85,9 +94,8 @@ static void _set_reset( void* user_data, bool value )
   WaterFlowSensor_ResetValue( dev );
 }
 
-static void _init_sensor( water_flow_sensor_t* dev )
+static void _init_sensor_gpio_isr( water_flow_sensor_t* dev )
 {
-  static bool is_interrupt_installed = false;
   gpio_config_t io_conf = {};
   io_conf.intr_type = GPIO_INTR_POSEDGE;
   io_conf.pin_bit_mask = ( 1ULL << dev->pin );
@@ -97,34 +105,126 @@ static void _init_sensor( water_flow_sensor_t* dev )
   gpio_config( &io_conf );
   gpio_set_intr_type( dev->pin, GPIO_INTR_POSEDGE );
 
-  if ( is_interrupt_installed == false )
+  /* Service can be installed by other driver */
+  esp_err_t err = gpio_install_isr_service( 0 );
+  assert( err == ESP_OK || err == ESP_ERR_INVALID_STATE );
+
+  gpio_isr_handler_add( dev->pin, gpio_isr_handler, (void*) dev );
+}
+
+static void _init_sensor_pcnt( water_flow_sensor_t* dev )
+{
+  pcnt_unit_config_t unit_config = {
+    .high_limit = PCNT_HIGH_LIMIT,
+    .low_limit = PCNT_LOW_LIMIT,
+    .flags.accum_count = 1,
+  };
+  pcnt_unit_handle_t unit = NULL;
+  ESP_ERROR_CHECK( pcnt_new_unit( &unit_config, &unit ) );
+  dev->pcnt_unit = (void*) unit;
+
+  pcnt_glitch_filter_config_t filter_config = {
+    .max_glitch_ns = PCNT_GLITCH_NS,
+  };
+  ESP_ERROR_CHECK( pcnt_unit_set_glitch_filter( unit, &filter_config ) );
+
+  pcnt_chan_config_t chan_config = {
+    .edge_gpio_num = dev->pin,
+    .level_gpio_num = -1,
+  };
+  pcnt_channel_handle_t channel = NULL;
+  ESP_ERROR_CHECK( pcnt_new_channel( unit, &chan_config, &channel ) );
+  dev->pcnt_channel = (void*) channel;
+  ESP_ERROR_CHECK( pcnt_channel_set_edge_action( channel, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_HOLD ) );
+  gpio_pullup_en( dev->pin );
+
+  /* Counter is cleared on high limit, driver accumulates overflows */
+  ESP_ERROR_CHECK( pcnt_unit_add_watch_point( unit, PCNT_HIGH_LIMIT ) );
+  ESP_ERROR_CHECK( pcnt_unit_enable( unit ) );
+  ESP_ERROR_CHECK( pcnt_unit_clear_count( unit ) );
+  ESP_ERROR_CHECK( pcnt_unit_start( unit ) );
+}
+
+static uint32_t _read_counter( water_flow_sensor_t* dev )
+{
+  if ( dev->backend == WATER_FLOW_SENSOR_BACKEND_PCNT )
   {
-    gpio_install_isr_service( 0 );
-    is_interrupt_installed = true;
+    int count = 0;
+    pcnt_unit_get_count( (pcnt_unit_handle_t) dev->pcnt_unit, &count );
+    dev->counter = (uint32_t) count;
   }
 
-  gpio_isr_handler_add( dev->pin, gpio_isr_handler, (void*) dev );
+  return dev->counter;
 }
 
-static void vTimerCallback( TimerHandle_t xTimer )
+/* Called from timer task or measure start, GPIO interrupt only starts timer */
+static void _set_sampling( water_flow_sensor_t* dev, bool is_sampling )
 {
-  water_flow_sensor_t* dev = (water_flow_sensor_t*) pvTimerGetTimerID( xTimer );
-  printf( "vTimerCallback\n" );
+  if ( dev->backend == WATER_FLOW_SENSOR_BACKEND_PCNT )
+  {
+    dev->is_sampling = is_sampling;
+    xTimerChangePeriod( (TimerHandle_t) dev->timer, MS2ST( is_sampling ? CONFIG_WATER_FLOW_SENSOR_SAMPLE_MS : CONFIG_WATER_FLOW_SENSOR_IDLE_SAMPLE_MS ), 0 );
+    return;
+  }
+
+  if ( is_sampling )
+  {
+    dev->is_sampling = true;
+    xTimerStart( (TimerHandle_t) dev->timer, 0 );
+  }
+  else
+  {
+    /* Stop is queued before flag is cleared, start from interrupt after it is not lost */
+    xTimerStop( (TimerHandle_t) dev->timer, 0 );
+    dev->is_sampling = false;
+  }
+}
+
+static void _change_state( water_flow_sensor_t* dev, water_flow_sensor_state_t state, uint32_t time_ms )
+{
+  dev->state = state;
+  dev->state_time_ms = time_ms;
+}
+
+static void _process_state( water_flow_sensor_t* dev, uint32_t new_pulses, uint32_t time_ms )
+{
+  uint32_t state_time_ms = time_ms - dev->state_time_ms;
+  uint32_t idle_time_ms = FlowRate_GetIdleTime( &dev->rate, time_ms );
+
+  if ( idle_time_ms > state_time_ms )
+  {
+    idle_time_ms = state_time_ms;
+  }
 
   switch ( dev->state )
   {
     case WATER_FLOW_SENSOR_STATE_START_MEASURE:
-      dev->state = WATER_FLOW_SENSOR_STATE_NO_WATER_SHORT_PERIOD;
-      dev->event_cb( WATER_FLOW_SENSOR_EVENT_NO_WATER_SHORT_PERIOD, 0 );
-      assert( xTimerChangePeriod( xTimer, MS2ST( LONG_PERIOD_MS ), 0 ) == pdPASS );
-      assert( xTimerStart( xTimer, 0 ) == pdPASS );
+      if ( idle_time_ms >= SHORT_PERIOD_MS )
+      {
+        _change_state( dev, WATER_FLOW_SENSOR_STATE_NO_WATER_SHORT_PERIOD, time_ms );
+        dev->event_cb( WATER_FLOW_SENSOR_EVENT_NO_WATER_SHORT_PERIOD, 0 );
+      }
       break;
 
     case WATER_FLOW_SENSOR_STATE_NO_WATER_SHORT_PERIOD:
-      dev->state = WATER_FLOW_SENSOR_STATE_NO_WATER_LONG_PERIOD;
-      dev->event_cb( WATER_FLOW_SENSOR_EVENT_NO_WATER_LONG_PERIOD, 0 );
-      assert( xTimerChangePeriod( xTimer, MS2ST( LONG_PERIOD_MS ), 0 ) == pdPASS );
-      assert( xTimerStart( xTimer, 0 ) == pdPASS );
+      if ( new_pulses > 0 )
+      {
+        _change_state( dev, WATER_FLOW_SENSOR_STATE_START_MEASURE, time_ms );
+        dev->event_cb( WATER_FLOW_SENSOR_EVENT_WATER_FLOW_BACK, 0 );
+      }
+      else if ( state_time_ms >= LONG_PERIOD_MS )
+      {
+        _change_state( dev, WATER_FLOW_SENSOR_STATE_NO_WATER_LONG_PERIOD, time_ms );
+        dev->event_cb( WATER_FLOW_SENSOR_EVENT_NO_WATER_LONG_PERIOD, 0 );
+      }
+      break;
+
+    case WATER_FLOW_SENSOR_STATE_NO_WATER_LONG_PERIOD:
+      if ( new_pulses > 0 )
+      {
+        _change_state( dev, WATER_FLOW_SENSOR_STATE_START_MEASURE, time_ms );
+        dev->event_cb( WATER_FLOW_SENSOR_EVENT_WATER_FLOW_BACK, 0 );
+      }
       break;
 
     default:
@@ -132,30 +232,89 @@ static void vTimerCallback( TimerHandle_t xTimer )
   }
 }
 
+static void vTimerCallback( TimerHandle_t xTimer )
+{
+  water_flow_sensor_t* dev = (water_flow_sensor_t*) pvTimerGetTimerID( xTimer );
+  uint32_t time_ms = ST2MS( xTaskGetTickCount() );
+  uint32_t new_pulses = FlowRate_Update( &dev->rate, _read_counter( dev ), time_ms );
+
+  dev->value_cl = dev->rate.total_cl;
+  _process_state( dev, new_pulses, time_ms );
+
+  /* Timer task also runs button and buzzer timers, sample is skipped while history is read */
+  if ( xSemaphoreTake( (SemaphoreHandle_t) dev->history_mutex, 0 ) == pdTRUE )
+  {
+    History_Add( &dev->history, (int32_t) dev->rate.rate_cl_min, time_ms );
+    xSemaphoreGive( (SemaphoreHandle_t) dev->history_mutex );
+  }
+
+  if ( FlowRate_CheckAlert( &dev->rate ) )
+  {
+    dev->event_cb( WATER_FLOW_SENSOR_EVENT_ALERT_VALUE, dev->value_cl );
+  }
+
+  /* Nothing flows and no measure waits for timeout, history fills missing time with empty buckets */
+  bool is_idle = dev->state == WATER_FLOW_SENSOR_STATE_IDLE && new_pulses == 0 && dev->rate.rate_cl_min == 0;
+  if ( is_idle == dev->is_sampling )
+  {
+    _set_sampling( dev, !is_idle );
+  }
+}
+
 /* Public functions ---------------------------------------------------------*/
 
 void WaterFlowSensor_Init( water_flow_sensor_t* dev, const char* name, uint32_t pulses_per_liter, water_flow_sensor_event_cb event_cb, uint8_t pin )
+{
+  WaterFlowSensor_InitWithBackend( dev, name, pulses_per_liter, event_cb, pin, DEFAULT_BACKEND );
+}
+
+void WaterFlowSensor_InitWithBackend( water_flow_sensor_t* dev, const char* name, uint32_t pulses_per_liter, water_flow_sensor_event_cb event_cb, uint8_t pin,
+                                      water_flow_sensor_backend_t backend )
 {
   assert( dev );
   assert( pulses_per_liter > 0 );
+  assert( backend < WATER_FLOW_SENSOR_BACKEND_LAST );
   dev->name = name;
   dev->event_cb = event_cb;
   dev->pin = pin;
   dev->pulses_per_liter = pulses_per_liter;
   dev->alert_value_l = UINT32_MAX;
   dev->state = WATER_FLOW_SENSOR_STATE_IDLE;
-  _init_sensor( dev );
+  dev->backend = backend;
+  dev->is_sampling = false;
+  FlowRate_Init( &dev->rate, pulses_per_liter );
+
+  const history_level_cfg_t history_cfg[] = HISTORY_DEFAULT_LEVELS;
+  History_Init( &dev->history, dev->history_buffer, sizeof( dev->history_buffer ), history_cfg, HISTORY_DEFAULT_LEVELS_CNT );
+  dev->history_mutex = (void*) xSemaphoreCreateMutex();
+  assert( dev->history_mutex );
+
+  /* Timer exists before first pulse interrupt */
   dev->timer = (void*) xTimerCreate( "Timer",
-                                     MS2ST( SHORT_PERIOD_MS ),
-                                     pdFALSE,
+                                     MS2ST( CONFIG_WATER_FLOW_SENSOR_SAMPLE_MS ),
+                                     pdTRUE,
                                      (void*) dev,
                                      vTimerCallback );
+  assert( dev->timer );
+
+  if ( backend == WATER_FLOW_SENSOR_BACKEND_PCNT )
+  {
+    _init_sensor_pcnt( dev );
+  }
+  else
+  {
+    _init_sensor_gpio_isr( dev );
+  }
+
+  FlowRate_Update( &dev->rate, _read_counter( dev ), ST2MS( xTaskGetTickCount() ) );
+  _set_sampling( dev, true );
 }
 
 error_code_t WaterFlowSensor_SetAlertValue( water_flow_sensor_t* dev, uint32_t alert_value )
 {
   assert( dev );
   dev->alert_value_l = alert_value;
+  FlowRate_SetAlert( &dev->rate, alert_value );
   return ERROR_CODE_OK;
 }
 
@@ -163,9 +322,8 @@ error_code_t WaterFlowSensor_ResetValue( water_flow_sensor_t* dev )
 {
   assert( dev );
   dev->value_cl = 0;
-  dev->counter = 0; 
   dev->state = WATER_FLOW_SENSOR_STATE_IDLE;
-  assert( xTimerStop( dev->timer, 0 ) == pdPASS );
+  FlowRate_Reset( &dev->rate );
   return ERROR_CODE_OK;
 }
 
@@ -173,9 +331,11 @@ error_code_t WaterFlowSensor_StartMeasure( water_flow_sensor_t* dev )
 {
   assert( dev );
   dev->value_cl = 0;
-  dev->state = WATER_FLOW_SENSOR_STATE_START_MEASURE;
-  assert( xTimerChangePeriod( dev->timer, MS2ST( SHORT_PERIOD_MS ), 0 ) == pdPASS );
-  assert( xTimerStart( dev->timer, 0 ) == pdPASS );
+  _change_state( dev, WATER_FLOW_SENSOR_STATE_START_MEASURE, ST2MS( xTaskGetTickCount() ) );
+  if ( !dev->is_sampling )
+  {
+    _set_sampling( dev, true );
+  }
   return ERROR_CODE_OK;
 }
 
@@ -183,7 +343,6 @@ error_code_t WaterFlowSensor_StopMeasure( water_flow_sensor_t* dev )
 {
   assert( dev );
   dev->state = WATER_FLOW_SENSOR_STATE_IDLE;
-  xTimerStop( dev->timer, 0 );
   return ERROR_CODE_OK;
 }
 
@@ -193,10 +352,27 @@ uint32_t WaterFlowSensor_GetValue( water_flow_sensor_t* dev )
   return dev->value_cl;
 }
 
+uint32_t WaterFlowSensor_GetFlowRate( water_flow_sensor_t* dev )
+{
+  assert( dev );
+  return dev->rate.rate_cl_min;
+}
+
+size_t WaterFlowSensor_GetHistory( water_flow_sensor_t* dev, uint8_t level, history_sample_t* out, size_t count )
+{
+  assert( dev );
+  assert( out );
+  xSemaphoreTake( (SemaphoreHandle_t) dev->history_mutex, portMAX_DELAY );
+  size_t result = History_GetWindow( &dev->history, level, out, count );
+  xSemaphoreGive( (SemaphoreHandle_t) dev->history_mutex );
+  return result;
+}
+
 void WaterFlowSensor_SetPulsesPerLiter( water_flow_sensor_t* dev, uint32_t pulses_per_liter )
 {
   assert( pulses_per_liter > 0 );
   dev->pulses_per_liter = pulses_per_liter;
+  FlowRate_SetPulsesPerLiter( &dev->rate, pulses_per_liter );
 }
 
 size_t WaterFlowSensor_GetStr( water_flow_sensor_t* dev, char* buffer, size_t buffer_size, bool is_add_comma )
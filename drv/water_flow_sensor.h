@@ -16,6 +16,8 @@
 #include <stdlib.h>
 
 #include "error_code.h"
+#include "flow_rate.h"
+#include "history.h"
 
 /* Public macro --------------------------------------------------------------*/
 
@@ -42,6 +44,13 @@ typedef enum
   WATER_FLOW_SENSOR_EVENT_LAST
 } water_flow_sensor_event_t;
 
+typedef enum
+{
+  WATER_FLOW_SENSOR_BACKEND_GPIO_ISR,    // count pulses in GPIO interrupt
+  WATER_FLOW_SENSOR_BACKEND_PCNT,    // count pulses in PCNT peripheral, no interrupt per pulse
+  WATER_FLOW_SENSOR_BACKEND_LAST
+} water_flow_sensor_backend_t;
+
 typedef void ( *water_flow_sensor_event_cb )( water_flow_sensor_event_t event, uint32_t value );
 
 typedef struct
@@ -54,7 +63,16 @@ typedef struct
   uint32_t alert_value_l;
   uint8_t pin;
   void* timer;
+  volatile bool is_sampling;    // timer runs with sample period, false when sensor is idle
   water_flow_sensor_state_t state;
+  water_flow_sensor_backend_t backend;
+  void* pcnt_unit;
+  void* pcnt_channel;
+  flow_rate_t rate;
+  uint32_t state_time_ms;
+  history_t history;    // flow rate history in centi litre per minute
+  uint8_t history_buffer[HISTORY_DEFAULT_BUFFER_SIZE];
+  void* history_mutex;
 } water_flow_sensor_t;
 
 /* Public functions ----------------------------------------------------------*/
@@ -69,6 +87,18 @@ typedef struct
  */
 void WaterFlowSensor_Init( water_flow_sensor_t* dev, const char* name, uint32_t pulses_per_liter, water_flow_sensor_event_cb event_cb, uint8_t pin );
 
+/**
+ * @brief   Init input device with selected pulse counting backend.
+ * @param   [in] dev - device pointer driver
+ * @param   [in] name - sensor name
+ * @param   [in] pulses_per_liter - pulses per liter
+ * @param   [in] event_cb - alert callback
+ * @param   [in] pin - GPIO number
+ * @param   [in] backend - pulse counting backend
+ */
+void WaterFlowSensor_InitWithBackend( water_flow_sensor_t* dev, const char* name, uint32_t pulses_per_liter, water_flow_sensor_event_cb event_cb, uint8_t pin,
+                                      water_flow_sensor_backend_t backend );
+
 /**
  * @brief   Water flow sensor reset value.
  * @param   [in] dev - device pointer driver
@@ -104,6 +134,23 @@ error_code_t WaterFlowSensor_SetAlertValue( water_flow_sensor_t* dev, uint32_t a
  */
 uint32_t WaterFlowSensor_GetValue( water_flow_sensor_t* dev );
 
+/**
+ * @brief   Water flow sensor get instantaneous flow rate.
+ * @param   [in] dev - device pointer driver
+ * @return  flow rate in centi liters per minute
+ */
+uint32_t WaterFlowSensor_GetFlowRate( water_flow_sensor_t* dev );
+
+/**
+ * @brief   Water flow sensor get flow rate history.
+ * @param   [in] dev - device pointer driver
+ * @param   [in] level - history level (0 - 1 s, 1 - 1 min, 2 - 1 h buckets)
+ * @param   [out] out - buffer for buckets, oldest first
+ * @param   [in] count - max count of buckets
+ * @return  count of copied buckets
+ */
+size_t WaterFlowSensor_GetHistory( water_flow_sensor_t* dev, uint8_t level, history_sample_t* out, size_t count );
+
 /**
  * @brief   Water flow sensor set pulses per liter.
  * @param   [in] dev - device pointer driver
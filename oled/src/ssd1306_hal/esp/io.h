@@ -74,6 +74,14 @@ static inline int  analogRead(int pin)    // analogRead()
 
 uint32_t millis(void);
 
+/**
+ * Session of i2c interface (start, send..., stop) is sent by this function if set,
+ * so display can share bus with other devices. addr is 7-bit address, first byte
+ * of data is control byte.
+ */
+typedef int (*ssd1306_platform_i2cTransfer_t)(uint8_t addr, const uint8_t *data, uint16_t len);
+void ssd1306_platform_i2cSetTransfer(ssd1306_platform_i2cTransfer_t transfer);
+
 static inline uint32_t micros(void)       // micros()
 {
     return 0;
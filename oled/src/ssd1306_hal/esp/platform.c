@@ -87,28 +87,55 @@ void delay( uint32_t ms )    // delay()
 static uint8_t s_i2c_addr = 0x3C;
 static int8_t s_bus_id;
 
-static i2c_cmd_handle_t s_cmd_handle;
+// Whole start/stop session is collected and sent as one write instead of byte by byte
+#define I2C_BUFFER_SIZE 1040
+static uint8_t s_i2c_buffer[I2C_BUFFER_SIZE];
+static uint16_t s_i2c_len;
+static ssd1306_platform_i2cTransfer_t s_transfer;
+
+static void platform_i2c_flush( void )
+{
+  if ( s_transfer != NULL )
+  {
+    s_transfer( s_i2c_addr, s_i2c_buffer, s_i2c_len );
+    return;
+  }
+
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  i2c_master_start( cmd );
+  i2c_master_write_byte( cmd, ( s_i2c_addr << 1 ) | I2C_MASTER_WRITE, 0x1 );
+  i2c_master_write( cmd, s_i2c_buffer, s_i2c_len, 0x1 );
+  i2c_master_stop( cmd );
+  /*esp_err_t ret =*/i2c_master_cmd_begin( s_bus_id, cmd, pdMS_TO_TICKS( 1000 ) );
+  i2c_cmd_link_delete( cmd );
+}
 
 static void platform_i2c_start( void )
 {
   // ... Open i2c channel for your device with specific s_i2c_addr
-  s_cmd_handle = i2c_cmd_link_create();
-  i2c_master_start( s_cmd_handle );
-  i2c_master_write_byte( s_cmd_handle, ( s_i2c_addr << 1 ) | I2C_MASTER_WRITE, 0x1 );
+  s_i2c_len = 0;
 }
 
 static void platform_i2c_stop( void )
 {
   // ... Complete i2c communication
-  i2c_master_stop( s_cmd_handle );
-  /*esp_err_t ret =*/i2c_master_cmd_begin( s_bus_id, s_cmd_handle, pdMS_TO_TICKS( 1000 ) );
-  i2c_cmd_link_delete( s_cmd_handle );
+  if ( s_i2c_len > 0 )
+  {
+    platform_i2c_flush();
+  }
+  s_i2c_len = 0;
 }
 
 static void platform_i2c_send( uint8_t data )
 {
   // ... Send byte to i2c communication channel
-  i2c_master_write_byte( s_cmd_handle, data, 0x1 );
+  if ( s_i2c_len >= sizeof( s_i2c_buffer ) )
+  {
+    // first byte is control byte (command or data stream), continue stream in next write
+    platform_i2c_flush();
+    s_i2c_len = 1;
+  }
+  s_i2c_buffer[s_i2c_len++] = data;
 }
 
 static void platform_i2c_close( void )
@@ -125,7 +152,11 @@ static void platform_i2c_send_buffer( const uint8_t* data, uint16_t len )
     platform_i2c_send( *data );
     data++;
   }
-  //    i2c_master_write(cmd, data_wr, size, ACK_CHECK_EN);
+}
+
+void ssd1306_platform_i2cSetTransfer( ssd1306_platform_i2cTransfer_t transfer )
+{
+  s_transfer = transfer;
 }
 
 void ssd1306_platform_i2cInit( int8_t busId, uint8_t addr, ssd1306_platform_i2cConfig_t* cfg )
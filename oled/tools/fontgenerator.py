@@ -56,6 +56,19 @@ def print_help_and_exit():
     print("      -d        Print demo text to console")
     print("      -t text   Use text as demo text")
     print("      --demo-only Prints demo text to console and exits")
+    print("   oled_ui font pack mode (must be first argument):")
+    print("      --oled-pack  build subset page-major font pack for oled_ui")
+    print("      --src F      GLCD font tables source file (oled_fonts.c), can be repeated")
+    print("      --strings F  translation file, non-ASCII chars of string literals (.c/.h) or")
+    print("                   whole text are kept, can be repeated. Printable ASCII is always kept")
+    print("      --chars S    additional chars to keep")
+    print("      --font N W H T1[,T2..]  pack font N, nominal width W, height H from tables T1..")
+    print("      --rle        compress glyphs with RLE when smaller")
+    print("      -o F         write to file instead of stdout")
+    print("      --asset-pack binary asset pack for data partition instead of C source, needs -o")
+    print("      --icon N F   add icon N from PBM file F to asset pack")
+    print("      --string-table N F  add string table N from text file F (line per string)")
+    print("      --pack-version V  asset pack content version")
     print("Examples:")
     print("   [convert ttf font to old format]")
     print("      ttf_fonts.py --ttf FreeSans.ttf -s 8 -f old > font.h")
@@ -63,11 +76,96 @@ def print_help_and_exit():
     print("      ttf_fonts.py --ttf FreeSans.ttf -d -f new")
     print("   [convert GLCD font generated file to new format]")
     print("      ttf_fonts.py --glcd font.c -f new > font.h")
+    print("   [build oled_ui font pack]")
+    print("      fontgenerator.py --oled-pack --src oled_fonts.c --strings lang.c --rle")
+    print("         --font oled_pack_font11 11 13 Calibri10x13,Calibri11x13_PL > oled_font_pack.c")
+    print("   [build oled_ui asset pack]")
+    print("      fontgenerator.py --oled-pack --asset-pack --src oled_fonts.c --string-table menu_pl menu_pl.txt")
+    print("         --icon wifi wifi.pbm --rle --font oled_pack_font11 11 13 Calibri10x13 -o assets.bin")
     exit(1)
 
+def oled_pack_main(args):
+    from modules import oledpack
+    sources = []
+    strings = []
+    extra = u""
+    fonts = []
+    rle = False
+    output = None
+    asset_pack = False
+    icons = []
+    string_tables = []
+    version = 0
+    idx = 0
+    while idx < len(args):
+        opt = args[idx]
+        if opt == "--src":
+            idx += 1
+            sources.append(args[idx])
+        elif opt == "--strings":
+            idx += 1
+            strings.append(args[idx])
+        elif opt == "--chars":
+            idx += 1
+            extra += args[idx]
+        elif opt == "--font":
+            fonts.append((args[idx + 1], int(args[idx + 2]), int(args[idx + 3]), args[idx + 4].split(",")))
+            idx += 4
+        elif opt == "--rle":
+            rle = True
+        elif opt == "-o":
+            idx += 1
+            output = args[idx]
+        elif opt == "--asset-pack":
+            asset_pack = True
+        elif opt == "--icon":
+            icons.append((args[idx + 1], args[idx + 2]))
+            idx += 2
+        elif opt == "--string-table":
+            string_tables.append((args[idx + 1], args[idx + 2]))
+            idx += 2
+        elif opt == "--pack-version":
+            idx += 1
+            version = int(args[idx], 0)
+        else:
+            print("Unknown option: {0}".format(opt))
+            print_help_and_exit()
+        idx += 1
+
+    if len(sources) == 0 or len(fonts) == 0 or (asset_pack and output is None):
+        print_help_and_exit()
+
+    tables = oledpack.load_glcd_tables(sources)
+    pack_fonts = []
+    for name, width, height, table_names in fonts:
+        for table in table_names:
+            if table not in tables:
+                sys.stderr.write("Table {0} not found\n".format(table))
+                exit(1)
+        pack_fonts.append(oledpack.PackFont(name, width, height, [tables[t] for t in table_names]))
+
+    chars = oledpack.collect_chars(strings + [f for _, f in string_tables], extra)
+    if asset_pack:
+        data, summary = oledpack.generate_asset_pack(pack_fonts, chars, rle, icons, string_tables, version)
+        with open(output, 'wb') as f:
+            f.write(data)
+        print(summary)
+        exit(0)
+
+    source = oledpack.generate_pack(pack_fonts, chars, rle)
+    if output is None:
+        sys.stdout.write(source)
+    else:
+        with codecs.open(output, 'w', encoding='utf-8') as f:
+            f.write(source)
+    exit(0)
+
 if len(sys.argv) < 2:
     print_help_and_exit()
 
+if sys.argv[1] == "--oled-pack":
+    oled_pack_main(sys.argv[2:])
+
 fsize = 8
 fold = False
 flimit_bottom = 0
@@ -0,0 +1,306 @@
+# -*- coding: UTF-8 -*-
+###################################################################################
+#
+# oled_ui font pack compiler.
+#
+# Reads MikroElektronika GLCD tables used by oled_ui (oled_fonts.c), keeps
+# printable ASCII and non-ASCII glyphs used by translation strings, converts
+# them to page-major columns (display RAM layout) and optionally compresses
+# them with PackBits RLE.
+#
+# Fonts, icons and string tables can also be written to binary asset pack,
+# flashed to data partition and used zero-copy by oled_ui/asset_pack.c.
+#
+###################################################################################
+
+import re
+import codecs
+import struct
+import zlib
+
+# Always kept, runtime text (SSID, serial, messages) can contain any of them
+DEFAULT_CHARS = u"".join(chr(c) for c in range(0x20, 0x7F))
+
+RLE_MAX_RUN = 128
+
+
+class GLCDTable:
+
+    def __init__(self, name, data):
+        self.name = name
+        self.data = data
+        self.first = data[2] | (data[3] << 8)
+        self.last = data[4] | (data[5] << 8)
+        self.height = data[6]
+
+    def has(self, code):
+        return self.first <= code < self.last
+
+    def glyph(self, code):
+        """ Returns (width, rows) where rows[y][x] is pixel """
+        entry = 8 + (code - self.first) * 4
+        width = self.data[entry]
+        addr = self.data[entry + 1] | (self.data[entry + 2] << 8) | (self.data[entry + 3] << 16)
+        bytes_width = (width + 7) // 8
+        rows = []
+        for y in range(self.height):
+            row = []
+            for x in range(width):
+                byte = self.data[addr + y * bytes_width + x // 8]
+                row.append((byte >> (x % 8)) & 1)
+            rows.append(row)
+        return width, rows
+
+
+def load_glcd_tables(filenames):
+    tables = {}
+    for filename in filenames:
+        with codecs.open(filename, 'r', encoding='utf-8') as f:
+            content = f.read()
+        for m in re.finditer(r'uint8_t\s+(\w+)\[\]\s*=\s*\{(.*?)\};', content, re.S):
+            body = re.sub(r'//.*', '', m.group(2))
+            data = [int(x, 16) for x in re.findall(r'0x[0-9A-Fa-f]+', body)]
+            tables[m.group(1)] = GLCDTable(m.group(1), data)
+    return tables
+
+
+def _unescape_c_string(literal):
+    raw = bytearray()
+    idx = 0
+    data = literal.encode('utf-8')
+    while idx < len(data):
+        c = data[idx]
+        if c == ord('\\') and idx + 1 < len(data):
+            n = chr(data[idx + 1])
+            if n == 'x':
+                m = re.match(rb'[0-9A-Fa-f]{1,2}', data[idx + 2:])
+                raw.append(int(m.group(0), 16))
+                idx += 2 + len(m.group(0))
+                continue
+            raw.append({'n': 10, 'r': 13, 't': 9, '0': 0}.get(n, data[idx + 1]))
+            idx += 2
+            continue
+        raw.append(c)
+        idx += 1
+    return raw.decode('utf-8', 'ignore')
+
+
+def collect_chars(filenames, extra=u""):
+    """ Printable ASCII and non-ASCII chars of C/H string literals or other whole files """
+    chars = set(DEFAULT_CHARS + extra)
+    for filename in filenames:
+        with codecs.open(filename, 'r', encoding='utf-8') as f:
+            content = f.read()
+        if filename.endswith(('.c', '.h')):
+            for m in re.finditer(r'"((?:[^"\\\n]|\\.)*)"', content):
+                chars.update(_unescape_c_string(m.group(1)))
+        else:
+            chars.update(content)
+    return sorted(c for c in chars if ord(c) >= 0x20 and ord(c) != 0x7F)
+
+
+def to_page_major(width, height, rows):
+    pages = (height + 7) // 8
+    columns = []
+    for page in range(pages):
+        for x in range(width):
+            byte = 0
+            for bit in range(8):
+                y = page * 8 + bit
+                if y < height and rows[y][x]:
+                    byte |= 1 << bit
+            columns.append(byte)
+    return columns
+
+
+def rle_encode(data):
+    """ PackBits: n < 128 - n + 1 literals follow, n >= 128 - next byte repeated n - 125 times """
+    out = []
+    idx = 0
+    while idx < len(data):
+        run = 1
+        while idx + run < len(data) and data[idx + run] == data[idx] and run < RLE_MAX_RUN + 2:
+            run += 1
+        if run >= 3:
+            out += [run + 125, data[idx]]
+            idx += run
+            continue
+        start = idx
+        while idx < len(data) and idx - start < RLE_MAX_RUN:
+            if idx + 2 < len(data) and data[idx] == data[idx + 1] == data[idx + 2]:
+                break
+            idx += 1
+        out += [idx - start - 1] + data[start:idx]
+    return out
+
+
+class PackFont:
+
+    def __init__(self, name, width, height, tables):
+        self.name = name
+        self.width = width
+        self.height = height
+        self.tables = tables
+        self.source_size = sum(len(t.data) for t in tables)
+        self.codes = []
+        self.glyphs = []
+        self.data = []
+
+    def build(self, chars, rle):
+        for char in chars:
+            code = ord(char)
+            table = next((t for t in self.tables if t.has(code)), None)
+            if table is None:
+                continue
+            width, rows = table.glyph(code)
+            columns = to_page_major(width, table.height, rows)
+            packed = rle_encode(columns) if rle else columns
+            is_rle = rle and len(packed) < len(columns)
+            self.codes.append(code)
+            self.glyphs.append((len(self.data), width, table.height, is_rle))
+            self.data += packed if is_rle else columns
+
+    def size(self):
+        return len(self.codes) * 2 + len(self.glyphs) * 8 + len(self.data)
+
+    def generate(self, out):
+        out.append("/* %s: %d glyphs, %d bytes (source tables %d bytes) */" %
+                   (self.name, len(self.codes), self.size(), self.source_size))
+        out.append("static const uint16_t %s_codes[] = {" % self.name)
+        for i in range(0, len(self.codes), 12):
+            out.append("  " + ", ".join("0x%04X" % c for c in self.codes[i:i + 12]) + ",")
+        out.append("};")
+        out.append("")
+        out.append("static const oledPackGlyph %s_glyphs[] = {" % self.name)
+        for code, glyph in zip(self.codes, self.glyphs):
+            comment = chr(code) if 0x20 < code < 0x7F else "U+%04X" % code
+            out.append("  { %d, %d, %d, %d },    // %s" % (glyph[0], glyph[1], glyph[2], glyph[3], comment))
+        out.append("};")
+        out.append("")
+        out.append("static const uint8_t %s_data[] = {" % self.name)
+        for i in range(0, len(self.data), 16):
+            out.append("  " + ",".join("0x%02X" % b for b in self.data[i:i + 16]) + ",")
+        out.append("};")
+        out.append("")
+        out.append("const oledPackFont %s = {" % self.name)
+        out.append("  .width = %d," % self.width)
+        out.append("  .height = %d," % self.height)
+        out.append("  .count = %d," % len(self.codes))
+        out.append("  .codes = %s_codes," % self.name)
+        out.append("  .glyphs = %s_glyphs," % self.name)
+        out.append("  .data = %s_data," % self.name)
+        out.append("};")
+        out.append("")
+
+
+def generate_pack(fonts, chars, rle):
+    out = []
+    out.append("/* Generated by oled/tools/fontgenerator.py --oled-pack, do not edit */")
+    out.append("")
+    out.append('#include "oled.h"')
+    out.append("")
+    total = 0
+    source = 0
+    for font in fonts:
+        font.build(chars, rle)
+        font.generate(out)
+        total += font.size()
+        source += font.source_size
+    out.append("/* Total %d bytes, source tables %d bytes */" % (total, source))
+    return "\n".join(out) + "\n"
+
+
+# Asset pack, all values little endian, must match oled_ui/asset_pack.h
+ASSET_PACK_MAGIC = 0x4B50414F    # "OAPK"
+ASSET_PACK_FORMAT = 1
+ASSET_PACK_HEADER_SIZE = 32
+ASSET_PACK_ENTRY_SIZE = 32
+ASSET_PACK_NAME_SIZE = 20
+
+ASSET_TYPE_FONT = 1
+ASSET_TYPE_BITMAP = 2
+ASSET_TYPE_STRINGS = 3
+
+
+def _align(data, size=4):
+    return data + b'\0' * (-len(data) % size)
+
+
+def font_asset(font):
+    """ header: width, height, count, codes offset, glyphs offset, data offset """
+    codes = _align(struct.pack('<%dH' % len(font.codes), *font.codes))
+    glyphs = b''.join(struct.pack('<IBBBx', *g) for g in font.glyphs)
+    header_size = 16
+    return (struct.pack('<BBHIII', font.width, font.height, len(font.codes), header_size,
+                        header_size + len(codes), header_size + len(codes) + len(glyphs)) +
+            codes + glyphs + bytes(font.data))
+
+
+def load_pbm(filename):
+    """ Returns (width, height, rows) of P1 or P4 bitmap, 1 - black pixel drawn """
+    with open(filename, 'rb') as f:
+        content = f.read()
+    content = re.sub(rb'#[^\n]*', b'', content) if content[:2] == b'P1' else content
+    m = re.match(rb'(P[14])\s+(\d+)\s+(\d+)\s', content)
+    kind, width, height = m.group(1), int(m.group(2)), int(m.group(3))
+    body = content[m.end():]
+    rows = []
+    if kind == b'P1':
+        bits = [int(c) for c in re.findall(rb'[01]', body)]
+        rows = [bits[y * width:(y + 1) * width] for y in range(height)]
+    else:
+        stride = (width + 7) // 8
+        for y in range(height):
+            line = body[y * stride:(y + 1) * stride]
+            rows.append([(line[x // 8] >> (7 - x % 8)) & 1 for x in range(width)])
+    return width, height, rows
+
+
+def bitmap_asset(filename):
+    width, height, rows = load_pbm(filename)
+    return struct.pack('<BBH', width, height, 0) + bytes(to_page_major(width, height, rows))
+
+
+def strings_asset(filename):
+    """ One string per line, \\n escapes are allowed """
+    with codecs.open(filename, 'r', encoding='utf-8') as f:
+        lines = [line.rstrip('\r\n').replace('\\n', '\n') for line in f]
+    offsets = []
+    text = b''
+    base = 4 + 4 * len(lines)
+    for line in lines:
+        offsets.append(base + len(text))
+        text += line.encode('utf-8') + b'\0'
+    return struct.pack('<HH', len(lines), 0) + struct.pack('<%dI' % len(lines), *offsets) + text
+
+
+def generate_asset_pack(fonts, chars, rle, bitmaps, strings, version):
+    """ bitmaps, strings: lists of (name, filename), returns (pack bytes, text summary) """
+    assets = []
+    summary = []
+    for font in fonts:
+        font.build(chars, rle)
+        assets.append((font.name, ASSET_TYPE_FONT, font_asset(font)))
+        summary.append("%s: %d glyphs, %d bytes" % (font.name, len(font.codes), len(assets[-1][2])))
+    for name, filename in bitmaps:
+        assets.append((name, ASSET_TYPE_BITMAP, bitmap_asset(filename)))
+    for name, filename in strings:
+        assets.append((name, ASSET_TYPE_STRINGS, strings_asset(filename)))
+
+    table = b''
+    payload = b''
+    offset = ASSET_PACK_HEADER_SIZE + ASSET_PACK_ENTRY_SIZE * len(assets)
+    for name, asset_type, data in assets:
+        encoded = name.encode('utf-8')
+        if len(encoded) >= ASSET_PACK_NAME_SIZE:
+            raise ValueError("Asset name too long: " + name)
+        table += struct.pack('<%dsHHII' % ASSET_PACK_NAME_SIZE, encoded, asset_type, 0,
+                             offset + len(payload), len(data))
+        payload = _align(payload + data)
+
+    body = table + payload
+    size = ASSET_PACK_HEADER_SIZE + len(body)
+    header = struct.pack('<IHHIII12x', ASSET_PACK_MAGIC, ASSET_PACK_FORMAT, len(assets),
+                         version, size, zlib.crc32(body) & 0xFFFFFFFF)
+    summary.append("Total %d bytes, %d assets, version %d" % (size, len(assets), version))
+    return header + body, "\n".join(summary)
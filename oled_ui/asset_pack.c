@@ -0,0 +1,423 @@
+/**
+ *******************************************************************************
+ * @file    asset_pack.c
+ * @author  Dmytro Shevchenko
+ * @brief   UI asset pack source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "asset_pack.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "app_config.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#endif
+
+/* Private macros ------------------------------------------------------------*/
+#define MODULE_NAME "[ASSET] "
+#define DEBUG_LVL   PRINT_DEBUG
+
+#if CONFIG_DEBUG_ASSET_PACK
+#define LOG( _lvl, ... ) \
+  debug_printf( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
+#else
+#define LOG( PRINT_INFO, ... )
+#endif
+
+#ifndef CONFIG_ASSET_PACK_PARTITION
+#define CONFIG_ASSET_PACK_PARTITION "assets"
+#endif
+
+#ifndef CONFIG_ASSET_PACK_FILE
+#define CONFIG_ASSET_PACK_FILE "assets.bin"
+#endif
+
+#define FONT_HEADER_SIZE   16
+#define BITMAP_HEADER_SIZE 4
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  const uint8_t* data;
+  const asset_pack_header_t* header;
+  const asset_pack_entry_t* entries;
+#ifdef __linux__
+  size_t map_size;
+#else
+  esp_partition_mmap_handle_t handle;
+#endif
+} asset_pack_ctx_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+static asset_pack_ctx_t ctx;
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint16_t _read_u16( const uint8_t* data )
+{
+  return data[0] | ( data[1] << 8 );
+}
+
+static uint32_t _read_u32( const uint8_t* data )
+{
+  return data[0] | ( data[1] << 8 ) | ( data[2] << 16 ) | ( (uint32_t) data[3] << 24 );
+}
+
+#ifdef __linux__
+static uint32_t _crc32( const uint8_t* data, size_t len )
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for ( size_t i = 0; i < len; i++ )
+  {
+    crc ^= data[i];
+    for ( int bit = 0; bit < 8; bit++ )
+    {
+      crc = ( crc >> 1 ) ^ ( 0xEDB88320 & -( crc & 1 ) );
+    }
+  }
+  return ~crc;
+}
+
+static const uint8_t* _map( void )
+{
+  struct stat st;
+  int fd = open( CONFIG_ASSET_PACK_FILE, O_RDONLY );
+  if ( fd < 0 )
+  {
+    LOG( PRINT_ERROR, "Cannot open %s", CONFIG_ASSET_PACK_FILE );
+    return NULL;
+  }
+
+  void* data = MAP_FAILED;
+  if ( fstat( fd, &st ) == 0 && st.st_size >= (off_t) sizeof( asset_pack_header_t ) )
+  {
+    data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  }
+  close( fd );
+
+  if ( data == MAP_FAILED )
+  {
+    LOG( PRINT_ERROR, "Cannot map %s", CONFIG_ASSET_PACK_FILE );
+    return NULL;
+  }
+
+  ctx.map_size = st.st_size;
+  const asset_pack_header_t* header = data;
+  if ( header->size > ctx.map_size )
+  {
+    LOG( PRINT_ERROR, "Pack truncated %u > %u", header->size, (unsigned) ctx.map_size );
+    munmap( data, ctx.map_size );
+    return NULL;
+  }
+
+  return data;
+}
+
+static void _unmap( void )
+{
+  munmap( (void*) ctx.data, ctx.map_size );
+}
+#else
+static uint32_t _crc32( const uint8_t* data, size_t len )
+{
+  return esp_rom_crc32_le( 0, data, len );
+}
+
+/* Only pack size is mapped, MMU pages are shared with code and rodata */
+static const uint8_t* _map( void )
+{
+  asset_pack_header_t header;
+  const void* data = NULL;
+  const esp_partition_t* partition = esp_partition_find_first( ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CONFIG_ASSET_PACK_PARTITION );
+  if ( partition == NULL )
+  {
+    LOG( PRINT_ERROR, "Partition %s not found", CONFIG_ASSET_PACK_PARTITION );
+    return NULL;
+  }
+
+  if ( esp_partition_read( partition, 0, &header, sizeof( header ) ) != ESP_OK )
+  {
+    return NULL;
+  }
+
+  if ( header.magic != ASSET_PACK_MAGIC || header.size < sizeof( header ) || header.size > partition->size )
+  {
+    LOG( PRINT_ERROR, "No asset pack in %s", CONFIG_ASSET_PACK_PARTITION );
+    return NULL;
+  }
+
+  if ( esp_partition_mmap( partition, 0, header.size, ESP_PARTITION_MMAP_DATA, &data, &ctx.handle ) != ESP_OK )
+  {
+    LOG( PRINT_ERROR, "Cannot map %s", CONFIG_ASSET_PACK_PARTITION );
+    return NULL;
+  }
+
+  return data;
+}
+
+static void _unmap( void )
+{
+  esp_partition_munmap( ctx.handle );
+}
+#endif
+
+static bool _validate( const uint8_t* data )
+{
+  const asset_pack_header_t* header = (const asset_pack_header_t*) data;
+
+  if ( header->magic != ASSET_PACK_MAGIC || header->format != ASSET_PACK_FORMAT )
+  {
+    LOG( PRINT_ERROR, "Unsupported pack format %u", header->format );
+    return false;
+  }
+
+  if ( sizeof( asset_pack_header_t ) + header->count * sizeof( asset_pack_entry_t ) > header->size )
+  {
+    return false;
+  }
+
+  if ( _crc32( data + sizeof( asset_pack_header_t ), header->size - sizeof( asset_pack_header_t ) ) != header->crc )
+  {
+    LOG( PRINT_ERROR, "Pack CRC error" );
+    return false;
+  }
+
+  const asset_pack_entry_t* entries = (const asset_pack_entry_t*) ( data + sizeof( asset_pack_header_t ) );
+  for ( uint16_t i = 0; i < header->count; i++ )
+  {
+    if ( entries[i].offset % 4 != 0 || entries[i].offset > header->size || entries[i].size > header->size - entries[i].offset )
+    {
+      LOG( PRINT_ERROR, "Wrong entry %u", i );
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Glyph data must be inside font entry, compressed glyph is walked like oled.c unpacks it */
+static bool _check_glyph( const oledPackGlyph* glyph, const uint8_t* data, uint32_t size )
+{
+  uint32_t out_size = (uint32_t) glyph->width * ( ( glyph->height + 7 ) / 8 );
+  if ( glyph->offset > size )
+  {
+    return false;
+  }
+
+  const uint8_t* in = &data[glyph->offset];
+  uint32_t in_size = size - glyph->offset;
+  if ( !glyph->is_rle )
+  {
+    return out_size <= in_size;
+  }
+
+  uint32_t pos = 0;
+  uint32_t in_pos = 0;
+  while ( pos < out_size )
+  {
+    if ( in_pos >= in_size )
+    {
+      return false;
+    }
+
+    uint8_t n = in[in_pos++];
+    uint32_t len = n < 128 ? n + 1u : n - 125u;
+    if ( len > out_size - pos )
+    {
+      len = out_size - pos;
+    }
+
+    in_pos += n < 128 ? len : 1;
+    if ( in_pos > in_size )
+    {
+      return false;
+    }
+    pos += len;
+  }
+
+  return true;
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+error_code_t AssetPack_Open( void )
+{
+  if ( ctx.data != NULL )
+  {
+    return ERROR_CODE_OK;
+  }
+
+  const uint8_t* data = _map();
+  if ( data == NULL )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  ctx.data = data;
+  if ( !_validate( data ) )
+  {
+    AssetPack_Close();
+    return ERROR_CODE_FAIL;
+  }
+
+  ctx.header = (const asset_pack_header_t*) data;
+  ctx.entries = (const asset_pack_entry_t*) ( data + sizeof( asset_pack_header_t ) );
+  LOG( PRINT_INFO, "Pack version %u, %u assets, %u bytes", ctx.header->version, ctx.header->count, ctx.header->size );
+  return ERROR_CODE_OK;
+}
+
+void AssetPack_Close( void )
+{
+  if ( ctx.data != NULL )
+  {
+    _unmap();
+  }
+
+  memset( &ctx, 0, sizeof( ctx ) );
+}
+
+bool AssetPack_IsOpen( void )
+{
+  return ctx.header != NULL;
+}
+
+uint32_t AssetPack_GetVersion( void )
+{
+  return ctx.header != NULL ? ctx.header->version : 0;
+}
+
+const uint8_t* AssetPack_Find( asset_type_t type, const char* name, uint32_t* size )
+{
+  if ( ctx.header == NULL || name == NULL )
+  {
+    return NULL;
+  }
+
+  for ( uint16_t i = 0; i < ctx.header->count; i++ )
+  {
+    const asset_pack_entry_t* entry = &ctx.entries[i];
+    if ( entry->type == type && strncmp( entry->name, name, ASSET_PACK_NAME_SIZE ) == 0 )
+    {
+      if ( size != NULL )
+      {
+        *size = entry->size;
+      }
+      return &ctx.data[entry->offset];
+    }
+  }
+
+  return NULL;
+}
+
+error_code_t AssetPack_GetFont( const char* name, oledPackFont* font )
+{
+  uint32_t size = 0;
+  const uint8_t* data = AssetPack_Find( ASSET_TYPE_FONT, name, &size );
+  if ( data == NULL || font == NULL || size < FONT_HEADER_SIZE )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  uint16_t count = _read_u16( &data[2] );
+  uint32_t codes = _read_u32( &data[4] );
+  uint32_t glyphs = _read_u32( &data[8] );
+  uint32_t glyph_data = _read_u32( &data[12] );
+  if ( codes + count * sizeof( uint16_t ) > size || glyphs + count * sizeof( oledPackGlyph ) > size || glyph_data > size )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  const oledPackGlyph* glyph_table = (const oledPackGlyph*) &data[glyphs];
+  for ( uint16_t i = 0; i < count; i++ )
+  {
+    if ( !_check_glyph( &glyph_table[i], &data[glyph_data], size - glyph_data ) )
+    {
+      LOG( PRINT_ERROR, "Font %s glyph %u out of entry", name, i );
+      return ERROR_CODE_FAIL;
+    }
+  }
+
+  font->width = data[0];
+  font->height = data[1];
+  font->count = count;
+  font->codes = (const uint16_t*) &data[codes];
+  font->glyphs = glyph_table;
+  font->data = &data[glyph_data];
+  return ERROR_CODE_OK;
+}
+
+error_code_t AssetPack_GetBitmap( const char* name, asset_bitmap_t* bitmap )
+{
+  uint32_t size = 0;
+  const uint8_t* data = AssetPack_Find( ASSET_TYPE_BITMAP, name, &size );
+  if ( data == NULL || bitmap == NULL || size < BITMAP_HEADER_SIZE )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  bitmap->width = data[0];
+  bitmap->height = data[1];
+  if ( BITMAP_HEADER_SIZE + (uint32_t) bitmap->width * ( ( bitmap->height + 7 ) / 8 ) > size )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  bitmap->data = &data[BITMAP_HEADER_SIZE];
+  return ERROR_CODE_OK;
+}
+
+error_code_t AssetPack_GetStrings( const char* name, asset_strings_t* strings )
+{
+  uint32_t size = 0;
+  const uint8_t* data = AssetPack_Find( ASSET_TYPE_STRINGS, name, &size );
+  if ( data == NULL || strings == NULL || size < 4 )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  uint16_t count = _read_u16( data );
+  if ( 4 + count * sizeof( uint32_t ) > size )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  /* Every string must start and be terminated inside entry */
+  const uint32_t* offsets = (const uint32_t*) &data[4];
+  for ( uint16_t i = 0; i < count; i++ )
+  {
+    if ( offsets[i] >= size || memchr( &data[offsets[i]], 0, size - offsets[i] ) == NULL )
+    {
+      LOG( PRINT_ERROR, "Strings %s index %u out of entry", name, i );
+      return ERROR_CODE_FAIL;
+    }
+  }
+
+  strings->count = count;
+  strings->offsets = offsets;
+  strings->base = data;
+  return ERROR_CODE_OK;
+}
+
+const char* AssetPack_GetString( const asset_strings_t* strings, uint16_t index )
+{
+  if ( strings == NULL || index >= strings->count )
+  {
+    return NULL;
+  }
+
+  return (const char*) &strings->base[strings->offsets[index]];
+}
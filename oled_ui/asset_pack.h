@@ -0,0 +1,142 @@
+/**
+ *******************************************************************************
+ * @file    asset_pack.h
+ * @author  Dmytro Shevchenko
+ * @brief   UI asset pack (fonts, icons, string tables) header file.
+ *          Pack is generated by oled/tools/fontgenerator.py --asset-pack and
+ *          stored in own data partition, so it can be updated without new
+ *          application image. Assets are used in place from mapped memory:
+ *          esp_partition_mmap on target, mmap of file on Linux host.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _ASSET_PACK_H_
+#define _ASSET_PACK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "error_code.h"
+#include "oled.h"
+
+/* Public macro --------------------------------------------------------------*/
+
+#define ASSET_PACK_MAGIC     0x4B50414F    // "OAPK"
+#define ASSET_PACK_FORMAT    1
+#define ASSET_PACK_NAME_SIZE 20
+
+/* Public types --------------------------------------------------------------*/
+
+typedef enum
+{
+  ASSET_TYPE_FONT = 1,
+  ASSET_TYPE_BITMAP,
+  ASSET_TYPE_STRINGS,
+} asset_type_t;
+
+/* Pack layout, all values little endian */
+typedef struct
+{
+  uint32_t magic;
+  uint16_t format;    ///< ASSET_PACK_FORMAT, layout version
+  uint16_t count;    ///< count of entries following header
+  uint32_t version;    ///< content version
+  uint32_t size;    ///< whole pack size with header
+  uint32_t crc;    ///< CRC32 of data after header
+  uint8_t reserved[12];
+} asset_pack_header_t;
+
+typedef struct
+{
+  char name[ASSET_PACK_NAME_SIZE];
+  uint16_t type;
+  uint16_t flags;
+  uint32_t offset;    ///< from pack start, 4 bytes aligned
+  uint32_t size;
+} asset_pack_entry_t;
+
+typedef struct
+{
+  uint8_t width;
+  uint8_t height;
+  const uint8_t* data;    ///< page-major, see oled_drawPageBitmap
+} asset_bitmap_t;
+
+typedef struct
+{
+  uint16_t count;
+  const uint32_t* offsets;
+  const uint8_t* base;
+} asset_strings_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Map and validate asset pack. Pack is checked once, assets returned
+ *          later point directly to mapped memory.
+ * @return  ERROR_CODE_OK if pack is valid
+ */
+error_code_t AssetPack_Open( void );
+
+/**
+ * @brief   Unmap asset pack, must be called before partition is rewritten.
+ *          Assets returned before are not valid after close.
+ */
+void AssetPack_Close( void );
+
+/**
+ * @brief   Check if asset pack is opened.
+ * @return  true if pack is mapped and valid
+ */
+bool AssetPack_IsOpen( void );
+
+/**
+ * @brief   Get content version of opened pack.
+ * @return  version, 0 if pack is not opened
+ */
+uint32_t AssetPack_GetVersion( void );
+
+/**
+ * @brief   Find asset.
+ * @param   [in] type - asset type
+ * @param   [in] name - asset name
+ * @param   [out] size - asset size, can be NULL
+ * @return  pointer to asset data in mapped memory, NULL if not found
+ */
+const uint8_t* AssetPack_Find( asset_type_t type, const char* name, uint32_t* size );
+
+/**
+ * @brief   Get font, can be used by oled_setFontPack.
+ * @param   [in] name - asset name
+ * @param   [out] font - font description pointing to mapped memory
+ * @return  ERROR_CODE_OK if found
+ */
+error_code_t AssetPack_GetFont( const char* name, oledPackFont* font );
+
+/**
+ * @brief   Get icon.
+ * @param   [in] name - asset name
+ * @param   [out] bitmap - icon description pointing to mapped memory
+ * @return  ERROR_CODE_OK if found
+ */
+error_code_t AssetPack_GetBitmap( const char* name, asset_bitmap_t* bitmap );
+
+/**
+ * @brief   Get string table.
+ * @param   [in] name - asset name
+ * @param   [out] strings - string table
+ * @return  ERROR_CODE_OK if found
+ */
+error_code_t AssetPack_GetStrings( const char* name, asset_strings_t* strings );
+
+/**
+ * @brief   Get string from table.
+ * @param   [in] strings - string table
+ * @param   [in] index - string index
+ * @return  UTF-8 string, NULL if index is out of table
+ */
+const char* AssetPack_GetString( const asset_strings_t* strings, uint16_t index );
+
+#endif
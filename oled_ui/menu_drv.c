@@ -1,4 +1,5 @@
 #include "menu_drv.h"
+#include "menu_tree.h"
 
 #include <stdarg.h>
 #include <stdint.h>
@@ -8,10 +9,14 @@
 #include "but.h"
 #include "esp_task_wdt.h"
 #include "freertos/semphr.h"
+#include "led.h"
 #include "oled.h"
+#include "oled_cmd.h"
 #include "parameters.h"
 #include "power_on.h"
+#include "scheduler.h"
 #include "ssd1306.h"
+#include "ui_trace.h"
 #include "wifidrv.h"
 
 #define MODULE_NAME "[MENU Drv] "
@@ -30,6 +35,16 @@
 #define POWER_OFF_TIMEOUT_MS  3500
 #define POWER_OFF_BLOCK_MS    5000
 
+/* Battery and signal icons drawn by callbacks in immediate mode */
+#define STATUS_AREA_X      100
+#define STATUS_AREA_WIDTH  28
+#define STATUS_AREA_HEIGHT MENU_HEIGHT
+
+/* Battery and signal are checked by scheduler job, screen is redrawn only when icon level changed */
+#ifndef CONFIG_MENU_STATUS_CHECK_MS
+#define CONFIG_MENU_STATUS_CHECK_MS 500
+#endif
+
 typedef enum
 {
   MENU_STATE_INIT,
@@ -50,25 +65,27 @@ typedef struct
   menu_state_t state;
   menu_state_t last_state;
   menu_token_t* entered_menu_tab[MENU_TAB_SIZE];
+  uint8_t tab_depth;
   TickType_t save_timeout;
   bool save_flag;
   bool exit_req;
   bool enter_req;
   bool error_flag;
   bool power_off_req;
-  bool emergency_led_status;
   bool emergency_disable_is_active;
-  uint32_t led_cnt;
   int error_code;
   char* error_msg;
   menu_token_t* new_menu;
   SemaphoreHandle_t update_screen_req;
+  scheduler_job_t status_job;
+  uint32_t status_key;
   TickType_t power_off_timer;
   TickType_t block_power_off_timer;
   void ( *toggleEmergencyDisable )( void );
   menuDrvDrawBatteryCb_t drawBattery;
   menuDrvDrawSignalCb_t drawSignal;
   menuDrvGetMsgCb_t getMsg;
+  widget_screen_t* active_screen;    ///< screen shown in frame buffer, NULL after other drawing
 } menu_drv_t;
 
 static menu_drv_t ctx;
@@ -98,6 +115,77 @@ static void update_screen( void )
   xSemaphoreGive( ctx.update_screen_req );
 }
 
+static uint8_t _get_signal_level( void )
+{
+  if ( !wifiDrvIsConnected() )
+  {
+    return 0;
+  }
+
+  int rssi = wifiDrvGetRssi();
+  if ( rssi >= -50 && rssi < 0 )
+  {
+    return 5;
+  }
+  else if ( rssi >= -60 && rssi < -50 )
+  {
+    return 4;
+  }
+  else if ( rssi >= -70 && rssi < -60 )
+  {
+    return 3;
+  }
+  else if ( rssi >= -80 && rssi < -70 )
+  {
+    return 2;
+  }
+
+  return 1;
+}
+
+static uint32_t _get_status_key( void )
+{
+  return battery_get_soc() | ( battery_get_charging_status() << 8 ) | ( _get_signal_level() << 9 );
+}
+
+static void _status_job( void* arg )
+{
+  uint32_t key = _get_status_key();
+  if ( key != ctx.status_key )
+  {
+    ctx.status_key = key;
+    update_screen();
+  }
+}
+
+static void _on_parameter_change( parameter_value_t val, uint32_t value )
+{
+  update_screen();
+}
+
+/* Wait for redraw event, wake up earlier only for live menu refresh or pending parameters save */
+static void _wait_for_update( menu_token_t* menu )
+{
+  TickType_t timeout = portMAX_DELAY;
+
+  if ( menu->refresh_ms != 0 )
+  {
+    timeout = MS2ST( menu->refresh_ms );
+  }
+
+  if ( ctx.save_flag )
+  {
+    TickType_t now = xTaskGetTickCount();
+    TickType_t save_wait = ctx.save_timeout > now ? ctx.save_timeout - now + 1 : 0;
+    if ( save_wait < timeout )
+    {
+      timeout = save_wait;
+    }
+  }
+
+  xSemaphoreTake( ctx.update_screen_req, timeout );
+}
+
 void menuDrvSaveParameters( void )
 {
   ctx.save_timeout = xTaskGetTickCount() + MS2ST( 5000 );
@@ -129,6 +217,12 @@ static void save_process( void )
 
 int menuDrvElementsCnt( menu_token_t* menu )
 {
+  const menu_tree_node_t* node = MenuTree_GetNode( menu );
+  if ( node != NULL )
+  {
+    return node->child_count;
+  }
+
   if ( menu->menu_list == NULL )
   {
     LOG( PRINT_INFO, "menu->menu_list == NULL (%ld)\n", menu->name_dict );
@@ -151,54 +245,51 @@ int menuDrvElementsCnt( menu_token_t* menu )
   return 0;
 }
 
-static menu_token_t* last_tab_element( void )
+menu_token_t* menuDrvGetElement( menu_token_t* menu, int index )
 {
-  for ( uint8_t i = 0; i < 8; i++ )
+  if ( MenuTree_GetNode( menu ) != NULL )
   {
-    if ( ( ctx.entered_menu_tab[i] == NULL ) && ( i != 0 ) )
-    {
-      return ctx.entered_menu_tab[i - 1];
-    }
+    return MenuTree_GetChild( menu, index );
   }
 
-  return NULL;
-}
-
-static int tab_len( void )
-{
-  for ( uint8_t i = 0; i < 8; i++ )
+  if ( index < 0 || index >= menuDrvElementsCnt( menu ) )
   {
-    if ( ctx.entered_menu_tab[i] == NULL )
-    {
-      return i;
-    }
+    return NULL;
   }
 
-  return 0;
+  return menu->menu_list[index];
 }
 
-static void add_menu_tab( menu_token_t* menu )
+static menu_token_t* last_tab_element( void )
 {
-  int pos = tab_len();
+  return ctx.tab_depth > 0 ? ctx.entered_menu_tab[ctx.tab_depth - 1] : NULL;
+}
 
-  ctx.entered_menu_tab[pos] = menu;
+static void add_menu_tab( menu_token_t* menu )
+{
+  if ( ctx.tab_depth < MENU_TAB_SIZE )
+  {
+    ctx.entered_menu_tab[ctx.tab_depth++] = menu;
+  }
+  else
+  {
+    LOG( PRINT_ERROR, "Menu tab is full" );
+  }
 }
 
 static void remove_last_menu_tab( void )
 {
-  int pos = tab_len();
-
-  if ( pos > 1 )
+  if ( ctx.tab_depth > 1 )
   {
-    ctx.entered_menu_tab[pos - 1] = NULL;
+    ctx.entered_menu_tab[--ctx.tab_depth] = NULL;
   }
 }
 
 void go_to_main_menu( void )
 {
-  for ( uint8_t i = 1; i < 8; i++ )
+  while ( ctx.tab_depth > 1 )
   {
-    ctx.entered_menu_tab[i] = NULL;
+    ctx.entered_menu_tab[--ctx.tab_depth] = NULL;
   }
 
   update_screen();
@@ -239,6 +330,7 @@ static void menu_timer_power_off_but_cb( void* arg )
   ctx.power_off_req = true;
   ctx.state = MENU_STATE_POWER_OFF_COUNT;
   ctx.power_off_timer = xTaskGetTickCount() + MS2ST( POWER_OFF_TIMEOUT_MS );
+  update_screen();
 }
 
 static void menu_rise_power_off_but_cb( void* arg )
@@ -498,60 +590,84 @@ static void menu_state_enter( menu_token_t* menu )
   }
 
   ctx.state = MENU_STATE_PROCESS;
+  update_screen();
 }
 
-static void menu_state_process( menu_token_t* menu )
+static void _draw_status( void )
 {
-  xSemaphoreTake( ctx.update_screen_req, (TickType_t) MS2ST( 300 ) );
-  oled_clearScreen();
+  if ( ctx.drawBattery != NULL )
+  {
+    ctx.drawBattery( 115, 1, battery_get_voltage(), battery_get_charging_status() );
+  }
 
-  if ( menu->menu_cb.process != NULL )
+  if ( ctx.drawSignal != NULL )
   {
-    menu->menu_cb.process( (void*) menu );
+    ctx.drawSignal( STATUS_AREA_X, 1, _get_signal_level() );
   }
-  else
+}
+
+/* Retained screen: process only updates widgets, changed widgets and status area are sent */
+static void _process_screen( menu_token_t* menu )
+{
+  oledRect status = { .x = STATUS_AREA_X, .y = 0, .width = STATUS_AREA_WIDTH, .height = STATUS_AREA_HEIGHT };
+
+  if ( ctx.active_screen != menu->screen )
   {
-    ctx.error_flag = true;
-    ctx.error_msg = "Process cb NULL";
-    ctx.state = MENU_STATE_EXIT;
+    WidgetScreen_Invalidate( menu->screen );
+    ctx.active_screen = menu->screen;
   }
 
-  if ( ctx.drawBattery != NULL )
+  if ( menu->menu_cb.process != NULL )
   {
-    ctx.drawBattery( 115, 1, battery_get_voltage(), battery_get_charging_status() );
+    menu->menu_cb.process( (void*) menu );
   }
 
-  uint8_t signal = 0;
-  if ( wifiDrvIsConnected() )
+  oled_clearRect( status.x, status.y, status.width, status.height );
+  _draw_status();
+  WidgetScreen_AddDamage( menu->screen, &status );
+  WidgetScreen_Render( menu->screen );
+}
+
+static void menu_state_process( menu_token_t* menu )
+{
+  _wait_for_update( menu );
+  if ( ctx.state != MENU_STATE_PROCESS )
   {
-    int rssi = wifiDrvGetRssi();
-    if ( rssi >= -50 && rssi < 0 )
-    {
-      signal = 5;
-    }
-    else if ( rssi >= -60 && rssi < -50 )
-    {
-      signal = 4;
-    }
-    else if ( rssi >= -70 && rssi < -60 )
-    {
-      signal = 3;
-    }
-    else if ( rssi >= -80 && rssi < -70 )
-    {
-      signal = 2;
-    }
-    else
+    return;
+  }
+
+  UI_TRACE( UI_TRACE_RENDER_START, 0 );
+  if ( menu->screen != NULL )
+  {
+    /* Flush of retained screen is part of render */
+    _process_screen( menu );
+    UI_TRACE( UI_TRACE_RENDER_END, 0 );
+    osDelay( 5 );
+    if ( ctx.enter_req || ctx.exit_req )
     {
-      signal = 1;
+      ctx.state = MENU_STATE_EXIT;
     }
+    return;
   }
 
-  if ( ctx.drawSignal != NULL )
+  ctx.active_screen = NULL;
+  oled_clearScreen();
+
+  if ( menu->menu_cb.process != NULL )
   {
-    ctx.drawSignal( 100, 1, signal );
+    menu->menu_cb.process( (void*) menu );
   }
+  else
+  {
+    ctx.error_flag = true;
+    ctx.error_msg = "Process cb NULL";
+    ctx.state = MENU_STATE_EXIT;
+  }
+
+  _draw_status();
+  UI_TRACE( UI_TRACE_RENDER_END, 0 );
 
+  /* Frame identical to displayed one is dropped by oled_update */
   oled_update();
   osDelay( 5 );
 
@@ -561,21 +677,20 @@ static void menu_state_process( menu_token_t* menu )
   }
 }
 
+/* Red LEDs blink by LED driver, menu task only keeps screen */
+static void _emergency_leds_start( void )
+{
+  MOTOR_LED_SET_GREEN( 0 );
+  SERVO_VIBRO_LED_SET_GREEN( 0 );
+  LED_Play( LED_UPPER_RED, &LED_PATTERN_EMERGENCY );
+  LED_Play( LED_BOTTOM_RED, &LED_PATTERN_EMERGENCY );
+}
+
 static void menu_state_emergency_disable( void )
 {
   oled_clearScreen();
   oled_printFixed( 2, MENU_HEIGHT, _get_msg( MENU_DRV_MSG_MENU_STOP ), OLED_FONT_SIZE_26 );    //Font_16x26
   oled_update();
-  if ( ctx.led_cnt % 10 == 0 )
-  {
-    MOTOR_LED_SET_GREEN( 0 );
-    SERVO_VIBRO_LED_SET_GREEN( 0 );
-    MOTOR_LED_SET_RED( ctx.emergency_led_status );
-    SERVO_VIBRO_LED_SET_RED( ctx.emergency_led_status );
-    ctx.emergency_led_status = ctx.emergency_led_status ? false : true;
-  }
-
-  ctx.led_cnt++;
   osDelay( 100 );
 }
 
@@ -645,6 +760,11 @@ static void menu_state_power_off_count( menu_token_t* menu )
     MOTOR_LED_SET_GREEN( 0 );
     SERVO_VIBRO_LED_SET_GREEN( 0 );
     ctx.state = ctx.emergency_disable_is_active ? MENU_STATE_EMERGENCY_DISABLE : MENU_STATE_PROCESS;
+    if ( ctx.emergency_disable_is_active )
+    {
+      _emergency_leds_start();
+    }
+    update_screen();
     return;
   }
 
@@ -701,9 +821,16 @@ static void menu_task( void* arg )
         LOG( PRINT_INFO, "state %s, menu is NULL", state_name[ctx.state] );
       }
 
+      UI_TRACE( UI_TRACE_MENU_STATE, ctx.state );
       prev_state = ctx.state;
     }
 
+    /* Other states draw whole frame, retained screen is drawn again from scratch */
+    if ( ctx.state != MENU_STATE_PROCESS )
+    {
+      ctx.active_screen = NULL;
+    }
+
     switch ( ctx.state )
     {
       case MENU_STATE_INIT:
@@ -751,6 +878,12 @@ static void menu_task( void* arg )
         ctx.state = MENU_STATE_IDLE;
         break;
     }
+
+    /* Commands of other tasks are drawn over current frame, retained screen is redrawn after them */
+    if ( OledCmd_Process() > 0 )
+    {
+      ctx.active_screen = NULL;
+    }
   }
 }
 
@@ -769,9 +902,16 @@ void menuSetMain( menu_token_t* menu )
   }
 
   ctx.entered_menu_tab[0] = menu;
+  ctx.tab_depth = menu != NULL ? 1 : 0;
+  if ( MenuTree_Build( menu ) != ERROR_CODE_OK )
+  {
+    LOG( PRINT_ERROR, "Menu tree not compiled, lists are walked" );
+  }
+
   if ( ctx.state != MENU_STATE_INIT )
   {
     ctx.state = MENU_STATE_IDLE;
+    update_screen();
   }
 }
 
@@ -797,12 +937,10 @@ void menuDrvEnterEmergencyDisable( void )
 {
   ctx.last_state = ctx.state;
   ctx.state = MENU_STATE_EMERGENCY_DISABLE;
-  ctx.emergency_led_status = true;
   ctx.emergency_disable_is_active = true;
-  MOTOR_LED_SET_GREEN( 0 );
-  SERVO_VIBRO_LED_SET_GREEN( 0 );
-  ctx.led_cnt = 0;
+  _emergency_leds_start();
   menu_deactivate_but();
+  update_screen();
 }
 
 void menuDrvExitEmergencyDisable( void )
@@ -812,13 +950,21 @@ void menuDrvExitEmergencyDisable( void )
 
   ctx.emergency_disable_is_active = false;
 
-  MOTOR_LED_SET_RED( 0 );
-  SERVO_VIBRO_LED_SET_RED( 0 );
+  /* Setting level stops emergency pattern */
+  LED_Set( LED_UPPER_RED, 0 );
+  LED_Set( LED_BOTTOM_RED, 0 );
 
   if ( menu != NULL )
   {
     menu_activate_but( menu );
   }
+
+  update_screen();
+}
+
+void menuDrvUpdateScreen( void )
+{
+  update_screen();
 }
 
 void menuDrvDisableSystemProcess( void )
@@ -835,6 +981,9 @@ void menuDrvInit( menu_drv_init_t init_type, void ( *toggleEmergencyDisable )( v
   ctx.update_screen_req = xSemaphoreCreateBinary();
   ctx.block_power_off_timer = MS2ST( POWER_OFF_BLOCK_MS ) + xTaskGetTickCount();
   ctx.toggleEmergencyDisable = toggleEmergencyDisable;
+  parameters_setChangeCb( _on_parameter_change );
+  /* Menu task sleeps until update request, commands of other tasks must wake it up */
+  OledCmd_SetNotify( update_screen );
 
   if ( init_type == MENU_DRV_LOW_BATTERY_INIT )
   {
@@ -856,6 +1005,11 @@ void menuDrvInit( menu_drv_init_t init_type, void ( *toggleEmergencyDisable )( v
   xTaskCreate( menu_test, "menu_test", 8192, NULL, 12, NULL );
 #else
   xTaskCreate( menu_task, "menu_task", 8192, NULL, 12, NULL );
+#endif
+  Scheduler_AddJob( &ctx.status_job, "menu", _status_job, NULL );
+  Scheduler_Start( &ctx.status_job, CONFIG_MENU_STATUS_CHECK_MS, CONFIG_MENU_STATUS_CHECK_MS );
+#if CONFIG_UI_TRACE
+  UiTrace_StartDump();
 #endif
   update_screen();
 }
@@ -3,6 +3,7 @@
 #include <stdint.h>
 
 #include "oled.h"
+#include "widget.h"
 
 #define LINE_HEIGHT      11
 #define MENU_HEIGHT      16
@@ -88,6 +89,9 @@ typedef struct menu_token
   menu_line_t line;
   bool last_button;
   bool update_screen_req;
+  uint16_t refresh_ms;    // periodic redraw for live values, 0 - redraw only on events
+  widget_screen_t* screen;    // retained widgets, process only updates them; NULL - process draws whole frame
+  uint16_t tree_node;    // index + 1 in compiled menu tree, 0 - not compiled
 
   /* Menu callbacks */
   menu_cb_t menu_cb;
@@ -97,6 +101,7 @@ typedef struct menu_token
 
 void menuDrvInit( menu_drv_init_t init_type, void ( *toggleEmergencyDisable )( void ) );
 int menuDrvElementsCnt( menu_token_t* menu );
+menu_token_t* menuDrvGetElement( menu_token_t* menu, int index );
 void menuEnter( menu_token_t* menu );
 void menuDrv_Exit( menu_token_t* menu );
 void menuSetMain( menu_token_t* menu );
@@ -108,6 +113,7 @@ void menuDrvExitEmergencyDisable( void );
 void enterMenuStart( void );
 void menuDrv_EnterToParameters( void );
 void menuDrvDisableSystemProcess( void );
+void menuDrvUpdateScreen( void );
 
 void menuDrvSetDrawBatteryCb( menuDrvDrawBatteryCb_t cb );
 void menuDrvSetDrawSignalCb( menuDrvDrawSignalCb_t cb );
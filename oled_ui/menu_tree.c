@@ -0,0 +1,142 @@
+/**
+ *******************************************************************************
+ * @file    menu_tree.c
+ * @author  Dmytro Shevchenko
+ * @brief   Compiled menu tree source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "menu_tree.h"
+
+#include <stddef.h>
+
+#include "app_config.h"
+
+/* Private macros ------------------------------------------------------------*/
+#define MODULE_NAME "[MENU Tree] "
+#define DEBUG_LVL   PRINT_INFO
+
+#if CONFIG_DEBUG_MENU_BACKEND
+#define LOG( _lvl, ... ) \
+  debug_printf( DEBUG_LVL, _lvl, MODULE_NAME __VA_ARGS__ )
+#else
+#define LOG( PRINT_INFO, ... )
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+
+static menu_tree_node_t nodes[CONFIG_MENU_TREE_MAX_NODES];
+static uint16_t nodes_count;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void _clear( void )
+{
+  for ( uint16_t i = 0; i < nodes_count; i++ )
+  {
+    nodes[i].token->tree_node = 0;
+  }
+
+  nodes_count = 0;
+}
+
+static bool _add_node( menu_token_t* token, uint16_t parent, uint8_t depth )
+{
+  if ( nodes_count >= CONFIG_MENU_TREE_MAX_NODES )
+  {
+    return false;
+  }
+
+  menu_tree_node_t* node = &nodes[nodes_count++];
+  node->token = token;
+  node->parent = parent;
+  node->first_child = 0;
+  node->child_count = 0;
+  node->depth = depth;
+  if ( token->tree_node == 0 )
+  {
+    token->tree_node = nodes_count;
+  }
+
+  return true;
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+error_code_t MenuTree_Build( menu_token_t* root )
+{
+  _clear();
+  if ( root == NULL )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  _add_node( root, MENU_TREE_NO_PARENT, 0 );
+
+  /* Breadth-first, nodes array is the queue */
+  for ( uint16_t i = 0; i < nodes_count; i++ )
+  {
+    menu_tree_node_t* node = &nodes[i];
+    node->first_child = nodes_count;
+
+    /* Shared token is expanded at first node only, it also stops cycles */
+    if ( node->token->menu_list == NULL || node->token->tree_node != i + 1 )
+    {
+      continue;
+    }
+
+    for ( menu_token_t** child = node->token->menu_list; *child != NULL; child++ )
+    {
+      if ( !_add_node( *child, i, node->depth + 1 ) )
+      {
+        LOG( PRINT_ERROR, "Menu tree has more than %d nodes", CONFIG_MENU_TREE_MAX_NODES );
+        _clear();
+        return ERROR_CODE_FAIL;
+      }
+      node->child_count++;
+    }
+  }
+
+  LOG( PRINT_INFO, "Menu tree %d nodes", nodes_count );
+  return ERROR_CODE_OK;
+}
+
+const menu_tree_node_t* MenuTree_GetNode( const menu_token_t* menu )
+{
+  if ( menu == NULL || menu->tree_node == 0 || menu->tree_node > nodes_count )
+  {
+    return NULL;
+  }
+
+  const menu_tree_node_t* node = &nodes[menu->tree_node - 1];
+  return node->token == menu ? node : NULL;
+}
+
+menu_token_t* MenuTree_GetChild( const menu_token_t* menu, uint16_t index )
+{
+  const menu_tree_node_t* node = MenuTree_GetNode( menu );
+  if ( node == NULL || index >= node->child_count )
+  {
+    return NULL;
+  }
+
+  return nodes[node->first_child + index].token;
+}
+
+menu_token_t* MenuTree_GetParent( const menu_token_t* menu )
+{
+  const menu_tree_node_t* node = MenuTree_GetNode( menu );
+  if ( node == NULL || node->parent == MENU_TREE_NO_PARENT )
+  {
+    return NULL;
+  }
+
+  return nodes[node->parent].token;
+}
+
+uint16_t MenuTree_GetSize( void )
+{
+  return nodes_count;
+}
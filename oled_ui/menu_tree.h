@@ -0,0 +1,79 @@
+/**
+ *******************************************************************************
+ * @file    menu_tree.h
+ * @author  Dmytro Shevchenko
+ * @brief   Compiled menu tree header file.
+ *          Menu definitions (NULL terminated menu_list) are flattened once
+ *          to array in breadth-first order, so children of node are stored
+ *          one after another and navigation does not walk the lists.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _MENU_TREE_H_
+#define _MENU_TREE_H_
+
+#include <stdint.h>
+
+#include "error_code.h"
+#include "menu_drv.h"
+
+/* Public macro --------------------------------------------------------------*/
+
+#ifndef CONFIG_MENU_TREE_MAX_NODES
+#define CONFIG_MENU_TREE_MAX_NODES 128
+#endif
+
+#define MENU_TREE_NO_PARENT 0xFFFF
+
+/* Public types --------------------------------------------------------------*/
+
+typedef struct
+{
+  menu_token_t* token;
+  uint16_t parent;    ///< node index, MENU_TREE_NO_PARENT for root
+  uint16_t first_child;    ///< node index of first child
+  uint16_t child_count;
+  uint8_t depth;
+} menu_tree_node_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Compile menu tree, must be called again when any menu_list changes.
+ *          Token used in more menus is expanded only once.
+ * @param   [in] root - main menu
+ * @return  ERROR_CODE_OK, ERROR_CODE_FAIL if tree has more nodes than CONFIG_MENU_TREE_MAX_NODES
+ */
+error_code_t MenuTree_Build( menu_token_t* root );
+
+/**
+ * @brief   Get compiled node of menu.
+ * @param   [in] menu - menu token
+ * @return  node, NULL if menu is not in compiled tree
+ */
+const menu_tree_node_t* MenuTree_GetNode( const menu_token_t* menu );
+
+/**
+ * @brief   Get child of menu.
+ * @param   [in] menu - menu token
+ * @param   [in] index - child index
+ * @return  child token, NULL if index is out of range or menu is not compiled
+ */
+menu_token_t* MenuTree_GetChild( const menu_token_t* menu, uint16_t index );
+
+/**
+ * @brief   Get parent of menu.
+ * @param   [in] menu - menu token
+ * @return  parent token, NULL for root or not compiled menu
+ */
+menu_token_t* MenuTree_GetParent( const menu_token_t* menu );
+
+/**
+ * @brief   Get count of compiled nodes.
+ * @return  count of nodes
+ */
+uint16_t MenuTree_GetSize( void );
+
+#endif
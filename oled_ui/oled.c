@@ -1,8 +1,15 @@
 #include "oled.h"
 
 #include "app_config.h"
+#include "i2c_bus.h"
+#include "intf/ssd1306_interface.h"
 #include "ssd1306.h"
 #include "ssd1306_1bit.h"
+#include "ui_trace.h"
+
+#ifdef CONFIG_OLED_ASSET_PACK
+#include "asset_pack.h"
+#endif
 
 #define YADDR1( y )     ( (uint16_t) ( ( y ) >> 3 ) * m_w )
 #define BANK_ADDR1( b ) ( ( b ) * m_w )
@@ -10,6 +17,47 @@
 #define DISPLAY_WIDTH    128
 #define DISPLAY_HEIGHT   64
 #define FONTS_TABLE_SIZE 3
+#define PAGE_COUNT       ( DISPLAY_HEIGHT / 8 )
+
+/* Glyphs converted to page-major columns, larger bitmaps are drawn pixel by pixel */
+#define GLYPH_MAX_WIDTH 32
+#define GLYPH_MAX_PAGES 4
+
+/* Direct-mapped code point index per font, power of 2, 128 keeps ASCII without collisions.
+   Entry takes 12 B of RAM, FONTS_TABLE_SIZE fonts with 128 entries ~4.6 KB */
+#ifndef CONFIG_OLED_GLYPH_INDEX_SIZE
+#define CONFIG_OLED_GLYPH_INDEX_SIZE 128
+#endif
+
+#if ( CONFIG_OLED_GLYPH_INDEX_SIZE & ( CONFIG_OLED_GLYPH_INDEX_SIZE - 1 ) ) != 0
+#error "CONFIG_OLED_GLYPH_INDEX_SIZE must be power of 2"
+#endif
+
+/* Transposed glyph cache, entry takes ~136 B of RAM (GLYPH_MAX_PAGES * GLYPH_MAX_WIDTH columns), 64 entries ~8.7 KB */
+#ifndef CONFIG_OLED_GLYPH_CACHE_SIZE
+#define CONFIG_OLED_GLYPH_CACHE_SIZE 64
+#endif
+
+/* Display port, platform i2c init installs I2C_NUM_1 by default */
+#ifndef CONFIG_OLED_I2C_PORT
+#define CONFIG_OLED_I2C_PORT 1
+#endif
+
+/* Unchanged gap shorter than this is sent instead of starting new block, set_block costs ~ 8 bytes */
+#ifndef CONFIG_OLED_FLUSH_MIN_GAP
+#define CONFIG_OLED_FLUSH_MIN_GAP 8
+#endif
+
+/* Pack fonts are generated at build time and/or loaded from asset pack partition */
+#if defined( CONFIG_OLED_FONT_PACK ) || defined( CONFIG_OLED_ASSET_PACK )
+#define OLED_PACK_FONTS 1
+#endif
+
+#ifdef CONFIG_OLED_FONT_PACK
+#define BUILTIN_PACK( _font ) ( &( _font ) )
+#else
+#define BUILTIN_PACK( _font ) NULL
+#endif
 
 enum
 {
@@ -40,22 +88,64 @@ struct oledFontData
   const uint8_t* data;
 };
 
+struct oledGlyphIndex
+{
+  const uint8_t* glyph;    ///< NULL if font has no glyph for code
+  uint16_t code;
+  uint8_t width;
+  uint8_t height;
+  bool is_rle;    ///< pack glyph is compressed
+  bool valid;
+};
+
 struct oledFont
 {
   lcduint_t width;
   lcduint_t height;
+#ifdef OLED_PACK_FONTS
+  const oledPackFont* pack;
+#else
   struct oledFontData data[FONTS_TABLE_SIZE];
+#endif
+  struct oledGlyphIndex index[CONFIG_OLED_GLYPH_INDEX_SIZE];
 };
 
 static lcduint_t m_w = DISPLAY_WIDTH;    ///< width of NanoCanvas area in pixels
 static lcduint_t m_h = DISPLAY_HEIGHT;    ///< height of NanoCanvas area in pixels
 static lcdint_t m_cursorX;    ///< current X cursor position for text output
 static lcdint_t m_cursorY;    ///< current Y cursor position for text output
-static uint8_t m_buf[DISPLAY_WIDTH * ( DISPLAY_HEIGHT / 8 )];    ///< Canvas data
+static uint8_t m_buf[DISPLAY_WIDTH * PAGE_COUNT] __attribute__( ( aligned( 4 ) ) );    ///< Canvas data
+static uint8_t m_shadow[DISPLAY_WIDTH * PAGE_COUNT] __attribute__( ( aligned( 4 ) ) );    ///< Last frame sent to display
+static bool m_shadow_valid;    ///< false forces full frame on next update
+static uint64_t m_shadow_hash;    ///< hash of m_shadow
+static bool m_shadow_hash_valid;    ///< false after partial update
+static oledFlushStats m_flush_stats;
 static uint16_t m_color;    ///< current color for monochrome operations
 static struct NanoPoint offset;
 static struct oledFont* actual_font;
 
+#ifdef OLED_PACK_FONTS
+static struct oledFont font11 =
+  {
+    .width = 11,
+    .height = 13,
+    .pack = BUILTIN_PACK( oled_pack_font11 ),
+};
+
+static struct oledFont font16 =
+  {
+    .width = 16,
+    .height = 17,
+    .pack = BUILTIN_PACK( oled_pack_font16 ),
+};
+
+static struct oledFont font26 =
+  {
+    .width = 16,
+    .height = 26,
+    .pack = BUILTIN_PACK( oled_pack_font26 ),
+};
+#else
 static struct oledFont font11 =
   {
     .width = 11,
@@ -76,6 +166,28 @@ static struct oledFont font26 =
     .height = 26,
     .data = {{ .data = Calibri21x24 }, { .data = Calibri21x26_PL }, { .data = Calibri26x24_RU }},
 };
+#endif
+
+struct oledGlyph
+{
+  const uint8_t* bitmap;    ///< source row-major or compressed bitmap, cache key
+  uint8_t width;
+  uint8_t height;
+  uint8_t columns[GLYPH_MAX_PAGES * GLYPH_MAX_WIDTH];    ///< page-major, byte per column of 8 rows
+};
+
+static struct oledGlyph glyph_cache[CONFIG_OLED_GLYPH_CACHE_SIZE];
+
+#ifdef CONFIG_OLED_ASSET_PACK
+static oledPackFont asset_fonts[OLED_FONT_SIZE_LAST];
+static const char* asset_font_names[OLED_FONT_SIZE_LAST] = { "oled_pack_font11", "oled_pack_font16", "oled_pack_font26" };
+#endif
+
+#ifdef OLED_PACK_FONTS
+static void _draw_pack_glyph( lcdint_t x, lcdint_t y, const struct oledGlyphIndex* entry );
+#endif
+
+static i2c_bus_device_t bus_dev;
 
 extern SFixedFontInfo s_fixedFont;
 #ifdef CONFIG_SSD1306_UNICODE_ENABLE
@@ -120,6 +232,43 @@ static struct oledFont* _get_font_table( enum oledFontSize font_size )
   return NULL;
 }
 
+#ifdef OLED_PACK_FONTS
+static void _find_glyph( struct oledFont* font, uint16_t unicode, struct oledGlyphIndex* entry )
+{
+  const oledPackFont* pack = font->pack;
+  int low = 0;
+  int high = pack != NULL ? (int) pack->count - 1 : -1;
+
+  entry->code = unicode;
+  entry->valid = true;
+  entry->glyph = NULL;
+  entry->width = 0;
+
+  while ( low <= high )
+  {
+    int mid = ( low + high ) / 2;
+    uint16_t code = pack->codes[mid];
+    if ( code == unicode )
+    {
+      const oledPackGlyph* glyph = &pack->glyphs[mid];
+      entry->glyph = &pack->data[glyph->offset];
+      entry->width = glyph->width;
+      entry->height = glyph->height;
+      entry->is_rle = glyph->is_rle;
+      return;
+    }
+
+    if ( code < unicode )
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid - 1;
+    }
+  }
+}
+#else
 static const uint8_t* _read_unicode_record( oledGLCDInfo* r, const uint8_t* p )
 {
   r->first_symbol = ( ( pgm_read_byte( &p[3] ) << 8 ) | ( pgm_read_byte( &p[2] ) ) );
@@ -129,37 +278,72 @@ static const uint8_t* _read_unicode_record( oledGLCDInfo* r, const uint8_t* p )
   return ( r->count > 0 ) ? ( &p[8] ) : NULL;
 }
 
-static void _get_GLCD_char_bitmap( uint16_t unicode, SCharInfo* info )
+static void _find_glyph( struct oledFont* font, uint16_t unicode, struct oledGlyphIndex* entry )
 {
-  if ( info == NULL )
-  {
-    return;
-  }
+  entry->code = unicode;
+  entry->valid = true;
+  entry->glyph = NULL;
+  entry->width = 0;
+  entry->height = font->height;
+  entry->is_rle = false;
 
   for ( int i = 0; i < FONTS_TABLE_SIZE; i++ )
   {
-    if ( ( unicode < actual_font->data[i].info.first_symbol ) || ( unicode >= actual_font->data[i].info.last_symbol ) )
+    if ( ( unicode < font->data[i].info.first_symbol ) || ( unicode >= font->data[i].info.last_symbol ) )
     {
       continue;
     }
-    /* At this point data points to jump table (height|addr|addr|addr) */
-    const uint8_t* data = actual_font->data[i].data;
-    unicode -= actual_font->data[i].info.first_symbol;
-    data += unicode * 4 + 8;
+    /* At this point data points to jump table (width|addr|addr|addr) */
+    const uint8_t* data = font->data[i].data;
+    data += ( unicode - font->data[i].info.first_symbol ) * 4 + 8;
     uint32_t addr = ( pgm_read_byte( &data[3] ) << 16 ) | ( pgm_read_byte( &data[2] ) << 8 ) | ( pgm_read_byte( &data[1] ) );
-    info->width = pgm_read_byte( &data[0] );
-    info->height = actual_font->height;
-    info->spacing = 1;
-    info->glyph = &actual_font->data[i].data[addr];
+    entry->width = pgm_read_byte( &data[0] );
+    entry->glyph = &font->data[i].data[addr];
     return;
   }
+}
+#endif
+
+static struct oledGlyphIndex* _get_index_entry( struct oledFont* font, uint16_t unicode )
+{
+  struct oledGlyphIndex* entry = &font->index[unicode & ( CONFIG_OLED_GLYPH_INDEX_SIZE - 1 )];
 
-  if ( !info->glyph )
+  if ( !entry->valid || entry->code != unicode )
+  {
+    _find_glyph( font, unicode, entry );
+  }
+
+  return entry;
+}
+
+static void _get_font_char_bitmap( struct oledFont* font, uint16_t unicode, SCharInfo* info )
+{
+  struct oledGlyphIndex* entry = _get_index_entry( font, unicode );
+
+  if ( entry->glyph != NULL )
+  {
+    info->width = entry->width;
+    info->height = entry->height;
+    info->spacing = 1;
+    info->glyph = entry->glyph;
+  }
+  else
   {
     info->width = 0;
     info->height = 0;
-    info->spacing = actual_font->width >> 1;
+    info->spacing = font->width >> 1;
+    info->glyph = NULL;
+  }
+}
+
+static void _get_GLCD_char_bitmap( uint16_t unicode, SCharInfo* info )
+{
+  if ( info == NULL )
+  {
+    return;
   }
+
+  _get_font_char_bitmap( actual_font, unicode, info );
 }
 
 /////////////////////////////////////////////////////////////////////////////////
@@ -168,19 +352,61 @@ static void _get_GLCD_char_bitmap( uint16_t unicode, SCharInfo* info )
 //
 /////////////////////////////////////////////////////////////////////////////////
 
+/* Display frame is sent in chunks, input devices can use bus between them */
+static int _bus_transfer( uint8_t addr, const uint8_t* data, uint16_t len )
+{
+  bus_dev.addr = addr;
+  return I2CBus_Write( &bus_dev, data, len, I2C_BUS_FLAG_SPLIT );
+}
+
 void oled_init( void )
 {
+  if ( I2CBus_AddDevice( &bus_dev, CONFIG_OLED_I2C_PORT, "oled", 0x3C, I2C_BUS_PRIO_LOW, 0 ) == ERROR_CODE_OK )
+  {
+    ssd1306_platform_i2cSetTransfer( _bus_transfer );
+  }
+
   m_color = WHITE;
   oled_clearScreen();
+#ifndef OLED_PACK_FONTS
   for ( int i = 0; i < FONTS_TABLE_SIZE; i++ )
   {
     _read_unicode_record( &font11.data[i].info, font11.data[i].data );
     _read_unicode_record( &font16.data[i].info, font16.data[i].data );
     _read_unicode_record( &font26.data[i].info, font26.data[i].data );
   }
+#endif
+  memset( font11.index, 0, sizeof( font11.index ) );
+  memset( font16.index, 0, sizeof( font16.index ) );
+  memset( font26.index, 0, sizeof( font26.index ) );
+#ifdef CONFIG_OLED_ASSET_PACK
+  if ( AssetPack_Open() == ERROR_CODE_OK )
+  {
+    for ( int i = 0; i < OLED_FONT_SIZE_LAST; i++ )
+    {
+      if ( AssetPack_GetFont( asset_font_names[i], &asset_fonts[i] ) == ERROR_CODE_OK )
+      {
+        oled_setFontPack( i, &asset_fonts[i] );
+      }
+    }
+  }
+#endif
   oled_setGLCDFont( OLED_FONT_SIZE_11 );
 }
 
+#ifdef OLED_PACK_FONTS
+void oled_setFontPack( enum oledFontSize font_size, const oledPackFont* pack )
+{
+  struct oledFont* font = _get_font_table( font_size );
+  if ( font != NULL )
+  {
+    font->pack = pack;
+    memset( font->index, 0, sizeof( font->index ) );
+    memset( glyph_cache, 0, sizeof( glyph_cache ) );
+  }
+}
+#endif
+
 void oled_clearScreen( void )
 {
   memset( m_buf, 0, YADDR1( m_h ) );
@@ -206,11 +432,15 @@ uint8_t oled_printGLCDChar( uint8_t c )
 
   SCharInfo char_info = { 0 };
   _get_GLCD_char_bitmap( unicode, &char_info );
+#ifdef OLED_PACK_FONTS
+  _draw_pack_glyph( m_cursorX, m_cursorY, _get_index_entry( actual_font, unicode ) );
+#else
   draw_GLCD( m_cursorX,
              m_cursorY,
              char_info.width,
              char_info.height,
              char_info.glyph );
+#endif
   m_cursorX += (lcdint_t) ( char_info.width + char_info.spacing );
   if ( m_cursorX > ( (lcdint_t) m_w - (lcdint_t) actual_font->width ) || ( m_cursorX > ( (lcdint_t) m_w - (lcdint_t) actual_font->width ) ) )
   {
@@ -224,6 +454,46 @@ uint8_t oled_printGLCDChar( uint8_t c )
   return 1;
 }
 
+lcduint_t oled_getStringWidth( const char* ch, enum oledFontSize font_size )
+{
+  struct oledFont* font = _get_font_table( font_size );
+  lcduint_t width = 0;
+  lcduint_t line_width = 0;
+  int8_t spacing = 0;
+
+  if ( font == NULL )
+  {
+    return 0;
+  }
+
+  for ( ; *ch; ch++ )
+  {
+    if ( *ch == '\n' )
+    {
+      line_width = 0;
+      spacing = 0;
+      continue;
+    }
+
+    uint16_t unicode = ssd1306_unicode16FromUtf8( *ch );
+    if ( unicode == SSD1306_MORE_CHARS_REQUIRED || *ch == '\r' )
+    {
+      continue;
+    }
+
+    SCharInfo char_info = { 0 };
+    _get_font_char_bitmap( font, unicode, &char_info );
+    line_width += spacing + char_info.width;
+    spacing = char_info.spacing;
+    if ( line_width > width )
+    {
+      width = line_width;
+    }
+  }
+
+  return width;
+}
+
 void oled_setCursor( lcdint_t xpos, lcdint_t y )
 {
   m_cursorX = xpos;
@@ -293,7 +563,141 @@ void oled_clearPixel( lcdint_t x, lcdint_t y )
   m_buf[YADDR1( y ) + x] &= ~( 1 << ( y & 0x7 ) );
 }
 
-uint8_t draw_GLCD( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* bitmap )
+static void _rect_apply( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, bool set )
+{
+  x -= offset.x;
+  y -= offset.y;
+  lcdint_t x1 = x + (lcdint_t) w;
+  lcdint_t y1 = y + (lcdint_t) h;
+  x = x < 0 ? 0 : x;
+  y = y < 0 ? 0 : y;
+  x1 = x1 > (lcdint_t) m_w ? (lcdint_t) m_w : x1;
+  y1 = y1 > (lcdint_t) m_h ? (lcdint_t) m_h : y1;
+  if ( x >= x1 || y >= y1 )
+  {
+    return;
+  }
+
+  for ( lcdint_t page = y >> 3; page <= ( y1 - 1 ) >> 3; page++ )
+  {
+    uint8_t mask = 0xFF;
+    if ( page == y >> 3 )
+    {
+      mask &= 0xFF << ( y & 0x7 );
+    }
+    if ( page == ( y1 - 1 ) >> 3 )
+    {
+      mask &= 0xFF >> ( 7 - ( ( y1 - 1 ) & 0x7 ) );
+    }
+
+    uint8_t* dst = &m_buf[BANK_ADDR1( page )];
+    for ( lcdint_t col = x; col < x1; col++ )
+    {
+      dst[col] = set ? ( dst[col] | mask ) : ( dst[col] & ~mask );
+    }
+  }
+}
+
+void oled_fillRect( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h )
+{
+  _rect_apply( x, y, w, h, true );
+}
+
+void oled_clearRect( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h )
+{
+  _rect_apply( x, y, w, h, false );
+}
+
+/* Convert row-major GLCD bitmap (bit 0 - left pixel) to display layout */
+static void _transpose_glyph( struct oledGlyph* glyph, const uint8_t* bitmap, lcduint_t w, lcduint_t h )
+{
+  uint8_t bytes_width = ( w + 7 ) / 8;
+
+  glyph->bitmap = bitmap;
+  glyph->width = w;
+  glyph->height = h;
+  memset( glyph->columns, 0, sizeof( glyph->columns ) );
+  for ( uint8_t row = 0; row < h; row++ )
+  {
+    uint8_t* page = &glyph->columns[( row >> 3 ) * w];
+    uint8_t mask = 1 << ( row & 0x7 );
+    for ( uint8_t col = 0; col < w; col++ )
+    {
+      if ( pgm_read_byte( bitmap + row * bytes_width + ( col >> 3 ) ) & ( 1 << ( col & 0x7 ) ) )
+      {
+        page[col] |= mask;
+      }
+    }
+  }
+}
+
+static struct oledGlyph* _get_glyph( const uint8_t* bitmap, lcduint_t w, lcduint_t h )
+{
+  uint32_t index = ( (uint32_t) (uintptr_t) bitmap * 2654435761u ) % CONFIG_OLED_GLYPH_CACHE_SIZE;
+  struct oledGlyph* glyph = &glyph_cache[index];
+
+  if ( glyph->bitmap != bitmap || glyph->width != w || glyph->height != h )
+  {
+    _transpose_glyph( glyph, bitmap, w, h );
+  }
+
+  return glyph;
+}
+
+/* Column bytes are shifted to destination row and OR-ed (AND-ed for black) into two pages */
+static void _blit_columns( const uint8_t* columns, uint8_t width, uint8_t height, lcdint_t x, lcdint_t y )
+{
+  uint8_t pages = ( height + 7 ) >> 3;
+  uint8_t shift = y & 0x7;
+  lcdint_t dst_page = y >> 3;
+  lcdint_t page_count = m_h >> 3;
+  uint8_t last_mask = ( height & 0x7 ) ? ( 1 << ( height & 0x7 ) ) - 1 : 0xFF;
+
+  for ( uint8_t page = 0; page < pages; page++, dst_page++ )
+  {
+    const uint8_t* src = &columns[page * width];
+    uint8_t mask = ( page == pages - 1 ) ? last_mask : 0xFF;
+    bool low_visible = dst_page >= 0 && dst_page < page_count;
+    bool high_visible = shift != 0 && dst_page + 1 >= 0 && dst_page + 1 < page_count;
+    uint8_t* low = low_visible ? &m_buf[BANK_ADDR1( dst_page ) + x] : NULL;
+    uint8_t* high = high_visible ? &m_buf[BANK_ADDR1( dst_page + 1 ) + x] : NULL;
+
+    for ( uint8_t col = 0; col < width; col++ )
+    {
+      uint8_t data = pgm_read_byte( &src[col] ) & mask;
+      if ( data == 0 )
+      {
+        continue;
+      }
+
+      if ( low_visible )
+      {
+        if ( m_color == BLACK )
+        {
+          low[col] &= ~(uint8_t) ( data << shift );
+        }
+        else
+        {
+          low[col] |= (uint8_t) ( data << shift );
+        }
+      }
+
+      if ( high_visible )
+      {
+        if ( m_color == BLACK )
+        {
+          high[col] &= ~(uint8_t) ( data >> ( 8 - shift ) );
+        }
+        else
+        {
+          high[col] |= (uint8_t) ( data >> ( 8 - shift ) );
+        }
+      }
+    }
+  }
+}
+
+static uint8_t _draw_GLCD_pixels( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* bitmap )
 {
   uint8_t i;
   uint8_t bytes_width;
@@ -346,7 +750,284 @@ uint8_t draw_GLCD( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8
   return w;
 }
 
+uint8_t draw_GLCD( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* bitmap )
+{
+  if ( bitmap == NULL || w == 0 || h == 0 )
+  {
+    return 0;
+  }
+
+  if ( w > GLYPH_MAX_WIDTH || h > GLYPH_MAX_PAGES * 8 )
+  {
+    return _draw_GLCD_pixels( x, y, w, h, bitmap );
+  }
+
+  x -= offset.x;
+  y -= offset.y;
+
+  /* Clipped once per glyph, char crossing right or left edge is skipped as before */
+  if ( x < 0 || x + (lcdint_t) w > (lcdint_t) m_w || y >= (lcdint_t) m_h || y + (lcdint_t) h <= 0 )
+  {
+    return 0;
+  }
+
+  struct oledGlyph* glyph = _get_glyph( bitmap, w, h );
+  _blit_columns( glyph->columns, glyph->width, glyph->height, x, y );
+  return w;
+}
+
+void oled_drawPageBitmap( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* columns )
+{
+  x -= offset.x;
+  y -= offset.y;
+
+  if ( columns == NULL || x < 0 || x + (lcdint_t) w > (lcdint_t) m_w || y >= (lcdint_t) m_h || y + (lcdint_t) h <= 0 )
+  {
+    return;
+  }
+
+  _blit_columns( columns, w, h, x, y );
+}
+
+#ifdef OLED_PACK_FONTS
+/* PackBits: n < 128 - n + 1 literal bytes follow, n >= 128 - next byte repeated n - 125 times */
+static void _unpack_glyph( struct oledGlyph* glyph, const uint8_t* data, lcduint_t w, lcduint_t h )
+{
+  uint16_t size = w * ( ( h + 7 ) >> 3 );
+  uint16_t pos = 0;
+
+  glyph->bitmap = data;
+  glyph->width = w;
+  glyph->height = h;
+  while ( pos < size )
+  {
+    uint8_t n = pgm_read_byte( data++ );
+    if ( n < 128 )
+    {
+      for ( uint16_t i = 0; i <= n && pos < size; i++ )
+      {
+        glyph->columns[pos++] = pgm_read_byte( data++ );
+      }
+    }
+    else
+    {
+      uint8_t value = pgm_read_byte( data++ );
+      for ( uint16_t i = 0; i < n - 125u && pos < size; i++ )
+      {
+        glyph->columns[pos++] = value;
+      }
+    }
+  }
+}
+
+/* Pack glyphs are already page-major, plain ones are blitted directly from flash */
+static void _draw_pack_glyph( lcdint_t x, lcdint_t y, const struct oledGlyphIndex* entry )
+{
+  const uint8_t* columns = entry->glyph;
+  lcduint_t w = entry->width;
+  lcduint_t h = entry->height;
+
+  if ( columns == NULL || w == 0 || h == 0 )
+  {
+    return;
+  }
+
+  x -= offset.x;
+  y -= offset.y;
+
+  if ( x < 0 || x + (lcdint_t) w > (lcdint_t) m_w || y >= (lcdint_t) m_h || y + (lcdint_t) h <= 0 )
+  {
+    return;
+  }
+
+  if ( entry->is_rle )
+  {
+    if ( w > GLYPH_MAX_WIDTH || h > GLYPH_MAX_PAGES * 8 )
+    {
+      return;
+    }
+
+    uint32_t index = ( (uint32_t) (uintptr_t) columns * 2654435761u ) % CONFIG_OLED_GLYPH_CACHE_SIZE;
+    struct oledGlyph* glyph = &glyph_cache[index];
+    if ( glyph->bitmap != columns )
+    {
+      _unpack_glyph( glyph, columns, w, h );
+    }
+    columns = glyph->columns;
+  }
+
+  _blit_columns( columns, w, h, x, y );
+}
+#endif
+
+static void _send_block( uint8_t page, uint16_t x0, uint16_t x1 )
+{
+  uint16_t pos = page * m_w + x0;
+  uint16_t len = x1 - x0;
+
+  ssd1306_lcd.set_block( offset.x + x0, ( offset.y >> 3 ) + page, len );
+  ssd1306_lcd.send_pixels_buffer1( &m_buf[pos], len );
+  ssd1306_intf.stop();
+  memcpy( &m_shadow[pos], &m_buf[pos], len );
+  m_flush_stats.last_bytes += len;
+  m_flush_stats.last_blocks++;
+}
+
+/* Find changed columns of page by word XOR and send them as few blocks,
+ * first_word and last_word limit compared range */
+static void _flush_page( uint8_t page, uint16_t first_word, uint16_t last_word )
+{
+  const uint32_t* cur = (const uint32_t*) &m_buf[page * m_w];
+  const uint32_t* old = (const uint32_t*) &m_shadow[page * m_w];
+  const uint8_t* cur8 = (const uint8_t*) cur;
+  const uint8_t* old8 = (const uint8_t*) old;
+  int32_t start = -1;
+  int32_t end = 0;
+
+  for ( uint16_t i = first_word; i < last_word; i++ )
+  {
+    if ( ( cur[i] ^ old[i] ) == 0 )
+    {
+      continue;
+    }
+
+    uint16_t x0 = i * sizeof( uint32_t );
+    uint16_t x1 = x0 + sizeof( uint32_t );
+    while ( cur8[x0] == old8[x0] )
+    {
+      x0++;
+    }
+    while ( cur8[x1 - 1] == old8[x1 - 1] )
+    {
+      x1--;
+    }
+
+    if ( start >= 0 && x0 - end >= CONFIG_OLED_FLUSH_MIN_GAP )
+    {
+      _send_block( page, start, end );
+      start = -1;
+    }
+
+    if ( start < 0 )
+    {
+      start = x0;
+    }
+    end = x1;
+  }
+
+  if ( start >= 0 )
+  {
+    _send_block( page, start, end );
+  }
+}
+
+/* FNV-1a over 32-bit words, 64-bit state makes collision of two frames practically impossible */
+static uint64_t _frame_hash( const uint8_t* buf )
+{
+  const uint32_t* words = (const uint32_t*) buf;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for ( uint32_t i = 0; i < sizeof( m_buf ) / sizeof( uint32_t ); i++ )
+  {
+    hash ^= words[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
 void oled_update( void )
 {
-  ssd1306_drawBufferFast( offset.x, offset.y, m_w, m_h, m_buf );
+  UI_TRACE( UI_TRACE_FLUSH_START, 0 );
+  uint64_t hash = _frame_hash( m_buf );
+
+  m_flush_stats.last_bytes = 0;
+  m_flush_stats.last_blocks = 0;
+
+  /* Identical frame is not compared nor transmitted */
+  if ( m_shadow_valid && m_shadow_hash_valid && hash == m_shadow_hash )
+  {
+    m_flush_stats.skipped++;
+    UI_TRACE( UI_TRACE_FLUSH_END, 0 );
+    return;
+  }
+
+  m_shadow_hash = hash;
+  m_shadow_hash_valid = true;
+  if ( !m_shadow_valid )
+  {
+    ssd1306_drawBufferFast( offset.x, offset.y, m_w, m_h, m_buf );
+    memcpy( m_shadow, m_buf, sizeof( m_shadow ) );
+    m_shadow_valid = true;
+    m_flush_stats.last_bytes = sizeof( m_buf );
+    m_flush_stats.last_blocks = 1;
+  }
+  else
+  {
+    for ( uint8_t page = 0; page < ( m_h >> 3 ); page++ )
+    {
+      _flush_page( page, 0, m_w / sizeof( uint32_t ) );
+    }
+  }
+
+  m_flush_stats.frames++;
+  m_flush_stats.total_bytes += m_flush_stats.last_bytes;
+  UI_TRACE( UI_TRACE_FLUSH_END, m_flush_stats.last_bytes );
+}
+
+void oled_updateRegions( const oledRect* rects, uint8_t count )
+{
+  if ( !m_shadow_valid )
+  {
+    oled_update();
+    return;
+  }
+
+  UI_TRACE( UI_TRACE_FLUSH_START, 0 );
+  m_flush_stats.last_bytes = 0;
+  m_flush_stats.last_blocks = 0;
+  if ( count == 0 )
+  {
+    m_flush_stats.skipped++;
+    UI_TRACE( UI_TRACE_FLUSH_END, 0 );
+    return;
+  }
+
+  /* Frame out of regions can differ from display, hash is computed again on next full update */
+  m_shadow_hash_valid = false;
+  for ( uint8_t i = 0; i < count; i++ )
+  {
+    lcdint_t x0 = rects[i].x - offset.x;
+    lcdint_t y0 = rects[i].y - offset.y;
+    lcdint_t x1 = x0 + (lcdint_t) rects[i].width;
+    lcdint_t y1 = y0 + (lcdint_t) rects[i].height;
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > (lcdint_t) m_w ? (lcdint_t) m_w : x1;
+    y1 = y1 > (lcdint_t) m_h ? (lcdint_t) m_h : y1;
+    if ( x0 >= x1 || y0 >= y1 )
+    {
+      continue;
+    }
+
+    /* Regions can overlap, columns already sent are equal to shadow and are not sent again */
+    for ( lcdint_t page = y0 >> 3; page <= ( y1 - 1 ) >> 3; page++ )
+    {
+      _flush_page( page, x0 / sizeof( uint32_t ), ( x1 + sizeof( uint32_t ) - 1 ) / sizeof( uint32_t ) );
+    }
+  }
+
+  m_flush_stats.frames++;
+  m_flush_stats.total_bytes += m_flush_stats.last_bytes;
+  UI_TRACE( UI_TRACE_FLUSH_END, m_flush_stats.last_bytes );
+}
+
+void oled_invalidate( void )
+{
+  m_shadow_valid = false;
+}
+
+void oled_getFlushStats( oledFlushStats* stats )
+{
+  *stats = m_flush_stats;
 }
\ No newline at end of file
@@ -30,20 +30,82 @@ enum oledFontSize
   OLED_FONT_SIZE_LAST
 };
 
+/* Font pack generated by oled/tools/fontgenerator.py --oled-pack,
+ * glyphs are page-major (byte per column of 8 rows) like display RAM */
+typedef struct
+{
+  uint32_t offset;    ///< glyph data offset in oledPackFont.data
+  uint8_t width;
+  uint8_t height;
+  uint8_t is_rle;    ///< data is PackBits compressed
+} oledPackGlyph;
+
+typedef struct
+{
+  uint8_t width;
+  uint8_t height;
+  uint16_t count;
+  const uint16_t* codes;    ///< sorted unicode codes
+  const oledPackGlyph* glyphs;
+  const uint8_t* data;
+} oledPackFont;
+
+#ifdef CONFIG_OLED_FONT_PACK
+extern const oledPackFont oled_pack_font11;
+extern const oledPackFont oled_pack_font16;
+extern const oledPackFont oled_pack_font26;
+#endif
+
+#if defined( CONFIG_OLED_FONT_PACK ) || defined( CONFIG_OLED_ASSET_PACK )
+/* Replace font, pack must be valid while used (asset pack is not closed) */
+void oled_setFontPack( enum oledFontSize font_size, const oledPackFont* pack );
+#endif
+
+typedef struct
+{
+  lcdint_t x;
+  lcdint_t y;
+  lcduint_t width;
+  lcduint_t height;
+} oledRect;
+
+typedef struct
+{
+  uint32_t last_bytes;    ///< pixel bytes sent by last update
+  uint32_t last_blocks;    ///< set_block transfers of last update
+  uint32_t frames;
+  uint32_t skipped;    ///< updates with frame identical to displayed one
+  uint64_t total_bytes;
+} oledFlushStats;
+
+/* Drawing functions use shared cursor, font and frame buffer, call them only from render task (menu_task).
+ * Other tasks post commands by oled_cmd.h */
 void oled_init( void );
 void oled_clearScreen( void );
 void oled_printFixed( lcdint_t xpos, lcdint_t y, const char* ch, enum oledFontSize font_size );
 void oled_printFixedBlack( lcdint_t xpos, lcdint_t y, const char* ch, enum oledFontSize font_size );
+/* Send only columns changed since last update */
 void oled_update( void );
+/* Send changed columns of given areas only, rest of frame is not compared */
+void oled_updateRegions( const oledRect* rects, uint8_t count );
+/* Next update sends full frame, use when display RAM was lost */
+void oled_invalidate( void );
+void oled_getFlushStats( oledFlushStats* stats );
 void oled_setCursor( lcdint_t xpos, lcdint_t y );
+/* Width in pixels of widest line, without trailing spacing */
+lcduint_t oled_getStringWidth( const char* ch, enum oledFontSize font_size );
 void oled_print( const char* ch );
 void oled_printBlack( const char* ch );
 void oled_putPixel( lcdint_t x, lcdint_t y );
 void oled_clearPixel( lcdint_t x, lcdint_t y );
+void oled_fillRect( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h );
+void oled_clearRect( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h );
 
 void oled_getGLCDCharBitmap( uint16_t unicode, SCharInfo* info );
 void oled_setGLCDFont( enum oledFontSize font_size );
 uint8_t oled_printGLCDChar( uint8_t c );
 uint8_t draw_GLCD( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* bitmap );
+/* Bitmap in display layout, byte per column of 8 rows, page after page (asset pack icons) */
+void oled_drawPageBitmap( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* columns );
 
 #endif
\ No newline at end of file
@@ -0,0 +1,304 @@
+/**
+ *******************************************************************************
+ * @file    oled_cmd.c
+ * @author  Dmytro Shevchenko
+ * @brief   Render command queue source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "oled_cmd.h"
+
+#include <string.h>
+
+/* Private macros ------------------------------------------------------------*/
+
+#define QUEUE_MASK ( CONFIG_OLED_CMD_QUEUE_SIZE - 1 )
+
+#if ( CONFIG_OLED_CMD_QUEUE_SIZE & QUEUE_MASK ) != 0
+#error "CONFIG_OLED_CMD_QUEUE_SIZE must be power of 2"
+#endif
+
+/* Position of slot in lap 0 is its index, so zeroed queue is empty and usable before init */
+#define LAP( _pos ) ( ( _pos ) & ~(uint32_t) QUEUE_MASK )
+
+/* Private types -------------------------------------------------------------*/
+
+typedef enum
+{
+  CMD_CLEAR,
+  CMD_PRINT,
+  CMD_PRINT_BLACK,
+  CMD_FILL_RECT,
+  CMD_CLEAR_RECT,
+  CMD_BITMAP,
+  CMD_INVALIDATE,
+  CMD_UPDATE,
+} cmd_type_t;
+
+typedef struct
+{
+  uint8_t type;
+  uint8_t font;
+  lcdint_t x;
+  lcdint_t y;
+  lcduint_t w;
+  lcduint_t h;
+  union
+  {
+    char text[CONFIG_OLED_CMD_TEXT_SIZE];
+    const uint8_t* columns;
+  };
+} cmd_t;
+
+/* seq: LAP( pos ) - free for producer of pos, LAP( pos ) + 1 - command posted,
+ * LAP( pos ) + QUEUE_SIZE - drawn, free for next lap */
+typedef struct
+{
+  uint32_t seq;
+  cmd_t cmd;
+} slot_t;
+
+typedef struct
+{
+  slot_t slots[CONFIG_OLED_CMD_QUEUE_SIZE];
+  uint32_t head;    ///< next position for producers
+  uint32_t tail;    ///< next position for render task
+  uint32_t done;    ///< position after last flushed batch
+  oled_cmd_stats_t stats;
+} cmd_queue_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+static cmd_queue_t queue;
+static oled_cmd_notify_cb notify_cb;
+
+/* Private functions ---------------------------------------------------------*/
+
+/* Producer which lost race for position retries with next one, nobody waits for other task */
+static error_code_t _post( const cmd_t* cmd, uint32_t* position )
+{
+  uint32_t pos = __atomic_load_n( &queue.head, __ATOMIC_RELAXED );
+
+  while ( 1 )
+  {
+    slot_t* slot = &queue.slots[pos & QUEUE_MASK];
+    uint32_t seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+    int32_t diff = (int32_t) ( seq - LAP( pos ) );
+
+    if ( diff == 0 )
+    {
+      if ( __atomic_compare_exchange_n( &queue.head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+      {
+        slot->cmd = *cmd;
+        __atomic_store_n( &slot->seq, seq + 1, __ATOMIC_RELEASE );
+        __atomic_fetch_add( &queue.stats.posted, 1, __ATOMIC_RELAXED );
+        if ( position != NULL )
+        {
+          *position = pos;
+        }
+        return ERROR_CODE_OK;
+      }
+    }
+    else if ( diff < 0 )
+    {
+      /* Slot of previous lap is not drawn yet */
+      __atomic_fetch_add( &queue.stats.dropped, 1, __ATOMIC_RELAXED );
+      return ERROR_CODE_FAIL;
+    }
+    else
+    {
+      pos = __atomic_load_n( &queue.head, __ATOMIC_RELAXED );
+    }
+  }
+}
+
+static error_code_t _post_area( cmd_type_t type, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h )
+{
+  cmd_t cmd = { .type = type, .x = x, .y = y, .w = w, .h = h };
+  return _post( &cmd, NULL );
+}
+
+static bool _is_posted( uint32_t pos )
+{
+  return __atomic_load_n( &queue.slots[pos & QUEUE_MASK].seq, __ATOMIC_ACQUIRE ) == LAP( pos ) + 1;
+}
+
+/* Position after last posted batch end. Commands of batch still being posted stay in queue,
+ * unless queue is full of them */
+static uint32_t _batch_end( void )
+{
+  uint32_t end = queue.tail;
+  uint32_t pos = queue.tail;
+
+  while ( pos - queue.tail < CONFIG_OLED_CMD_QUEUE_SIZE && _is_posted( pos ) )
+  {
+    if ( queue.slots[pos & QUEUE_MASK].cmd.type == CMD_UPDATE )
+    {
+      end = pos + 1;
+    }
+    pos++;
+  }
+
+  return pos - queue.tail == CONFIG_OLED_CMD_QUEUE_SIZE ? pos : end;
+}
+
+static void _draw( const cmd_t* cmd )
+{
+  switch ( cmd->type )
+  {
+    case CMD_CLEAR:
+      oled_clearScreen();
+      break;
+
+    case CMD_PRINT:
+      oled_printFixed( cmd->x, cmd->y, cmd->text, (enum oledFontSize) cmd->font );
+      break;
+
+    case CMD_PRINT_BLACK:
+      oled_printFixedBlack( cmd->x, cmd->y, cmd->text, (enum oledFontSize) cmd->font );
+      break;
+
+    case CMD_FILL_RECT:
+      oled_fillRect( cmd->x, cmd->y, cmd->w, cmd->h );
+      break;
+
+    case CMD_CLEAR_RECT:
+      oled_clearRect( cmd->x, cmd->y, cmd->w, cmd->h );
+      break;
+
+    case CMD_BITMAP:
+      oled_drawPageBitmap( cmd->x, cmd->y, cmd->w, cmd->h, cmd->columns );
+      break;
+
+    case CMD_INVALIDATE:
+      oled_invalidate();
+      break;
+
+    default:
+      break;
+  }
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+error_code_t OledCmd_Clear( void )
+{
+  return _post_area( CMD_CLEAR, 0, 0, 0, 0 );
+}
+
+error_code_t OledCmd_PrintFixed( lcdint_t x, lcdint_t y, const char* text, enum oledFontSize font_size, bool black )
+{
+  if ( text == NULL || font_size >= OLED_FONT_SIZE_LAST )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  cmd_t cmd = { .type = black ? CMD_PRINT_BLACK : CMD_PRINT, .font = font_size, .x = x, .y = y };
+  strncpy( cmd.text, text, sizeof( cmd.text ) - 1 );
+  return _post( &cmd, NULL );
+}
+
+error_code_t OledCmd_FillRect( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h )
+{
+  return _post_area( CMD_FILL_RECT, x, y, w, h );
+}
+
+error_code_t OledCmd_ClearRect( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h )
+{
+  return _post_area( CMD_CLEAR_RECT, x, y, w, h );
+}
+
+error_code_t OledCmd_DrawPageBitmap( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* columns )
+{
+  if ( columns == NULL )
+  {
+    return ERROR_CODE_FAIL;
+  }
+
+  cmd_t cmd = { .type = CMD_BITMAP, .x = x, .y = y, .w = w, .h = h, .columns = columns };
+  return _post( &cmd, NULL );
+}
+
+error_code_t OledCmd_Invalidate( void )
+{
+  return _post_area( CMD_INVALIDATE, 0, 0, 0, 0 );
+}
+
+error_code_t OledCmd_Update( uint32_t* ticket )
+{
+  cmd_t cmd = { .type = CMD_UPDATE };
+  uint32_t pos = 0;
+  error_code_t err = _post( &cmd, &pos );
+
+  if ( err == ERROR_CODE_OK && ticket != NULL )
+  {
+    *ticket = pos + 1;
+  }
+
+  oled_cmd_notify_cb cb = __atomic_load_n( &notify_cb, __ATOMIC_ACQUIRE );
+  if ( err == ERROR_CODE_OK && cb != NULL )
+  {
+    cb();
+  }
+
+  return err;
+}
+
+void OledCmd_SetNotify( oled_cmd_notify_cb cb )
+{
+  __atomic_store_n( &notify_cb, cb, __ATOMIC_RELEASE );
+}
+
+bool OledCmd_IsDone( uint32_t ticket )
+{
+  return (int32_t) ( __atomic_load_n( &queue.done, __ATOMIC_ACQUIRE ) - ticket ) >= 0;
+}
+
+uint32_t OledCmd_Process( void )
+{
+  uint32_t end = _batch_end();
+  uint32_t count = end - queue.tail;
+  bool flush = false;
+
+  while ( queue.tail != end )
+  {
+    slot_t* slot = &queue.slots[queue.tail & QUEUE_MASK];
+    cmd_t cmd = slot->cmd;
+
+    /* Slot is given back before drawing, producers do not wait for display */
+    __atomic_store_n( &slot->seq, LAP( queue.tail ) + CONFIG_OLED_CMD_QUEUE_SIZE, __ATOMIC_RELEASE );
+    queue.tail++;
+
+    if ( cmd.type == CMD_UPDATE )
+    {
+      flush = true;
+    }
+    else
+    {
+      _draw( &cmd );
+    }
+  }
+
+  if ( flush )
+  {
+    oled_update();
+    queue.stats.batches++;
+    __atomic_store_n( &queue.done, end, __ATOMIC_RELEASE );
+  }
+
+  return count;
+}
+
+void OledCmd_GetStats( oled_cmd_stats_t* stats )
+{
+  if ( stats == NULL )
+  {
+    return;
+  }
+
+  stats->posted = __atomic_load_n( &queue.stats.posted, __ATOMIC_RELAXED );
+  stats->dropped = __atomic_load_n( &queue.stats.dropped, __ATOMIC_RELAXED );
+  stats->batches = queue.stats.batches;
+}
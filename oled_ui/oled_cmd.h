@@ -0,0 +1,112 @@
+/**
+ *******************************************************************************
+ * @file    oled_cmd.h
+ * @author  Dmytro Shevchenko
+ * @brief   Render command queue header file.
+ *          oled.c keeps cursor, font and frame buffer in globals, so it may be
+ *          used only by render task (menu_task). Other tasks post draw
+ *          commands to lock-free queue, render task draws them to frame buffer
+ *          and sends changes once per batch. Posting never waits for display.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _OLED_CMD_H_
+#define _OLED_CMD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "error_code.h"
+#include "oled.h"
+
+/* Public macro --------------------------------------------------------------*/
+
+/* Must be power of 2 */
+#ifndef CONFIG_OLED_CMD_QUEUE_SIZE
+#define CONFIG_OLED_CMD_QUEUE_SIZE 32
+#endif
+
+#ifndef CONFIG_OLED_CMD_TEXT_SIZE
+#define CONFIG_OLED_CMD_TEXT_SIZE 32
+#endif
+
+/* Public types --------------------------------------------------------------*/
+
+typedef struct
+{
+  uint32_t posted;
+  uint32_t dropped;    ///< commands not posted because queue was full
+  uint32_t batches;    ///< flushes done by render task
+} oled_cmd_stats_t;
+
+typedef void ( *oled_cmd_notify_cb )( void );
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Post clear of whole frame buffer.
+ * @return  ERROR_CODE_FAIL if queue is full
+ */
+error_code_t OledCmd_Clear( void );
+
+/**
+ * @brief   Post text, font is part of command so commands of different tasks
+ *          can be mixed.
+ * @param   [in] x - x position
+ * @param   [in] y - y position
+ * @param   [in] text - text, copied to command, cut to CONFIG_OLED_CMD_TEXT_SIZE - 1 bytes
+ * @param   [in] font_size - font
+ * @param   [in] black - print black text on white background
+ * @return  ERROR_CODE_FAIL if queue is full
+ */
+error_code_t OledCmd_PrintFixed( lcdint_t x, lcdint_t y, const char* text, enum oledFontSize font_size, bool black );
+
+error_code_t OledCmd_FillRect( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h );
+error_code_t OledCmd_ClearRect( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h );
+
+/**
+ * @brief   Post page-major bitmap, see oled_drawPageBitmap.
+ * @param   [in] columns - bitmap data, not copied, must be valid until batch is done
+ * @return  ERROR_CODE_FAIL if queue is full
+ */
+error_code_t OledCmd_DrawPageBitmap( lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* columns );
+
+/**
+ * @brief   Post full frame send on next flush, use when display RAM was lost.
+ * @return  ERROR_CODE_FAIL if queue is full
+ */
+error_code_t OledCmd_Invalidate( void );
+
+/**
+ * @brief   End batch and wake up render task. Render task draws commands only up to
+ *          last posted batch end, so half posted batch is not shown.
+ * @param   [out] ticket - for OledCmd_IsDone, can be NULL
+ * @return  ERROR_CODE_FAIL if queue is full
+ */
+error_code_t OledCmd_Update( uint32_t* ticket );
+
+/**
+ * @brief   Set function waking up render task, called by OledCmd_Update from
+ *          posting task. Render task which sleeps between frames must register it.
+ * @param   [in] cb - wake up function, NULL to disable
+ */
+void OledCmd_SetNotify( oled_cmd_notify_cb cb );
+
+/**
+ * @brief   Check if batch was sent to display.
+ * @param   [in] ticket - ticket from OledCmd_Update
+ * @return  true if batch is on display
+ */
+bool OledCmd_IsDone( uint32_t ticket );
+
+/**
+ * @brief   Draw ended batches and flush display once. Only for render task.
+ * @return  count of drawn commands, frame buffer was changed if not 0
+ */
+uint32_t OledCmd_Process( void );
+
+void OledCmd_GetStats( oled_cmd_stats_t* stats );
+
+#endif
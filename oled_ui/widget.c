@@ -0,0 +1,477 @@
+/**
+ *******************************************************************************
+ * @file    widget.c
+ * @author  Dmytro Shevchenko
+ * @brief   Retained mode widgets for oled_ui source file
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "widget.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Private macros ------------------------------------------------------------*/
+
+#define SCREEN_WIDTH  128
+#define SCREEN_HEIGHT 64
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint32_t _text_hash( const char* text )
+{
+  uint32_t hash = 2166136261u;
+
+  if ( text == NULL )
+  {
+    return 0;
+  }
+
+  while ( *text )
+  {
+    hash ^= (uint8_t) *text++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+static bool _is_empty( const oledRect* rect )
+{
+  return rect->width == 0 || rect->height == 0;
+}
+
+static bool _intersects( const oledRect* a, const oledRect* b )
+{
+  return a->x < b->x + (lcdint_t) b->width && b->x < a->x + (lcdint_t) a->width && a->y < b->y + (lcdint_t) b->height && b->y < a->y + (lcdint_t) a->height;
+}
+
+static void _union( oledRect* dst, const oledRect* src )
+{
+  lcdint_t x0 = dst->x < src->x ? dst->x : src->x;
+  lcdint_t y0 = dst->y < src->y ? dst->y : src->y;
+  lcdint_t x1 = dst->x + (lcdint_t) dst->width;
+  lcdint_t y1 = dst->y + (lcdint_t) dst->height;
+
+  x1 = x1 > src->x + (lcdint_t) src->width ? x1 : src->x + (lcdint_t) src->width;
+  y1 = y1 > src->y + (lcdint_t) src->height ? y1 : src->y + (lcdint_t) src->height;
+  dst->x = x0;
+  dst->y = y0;
+  dst->width = x1 - x0;
+  dst->height = y1 - y0;
+}
+
+static void _init( widget_t* widget, widget_type_t type, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h )
+{
+  assert( widget );
+  memset( widget, 0, sizeof( widget_t ) );
+  widget->type = type;
+  widget->flags = WIDGET_FLAG_DIRTY;
+  widget->box.x = x;
+  widget->box.y = y;
+  widget->box.width = w;
+  widget->box.height = h;
+}
+
+static void _draw_text( lcdint_t x, lcdint_t y, const char* text, enum oledFontSize font, bool inverted )
+{
+  if ( inverted )
+  {
+    oled_printFixedBlack( x, y, text, font );
+  }
+  else
+  {
+    oled_printFixed( x, y, text, font );
+  }
+}
+
+static void _draw_list( const widget_t* widget, bool inverted )
+{
+  uint16_t lines = widget->list.line_height ? widget->box.height / widget->list.line_height : 0;
+
+  for ( uint16_t i = 0; i < lines && widget->list.first + i < widget->list.count; i++ )
+  {
+    uint16_t item = widget->list.first + i;
+    lcdint_t y = widget->box.y + i * widget->list.line_height;
+    bool highlight = ( item == widget->list.selected ) != inverted;
+
+    if ( highlight )
+    {
+      oled_fillRect( widget->box.x, y, widget->box.width, widget->list.line_height );
+    }
+    else if ( inverted )
+    {
+      oled_clearRect( widget->box.x, y, widget->box.width, widget->list.line_height );
+    }
+    const char* text = widget->list.get_item != NULL ? widget->list.get_item( widget->list.arg, item ) : widget->list.items[item];
+    if ( text != NULL )
+    {
+      _draw_text( widget->box.x + 1, y, text, widget->list.font, highlight );
+    }
+  }
+}
+
+static void _draw_progress( const widget_t* widget, bool inverted )
+{
+  const oledRect* box = &widget->box;
+  lcduint_t inner = box->width > 2 ? box->width - 2 : 0;
+  lcduint_t filled = widget->progress.max ? (lcduint_t) ( (uint64_t) inner * widget->progress.value / widget->progress.max ) : 0;
+  void ( *draw )( lcdint_t, lcdint_t, lcduint_t, lcduint_t ) = inverted ? oled_clearRect : oled_fillRect;
+
+  if ( box->height < 3 || box->width < 3 )
+  {
+    return;
+  }
+
+  draw( box->x, box->y, box->width, 1 );
+  draw( box->x, box->y + box->height - 1, box->width, 1 );
+  draw( box->x, box->y, 1, box->height );
+  draw( box->x + box->width - 1, box->y, 1, box->height );
+  draw( box->x + 1, box->y + 1, filled > inner ? inner : filled, box->height - 2 );
+}
+
+/* Box is cleared (filled if inverted) and widget drawn from its retained state */
+static void _draw( const widget_t* widget )
+{
+  bool inverted = ( widget->flags & WIDGET_FLAG_INVERTED ) != 0;
+  char buffer[WIDGET_VALUE_BUFFER_SIZE];
+
+  if ( inverted )
+  {
+    oled_fillRect( widget->box.x, widget->box.y, widget->box.width, widget->box.height );
+  }
+  else
+  {
+    oled_clearRect( widget->box.x, widget->box.y, widget->box.width, widget->box.height );
+  }
+
+  switch ( widget->type )
+  {
+    case WIDGET_TYPE_LABEL:
+      if ( widget->label.text != NULL )
+      {
+        _draw_text( widget->box.x, widget->box.y, widget->label.text, widget->label.font, inverted );
+      }
+      break;
+
+    case WIDGET_TYPE_VALUE:
+      snprintf( buffer, sizeof( buffer ), widget->value.format, widget->value.value );
+      _draw_text( widget->box.x, widget->box.y, buffer, widget->value.font, inverted );
+      break;
+
+    case WIDGET_TYPE_LIST:
+      _draw_list( widget, inverted );
+      break;
+
+    case WIDGET_TYPE_PROGRESS:
+      _draw_progress( widget, inverted );
+      break;
+
+    case WIDGET_TYPE_ICON:
+      if ( widget->icon.data != NULL && !inverted )
+      {
+        oled_drawPageBitmap( widget->box.x, widget->box.y, widget->box.width, widget->box.height, widget->icon.data );
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/* Overlapping damage is merged, when list is full last rect grows */
+static void _add_damage( widget_screen_t* screen, const oledRect* rect )
+{
+  if ( _is_empty( rect ) )
+  {
+    return;
+  }
+
+  for ( uint8_t i = 0; i < screen->damage_count; i++ )
+  {
+    if ( _intersects( &screen->damage[i], rect ) )
+    {
+      _union( &screen->damage[i], rect );
+      return;
+    }
+  }
+
+  if ( screen->damage_count < CONFIG_WIDGET_MAX_DAMAGE )
+  {
+    screen->damage[screen->damage_count++] = *rect;
+  }
+  else
+  {
+    _union( &screen->damage[CONFIG_WIDGET_MAX_DAMAGE - 1], rect );
+  }
+}
+
+static bool _is_damaged( const widget_screen_t* screen, const oledRect* rect )
+{
+  for ( uint8_t i = 0; i < screen->damage_count; i++ )
+  {
+    if ( _intersects( &screen->damage[i], rect ) )
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void _set_dirty( widget_t* widget )
+{
+  widget->flags |= WIDGET_FLAG_DIRTY;
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+void WidgetScreen_Init( widget_screen_t* screen )
+{
+  assert( screen );
+  memset( screen, 0, sizeof( widget_screen_t ) );
+}
+
+void WidgetScreen_Add( widget_screen_t* screen, widget_t* widget )
+{
+  assert( screen );
+  assert( widget );
+  widget_t** last = &screen->first;
+
+  while ( *last != NULL )
+  {
+    last = &( *last )->next;
+  }
+
+  widget->next = NULL;
+  *last = widget;
+  _set_dirty( widget );
+}
+
+void WidgetScreen_Invalidate( widget_screen_t* screen )
+{
+  assert( screen );
+  oledRect all = { .x = 0, .y = 0, .width = SCREEN_WIDTH, .height = SCREEN_HEIGHT };
+
+  oled_clearScreen();
+  screen->damage_count = 0;
+  _add_damage( screen, &all );
+}
+
+void WidgetScreen_AddDamage( widget_screen_t* screen, const oledRect* rect )
+{
+  assert( screen );
+  assert( rect );
+  _add_damage( screen, rect );
+}
+
+bool WidgetScreen_Render( widget_screen_t* screen )
+{
+  assert( screen );
+
+  for ( widget_t* widget = screen->first; widget != NULL; widget = widget->next )
+  {
+    if ( widget->flags & WIDGET_FLAG_DIRTY )
+    {
+      /* Area left by moved or hidden widget stays clear */
+      oled_clearRect( widget->drawn.x, widget->drawn.y, widget->drawn.width, widget->drawn.height );
+      _add_damage( screen, &widget->drawn );
+      if ( !( widget->flags & WIDGET_FLAG_HIDDEN ) )
+      {
+        _add_damage( screen, &widget->box );
+      }
+    }
+  }
+
+  if ( screen->damage_count == 0 )
+  {
+    return false;
+  }
+
+  for ( widget_t* widget = screen->first; widget != NULL; widget = widget->next )
+  {
+    if ( widget->flags & WIDGET_FLAG_HIDDEN )
+    {
+      memset( &widget->drawn, 0, sizeof( widget->drawn ) );
+    }
+    else if ( ( widget->flags & WIDGET_FLAG_DIRTY ) || _is_damaged( screen, &widget->box ) )
+    {
+      _draw( widget );
+      widget->drawn = widget->box;
+    }
+    widget->flags &= ~WIDGET_FLAG_DIRTY;
+  }
+
+  oled_updateRegions( screen->damage, screen->damage_count );
+  screen->damage_count = 0;
+  return true;
+}
+
+void Widget_InitLabel( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, enum oledFontSize font, const char* text )
+{
+  _init( widget, WIDGET_TYPE_LABEL, x, y, w, h );
+  widget->label.font = font;
+  widget->label.text = text;
+  widget->label.hash = _text_hash( text );
+}
+
+void Widget_InitValue( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, enum oledFontSize font, const char* format )
+{
+  _init( widget, WIDGET_TYPE_VALUE, x, y, w, h );
+  widget->value.font = font;
+  widget->value.format = format;
+}
+
+void Widget_InitList( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, enum oledFontSize font, uint8_t line_height )
+{
+  _init( widget, WIDGET_TYPE_LIST, x, y, w, h );
+  widget->list.font = font;
+  widget->list.line_height = line_height;
+}
+
+void Widget_InitProgress( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, uint32_t max )
+{
+  _init( widget, WIDGET_TYPE_PROGRESS, x, y, w, h );
+  widget->progress.max = max;
+}
+
+void Widget_InitIcon( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* data )
+{
+  _init( widget, WIDGET_TYPE_ICON, x, y, w, h );
+  widget->icon.data = data;
+}
+
+void Widget_SetText( widget_t* widget, const char* text )
+{
+  assert( widget );
+  uint32_t hash = _text_hash( text );
+
+  if ( widget->label.text != text || widget->label.hash != hash )
+  {
+    widget->label.text = text;
+    widget->label.hash = hash;
+    _set_dirty( widget );
+  }
+}
+
+void Widget_SetValue( widget_t* widget, int32_t value )
+{
+  assert( widget );
+
+  if ( widget->type == WIDGET_TYPE_PROGRESS )
+  {
+    uint32_t progress = value < 0 ? 0 : (uint32_t) value;
+    progress = progress > widget->progress.max ? widget->progress.max : progress;
+    if ( progress != widget->progress.value )
+    {
+      widget->progress.value = progress;
+      _set_dirty( widget );
+    }
+  }
+  else if ( widget->value.value != value )
+  {
+    widget->value.value = value;
+    _set_dirty( widget );
+  }
+}
+
+void Widget_SetListItems( widget_t* widget, const char* const* items, uint16_t count )
+{
+  assert( widget );
+  widget->list.items = items;
+  widget->list.get_item = NULL;
+  widget->list.count = count;
+  widget->list.first = 0;
+  widget->list.selected = 0;
+  _set_dirty( widget );
+}
+
+void Widget_SetListSource( widget_t* widget, widget_list_item_cb_t get_item, void* arg, uint16_t count )
+{
+  assert( widget );
+  widget->list.items = NULL;
+  widget->list.get_item = get_item;
+  widget->list.arg = arg;
+  widget->list.count = count;
+  widget->list.first = 0;
+  widget->list.selected = 0;
+  _set_dirty( widget );
+}
+
+void Widget_SetListSelected( widget_t* widget, uint16_t selected )
+{
+  assert( widget );
+  uint16_t lines = widget->list.line_height ? widget->box.height / widget->list.line_height : 1;
+
+  if ( selected >= widget->list.count || selected == widget->list.selected )
+  {
+    return;
+  }
+
+  widget->list.selected = selected;
+  if ( selected < widget->list.first )
+  {
+    widget->list.first = selected;
+  }
+  else if ( lines > 0 && selected >= widget->list.first + lines )
+  {
+    widget->list.first = selected - lines + 1;
+  }
+  _set_dirty( widget );
+}
+
+void Widget_SetIcon( widget_t* widget, const uint8_t* data )
+{
+  assert( widget );
+
+  if ( widget->icon.data != data )
+  {
+    widget->icon.data = data;
+    _set_dirty( widget );
+  }
+}
+
+void Widget_SetVisible( widget_t* widget, bool visible )
+{
+  assert( widget );
+  bool hidden = ( widget->flags & WIDGET_FLAG_HIDDEN ) != 0;
+
+  if ( visible == hidden )
+  {
+    widget->flags ^= WIDGET_FLAG_HIDDEN;
+    _set_dirty( widget );
+  }
+}
+
+void Widget_SetInverted( widget_t* widget, bool inverted )
+{
+  assert( widget );
+  bool is_inverted = ( widget->flags & WIDGET_FLAG_INVERTED ) != 0;
+
+  if ( inverted != is_inverted )
+  {
+    widget->flags ^= WIDGET_FLAG_INVERTED;
+    _set_dirty( widget );
+  }
+}
+
+void Widget_SetPosition( widget_t* widget, lcdint_t x, lcdint_t y )
+{
+  assert( widget );
+
+  if ( widget->box.x != x || widget->box.y != y )
+  {
+    widget->box.x = x;
+    widget->box.y = y;
+    _set_dirty( widget );
+  }
+}
+
+void Widget_Invalidate( widget_t* widget )
+{
+  assert( widget );
+  _set_dirty( widget );
+}
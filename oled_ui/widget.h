@@ -0,0 +1,197 @@
+/**
+ *******************************************************************************
+ * @file    widget.h
+ * @author  Dmytro Shevchenko
+ * @brief   Retained mode widgets for oled_ui header file.
+ *          Widgets keep their state and box, setters mark only changed
+ *          widgets dirty. Render clears and redraws damaged areas and sends
+ *          only them to display.
+ *******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion ------------------------------------*/
+
+#ifndef _WIDGET_H_
+#define _WIDGET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "oled.h"
+
+/* Public macro --------------------------------------------------------------*/
+
+#ifndef CONFIG_WIDGET_MAX_DAMAGE
+#define CONFIG_WIDGET_MAX_DAMAGE 8
+#endif
+
+#define WIDGET_VALUE_BUFFER_SIZE 16
+
+#define WIDGET_FLAG_DIRTY    0x01
+#define WIDGET_FLAG_HIDDEN   0x02
+#define WIDGET_FLAG_INVERTED 0x04
+
+/* Public types --------------------------------------------------------------*/
+
+typedef enum
+{
+  WIDGET_TYPE_LABEL,
+  WIDGET_TYPE_VALUE,
+  WIDGET_TYPE_LIST,
+  WIDGET_TYPE_PROGRESS,
+  WIDGET_TYPE_ICON,
+} widget_type_t;
+
+/* Text of list item, list asks only for visible rows */
+typedef const char* ( *widget_list_item_cb_t )( void* arg, uint16_t index );
+
+/* Widget owns its box: box is cleared before widget is drawn, boxes of widgets should not overlap */
+typedef struct widget
+{
+  widget_type_t type;
+  uint8_t flags;
+  oledRect box;
+  oledRect drawn;    ///< box at last render, damaged when widget moves or hides
+  struct widget* next;
+  union
+  {
+    struct
+    {
+      const char* text;
+      uint32_t hash;    ///< text can change in same buffer, hash detects it
+      enum oledFontSize font;
+    } label;
+
+    struct
+    {
+      const char* format;    ///< printf format with one int32_t argument
+      int32_t value;
+      enum oledFontSize font;
+    } value;
+
+    struct
+    {
+      const char* const* items;
+      widget_list_item_cb_t get_item;    ///< used instead of items if set
+      void* arg;
+      uint16_t count;
+      uint16_t selected;
+      uint16_t first;    ///< first visible item
+      uint8_t line_height;
+      enum oledFontSize font;
+    } list;
+
+    struct
+    {
+      uint32_t value;
+      uint32_t max;
+    } progress;
+
+    struct
+    {
+      const uint8_t* data;    ///< page-major bitmap, see oled_drawPageBitmap
+    } icon;
+  };
+} widget_t;
+
+typedef struct
+{
+  widget_t* first;
+  oledRect damage[CONFIG_WIDGET_MAX_DAMAGE];
+  uint8_t damage_count;
+} widget_screen_t;
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief   Init empty screen.
+ * @param   [in] screen - screen pointer
+ */
+void WidgetScreen_Init( widget_screen_t* screen );
+
+/**
+ * @brief   Add widget to screen, widget is drawn on next render.
+ * @param   [in] screen - screen pointer
+ * @param   [in] widget - initialized widget
+ */
+void WidgetScreen_Add( widget_screen_t* screen, widget_t* widget );
+
+/**
+ * @brief   Clear frame buffer and damage whole screen, use when frame buffer was
+ *          drawn by other code. All widgets are drawn on next render.
+ * @param   [in] screen - screen pointer
+ */
+void WidgetScreen_Invalidate( widget_screen_t* screen );
+
+/**
+ * @brief   Add area drawn outside of widgets (immediate mode) to next flush.
+ *          Area is not cleared, widgets crossing it are redrawn.
+ * @param   [in] screen - screen pointer
+ * @param   [in] rect - changed area
+ */
+void WidgetScreen_AddDamage( widget_screen_t* screen, const oledRect* rect );
+
+/**
+ * @brief   Redraw dirty widgets and send damaged areas to display.
+ * @param   [in] screen - screen pointer
+ * @return  true if anything was damaged
+ */
+bool WidgetScreen_Render( widget_screen_t* screen );
+
+void Widget_InitLabel( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, enum oledFontSize font, const char* text );
+void Widget_InitValue( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, enum oledFontSize font, const char* format );
+void Widget_InitList( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, enum oledFontSize font, uint8_t line_height );
+void Widget_InitProgress( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, uint32_t max );
+void Widget_InitIcon( widget_t* widget, lcdint_t x, lcdint_t y, lcduint_t w, lcduint_t h, const uint8_t* data );
+
+/**
+ * @brief   Set label text. Widget is dirty only if text differs.
+ * @param   [in] widget - label widget
+ * @param   [in] text - text, must be valid until next render
+ */
+void Widget_SetText( widget_t* widget, const char* text );
+
+/**
+ * @brief   Set value of value widget or progress bar. Widget is dirty only if value differs.
+ * @param   [in] widget - value or progress widget
+ * @param   [in] value - new value
+ */
+void Widget_SetValue( widget_t* widget, int32_t value );
+
+/**
+ * @brief   Set list items.
+ * @param   [in] widget - list widget
+ * @param   [in] items - items text, must be valid while widget is used
+ * @param   [in] count - count of items
+ */
+void Widget_SetListItems( widget_t* widget, const char* const* items, uint16_t count );
+
+/**
+ * @brief   Set list items source, for long lists without array of texts (e.g. menu elements).
+ *          Only visible rows are requested when list is drawn.
+ * @param   [in] widget - list widget
+ * @param   [in] get_item - returns text of item
+ * @param   [in] arg - argument of get_item
+ * @param   [in] count - count of items
+ */
+void Widget_SetListSource( widget_t* widget, widget_list_item_cb_t get_item, void* arg, uint16_t count );
+
+/**
+ * @brief   Select list item, list is scrolled to keep it visible.
+ * @param   [in] widget - list widget
+ * @param   [in] selected - item index
+ */
+void Widget_SetListSelected( widget_t* widget, uint16_t selected );
+
+void Widget_SetIcon( widget_t* widget, const uint8_t* data );
+void Widget_SetVisible( widget_t* widget, bool visible );
+void Widget_SetInverted( widget_t* widget, bool inverted );
+void Widget_SetPosition( widget_t* widget, lcdint_t x, lcdint_t y );
+
+/**
+ * @brief   Force redraw of widget on next render.
+ * @param   [in] widget - widget pointer
+ */
+void Widget_Invalidate( widget_t* widget );
+
+#endif
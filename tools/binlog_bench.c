@@ -0,0 +1,212 @@
+/**
+ *******************************************************************************
+ * @file    binlog_bench.c
+ * @author  Dmytro Shevchenko
+ * @brief   Host side check and benchmark of deferred formatting binary log.
+ *          Deferred output is compared with printf of the same arguments.
+ *
+ *          Build and run on Linux:
+ *          cc -O2 -I../drv binlog_bench.c ../drv/binlog.c -o binlog_bench
+ *          ./binlog_bench
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "binlog.h"
+
+/* Private macros ------------------------------------------------------------*/
+
+#define RING_SIZE            4096
+#define BENCHMARK_ITERATIONS 10000000
+
+/* Log and printf the same message, compare after read */
+#define CHECK( _fmt, ... )                                                  \
+  do                                                                        \
+  {                                                                         \
+    snprintf( expected[count], sizeof( expected[0] ), _fmt, ##__VA_ARGS__ ); \
+    BINLOG_WRITE( &ring, count, 1, _fmt, ##__VA_ARGS__ );                   \
+    count++;                                                                \
+  } while ( 0 )
+
+/* Private variables ---------------------------------------------------------*/
+
+static uint8_t buffer[RING_SIZE] __attribute__( ( aligned( 4 ) ) );
+static binlog_ring_t ring;
+static char expected[32][128];
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint64_t _now_ns( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int _check_format( void )
+{
+  uint8_t ssid[33] = "rural_network";
+  char name[16] = "stack buffer";
+  const char* long_str = "0123456789012345678901234567890123456789";
+  int errors = 0;
+  int count = 0;
+
+  BinLog_Init( &ring, buffer, sizeof( buffer ) );
+  CHECK( "no arguments" );
+  CHECK( "State: %s", "CONNECTED" );
+  CHECK( "int %d %i %u %x %X %o %5d|%-5d|%05d", -5, 7, 3000000000u, 0xBEEF, 0xBEEF, 8, 42, 42, -42 );
+  CHECK( "long %ld %lu %lld %llu %zu", -1L, 4000000000UL, -123456789012LL, 18446744073709551615ULL, sizeof( ring ) );
+  CHECK( "short %hhu %hd char %c", (unsigned char) 200, (short) -3, 'x' );
+  CHECK( "double %f %.2f %e %g", 3.14159, 2.5f, 1e-9, 100.0 );
+  CHECK( "Ssid %s bssid %x.%x.%x.%x.%x.%x len %d reason %d", ssid, 1, 2, 3, 4, 5, 6, 13, 201 );
+  CHECK( "string %s after change, %10s|%-10s|", name, "ab", "cd" );
+  CHECK( "pointer %p", (void*) &ring );
+  CHECK( "100%% done" );
+  memcpy( name, "overwritten", 12 );
+
+  /* Long string is truncated to BINLOG_MAX_STRING */
+  BINLOG_WRITE( &ring, count, 2, "long %s", long_str );
+  snprintf( expected[count], sizeof( expected[0] ), "long %.*s", BINLOG_MAX_STRING, long_str );
+  count++;
+
+  for ( int i = 0; i < count; i++ )
+  {
+    binlog_msg_t msg;
+    char text[128];
+    if ( !BinLog_Read( &ring, &msg, text, sizeof( text ) ) || msg.time_us != (uint32_t) i )
+    {
+      printf( "read error %d\n", i );
+      errors++;
+      continue;
+    }
+
+    if ( strcmp( text, expected[i] ) != 0 )
+    {
+      printf( "format error:\n  got      '%s'\n  expected '%s'\n", text, expected[i] );
+      errors++;
+    }
+  }
+
+  binlog_msg_t msg;
+  char text[8];
+  if ( BinLog_Read( &ring, &msg, text, sizeof( text ) ) )
+  {
+    printf( "ring not empty\n" );
+    errors++;
+  }
+
+  return errors;
+}
+
+static int _check_wrap_and_drop( void )
+{
+  static const char* padding = "abcdefghijklmnopqrstuvwxyz";
+  binlog_msg_t msg;
+  char text[128];
+  char expected_text[128];
+  uint32_t written = 0;
+  uint32_t read = 0;
+  int errors = 0;
+
+  BinLog_Init( &ring, buffer, sizeof( buffer ) );
+
+  /* Fill ring until first drop */
+  while ( BINLOG_WRITE( &ring, written, 0, "message %u %s", written, "abc" ) )
+  {
+    written++;
+  }
+  uint32_t filled = written;
+
+  if ( BinLog_GetDropped( &ring ) != 1 )
+  {
+    printf( "drop counter error %u\n", BinLog_GetDropped( &ring ) );
+    errors++;
+  }
+
+  /* Reader and writer go around ring many times, record length changes to check padding */
+  for ( uint32_t i = 0; i < 100000; i++ )
+  {
+    for ( uint32_t j = 0; j < 1 + i % 3; j++ )
+    {
+      if ( BINLOG_WRITE( &ring, written, 0, "message %u %s", written, &padding[written % 26] ) )
+      {
+        written++;
+      }
+    }
+
+    for ( uint32_t j = 0; j < 1 + i % 4 && read < written; j++ )
+    {
+      uint32_t time_us = 0;
+      if ( !BinLog_Peek( &ring, &time_us ) || time_us != read || !BinLog_Read( &ring, &msg, text, sizeof( text ) ) )
+      {
+        printf( "wrap read error %u\n", read );
+        return errors + 1;
+      }
+
+      snprintf( expected_text, sizeof( expected_text ), "message %u %s", read, read < filled ? "abc" : &padding[read % 26] );
+      if ( strcmp( text, expected_text ) != 0 )
+      {
+        printf( "wrap content error '%s' expected '%s'\n", text, expected_text );
+        return errors + 1;
+      }
+      read++;
+    }
+  }
+
+  printf( "wrap: written %u read %u dropped %u\n", ring.written, read, BinLog_GetDropped( &ring ) );
+  return errors;
+}
+
+static void _benchmark( void )
+{
+  binlog_msg_t msg;
+  char text[128];
+  uint64_t write_ns = 0;
+  uint64_t read_ns = 0;
+  uint64_t printf_ns = 0;
+
+  BinLog_Init( &ring, buffer, sizeof( buffer ) );
+  for ( uint32_t i = 0; i < BENCHMARK_ITERATIONS / 32; i++ )
+  {
+    uint64_t start = _now_ns();
+    for ( uint32_t j = 0; j < 32; j++ )
+    {
+      BINLOG_WRITE( &ring, j, 1, "%s answer len: %d", __func__, (int) j );
+    }
+    write_ns += _now_ns() - start;
+
+    start = _now_ns();
+    while ( BinLog_Read( &ring, &msg, text, sizeof( text ) ) )
+    {
+    }
+    read_ns += _now_ns() - start;
+  }
+
+  uint64_t start = _now_ns();
+  for ( uint32_t i = 0; i < BENCHMARK_ITERATIONS / 10; i++ )
+  {
+    snprintf( text, sizeof( text ), "%s answer len: %d", __func__, (int) i );
+  }
+  printf_ns = _now_ns() - start;
+
+  printf( "write %.1f ns, deferred format %.1f ns, snprintf %.1f ns per message, dropped %u\n",
+          (double) write_ns / BENCHMARK_ITERATIONS, (double) read_ns / BENCHMARK_ITERATIONS,
+          (double) printf_ns * 10 / BENCHMARK_ITERATIONS, BinLog_GetDropped( &ring ) );
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+int main( void )
+{
+  int errors = _check_format();
+  errors += _check_wrap_and_drop();
+  _benchmark();
+  printf( "%s: %d errors\n", errors ? "FAIL" : "PASS", errors );
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,305 @@
+/**
+ *******************************************************************************
+ * @file    history_test.c
+ * @author  Dmytro Shevchenko
+ * @brief   Host side round trip check of multi-resolution history.
+ *          Compressed buckets of all levels are compared with buckets of
+ *          uncompressed reference model: gaps (also longer than one gap
+ *          record), spread escapes, extreme deltas, bucket alignment of
+ *          unaligned start time, dropped blocks and partial windows.
+ *
+ *          Build and run on Linux:
+ *          cc -O2 -I../drv history_test.c ../drv/history.c -o history_test
+ *          ./history_test
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+/* Private macros ------------------------------------------------------------*/
+
+#define ARRAY_SIZE( _array ) sizeof( _array ) / sizeof( _array[0] )
+#define LEVELS_CNT           3
+#define MAX_BUCKETS          40000
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  int32_t min;
+  int32_t max;
+  int64_t sum;
+  uint32_t cnt;
+} ref_bucket_t;
+
+typedef enum
+{
+  SIGNAL_SLOW,    // small deltas and spreads, one byte spread
+  SIGNAL_NOISY,    // spread over escape limit
+  SIGNAL_EXTREME,    // INT32 limits, largest varints
+} signal_t;
+
+typedef struct
+{
+  const char* name;
+  signal_t signal;
+  uint32_t start_ms;
+  uint32_t values;
+  uint32_t max_gap_buckets;    // random gaps between values, 0 - no gaps
+  uint16_t level0_blocks;    // small level drops oldest blocks
+} scenario_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+static const scenario_t scenarios[] =
+  {
+    { .name = "slow, unaligned start", .signal = SIGNAL_SLOW, .start_ms = 12345, .values = 6000, .max_gap_buckets = 0, .level0_blocks = 96 },
+    { .name = "slow with gaps", .signal = SIGNAL_SLOW, .start_ms = 99, .values = 600, .max_gap_buckets = 300, .level0_blocks = 96 },
+    { .name = "noisy escapes", .signal = SIGNAL_NOISY, .start_ms = 7, .values = 2000, .max_gap_buckets = 3, .level0_blocks = 96 },
+    { .name = "extreme deltas", .signal = SIGNAL_EXTREME, .start_ms = 1001, .values = 1000, .max_gap_buckets = 2, .level0_blocks = 96 },
+    { .name = "dropped blocks", .signal = SIGNAL_NOISY, .start_ms = 50, .values = 3000, .max_gap_buckets = 140, .level0_blocks = 4 },
+};
+
+/* Periods are not powers of 10 of each other, so bucket borders of levels differ from start time */
+static const uint32_t periods[LEVELS_CNT] = { 100, 700, 4900 };
+
+static uint8_t buffer[HISTORY_MAX_BLOCKS * HISTORY_BLOCK_SIZE * LEVELS_CNT];
+static history_t hist;
+static ref_bucket_t ref[LEVELS_CNT][MAX_BUCKETS];
+static history_sample_t expected[MAX_BUCKETS];
+static history_sample_t out[MAX_BUCKETS];
+static uint32_t rnd_state;
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint32_t _rand( void )
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+static int32_t _value( signal_t signal, uint32_t i )
+{
+  switch ( signal )
+  {
+    case SIGNAL_SLOW:
+      return 4000 + (int32_t) ( i / 50 % 20 ) + (int32_t) ( _rand() % 3 );
+
+    case SIGNAL_NOISY:
+      return -500 + (int32_t) ( _rand() % 1000 );
+
+    case SIGNAL_EXTREME:
+    default:
+      switch ( _rand() % 4 )
+      {
+        case 0:
+          return INT32_MIN;
+        case 1:
+          return INT32_MAX;
+        case 2:
+          return 0;
+        default:
+          return (int32_t) _rand();
+      }
+  }
+}
+
+static void _ref_add( ref_bucket_t* bucket, int32_t min, int32_t max, int32_t avg )
+{
+  if ( bucket->cnt == 0 || min < bucket->min )
+  {
+    bucket->min = min;
+  }
+
+  if ( bucket->cnt == 0 || max > bucket->max )
+  {
+    bucket->max = max;
+  }
+
+  bucket->sum += avg;
+  bucket->cnt++;
+}
+
+static history_sample_t _ref_sample( const ref_bucket_t* bucket )
+{
+  if ( bucket->cnt == 0 )
+  {
+    return ( history_sample_t ) { .is_empty = true };
+  }
+
+  return ( history_sample_t ) { .min = bucket->min, .max = bucket->max, .avg = (int32_t) ( bucket->sum / (int64_t) bucket->cnt ) };
+}
+
+static bool _sample_equal( const history_sample_t* a, const history_sample_t* b )
+{
+  if ( a->is_empty || b->is_empty )
+  {
+    return a->is_empty == b->is_empty;
+  }
+
+  return a->min == b->min && a->max == b->max && a->avg == b->avg;
+}
+
+/* Compare newest count buckets of level with tail of expected, level keeps stored newest buckets */
+static int _check_window( uint8_t level, size_t expected_cnt, size_t stored, size_t count, const char* name )
+{
+  size_t n = History_GetWindow( &hist, level, out, count );
+  size_t want = count < stored ? count : stored;
+
+  if ( n != want )
+  {
+    printf( "%s: level %u window %zu returned %zu expected %zu\n", name, level, count, n, want );
+    return 1;
+  }
+
+  for ( size_t i = 0; i < n; i++ )
+  {
+    const history_sample_t* e = &expected[expected_cnt - n + i];
+    if ( !_sample_equal( &out[i], e ) )
+    {
+      printf( "%s: level %u bucket %zu/%zu got %s %d/%d/%d expected %s %d/%d/%d\n", name, level, i, n,
+              out[i].is_empty ? "empty" : "", out[i].min, out[i].avg, out[i].max,
+              e->is_empty ? "empty" : "", e->min, e->avg, e->max );
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int _run( const scenario_t* sc )
+{
+  const history_level_cfg_t cfg[LEVELS_CNT] =
+    {
+      { .period_ms = periods[0], .blocks = sc->level0_blocks },
+      { .period_ms = periods[1], .blocks = HISTORY_MAX_BLOCKS },
+      { .period_ms = periods[2], .blocks = HISTORY_MAX_BLOCKS },
+    };
+  uint32_t base[LEVELS_CNT];
+  uint32_t time_ms = sc->start_ms;
+  int errors = 0;
+
+  History_Init( &hist, buffer, sizeof( buffer ), cfg, LEVELS_CNT );
+  memset( ref, 0, sizeof( ref ) );
+  for ( uint8_t l = 0; l < LEVELS_CNT; l++ )
+  {
+    base[l] = sc->start_ms / periods[l];
+  }
+
+  /* 1 to 3 values per bucket at random position in bucket, then optional gap */
+  for ( uint32_t i = 0; i < sc->values; i++ )
+  {
+    int32_t value = _value( sc->signal, i );
+    uint32_t index = time_ms / periods[0] - base[0];
+    if ( index >= MAX_BUCKETS )
+    {
+      printf( "%s: scenario too long\n", sc->name );
+      return 1;
+    }
+
+    History_Add( &hist, value, time_ms );
+    _ref_add( &ref[0][index], value, value, value );
+
+    time_ms += 1 + _rand() % ( periods[0] / 2 );
+    if ( sc->max_gap_buckets > 0 && _rand() % 8 == 0 )
+    {
+      time_ms += periods[0] * ( _rand() % ( sc->max_gap_buckets + 1 ) );
+    }
+  }
+  uint32_t last_ms = time_ms - 1;
+
+  /* Closed buckets are those before bucket of last value, lower level is built from closed non empty buckets */
+  size_t closed[LEVELS_CNT];
+  History_Add( &hist, 0, last_ms );
+  for ( uint8_t l = 0; l < LEVELS_CNT; l++ )
+  {
+    closed[l] = last_ms / periods[l] - base[l];
+    if ( l + 1 < LEVELS_CNT )
+    {
+      for ( size_t i = 0; i < closed[l]; i++ )
+      {
+        history_sample_t s = _ref_sample( &ref[l][i] );
+        size_t parent = ( ( base[l] + i ) * (uint64_t) periods[l] ) / periods[l + 1] - base[l + 1];
+        if ( !s.is_empty && parent < last_ms / periods[l + 1] - base[l + 1] )
+        {
+          _ref_add( &ref[l + 1][parent], s.min, s.max, s.avg );
+        }
+      }
+    }
+  }
+
+  for ( uint8_t l = 0; l < LEVELS_CNT; l++ )
+  {
+    for ( size_t i = 0; i < closed[l]; i++ )
+    {
+      expected[i] = _ref_sample( &ref[l][i] );
+    }
+
+    /* Level keeps newest buckets, oldest blocks are dropped when level is full */
+    size_t count = History_GetCount( &hist, l );
+    bool keeps_all = l > 0 || sc->level0_blocks == HISTORY_MAX_BLOCKS;
+    if ( count > closed[l] || keeps_all != ( count == closed[l] ) )
+    {
+      printf( "%s: level %u count %zu closed %zu\n", sc->name, l, count, closed[l] );
+      errors++;
+      continue;
+    }
+
+    const size_t windows[] = { count, count / 2 + 1, 1, 0, count + 10 };
+    for ( size_t w = 0; w < ARRAY_SIZE( windows ); w++ )
+    {
+      errors += _check_window( l, closed[l], count, windows[w], sc->name );
+    }
+  }
+
+  printf( "%-22s buckets %5zu %4zu %3zu, stored %5zu, %5zu bytes\n", sc->name, closed[0], closed[1], closed[2],
+          History_GetCount( &hist, 0 ), History_GetUsedBytes( &hist ) );
+  return errors;
+}
+
+/* Window starting inside run of empty buckets, run longer than one gap record */
+static int _check_gap_split( void )
+{
+  const history_level_cfg_t cfg[] = { { .period_ms = 10, .blocks = 8 } };
+  int errors = 0;
+
+  History_Init( &hist, buffer, sizeof( buffer ), cfg, 1 );
+  History_Add( &hist, 5, 0 );
+  History_Add( &hist, 6, 3000 );    // 299 empty buckets, 3 gap records
+  History_Add( &hist, 7, 3010 );
+
+  size_t count = History_GetCount( &hist, 0 );
+  size_t n = History_GetWindow( &hist, 0, out, 200 );
+  if ( count != 301 || n != 200 || !out[0].is_empty || !out[198].is_empty || out[199].is_empty || out[199].avg != 6 )
+  {
+    printf( "gap split: count %zu window %zu\n", count, n );
+    errors++;
+  }
+
+  return errors;
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+int main( void )
+{
+  int errors = 0;
+
+  rnd_state = 0x12345678;
+  for ( size_t i = 0; i < ARRAY_SIZE( scenarios ); i++ )
+  {
+    errors += _run( &scenarios[i] );
+  }
+  errors += _check_gap_split();
+
+  printf( "%s: %d errors\n", errors ? "FAIL" : "PASS", errors );
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,559 @@
+/**
+ *******************************************************************************
+ * @file    ota_delta.c
+ * @author  Dmytro Shevchenko
+ * @brief   Host side delta OTA patch generator (see ota_stream.h).
+ *
+ *          Every block of new image is built from operations on old image:
+ *          copy, add (bsdiff like, old + small differences, good for
+ *          relocated code) or literal. Operations are deflated per block.
+ *          Generated patch is applied by OtaStream and verified before save.
+ *
+ *          Build and run on Linux:
+ *          cc -O2 -I../drv ota_delta.c ../drv/ota_stream.c ../drv/sha256.c -lz -o ota_delta
+ *          ./ota_delta <old.bin> <new.bin> <patch.hqoz>
+ *          ./ota_delta    (self test on generated images)
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "ota_stream.h"
+
+/* Private macros ------------------------------------------------------------*/
+
+#define BLOCK_SIZE         4096
+#define HASH_LEN           8
+#define HASH_BITS          20
+#define MAX_CHAIN          64
+#define MIN_MATCH          12
+#define APPROX_WINDOW      32
+#define APPROX_MAX_ERRORS  8
+#define GENERATED_SIZE     ( 1024 * 1024 )
+#define EXPECTED_RATIO_MIN 5.0
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  uint8_t* data;
+  size_t len;
+} buffer_t;
+
+typedef struct
+{
+  const buffer_t* old;
+  int32_t* head;
+  int32_t* prev;
+} matcher_t;
+
+typedef struct
+{
+  const buffer_t* old;
+  buffer_t image;
+} apply_ctx_t;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void _put_u32( uint8_t* buf, uint32_t value )
+{
+  buf[0] = (uint8_t) value;
+  buf[1] = (uint8_t) ( value >> 8 );
+  buf[2] = (uint8_t) ( value >> 16 );
+  buf[3] = (uint8_t) ( value >> 24 );
+}
+
+static size_t _put_varint( uint8_t* buf, uint32_t value )
+{
+  size_t len = 0;
+  while ( value >= 0x80 )
+  {
+    buf[len++] = (uint8_t) ( value | 0x80 );
+    value >>= 7;
+  }
+  buf[len++] = (uint8_t) value;
+  return len;
+}
+
+static bool _read_file( const char* path, buffer_t* buf )
+{
+  FILE* f = fopen( path, "rb" );
+  if ( f == NULL )
+  {
+    return false;
+  }
+
+  fseek( f, 0, SEEK_END );
+  buf->len = (size_t) ftell( f );
+  fseek( f, 0, SEEK_SET );
+  buf->data = malloc( buf->len );
+  bool ret = buf->data != NULL && fread( buf->data, 1, buf->len, f ) == buf->len;
+  fclose( f );
+  return ret;
+}
+
+static uint32_t _hash( const uint8_t* data )
+{
+  uint64_t value;
+  memcpy( &value, data, sizeof( value ) );
+  return (uint32_t) ( ( value * 0x9E3779B97F4A7C15ULL ) >> ( 64 - HASH_BITS ) );
+}
+
+static void _matcher_init( matcher_t* matcher, const buffer_t* old )
+{
+  matcher->old = old;
+  matcher->head = malloc( sizeof( int32_t ) << HASH_BITS );
+  matcher->prev = malloc( sizeof( int32_t ) * ( old->len + 1 ) );
+  memset( matcher->head, 0xFF, sizeof( int32_t ) << HASH_BITS );
+  for ( size_t i = 0; i + HASH_LEN <= old->len; i++ )
+  {
+    uint32_t hash = _hash( &old->data[i] );
+    matcher->prev[i] = matcher->head[hash];
+    matcher->head[hash] = (int32_t) i;
+  }
+}
+
+static size_t _exact_len( const buffer_t* old, size_t old_pos, const uint8_t* data, size_t len )
+{
+  size_t max = old->len - old_pos < len ? old->len - old_pos : len;
+  size_t i = 0;
+  while ( i < max && old->data[old_pos + i] == data[i] )
+  {
+    i++;
+  }
+  return i;
+}
+
+/* Extend match while at most APPROX_MAX_ERRORS bytes differ in last APPROX_WINDOW bytes */
+static size_t _approx_len( const buffer_t* old, size_t old_pos, const uint8_t* data, size_t len, size_t* equal )
+{
+  size_t max = old->len - old_pos < len ? old->len - old_pos : len;
+  uint8_t window[APPROX_WINDOW] = { 0 };
+  size_t errors = 0;
+  size_t best = 0;
+  size_t matched = 0;
+
+  *equal = 0;
+  for ( size_t i = 0; i < max; i++ )
+  {
+    uint8_t error = old->data[old_pos + i] != data[i];
+    errors += error - window[i % APPROX_WINDOW];
+    window[i % APPROX_WINDOW] = error;
+    if ( errors > APPROX_MAX_ERRORS )
+    {
+      break;
+    }
+
+    if ( !error )
+    {
+      matched++;
+      best = i + 1;
+      *equal = matched;
+    }
+  }
+
+  return best;
+}
+
+static size_t _emit_literal( uint8_t* ops, size_t pos, const uint8_t* data, size_t len )
+{
+  if ( len > 0 )
+  {
+    ops[pos++] = OTA_STREAM_DELTA_LITERAL;
+    pos += _put_varint( &ops[pos], len );
+    memcpy( &ops[pos], data, len );
+    pos += len;
+  }
+  return pos;
+}
+
+/* Returns operations length or 0 if operations are longer than block */
+static size_t _encode_block( matcher_t* matcher, const uint8_t* data, size_t len, int64_t* last_disp, uint8_t* ops, size_t ops_size )
+{
+  const buffer_t* old = matcher->old;
+  size_t pos = 0;
+  size_t literal = 0;
+  size_t p = 0;
+
+  while ( p < len )
+  {
+    int64_t best_old = -1;
+    size_t best_len = 0;
+    size_t best_equal = 0;
+
+    /* Same displacement as previous match, typical for code shifted by few bytes */
+    int64_t cand = (int64_t) p + *last_disp;
+    if ( cand >= 0 && (size_t) cand < old->len )
+    {
+      size_t equal = 0;
+      size_t approx = _approx_len( old, cand, &data[p], len - p, &equal );
+      if ( equal >= MIN_MATCH && equal * 4 >= approx * 3 )
+      {
+        best_old = cand;
+        best_len = approx;
+        best_equal = equal;
+      }
+    }
+
+    if ( p + HASH_LEN <= len )
+    {
+      int32_t chain = matcher->head[_hash( &data[p] )];
+      for ( int i = 0; i < MAX_CHAIN && chain >= 0; i++, chain = matcher->prev[chain] )
+      {
+        size_t exact = _exact_len( old, chain, &data[p], len - p );
+        if ( exact >= MIN_MATCH && exact > best_equal )
+        {
+          size_t equal = 0;
+          best_len = _approx_len( old, chain, &data[p], len - p, &equal );
+          best_equal = equal;
+          best_old = chain;
+        }
+      }
+    }
+
+    if ( best_old < 0 )
+    {
+      p++;
+      literal++;
+      continue;
+    }
+
+    /* Worst case: literal op + copy/add op header + diff */
+    if ( pos + literal + best_len + 16 > ops_size )
+    {
+      return 0;
+    }
+
+    pos = _emit_literal( ops, pos, &data[p - literal], literal );
+    literal = 0;
+    bool is_copy = best_equal == best_len;
+    ops[pos++] = is_copy ? OTA_STREAM_DELTA_COPY : OTA_STREAM_DELTA_ADD;
+    pos += _put_varint( &ops[pos], (uint32_t) best_old );
+    pos += _put_varint( &ops[pos], best_len );
+    if ( !is_copy )
+    {
+      for ( size_t i = 0; i < best_len; i++ )
+      {
+        ops[pos++] = (uint8_t) ( data[p + i] - old->data[best_old + i] );
+      }
+    }
+
+    *last_disp = best_old - (int64_t) p;
+    p += best_len;
+  }
+
+  if ( pos + literal + 8 > ops_size )
+  {
+    return 0;
+  }
+
+  return _emit_literal( ops, pos, &data[p - literal], literal );
+}
+
+static size_t _deflate( const uint8_t* in, size_t in_len, uint8_t* out, size_t out_size )
+{
+  z_stream zs = { 0 };
+  if ( deflateInit2( &zs, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY ) != Z_OK )
+  {
+    return 0;
+  }
+
+  zs.next_in = (uint8_t*) in;
+  zs.avail_in = in_len;
+  zs.next_out = out;
+  zs.avail_out = out_size;
+  int ret = deflate( &zs, Z_FINISH );
+  size_t len = zs.total_out;
+  deflateEnd( &zs );
+  return ret == Z_STREAM_END ? len : 0;
+}
+
+static void _put_header( buffer_t* out, const buffer_t* image, uint8_t compression )
+{
+  sha256_ctx_t sha;
+
+  memset( out->data, 0, OTA_STREAM_HEADER_SIZE );
+  _put_u32( &out->data[0], OTA_STREAM_MAGIC );
+  out->data[4] = OTA_STREAM_VERSION;
+  out->data[5] = compression;
+  _put_u32( &out->data[8], BLOCK_SIZE );
+  _put_u32( &out->data[12], image->len );
+  _put_u32( &out->data[16], ( image->len + BLOCK_SIZE - 1 ) / BLOCK_SIZE );
+  Sha256_Init( &sha );
+  Sha256_Update( &sha, image->data, image->len );
+  Sha256_Final( &sha, &out->data[20] );
+  out->len = OTA_STREAM_HEADER_SIZE;
+}
+
+static void _put_block( buffer_t* out, const uint8_t* data, size_t len, const uint8_t* raw, size_t raw_len )
+{
+  if ( len > 0 && len < raw_len )
+  {
+    _put_u32( &out->data[out->len], len );
+    memcpy( &out->data[out->len + 4], data, len );
+    out->len += 4 + len;
+  }
+  else
+  {
+    _put_u32( &out->data[out->len], raw_len | OTA_STREAM_BLOCK_STORED );
+    memcpy( &out->data[out->len + 4], raw, raw_len );
+    out->len += 4 + raw_len;
+  }
+}
+
+static void _make_delta( const buffer_t* old, const buffer_t* image, buffer_t* out )
+{
+  uint32_t block_count = ( image->len + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+  uint8_t ops[OTA_STREAM_MAX_DELTA_SIZE];
+  uint8_t compressed[OTA_STREAM_MAX_DELTA_SIZE * 2];
+  int64_t last_disp = 0;
+  matcher_t matcher;
+  sha256_ctx_t sha;
+
+  _matcher_init( &matcher, old );
+  out->data = malloc( OTA_STREAM_HEADER_SIZE + OTA_STREAM_DELTA_EXT_SIZE + block_count * ( BLOCK_SIZE + 4 ) );
+  _put_header( out, image, OTA_STREAM_COMPRESSION_DELTA );
+  _put_u32( &out->data[out->len], old->len );
+  Sha256_Init( &sha );
+  Sha256_Update( &sha, old->data, old->len );
+  Sha256_Final( &sha, &out->data[out->len + 4] );
+  out->len += OTA_STREAM_DELTA_EXT_SIZE;
+
+  for ( uint32_t i = 0; i < block_count; i++ )
+  {
+    const uint8_t* block = &image->data[i * BLOCK_SIZE];
+    size_t block_len = image->len - i * BLOCK_SIZE < BLOCK_SIZE ? image->len - i * BLOCK_SIZE : BLOCK_SIZE;
+    size_t ops_len = _encode_block( &matcher, block, block_len, &last_disp, ops, sizeof( ops ) );
+    size_t len = ops_len > 0 ? _deflate( ops, ops_len, compressed, sizeof( compressed ) ) : 0;
+    _put_block( out, compressed, len, block, block_len );
+  }
+
+  free( matcher.head );
+  free( matcher.prev );
+}
+
+static void _make_full( const buffer_t* image, buffer_t* out )
+{
+  uint32_t block_count = ( image->len + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+  uint8_t compressed[BLOCK_SIZE * 2];
+
+  out->data = malloc( OTA_STREAM_HEADER_SIZE + block_count * ( BLOCK_SIZE + 4 ) );
+  _put_header( out, image, OTA_STREAM_COMPRESSION_DEFLATE );
+  for ( uint32_t i = 0; i < block_count; i++ )
+  {
+    const uint8_t* block = &image->data[i * BLOCK_SIZE];
+    size_t block_len = image->len - i * BLOCK_SIZE < BLOCK_SIZE ? image->len - i * BLOCK_SIZE : BLOCK_SIZE;
+    _put_block( out, compressed, _deflate( block, block_len, compressed, sizeof( compressed ) ), block, block_len );
+  }
+}
+
+static int _decompress( void* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t out_size, size_t* out_len )
+{
+  (void) ctx;
+  z_stream zs = { 0 };
+  if ( inflateInit2( &zs, -15 ) != Z_OK )
+  {
+    return -1;
+  }
+
+  zs.next_in = (uint8_t*) in;
+  zs.avail_in = in_len;
+  zs.next_out = out;
+  zs.avail_out = out_size;
+  int ret = inflate( &zs, Z_FINISH );
+  *out_len = zs.total_out;
+  inflateEnd( &zs );
+  return ret == Z_STREAM_END ? 0 : -1;
+}
+
+static int _write( void* ctx, uint32_t offset, const uint8_t* data, size_t len )
+{
+  apply_ctx_t* apply = ctx;
+  if ( offset + len > apply->image.len )
+  {
+    return -1;
+  }
+
+  memcpy( &apply->image.data[offset], data, len );
+  return 0;
+}
+
+static int _read_source( void* ctx, uint32_t offset, uint8_t* data, size_t len )
+{
+  apply_ctx_t* apply = ctx;
+  if ( offset + len > apply->old->len )
+  {
+    return -1;
+  }
+
+  memcpy( data, &apply->old->data[offset], len );
+  return 0;
+}
+
+static bool _verify( const buffer_t* old, const buffer_t* image, const buffer_t* patch )
+{
+  static ota_stream_t stream;
+  apply_ctx_t apply = { .old = old, .image = { .data = calloc( 1, image->len ), .len = image->len } };
+  ota_stream_io_t io = { .decompress = _decompress, .write = _write, .read_source = _read_source, .ctx = &apply };
+
+  OtaStream_Init( &stream, &io, NULL );
+  ota_stream_result_t result = OtaStream_Feed( &stream, patch->data, patch->len );
+  bool ret = result == OTA_STREAM_RESULT_DONE && memcmp( apply.image.data, image->data, image->len ) == 0;
+  if ( !ret )
+  {
+    printf( "patch verify error: result %d\n", result );
+  }
+
+  free( apply.image.data );
+  return ret;
+}
+
+static double _report( const buffer_t* old, const buffer_t* image, const buffer_t* patch )
+{
+  buffer_t full;
+  _make_full( image, &full );
+  double ratio = (double) full.len / patch->len;
+  printf( "old %zu B, new %zu B, full container %zu B, patch %zu B, %.1fx smaller than full, %.1fx smaller than image\n",
+          old->len, image->len, full.len, patch->len, ratio, (double) image->len / patch->len );
+  free( full.data );
+  return ratio;
+}
+
+/* Firmware like image: instructions, literal pool pointers into image and strings */
+static void _generate_image( buffer_t* buf, size_t len, uint32_t seed )
+{
+  static const char* words[] = { "wifi", "menu", "oled", "pcf8574", "battery", "error", "config", "mqtt" };
+
+  buf->len = len;
+  buf->data = malloc( len );
+  for ( size_t i = 0; i + 4 <= len; i += 4 )
+  {
+    seed = seed * 1103515245 + 12345;
+    uint32_t value = 0;
+    switch ( ( seed >> 16 ) % 8 )
+    {
+      case 0:
+      case 1:
+        value = 0x400D0000 + ( ( seed >> 4 ) % len & ~3u );
+        break;
+      case 2:
+        memcpy( &value, words[( seed >> 8 ) % 8], 4 );
+        break;
+      default:
+        value = 0x00050136 + ( ( seed >> 20 ) & 0x3F ) * 0x100;
+        break;
+    }
+    memcpy( &buf->data[i], &value, 4 );
+  }
+}
+
+/* Point release: few functions changed, code after them moved, pointers relocated */
+static void _generate_release( const buffer_t* old, buffer_t* image )
+{
+  const size_t insert_at = old->len / 3;
+  const size_t insert_len = 1200;
+  const size_t append_len = 16 * 1024;
+  buffer_t extra;
+
+  _generate_image( &extra, insert_len + append_len, 999 );
+  image->len = old->len + insert_len + append_len;
+  image->data = malloc( image->len );
+  memcpy( image->data, old->data, insert_at );
+  memcpy( &image->data[insert_at], extra.data, insert_len );
+  memcpy( &image->data[insert_at + insert_len], &old->data[insert_at], old->len - insert_at );
+  memcpy( &image->data[old->len + insert_len], &extra.data[insert_len], append_len );
+
+  for ( size_t i = 0; i + 4 <= old->len + insert_len; i += 4 )
+  {
+    uint32_t value;
+    memcpy( &value, &image->data[i], 4 );
+    if ( value >= 0x400D0000 + insert_at && value < 0x400D0000 + old->len )
+    {
+      value += insert_len;
+      memcpy( &image->data[i], &value, 4 );
+    }
+  }
+
+  /* Changed strings / constants */
+  for ( size_t i = 0; i < 64; i++ )
+  {
+    image->data[( i * 7919 * 16 ) % old->len] ^= 0x5A;
+  }
+
+  free( extra.data );
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+int main( int argc, char** argv )
+{
+  buffer_t old = { 0 };
+  buffer_t image = { 0 };
+  buffer_t patch = { 0 };
+
+  if ( argc == 4 )
+  {
+    if ( !_read_file( argv[1], &old ) || !_read_file( argv[2], &image ) )
+    {
+      printf( "read error\n" );
+      return 1;
+    }
+
+    _make_delta( &old, &image, &patch );
+    if ( !_verify( &old, &image, &patch ) )
+    {
+      return 1;
+    }
+    _report( &old, &image, &patch );
+
+    FILE* f = fopen( argv[3], "wb" );
+    if ( f == NULL || fwrite( patch.data, 1, patch.len, f ) != patch.len )
+    {
+      printf( "write error %s\n", argv[3] );
+      return 1;
+    }
+    fclose( f );
+    return 0;
+  }
+
+  if ( argc != 1 )
+  {
+    printf( "usage: %s <old.bin> <new.bin> <patch.hqoz>\n", argv[0] );
+    return 2;
+  }
+
+  int errors = 0;
+  _generate_image( &old, GENERATED_SIZE, 12345 );
+  _generate_release( &old, &image );
+  _make_delta( &old, &image, &patch );
+  if ( !_verify( &old, &image, &patch ) )
+  {
+    errors++;
+  }
+
+  if ( _report( &old, &image, &patch ) < EXPECTED_RATIO_MIN )
+  {
+    printf( "patch is too big\n" );
+    errors++;
+  }
+
+  /* Patch must be rejected on other source image */
+  old.data[old.len / 2] ^= 1;
+  static ota_stream_t stream;
+  apply_ctx_t apply = { .old = &old, .image = { .data = malloc( image.len ), .len = image.len } };
+  ota_stream_io_t io = { .decompress = _decompress, .write = _write, .read_source = _read_source, .ctx = &apply };
+  OtaStream_Init( &stream, &io, NULL );
+  if ( OtaStream_Feed( &stream, patch.data, patch.len ) != OTA_STREAM_RESULT_ERROR_SOURCE )
+  {
+    printf( "wrong source not detected\n" );
+    errors++;
+  }
+
+  printf( "%s: %d errors\n", errors ? "FAIL" : "PASS", errors );
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,514 @@
+/**
+ *******************************************************************************
+ * @file    ota_stream_test.c
+ * @author  Dmytro Shevchenko
+ * @brief   Host side packer and resumable download test for OTA stream.
+ *
+ *          Local HTTP server stand-in supports Range requests and drops
+ *          connection after random count of bytes. Client resumes with
+ *          Range, sometimes simulates reset and resumes from stored progress.
+ *
+ *          Build and run on Linux:
+ *          cc -O2 -I../drv ota_stream_test.c ../drv/ota_stream.c ../drv/sha256.c -lz -o ota_stream_test
+ *          ./ota_stream_test pack <image.bin> <image.hqoz>
+ *          ./ota_stream_test [image.bin] [max_bytes_per_connection]
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "ota_stream.h"
+
+/* Private macros ------------------------------------------------------------*/
+
+#define GENERATED_IMAGE_SIZE ( 1024 * 1024 + 123 )
+#define BLOCK_SIZE           4096
+#define SAVE_EVERY_BLOCKS    16
+#define RESET_EVERY_DROPS    7
+#define MAX_ATTEMPTS         10000
+#define SEGMENT_SIZE         1460
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  uint8_t* data;
+  size_t len;
+} buffer_t;
+
+typedef struct
+{
+  buffer_t image;
+  ota_stream_progress_t stored;
+  bool has_stored;
+  uint32_t saves;
+} client_ctx_t;
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint64_t _now_ns( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void _put_u32( uint8_t* buf, uint32_t value )
+{
+  buf[0] = (uint8_t) value;
+  buf[1] = (uint8_t) ( value >> 8 );
+  buf[2] = (uint8_t) ( value >> 16 );
+  buf[3] = (uint8_t) ( value >> 24 );
+}
+
+static bool _read_file( const char* path, buffer_t* buf )
+{
+  FILE* f = fopen( path, "rb" );
+  if ( f == NULL )
+  {
+    return false;
+  }
+
+  fseek( f, 0, SEEK_END );
+  buf->len = (size_t) ftell( f );
+  fseek( f, 0, SEEK_SET );
+  buf->data = malloc( buf->len );
+  bool ret = buf->data != NULL && fread( buf->data, 1, buf->len, f ) == buf->len;
+  fclose( f );
+  return ret;
+}
+
+static void _generate_image( buffer_t* buf )
+{
+  /* Firmware like content: code with repeated patterns, strings and some random data */
+  static const char* words[] = { "wifi", "menu", "oled", "pcf8574", "battery", "error", "config", "mqtt" };
+  uint32_t seed = 12345;
+
+  buf->len = GENERATED_IMAGE_SIZE;
+  buf->data = malloc( buf->len );
+  for ( size_t i = 0; i < buf->len; )
+  {
+    seed = seed * 1103515245 + 12345;
+    uint32_t kind = ( seed >> 16 ) % 4;
+    size_t len = 0;
+    if ( kind == 0 )
+    {
+      len = snprintf( (char*) &buf->data[i], buf->len - i, "%s_%u ", words[( seed >> 8 ) % 8], ( seed >> 4 ) % 100 );
+    }
+    else
+    {
+      len = 4;
+      uint32_t op = 0x00050136 + ( ( seed >> 20 ) & ( kind == 3 ? 0xFFF : 0x3 ) );
+      for ( size_t j = 0; j < len && i + j < buf->len; j++ )
+      {
+        buf->data[i + j] = (uint8_t) ( op >> ( j * 8 ) );
+      }
+    }
+    i += len;
+  }
+}
+
+static bool _pack( const buffer_t* image, buffer_t* out )
+{
+  uint32_t block_count = ( image->len + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+  sha256_ctx_t sha;
+  uint8_t compressed[BLOCK_SIZE * 2];
+
+  out->data = malloc( OTA_STREAM_HEADER_SIZE + block_count * ( BLOCK_SIZE + 4 ) );
+  memset( out->data, 0, OTA_STREAM_HEADER_SIZE );
+  _put_u32( &out->data[0], OTA_STREAM_MAGIC );
+  out->data[4] = OTA_STREAM_VERSION;
+  out->data[5] = OTA_STREAM_COMPRESSION_DEFLATE;
+  _put_u32( &out->data[8], BLOCK_SIZE );
+  _put_u32( &out->data[12], image->len );
+  _put_u32( &out->data[16], block_count );
+  Sha256_Init( &sha );
+  Sha256_Update( &sha, image->data, image->len );
+  Sha256_Final( &sha, &out->data[20] );
+  out->len = OTA_STREAM_HEADER_SIZE;
+
+  for ( uint32_t i = 0; i < block_count; i++ )
+  {
+    const uint8_t* block = &image->data[i * BLOCK_SIZE];
+    size_t block_len = image->len - i * BLOCK_SIZE < BLOCK_SIZE ? image->len - i * BLOCK_SIZE : BLOCK_SIZE;
+    z_stream zs = { 0 };
+    if ( deflateInit2( &zs, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY ) != Z_OK )
+    {
+      return false;
+    }
+    zs.next_in = (uint8_t*) block;
+    zs.avail_in = block_len;
+    zs.next_out = compressed;
+    zs.avail_out = sizeof( compressed );
+    int ret = deflate( &zs, Z_FINISH );
+    size_t compressed_len = zs.total_out;
+    deflateEnd( &zs );
+
+    if ( ret == Z_STREAM_END && compressed_len < block_len )
+    {
+      _put_u32( &out->data[out->len], compressed_len );
+      memcpy( &out->data[out->len + 4], compressed, compressed_len );
+      out->len += 4 + compressed_len;
+    }
+    else
+    {
+      _put_u32( &out->data[out->len], block_len | OTA_STREAM_BLOCK_STORED );
+      memcpy( &out->data[out->len + 4], block, block_len );
+      out->len += 4 + block_len;
+    }
+  }
+
+  return true;
+}
+
+static void _serve( int listen_fd, const buffer_t* file, size_t max_bytes )
+{
+  char request[1024];
+  uint32_t seed = 777;
+
+  while ( 1 )
+  {
+    int fd = accept( listen_fd, NULL, NULL );
+    if ( fd < 0 )
+    {
+      continue;
+    }
+
+    ssize_t len = recv( fd, request, sizeof( request ) - 1, 0 );
+    if ( len <= 0 )
+    {
+      close( fd );
+      continue;
+    }
+    request[len] = 0;
+
+    size_t offset = 0;
+    const char* range = strstr( request, "Range: bytes=" );
+    if ( range != NULL )
+    {
+      offset = strtoul( range + strlen( "Range: bytes=" ), NULL, 10 );
+    }
+
+    char header[256];
+    int header_len = 0;
+    if ( offset >= file->len )
+    {
+      header_len = snprintf( header, sizeof( header ), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n" );
+      send( fd, header, header_len, MSG_NOSIGNAL );
+      close( fd );
+      continue;
+    }
+
+    if ( range != NULL )
+    {
+      header_len = snprintf( header, sizeof( header ), "HTTP/1.1 206 Partial Content\r\nContent-Length: %zu\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                             file->len - offset, offset, file->len - 1, file->len );
+    }
+    else
+    {
+      header_len = snprintf( header, sizeof( header ), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", file->len );
+    }
+    send( fd, header, header_len, MSG_NOSIGNAL );
+
+    /* Weak link: connection is lost after random count of bytes */
+    seed = seed * 1103515245 + 12345;
+    size_t limit = max_bytes > 0 ? 1 + ( seed >> 8 ) % max_bytes : file->len;
+    size_t end = offset + limit < file->len ? offset + limit : file->len;
+    while ( offset < end )
+    {
+      size_t chunk = end - offset < SEGMENT_SIZE ? end - offset : SEGMENT_SIZE;
+      if ( send( fd, &file->data[offset], chunk, MSG_NOSIGNAL ) <= 0 )
+      {
+        break;
+      }
+      offset += chunk;
+    }
+    close( fd );
+  }
+}
+
+static int _decompress( void* ctx, const uint8_t* in, size_t in_len, uint8_t* out, size_t out_size, size_t* out_len )
+{
+  (void) ctx;
+  z_stream zs = { 0 };
+  if ( inflateInit2( &zs, -15 ) != Z_OK )
+  {
+    return -1;
+  }
+
+  zs.next_in = (uint8_t*) in;
+  zs.avail_in = in_len;
+  zs.next_out = out;
+  zs.avail_out = out_size;
+  int ret = inflate( &zs, Z_FINISH );
+  *out_len = zs.total_out;
+  inflateEnd( &zs );
+  return ret == Z_STREAM_END ? 0 : -1;
+}
+
+static int _write( void* ctx, uint32_t offset, const uint8_t* data, size_t len )
+{
+  client_ctx_t* client = ctx;
+  if ( offset + len > client->image.len )
+  {
+    return -1;
+  }
+
+  memcpy( &client->image.data[offset], data, len );
+  return 0;
+}
+
+static void _save_progress( void* ctx, const ota_stream_progress_t* progress )
+{
+  client_ctx_t* client = ctx;
+  client->stored = *progress;
+  client->has_stored = true;
+  client->saves++;
+}
+
+/* Returns -1 on connection error, otherwise stream result */
+static int _fetch( uint16_t port, ota_stream_t* stream, uint32_t* wire_bytes )
+{
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons( port ), .sin_addr.s_addr = htonl( INADDR_LOOPBACK ) };
+  uint8_t buf[SEGMENT_SIZE * 4];
+  char request[128];
+
+  int fd = socket( AF_INET, SOCK_STREAM, 0 );
+  if ( fd < 0 || connect( fd, (struct sockaddr*) &addr, sizeof( addr ) ) != 0 )
+  {
+    close( fd );
+    return -1;
+  }
+
+  uint32_t offset = OtaStream_GetInputOffset( stream );
+  int len = snprintf( request, sizeof( request ), "GET /image.hqoz HTTP/1.1\r\nHost: localhost\r\nRange: bytes=%u-\r\n\r\n", offset );
+  send( fd, request, len, MSG_NOSIGNAL );
+
+  /* Skip response header */
+  size_t fill = 0;
+  char* body = NULL;
+  while ( body == NULL )
+  {
+    ssize_t n = recv( fd, &buf[fill], sizeof( buf ) - fill - 1, 0 );
+    if ( n <= 0 )
+    {
+      close( fd );
+      return -1;
+    }
+    fill += n;
+    buf[fill] = 0;
+    body = strstr( (char*) buf, "\r\n\r\n" );
+  }
+
+  if ( strncmp( (char*) buf, "HTTP/1.1 206", 12 ) != 0 )
+  {
+    close( fd );
+    return -1;
+  }
+
+  body += 4;
+  int result = OTA_STREAM_RESULT_OK;
+  size_t body_len = fill - ( (uint8_t*) body - buf );
+  *wire_bytes += body_len;
+  result = OtaStream_Feed( stream, (uint8_t*) body, body_len );
+  while ( result == OTA_STREAM_RESULT_OK )
+  {
+    ssize_t n = recv( fd, buf, sizeof( buf ), 0 );
+    if ( n <= 0 )
+    {
+      result = -1;
+      break;
+    }
+    *wire_bytes += n;
+    result = OtaStream_Feed( stream, buf, n );
+  }
+
+  close( fd );
+  return result;
+}
+
+static int _download( uint16_t port, const buffer_t* image, size_t container_len )
+{
+  static ota_stream_t stream;
+  client_ctx_t client = { 0 };
+  ota_stream_io_t io = {
+    .decompress = _decompress,
+    .write = _write,
+    .save_progress = _save_progress,
+    .ctx = &client,
+    .save_every = SAVE_EVERY_BLOCKS,
+  };
+  uint32_t wire_bytes = 0;
+  uint32_t drops = 0;
+  uint32_t resets = 0;
+  int result = -1;
+
+  client.image.len = image->len;
+  client.image.data = calloc( 1, image->len );
+  OtaStream_Init( &stream, &io, NULL );
+
+  uint64_t start = _now_ns();
+  for ( uint32_t attempt = 0; attempt < MAX_ATTEMPTS; attempt++ )
+  {
+    result = _fetch( port, &stream, &wire_bytes );
+    if ( result == OTA_STREAM_RESULT_SEEK )
+    {
+      continue;
+    }
+
+    if ( result != -1 )
+    {
+      break;
+    }
+
+    drops++;
+    if ( drops % RESET_EVERY_DROPS == 0 )
+    {
+      /* Power loss, everything after last stored progress is lost */
+      resets++;
+      OtaStream_Init( &stream, &io, client.has_stored ? &client.stored : NULL );
+    }
+    else
+    {
+      OtaStream_SaveProgress( &stream );
+      OtaStream_Rewind( &stream );
+    }
+  }
+  double elapsed = (double) ( _now_ns() - start ) / 1e9;
+
+  printf( "image %zu B, container %zu B (%.1f %%)\n", image->len, container_len, 100.0 * container_len / image->len );
+  printf( "drops %u, resets %u, progress saves %u, wire %u B (%.2f x container)\n", drops, resets, client.saves, wire_bytes, (double) wire_bytes / container_len );
+  printf( "time %.3f s, wire %.1f kB/s, effective %.1f kB/s\n", elapsed, wire_bytes / elapsed / 1024, image->len / elapsed / 1024 );
+
+  int errors = 0;
+  if ( result != OTA_STREAM_RESULT_DONE )
+  {
+    printf( "download error: result %d\n", result );
+    errors++;
+  }
+  else if ( memcmp( client.image.data, image->data, image->len ) != 0 )
+  {
+    printf( "image content error\n" );
+    errors++;
+  }
+
+  free( client.image.data );
+  return errors;
+}
+
+static int _check_corrupted( const buffer_t* container, size_t image_len )
+{
+  static ota_stream_t stream;
+  client_ctx_t client = { 0 };
+  ota_stream_io_t io = { .decompress = _decompress, .write = _write, .ctx = &client };
+  uint8_t* data = malloc( container->len );
+  int errors = 0;
+
+  client.image.len = image_len;
+  client.image.data = malloc( image_len );
+
+  /* Flip one bit in stored hash, every block is fine but image is not */
+  memcpy( data, container->data, container->len );
+  data[20] ^= 0x01;
+  OtaStream_Init( &stream, &io, NULL );
+  if ( OtaStream_Feed( &stream, data, container->len ) != OTA_STREAM_RESULT_ERROR_HASH )
+  {
+    printf( "corrupted hash not detected\n" );
+    errors++;
+  }
+
+  /* Resume progress of other image is ignored */
+  ota_stream_progress_t other = { .magic = OTA_STREAM_PROGRESS_MAGIC, .input_offset = 1000, .block_index = 0 };
+  OtaStream_Init( &stream, &io, &other );
+  if ( OtaStream_Feed( &stream, container->data, container->len ) != OTA_STREAM_RESULT_DONE )
+  {
+    printf( "foreign progress not ignored\n" );
+    errors++;
+  }
+
+  free( data );
+  free( client.image.data );
+  return errors;
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+int main( int argc, char** argv )
+{
+  buffer_t image = { 0 };
+  buffer_t container = { 0 };
+
+  if ( argc == 4 && strcmp( argv[1], "pack" ) == 0 )
+  {
+    if ( !_read_file( argv[2], &image ) || !_pack( &image, &container ) )
+    {
+      printf( "pack error\n" );
+      return 1;
+    }
+
+    FILE* f = fopen( argv[3], "wb" );
+    if ( f == NULL || fwrite( container.data, 1, container.len, f ) != container.len )
+    {
+      printf( "write error %s\n", argv[3] );
+      return 1;
+    }
+    fclose( f );
+    printf( "%s: %zu -> %zu B\n", argv[3], image.len, container.len );
+    return 0;
+  }
+
+  if ( argc > 1 && !_read_file( argv[1], &image ) )
+  {
+    printf( "usage: %s pack <image.bin> <image.hqoz> | [image.bin] [max_bytes_per_connection]\n", argv[0] );
+    return 2;
+  }
+
+  if ( image.data == NULL )
+  {
+    _generate_image( &image );
+  }
+  size_t max_bytes = argc > 2 ? strtoul( argv[2], NULL, 10 ) : 64 * 1024;
+
+  if ( !_pack( &image, &container ) )
+  {
+    printf( "pack error\n" );
+    return 1;
+  }
+
+  int listen_fd = socket( AF_INET, SOCK_STREAM, 0 );
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl( INADDR_LOOPBACK ) };
+  socklen_t addr_len = sizeof( addr );
+  if ( listen_fd < 0 || bind( listen_fd, (struct sockaddr*) &addr, sizeof( addr ) ) != 0 || listen( listen_fd, 4 ) != 0 || getsockname( listen_fd, (struct sockaddr*) &addr, &addr_len ) != 0 )
+  {
+    printf( "server socket error\n" );
+    return 1;
+  }
+
+  pid_t server = fork();
+  if ( server == 0 )
+  {
+    _serve( listen_fd, &container, max_bytes );
+    return 0;
+  }
+  close( listen_fd );
+
+  int errors = _download( ntohs( addr.sin_port ), &image, container.len );
+  errors += _check_corrupted( &container, image.len );
+
+  kill( server, SIGTERM );
+  waitpid( server, NULL, 0 );
+  printf( "%s: %d errors\n", errors ? "FAIL" : "PASS", errors );
+  return errors ? 1 : 0;
+}
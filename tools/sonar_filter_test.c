@@ -0,0 +1,324 @@
+/**
+ *******************************************************************************
+ * @file    sonar_filter_test.c
+ * @author  Dmytro Shevchenko
+ * @brief   Host side check of ultrasonic sensor frame parser and distance
+ *          filter. Parser is fed byte by byte from stream with garbage,
+ *          out of range values, broken checksums and lost bytes, filter
+ *          output is compared with median and average of reference model.
+ *          Parser runs in mode of CONFIG_ULTRASONAR_CHECKSUM first, then
+ *          in the other mode.
+ *
+ *          Build and run on Linux:
+ *          cc -O2 -I../drv sonar_filter_test.c ../drv/sonar_filter.c -o sonar_filter_test
+ *          cc -O2 -I../drv -DCONFIG_ULTRASONAR_CHECKSUM=1 sonar_filter_test.c ../drv/sonar_filter.c -o sonar_filter_test
+ *          ./sonar_filter_test
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sonar_filter.h"
+
+/* Private macros ------------------------------------------------------------*/
+
+#define ARRAY_SIZE( _array ) sizeof( _array ) / sizeof( _array[0] )
+#define MAX_VALUE            4500
+#define MAX_FRAMES           5000
+#define MAX_STREAM           ( MAX_FRAMES * 8 )
+#define FILTER_SAMPLES       2000
+
+#ifndef CONFIG_ULTRASONAR_CHECKSUM
+#define CONFIG_ULTRASONAR_CHECKSUM 0
+#endif
+
+/* Private types -------------------------------------------------------------*/
+
+typedef enum
+{
+  DAMAGE_NONE,
+  DAMAGE_GARBAGE,    // bytes without header between frames
+  DAMAGE_RANGE,    // value above max
+  DAMAGE_CHECKSUM,    // wrong checksum, never header value
+  DAMAGE_LOST_CHECKSUM,    // checksum byte lost, next header is taken as checksum
+} damage_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+static uint8_t stream[MAX_STREAM];
+static uint16_t expected[MAX_FRAMES];
+static uint16_t samples[FILTER_SAMPLES];
+static uint32_t rnd_state;
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint32_t _rand( void )
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+static uint8_t _checksum( uint16_t value )
+{
+  return (uint8_t) ( SONAR_FRAME_HEADER + ( value >> 8 ) + ( value & 0xFF ) );
+}
+
+/* Stream of frames with random damages, expected keeps values of frames which must be parsed */
+static size_t _build_stream( bool use_checksum, uint32_t frames, size_t* expected_cnt, uint32_t* expected_errors )
+{
+  size_t len = 0;
+  int32_t lost_checksum = -1;
+  *expected_cnt = 0;
+  *expected_errors = 0;
+
+  for ( uint32_t i = 0; i < frames; i++ )
+  {
+    uint16_t value = (uint16_t) ( _rand() % ( MAX_VALUE + 1 ) );
+    damage_t damage = _rand() % 4 == 0 ? (damage_t) ( 1 + _rand() % 4 ) : DAMAGE_NONE;
+    if ( !use_checksum && ( damage == DAMAGE_CHECKSUM || damage == DAMAGE_LOST_CHECKSUM ) )
+    {
+      damage = DAMAGE_NONE;
+    }
+
+    /* Last frame has no next header to resynchronize on, header as checksum would be valid */
+    if ( damage == DAMAGE_LOST_CHECKSUM && ( i + 1 == frames || _checksum( value ) == SONAR_FRAME_HEADER ) )
+    {
+      damage = DAMAGE_NONE;
+    }
+
+    if ( damage == DAMAGE_GARBAGE )
+    {
+      /* First garbage byte after lost checksum must not match it */
+      for ( uint32_t n = 1 + _rand() % 5; n > 0; n-- )
+      {
+        uint8_t byte;
+        do
+        {
+          byte = (uint8_t) ( _rand() % SONAR_FRAME_HEADER );
+        } while ( byte == lost_checksum );
+        stream[len++] = byte;
+        lost_checksum = -1;
+      }
+    }
+
+    if ( damage == DAMAGE_RANGE )
+    {
+      value = (uint16_t) ( MAX_VALUE + 1 + _rand() % ( 0xFEFF - MAX_VALUE ) );
+    }
+
+    stream[len++] = SONAR_FRAME_HEADER;
+    stream[len++] = (uint8_t) ( value >> 8 );
+    stream[len++] = (uint8_t) value;
+    if ( use_checksum && damage != DAMAGE_LOST_CHECKSUM )
+    {
+      uint8_t checksum = _checksum( value );
+      if ( damage == DAMAGE_CHECKSUM )
+      {
+        do
+        {
+          checksum = (uint8_t) ( checksum + 1 + _rand() % 16 );
+        } while ( checksum == _checksum( value ) || checksum == SONAR_FRAME_HEADER );
+      }
+      stream[len++] = checksum;
+    }
+
+    lost_checksum = damage == DAMAGE_LOST_CHECKSUM ? _checksum( value ) : -1;
+    if ( damage == DAMAGE_NONE || damage == DAMAGE_GARBAGE )
+    {
+      expected[( *expected_cnt )++] = value;
+    }
+    else
+    {
+      ( *expected_errors )++;
+    }
+  }
+
+  return len;
+}
+
+static int _check_parser( bool use_checksum )
+{
+  const char* name = use_checksum ? "parser with checksum" : "parser without checksum";
+  sonar_parser_t parser;
+  size_t expected_cnt = 0;
+  uint32_t expected_errors = 0;
+  size_t parsed = 0;
+  int errors = 0;
+
+  size_t len = _build_stream( use_checksum, MAX_FRAMES, &expected_cnt, &expected_errors );
+  SonarParser_Init( &parser, use_checksum, MAX_VALUE );
+
+  /* Byte by byte feeding splits frames at every position */
+  for ( size_t i = 0; i < len; i++ )
+  {
+    uint16_t value = 0;
+    if ( !SonarParser_Feed( &parser, stream[i], &value ) )
+    {
+      continue;
+    }
+
+    if ( parsed >= expected_cnt || value != expected[parsed] )
+    {
+      printf( "%s: frame %zu value %u expected %u\n", name, parsed, value, parsed < expected_cnt ? expected[parsed] : 0 );
+      return errors + 1;
+    }
+    parsed++;
+  }
+
+  if ( parsed != expected_cnt || parser.frames != expected_cnt || parser.errors != expected_errors )
+  {
+    printf( "%s: parsed %zu/%u expected %zu, errors %u expected %u\n", name, parsed, parser.frames, expected_cnt,
+            parser.errors, expected_errors );
+    errors++;
+  }
+
+  printf( "%-24s %6zu bytes, %5u frames, %4u errors\n", name, len, parser.frames, parser.errors );
+  return errors;
+}
+
+/* Header value inside of frame is data, not start of new frame */
+static int _check_header_in_data( bool use_checksum )
+{
+  const uint16_t value = 0xFFFF;
+  sonar_parser_t parser;
+  uint16_t out = 0;
+  uint32_t completed = 0;
+  int errors = 0;
+
+  uint8_t frame[4];
+  size_t len = 0;
+  frame[len++] = SONAR_FRAME_HEADER;
+  frame[len++] = (uint8_t) ( value >> 8 );
+  frame[len++] = (uint8_t) value;
+  if ( use_checksum )
+  {
+    frame[len++] = _checksum( value );
+  }
+
+  SonarParser_Init( &parser, use_checksum, 0xFFFF );
+  for ( size_t i = 0; i < len; i++ )
+  {
+    completed += SonarParser_Feed( &parser, frame[i], &out ) ? 1 : 0;
+  }
+
+  if ( completed != 1 || out != value || parser.errors != 0 )
+  {
+    printf( "header in data %s checksum: completed %u value %u errors %u\n", use_checksum ? "with" : "without",
+            completed, out, parser.errors );
+    errors++;
+  }
+
+  return errors;
+}
+
+static uint16_t _ref_median( const uint16_t* tab, size_t len )
+{
+  uint16_t sorted[SONAR_MEDIAN_SIZE];
+
+  memcpy( sorted, tab, len * sizeof( uint16_t ) );
+  for ( size_t i = 0; i < len; i++ )
+  {
+    for ( size_t j = i + 1; j < len; j++ )
+    {
+      if ( sorted[j] < sorted[i] )
+      {
+        uint16_t tmp = sorted[i];
+        sorted[i] = sorted[j];
+        sorted[j] = tmp;
+      }
+    }
+  }
+
+  return sorted[len / 2];
+}
+
+/* Filter output is average of last medians, each median is taken from last samples, both shorter at start */
+static int _check_filter( const char* name, size_t count )
+{
+  static uint16_t medians[FILTER_SAMPLES];
+  sonar_filter_t filter;
+
+  SonarFilter_Init( &filter );
+  for ( size_t i = 0; i < count; i++ )
+  {
+    size_t median_len = i + 1 < SONAR_MEDIAN_SIZE ? i + 1 : SONAR_MEDIAN_SIZE;
+    medians[i] = _ref_median( &samples[i + 1 - median_len], median_len );
+
+    size_t average_len = i + 1 < SONAR_AVERAGE_SIZE ? i + 1 : SONAR_AVERAGE_SIZE;
+    uint32_t sum = 0;
+    for ( size_t j = i + 1 - average_len; j <= i; j++ )
+    {
+      sum += medians[j];
+    }
+
+    uint32_t result = SonarFilter_Add( &filter, samples[i] );
+    if ( result != sum / average_len )
+    {
+      printf( "%s: sample %zu result %u expected %u\n", name, i, result, (uint32_t) ( sum / average_len ) );
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int _check_filters( void )
+{
+  int errors = 0;
+
+  /* Full range, running sum must not overflow or drift */
+  for ( size_t i = 0; i < FILTER_SAMPLES; i++ )
+  {
+    samples[i] = _rand() % 8 == 0 ? ( _rand() % 2 ? 0xFFFF : 0 ) : (uint16_t) _rand();
+  }
+  errors += _check_filter( "filter full range", FILTER_SAMPLES );
+
+  /* Shorter than median and average windows */
+  errors += _check_filter( "filter short", 3 );
+  errors += _check_filter( "filter average fill", SONAR_AVERAGE_SIZE + 1 );
+
+  /* Two outliers in five samples are rejected by median, average stays on signal */
+  for ( size_t i = 0; i < FILTER_SAMPLES; i++ )
+  {
+    samples[i] = ( i % 5 == 1 || i % 5 == 3 ) ? (uint16_t) ( _rand() % 2 ? 0 : MAX_VALUE ) : 1000;
+  }
+  errors += _check_filter( "filter outliers", FILTER_SAMPLES );
+
+  sonar_filter_t filter;
+  SonarFilter_Init( &filter );
+  uint32_t result = 0;
+  for ( size_t i = 0; i < FILTER_SAMPLES; i++ )
+  {
+    result = SonarFilter_Add( &filter, samples[i] );
+  }
+  if ( result != 1000 )
+  {
+    printf( "filter outliers: result %u expected 1000\n", result );
+    errors++;
+  }
+
+  return errors;
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+int main( void )
+{
+  int errors = 0;
+
+  rnd_state = 0x12345678;
+  errors += _check_parser( CONFIG_ULTRASONAR_CHECKSUM );
+  errors += _check_parser( !CONFIG_ULTRASONAR_CHECKSUM );
+  errors += _check_header_in_data( CONFIG_ULTRASONAR_CHECKSUM );
+  errors += _check_header_in_data( !CONFIG_ULTRASONAR_CHECKSUM );
+  errors += _check_filters();
+
+  printf( "%s: %d errors\n", errors ? "FAIL" : "PASS", errors );
+  return errors ? 1 : 0;
+}
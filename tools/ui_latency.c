@@ -0,0 +1,550 @@
+/**
+ *******************************************************************************
+ * @file    ui_latency.c
+ * @author  Dmytro Shevchenko
+ * @brief   Host side input to display latency analysis of ui_trace dump.
+ *
+ *          Reads "UITRACE <time_us> <id> <arg>" lines (other log lines are
+ *          ignored), follows every button edge through callback, render and
+ *          flush to first flush which changed display. Prints breakdown per
+ *          stage, histogram of total latency and optionally every
+ *          interaction as CSV. With --max-p95 exit code is 1 if 95th
+ *          percentile of total latency is over limit, so regression can be
+ *          checked on captured log.
+ *
+ *          Build and run on Linux:
+ *          cc -O2 -I../drv ui_latency.c -o ui_latency
+ *          ./ui_latency [--csv] [--max-p95 <ms>] [--timeout <ms>] <monitor.log | ->
+ *          ./ui_latency    (self test on generated trace)
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ui_trace.h"
+
+/* Private macros ------------------------------------------------------------*/
+
+#define MAX_PENDING        16
+#define DEFAULT_TIMEOUT_MS 1000
+#define HISTOGRAM_STEP_MS  5
+#define HISTOGRAM_BUCKETS  20
+#define HISTOGRAM_WIDTH    50
+#define LINE_SIZE          256
+
+#define NO_TIME ( -1LL )
+
+/* Private types -------------------------------------------------------------*/
+
+typedef enum
+{
+  STAGE_INPUT,    ///< edge -> callback
+  STAGE_QUEUE,    ///< callback -> render start
+  STAGE_RENDER,    ///< render start -> render end or flush start
+  STAGE_FLUSH,    ///< flush start -> flush end
+  STAGE_TOTAL,    ///< edge -> flush end
+  STAGE_LAST,
+} stage_t;
+
+/* Times are extended to 64 bits, trace timestamps wrap after 71 minutes */
+typedef struct
+{
+  uint16_t button;
+  uint16_t event;
+  int64_t edge;
+  int64_t callback;
+  int64_t render_start;
+  int64_t render_end;
+  int64_t flush_start;
+  int64_t flush_end;
+  uint32_t bytes;
+} interaction_t;
+
+typedef struct
+{
+  int64_t* values;
+  size_t count;
+  size_t size;
+} samples_t;
+
+typedef struct
+{
+  interaction_t pending[MAX_PENDING];
+  uint32_t pending_count;
+  int64_t timeout_us;
+  int64_t last_time;
+  uint32_t last_raw;
+  bool has_time;
+  samples_t stages[STAGE_LAST];
+  uint32_t completed;
+  uint32_t no_change;
+  uint32_t overflow;
+  uint32_t records;
+  uint32_t lost;
+  FILE* csv;
+} analyzer_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+static const char* stage_names[STAGE_LAST] =
+  {
+    [STAGE_INPUT] = "edge -> callback",
+    [STAGE_QUEUE] = "callback -> render",
+    [STAGE_RENDER] = "render",
+    [STAGE_FLUSH] = "flush",
+    [STAGE_TOTAL] = "total",
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+static void _add_sample( samples_t* samples, int64_t value )
+{
+  if ( samples->count == samples->size )
+  {
+    samples->size = samples->size ? samples->size * 2 : 256;
+    samples->values = realloc( samples->values, samples->size * sizeof( int64_t ) );
+    if ( samples->values == NULL )
+    {
+      fprintf( stderr, "Out of memory\n" );
+      exit( 2 );
+    }
+  }
+  samples->values[samples->count++] = value;
+}
+
+static int _compare( const void* a, const void* b )
+{
+  int64_t x = *(const int64_t*) a;
+  int64_t y = *(const int64_t*) b;
+  return ( x > y ) - ( x < y );
+}
+
+static int64_t _percentile( const samples_t* samples, int percent )
+{
+  if ( samples->count == 0 )
+  {
+    return 0;
+  }
+
+  size_t idx = ( samples->count * percent + 99 ) / 100;
+  return samples->values[idx > 0 ? idx - 1 : 0];
+}
+
+static void _init( analyzer_t* analyzer, int64_t timeout_ms, FILE* csv )
+{
+  memset( analyzer, 0, sizeof( *analyzer ) );
+  analyzer->timeout_us = timeout_ms * 1000;
+  analyzer->csv = csv;
+  if ( csv != NULL )
+  {
+    fprintf( csv, "edge_us,button,event,input_us,queue_us,render_us,flush_us,total_us,bytes\n" );
+  }
+}
+
+static void _free( analyzer_t* analyzer )
+{
+  for ( int i = 0; i < STAGE_LAST; i++ )
+  {
+    free( analyzer->stages[i].values );
+  }
+}
+
+static void _remove( analyzer_t* analyzer, uint32_t idx )
+{
+  analyzer->pending_count--;
+  memmove( &analyzer->pending[idx], &analyzer->pending[idx + 1], ( analyzer->pending_count - idx ) * sizeof( interaction_t ) );
+}
+
+static void _complete( analyzer_t* analyzer, const interaction_t* it )
+{
+  int64_t render_end = it->render_end != NO_TIME && it->render_end < it->flush_start ? it->render_end : it->flush_start;
+  int64_t values[STAGE_LAST] =
+    {
+      [STAGE_INPUT] = it->callback - it->edge,
+      [STAGE_QUEUE] = it->render_start - it->callback,
+      [STAGE_RENDER] = render_end - it->render_start,
+      [STAGE_FLUSH] = it->flush_end - it->flush_start,
+      [STAGE_TOTAL] = it->flush_end - it->edge,
+  };
+
+  for ( int i = 0; i < STAGE_LAST; i++ )
+  {
+    _add_sample( &analyzer->stages[i], values[i] );
+  }
+  analyzer->completed++;
+
+  if ( analyzer->csv != NULL )
+  {
+    fprintf( analyzer->csv, "%lld,%u,%u,%lld,%lld,%lld,%lld,%lld,%u\n", (long long) it->edge, it->button, it->event,
+             (long long) values[STAGE_INPUT], (long long) values[STAGE_QUEUE], (long long) values[STAGE_RENDER],
+             (long long) values[STAGE_FLUSH], (long long) values[STAGE_TOTAL], it->bytes );
+  }
+}
+
+/* Edge which did not change display in timeout (release, press of inactive button) */
+static void _expire( analyzer_t* analyzer, int64_t now )
+{
+  uint32_t i = 0;
+  while ( i < analyzer->pending_count )
+  {
+    if ( now - analyzer->pending[i].edge > analyzer->timeout_us )
+    {
+      analyzer->no_change++;
+      _remove( analyzer, i );
+      continue;
+    }
+    i++;
+  }
+}
+
+static void _record( analyzer_t* analyzer, uint32_t raw_time, uint16_t id, uint16_t arg )
+{
+  int64_t now = analyzer->has_time ? analyzer->last_time + (int32_t) ( raw_time - analyzer->last_raw ) : raw_time;
+  analyzer->last_time = now;
+  analyzer->last_raw = raw_time;
+  analyzer->has_time = true;
+  analyzer->records++;
+
+  _expire( analyzer, now );
+
+  if ( id == UI_TRACE_BUTTON_EDGE )
+  {
+    if ( analyzer->pending_count == MAX_PENDING )
+    {
+      analyzer->overflow++;
+      _remove( analyzer, 0 );
+    }
+
+    interaction_t* it = &analyzer->pending[analyzer->pending_count++];
+    *it = ( interaction_t ) { .button = arg, .edge = now, .callback = NO_TIME, .render_start = NO_TIME, .render_end = NO_TIME, .flush_start = NO_TIME, .flush_end = NO_TIME };
+    return;
+  }
+
+  uint32_t i = 0;
+  while ( i < analyzer->pending_count )
+  {
+    interaction_t* it = &analyzer->pending[i];
+    switch ( id )
+    {
+      case UI_TRACE_BUTTON_CB:
+        /* Only first callback of edge, next events of same gesture are from timer */
+        if ( it->callback == NO_TIME && it->button == ( arg & 0xFF ) )
+        {
+          it->callback = now;
+          it->event = arg >> 8;
+          i = analyzer->pending_count;
+          continue;
+        }
+        break;
+
+      case UI_TRACE_RENDER_START:
+        if ( it->callback != NO_TIME && it->render_start == NO_TIME )
+        {
+          it->render_start = now;
+        }
+        break;
+
+      case UI_TRACE_RENDER_END:
+        if ( it->render_start != NO_TIME && it->render_end == NO_TIME )
+        {
+          it->render_end = now;
+        }
+        break;
+
+      case UI_TRACE_FLUSH_START:
+        if ( it->render_start != NO_TIME && it->flush_start == NO_TIME )
+        {
+          it->flush_start = now;
+        }
+        break;
+
+      case UI_TRACE_FLUSH_END:
+        if ( it->flush_start == NO_TIME )
+        {
+          break;
+        }
+
+        /* Unchanged frame, change can be drawn by one of next renders */
+        if ( arg == 0 )
+        {
+          it->render_start = NO_TIME;
+          it->render_end = NO_TIME;
+          it->flush_start = NO_TIME;
+          break;
+        }
+
+        it->flush_end = now;
+        it->bytes = arg;
+        _complete( analyzer, it );
+        _remove( analyzer, i );
+        continue;
+
+      default:
+        break;
+    }
+    i++;
+  }
+}
+
+/* Returns false for lines without trace record */
+static bool _parse_line( analyzer_t* analyzer, const char* line )
+{
+  const char* tag = strstr( line, UI_TRACE_DUMP_TAG " " );
+  unsigned time_us, id, arg, lost;
+
+  if ( tag == NULL )
+  {
+    return false;
+  }
+
+  tag += strlen( UI_TRACE_DUMP_TAG " " );
+  if ( sscanf( tag, "lost %u", &lost ) == 1 )
+  {
+    analyzer->lost += lost;
+    return true;
+  }
+
+  if ( sscanf( tag, "%u %u %u", &time_us, &id, &arg ) != 3 || id == 0 || id >= UI_TRACE_ID_LAST )
+  {
+    return false;
+  }
+
+  _record( analyzer, time_us, id, arg );
+  return true;
+}
+
+static void _finish( analyzer_t* analyzer )
+{
+  analyzer->no_change += analyzer->pending_count;
+  analyzer->pending_count = 0;
+  for ( int i = 0; i < STAGE_LAST; i++ )
+  {
+    samples_t* samples = &analyzer->stages[i];
+    qsort( samples->values, samples->count, sizeof( int64_t ), _compare );
+  }
+}
+
+static void _print_report( const analyzer_t* analyzer )
+{
+  const samples_t* total = &analyzer->stages[STAGE_TOTAL];
+
+  printf( "records %u, lost %u, interactions %u, without display change %u, dropped %u\n\n", analyzer->records,
+          analyzer->lost, analyzer->completed, analyzer->no_change, analyzer->overflow );
+  if ( analyzer->completed == 0 )
+  {
+    return;
+  }
+
+  printf( "%-20s %9s %9s %9s %9s %9s\n", "stage [ms]", "min", "p50", "p95", "p99", "max" );
+  for ( int i = 0; i < STAGE_LAST; i++ )
+  {
+    const samples_t* samples = &analyzer->stages[i];
+    printf( "%-20s %9.2f %9.2f %9.2f %9.2f %9.2f\n", stage_names[i], samples->values[0] / 1000.0,
+            _percentile( samples, 50 ) / 1000.0, _percentile( samples, 95 ) / 1000.0, _percentile( samples, 99 ) / 1000.0,
+            samples->values[samples->count - 1] / 1000.0 );
+  }
+
+  uint32_t buckets[HISTOGRAM_BUCKETS + 1] = { 0 };
+  uint32_t max_bucket = 1;
+  for ( size_t i = 0; i < total->count; i++ )
+  {
+    int64_t bucket = total->values[i] / ( HISTOGRAM_STEP_MS * 1000 );
+    bucket = bucket < 0 ? 0 : bucket > HISTOGRAM_BUCKETS ? HISTOGRAM_BUCKETS : bucket;
+    buckets[bucket]++;
+    max_bucket = buckets[bucket] > max_bucket ? buckets[bucket] : max_bucket;
+  }
+
+  printf( "\ntotal latency histogram\n" );
+  for ( int i = 0; i <= HISTOGRAM_BUCKETS; i++ )
+  {
+    char bar[HISTOGRAM_WIDTH + 1];
+    int len = (int) ( (uint64_t) buckets[i] * HISTOGRAM_WIDTH / max_bucket );
+    memset( bar, '#', len );
+    bar[len] = 0;
+    if ( i < HISTOGRAM_BUCKETS )
+    {
+      printf( "%4d-%-4d ms %6u %s\n", i * HISTOGRAM_STEP_MS, ( i + 1 ) * HISTOGRAM_STEP_MS, buckets[i], bar );
+    }
+    else
+    {
+      printf( "   >=%-4d ms %6u %s\n", i * HISTOGRAM_STEP_MS, buckets[i], bar );
+    }
+  }
+}
+
+/* Self test ---------------------------------------------------------------*/
+
+typedef struct
+{
+  uint32_t time_us;
+  uint16_t id;
+  uint16_t arg;
+} test_record_t;
+
+static int _self_test( void )
+{
+  /* Time starts near wrap of 32-bit timestamp */
+  const uint32_t t0 = 0xFFFFF000;
+  const test_record_t records[] =
+    {
+      /* press of button 2: 300 us to callback, render 2 ms later, 1.5 ms render, 4 ms flush */
+      { t0, UI_TRACE_BUTTON_EDGE, 2 },
+      { t0 + 300, UI_TRACE_BUTTON_CB, 2 | ( 0 << 8 ) },
+      { t0 + 1000, UI_TRACE_MENU_STATE, 4 },
+      { t0 + 2300, UI_TRACE_RENDER_START, 0 },
+      { t0 + 3800, UI_TRACE_RENDER_END, 0 },
+      { t0 + 3800, UI_TRACE_FLUSH_START, 0 },
+      { t0 + 7800, UI_TRACE_FLUSH_END, 128 },
+      /* release: callback, frame not changed, expires */
+      { t0 + 90000, UI_TRACE_BUTTON_EDGE, 2 },
+      { t0 + 90200, UI_TRACE_BUTTON_CB, 2 | ( 1 << 8 ) },
+      { t0 + 95000, UI_TRACE_RENDER_START, 0 },
+      { t0 + 95500, UI_TRACE_RENDER_END, 0 },
+      { t0 + 95500, UI_TRACE_FLUSH_START, 0 },
+      { t0 + 95600, UI_TRACE_FLUSH_END, 0 },
+      /* press of button 5, first render is unchanged, second one (retained screen, flush inside render) shows it */
+      { t0 + 2000000, UI_TRACE_BUTTON_EDGE, 5 },
+      { t0 + 2000100, UI_TRACE_BUTTON_CB, 5 },
+      { t0 + 2001000, UI_TRACE_RENDER_START, 0 },
+      { t0 + 2001500, UI_TRACE_FLUSH_START, 0 },
+      { t0 + 2001600, UI_TRACE_FLUSH_END, 0 },
+      { t0 + 2001700, UI_TRACE_RENDER_END, 0 },
+      { t0 + 2050000, UI_TRACE_RENDER_START, 0 },
+      { t0 + 2052000, UI_TRACE_FLUSH_START, 0 },
+      { t0 + 2060000, UI_TRACE_FLUSH_END, 512 },
+      { t0 + 2060100, UI_TRACE_RENDER_END, 0 },
+    };
+  const int64_t expected[STAGE_LAST] =
+    {
+      [STAGE_INPUT] = 300,
+      [STAGE_QUEUE] = 2000,
+      [STAGE_RENDER] = 1500,
+      [STAGE_FLUSH] = 4000,
+      [STAGE_TOTAL] = 7800,
+  };
+  const int64_t expected_second[STAGE_LAST] =
+    {
+      [STAGE_INPUT] = 100,
+      [STAGE_QUEUE] = 49900,
+      [STAGE_RENDER] = 2000,
+      [STAGE_FLUSH] = 8000,
+      [STAGE_TOTAL] = 60000,
+  };
+  analyzer_t analyzer;
+  char line[LINE_SIZE];
+  int errors = 0;
+
+  _init( &analyzer, DEFAULT_TIMEOUT_MS, NULL );
+  _parse_line( &analyzer, "I (1234) [MENU Drv] state: MENU_STATE_PROCESS" );
+  for ( size_t i = 0; i < sizeof( records ) / sizeof( records[0] ); i++ )
+  {
+    snprintf( line, sizeof( line ), "noise " UI_TRACE_DUMP_TAG " %u %u %u", (unsigned) records[i].time_us, records[i].id, records[i].arg );
+    _parse_line( &analyzer, line );
+  }
+  _parse_line( &analyzer, UI_TRACE_DUMP_TAG " lost 3" );
+
+  /* Samples are not sorted before _finish, order of interactions is kept */
+  for ( int i = 0; i < STAGE_LAST; i++ )
+  {
+    const samples_t* samples = &analyzer.stages[i];
+    if ( samples->count != 2 || samples->values[0] != expected[i] || samples->values[1] != expected_second[i] )
+    {
+      printf( "stage %s: wrong samples\n", stage_names[i] );
+      errors++;
+    }
+  }
+
+  _finish( &analyzer );
+  if ( analyzer.records != sizeof( records ) / sizeof( records[0] ) || analyzer.completed != 2 || analyzer.no_change != 1 || analyzer.lost != 3 )
+  {
+    printf( "wrong counters: records %u, completed %u, no change %u, lost %u\n", analyzer.records, analyzer.completed,
+            analyzer.no_change, analyzer.lost );
+    errors++;
+  }
+
+  _print_report( &analyzer );
+  _free( &analyzer );
+  printf( "\nself test %s\n", errors ? "FAILED" : "OK" );
+  return errors ? 1 : 0;
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+int main( int argc, char** argv )
+{
+  const char* filename = NULL;
+  double max_p95_ms = -1;
+  int64_t timeout_ms = DEFAULT_TIMEOUT_MS;
+  bool csv = false;
+
+  for ( int i = 1; i < argc; i++ )
+  {
+    if ( strcmp( argv[i], "--csv" ) == 0 )
+    {
+      csv = true;
+    }
+    else if ( strcmp( argv[i], "--max-p95" ) == 0 && i + 1 < argc )
+    {
+      max_p95_ms = atof( argv[++i] );
+    }
+    else if ( strcmp( argv[i], "--timeout" ) == 0 && i + 1 < argc )
+    {
+      timeout_ms = atoll( argv[++i] );
+    }
+    else
+    {
+      filename = argv[i];
+    }
+  }
+
+  if ( filename == NULL )
+  {
+    return _self_test();
+  }
+
+  FILE* input = strcmp( filename, "-" ) == 0 ? stdin : fopen( filename, "r" );
+  if ( input == NULL )
+  {
+    fprintf( stderr, "Cannot open %s\n", filename );
+    return 2;
+  }
+
+  analyzer_t analyzer;
+  char line[LINE_SIZE];
+  _init( &analyzer, timeout_ms, csv ? stdout : NULL );
+  while ( fgets( line, sizeof( line ), input ) != NULL )
+  {
+    _parse_line( &analyzer, line );
+  }
+
+  if ( input != stdin )
+  {
+    fclose( input );
+  }
+
+  _finish( &analyzer );
+  if ( csv )
+  {
+    printf( "\n" );
+  }
+  _print_report( &analyzer );
+
+  int result = 0;
+  if ( max_p95_ms >= 0 && analyzer.completed > 0 )
+  {
+    double p95_ms = _percentile( &analyzer.stages[STAGE_TOTAL], 95 ) / 1000.0;
+    if ( p95_ms > max_p95_ms )
+    {
+      printf( "\ntotal p95 %.2f ms is over limit %.2f ms\n", p95_ms, max_p95_ms );
+      result = 1;
+    }
+  }
+
+  _free( &analyzer );
+  return result;
+}
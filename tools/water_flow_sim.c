@@ -0,0 +1,172 @@
+/**
+ *******************************************************************************
+ * @file    water_flow_sim.c
+ * @author  Dmytro Shevchenko
+ * @brief   Host side pulse train simulator for flow rate engine.
+ *
+ *          Build and run on Linux:
+ *          cc -O2 -I../drv water_flow_sim.c ../drv/flow_rate.c -o water_flow_sim
+ *          ./water_flow_sim [pulses_per_liter] [sample_ms]
+ *******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "flow_rate.h"
+
+/* Private macros ------------------------------------------------------------*/
+
+#define ARRAY_SIZE( _array )  sizeof( _array ) / sizeof( _array[0] )
+#define SIM_STEP_US           100
+#define RATE_TOLERANCE_PCT    5
+#define BENCHMARK_ITERATIONS  10000000
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  uint32_t duration_ms;
+  uint32_t rate_cl_min;
+} flow_step_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+static const flow_step_t profile[] =
+  {
+    { .duration_ms = 5000, .rate_cl_min = 0 },
+    { .duration_ms = 20000, .rate_cl_min = 200 },
+    { .duration_ms = 20000, .rate_cl_min = 1500 },
+    { .duration_ms = 10000, .rate_cl_min = 3000 },
+    { .duration_ms = 15000, .rate_cl_min = 0 },
+    { .duration_ms = 20000, .rate_cl_min = 800 },
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint64_t _now_ns( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int _simulate( uint32_t pulses_per_liter, uint32_t sample_ms )
+{
+  flow_rate_t rate;
+  uint32_t counter = UINT32_MAX - 1000;    // check counter wrap around
+  uint32_t expected_pulses = 0;
+  uint32_t alerts = 0;
+  uint32_t errors = 0;
+  double pulse_phase = 0.0;
+  uint32_t time_ms = 0;
+
+  FlowRate_Init( &rate, pulses_per_liter );
+  FlowRate_SetAlert( &rate, 10 );
+  FlowRate_Update( &rate, counter, time_ms );
+
+  for ( size_t i = 0; i < ARRAY_SIZE( profile ); i++ )
+  {
+    double pulses_per_us = (double) profile[i].rate_cl_min * pulses_per_liter / 100.0 / 60e6;
+    uint32_t step_end_ms = time_ms + profile[i].duration_ms;
+
+    for ( uint64_t us = (uint64_t) time_ms * 1000; us < (uint64_t) step_end_ms * 1000; us += SIM_STEP_US )
+    {
+      pulse_phase += pulses_per_us * SIM_STEP_US;
+      while ( pulse_phase >= 1.0 )
+      {
+        pulse_phase -= 1.0;
+        counter++;
+        expected_pulses++;
+      }
+
+      uint32_t now_ms = (uint32_t) ( us / 1000 );
+      if ( ( us % 1000 ) != 0 || ( now_ms % sample_ms ) != 0 )
+      {
+        continue;
+      }
+
+      FlowRate_Update( &rate, counter, now_ms );
+      if ( FlowRate_CheckAlert( &rate ) )
+      {
+        alerts++;
+        printf( "%8u ms alert at %u cl\n", now_ms, rate.total_cl );
+      }
+
+      /* Skip first sample after rate change, window is shared by two steps */
+      if ( now_ms - time_ms > sample_ms )
+      {
+        uint32_t expected = profile[i].rate_cl_min;
+        uint32_t diff = rate.rate_cl_min > expected ? rate.rate_cl_min - expected : expected - rate.rate_cl_min;
+        uint32_t quantum = (uint32_t) ( 100ULL * 60000 / ( (uint64_t) pulses_per_liter * sample_ms ) ) + 1;
+        if ( diff > expected * RATE_TOLERANCE_PCT / 100 && diff > quantum )
+        {
+          printf( "%8u ms rate error: %u cl/min expected %u\n", now_ms, rate.rate_cl_min, expected );
+          errors++;
+        }
+      }
+    }
+
+    time_ms = step_end_ms;
+    printf( "%8u ms rate %5u cl/min total %6u cl\n", time_ms, rate.rate_cl_min, rate.total_cl );
+  }
+
+  FlowRate_Update( &rate, counter, time_ms + sample_ms );
+
+  uint32_t expected_cl = (uint32_t) ( (uint64_t) expected_pulses * 100 / pulses_per_liter );
+  uint32_t counted_cl = (uint32_t) ( rate.total_pulses * 100 / pulses_per_liter );
+  if ( counted_cl != expected_cl )
+  {
+    printf( "total error: %u cl expected %u\n", counted_cl, expected_cl );
+    errors++;
+  }
+
+  if ( alerts != 1 )
+  {
+    printf( "alert error: reported %u times\n", alerts );
+    errors++;
+  }
+
+  return errors;
+}
+
+static void _benchmark( uint32_t pulses_per_liter )
+{
+  flow_rate_t rate;
+  uint32_t counter = 0;
+  volatile uint32_t sink = 0;
+
+  FlowRate_Init( &rate, pulses_per_liter );
+  uint64_t start = _now_ns();
+  for ( uint32_t i = 1; i <= BENCHMARK_ITERATIONS; i++ )
+  {
+    counter += i & 0x1F;
+    sink += FlowRate_Update( &rate, counter, i );
+    sink += FlowRate_CheckAlert( &rate );
+  }
+  uint64_t elapsed = _now_ns() - start;
+
+  printf( "FlowRate_Update: %.1f ns per sample (%u)\n", (double) elapsed / BENCHMARK_ITERATIONS, sink );
+}
+
+/* Public functions ---------------------------------------------------------*/
+
+int main( int argc, char** argv )
+{
+  uint32_t pulses_per_liter = argc > 1 ? (uint32_t) atoi( argv[1] ) : 450;
+  uint32_t sample_ms = argc > 2 ? (uint32_t) atoi( argv[2] ) : 1000;
+
+  if ( pulses_per_liter == 0 || sample_ms == 0 )
+  {
+    printf( "usage: %s [pulses_per_liter] [sample_ms]\n", argv[0] );
+    return 2;
+  }
+
+  int errors = _simulate( pulses_per_liter, sample_ms );
+  _benchmark( pulses_per_liter );
+  printf( "%s: %d errors\n", errors ? "FAIL" : "PASS", errors );
+  return errors ? 1 : 0;
+}